@@ -0,0 +1,131 @@
+#!/usr/bin/env python
+#
+#  FUSE request throughput benchmark for zfs-fuse
+#
+#  Runs an increasing number of client threads against a directory inside a
+#  mounted ZFS filesystem and prints the number of requests per second that
+#  the daemon served for each thread count.
+#
+#  Usage: fusebench.py [-m read|stat] [-t 1,2,4,8,16,32] [-s SECONDS]
+#                      [-T 1,2,4,8,16 -d DATASET] DIR
+#
+#  The "read" mode does 4k preads at random offsets in a set of files, the
+#  "stat" mode stats them.  Mount with direct_io (--disable-block-cache) so
+#  that reads are not served from the kernel page cache.
+#
+#  With -T, the whole client sweep is repeated for each number of daemon
+#  threads per filesystem: the fuse_threads_per_fs tunable is set with ztune
+#  and DATASET, the filesystem DIR lives in, is remounted so that it gets
+#  that many threads.  This is how the default of --fuse-threads was chosen;
+#  rerun it on your hardware to pick your own.  Keep fuse_threads_max above
+#  the largest count or the remounted filesystem gets fewer threads.
+
+import sys, os, random, threading, time, getopt, subprocess
+
+NFILES = 64
+FILESIZE = 1 << 20
+IOSIZE = 4096
+
+def usage():
+	sys.stderr.write('Usage: %s [-m read|stat] [-t 1,2,4,...] [-s SECONDS] [-T 1,2,4,... -d DATASET] DIR\n' % sys.argv[0])
+	sys.exit(64)
+
+def setup(dir):
+	names = []
+	for i in range(NFILES):
+		name = os.path.join(dir, 'fusebench.%d' % i)
+		if not os.path.exists(name) or os.path.getsize(name) != FILESIZE:
+			f = open(name, 'wb')
+			f.write(os.urandom(FILESIZE))
+			f.close()
+		names.append(name)
+	return names
+
+class Worker(threading.Thread):
+	def __init__(self, names, mode, deadline):
+		threading.Thread.__init__(self)
+		self.names = names
+		self.mode = mode
+		self.deadline = deadline
+		self.ops = 0
+
+	def run(self):
+		rnd = random.Random()
+		fds = []
+		if self.mode == 'read':
+			fds = [os.open(n, os.O_RDONLY) for n in self.names]
+		while time.time() < self.deadline:
+			for i in range(64):
+				if self.mode == 'read':
+					fd = rnd.choice(fds)
+					os.lseek(fd, rnd.randrange(FILESIZE // IOSIZE) * IOSIZE, 0)
+					os.read(fd, IOSIZE)
+				else:
+					os.stat(rnd.choice(self.names))
+			self.ops += 64
+		for fd in fds:
+			os.close(fd)
+
+def run(names, mode, nthreads, seconds):
+	deadline = time.time() + seconds
+	workers = [Worker(names, mode, deadline) for i in range(nthreads)]
+	start = time.time()
+	for w in workers:
+		w.start()
+	for w in workers:
+		w.join()
+	elapsed = time.time() - start
+	return sum([w.ops for w in workers]) / elapsed
+
+def remount(dataset, nthreads):
+	for cmd in (['ztune', 'fuse_threads_per_fs=%d' % nthreads],
+	    ['zfs', 'umount', dataset], ['zfs', 'mount', dataset]):
+		if subprocess.call(cmd) != 0:
+			sys.stderr.write('%s failed\n' % ' '.join(cmd))
+			sys.exit(1)
+
+def main():
+	mode = 'read'
+	threads = [1, 2, 4, 8, 16, 32]
+	seconds = 10
+	daemon = [None]
+	dataset = None
+	try:
+		opts, args = getopt.getopt(sys.argv[1:], 'm:t:s:T:d:h')
+	except getopt.GetoptError:
+		usage()
+	for o, a in opts:
+		if o == '-m':
+			mode = a
+		elif o == '-t':
+			threads = [int(t) for t in a.split(',')]
+		elif o == '-s':
+			seconds = int(a)
+		elif o == '-T':
+			daemon = [int(t) for t in a.split(',')]
+		elif o == '-d':
+			dataset = a
+		else:
+			usage()
+	if len(args) != 1 or mode not in ('read', 'stat'):
+		usage()
+	if (daemon != [None]) != (dataset is not None):
+		usage()
+
+	names = setup(args[0])
+
+	if dataset:
+		sys.stdout.write('%8s ' % 'daemon')
+	sys.stdout.write('%8s %12s %10s\n' % ('threads', 'ops/s', 'MB/s'))
+	for d in daemon:
+		if dataset:
+			remount(dataset, d)
+		for n in threads:
+			ops = run(names, mode, n, seconds)
+			mbs = mode == 'read' and ops * IOSIZE / float(1 << 20) or 0
+			if dataset:
+				sys.stdout.write('%8d ' % d)
+			sys.stdout.write('%8d %12.0f %10.1f\n' % (n, ops, mbs))
+			sys.stdout.flush()
+
+main()
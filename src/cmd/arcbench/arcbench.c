@@ -0,0 +1,320 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * arcbench: cached read throughput of the ARC with many threads.
+ *
+ * A pool is created on a file vdev and every thread gets an object of its
+ * own, in a dnode block of its own, which is written out and read once so
+ * that all of it is in the ARC.  The threads then hold and release random
+ * blocks of their object with dmu_buf_hold()/dmu_buf_rele(), the path a
+ * cached read takes through the DMU.  The dnodes stay held throughout, so
+ * that the ARC state lists are the only structures all threads share:
+ * every hold takes the buffer off its state list and every release puts
+ * it back.
+ *
+ * For each thread count, the number of hold/release pairs per second is
+ * printed with how often a thread found the state sublist it needed
+ * locked, and how long it waited for it.  Run it once with -l 1 (a single
+ * list per state, as the ARC used to have) and once with the default to
+ * compare.
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/spa.h>
+#include <sys/spa_impl.h>
+#include <sys/dmu.h>
+#include <sys/dnode.h>
+#include <sys/txg.h>
+#include <sys/fs/zfs.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#define	ARCBENCH_POOL		"arcbench"
+#define	ARCBENCH_BLKSZ		(16 << 10)
+#define	ARCBENCH_MAX_THREADS	64
+#define	ARCBENCH_WRITE_CHUNK	(1 << 20)
+
+extern uint64_t zfs_arc_max;
+extern int zfs_arc_sublists;
+extern kstat_t *arc_ksp;
+
+static objset_t *os;
+static int nblocks = 64;
+static hrtime_t deadline;
+
+typedef struct worker {
+	pthread_t	w_thread;
+	uint64_t	w_object;
+	uint64_t	w_ops;
+} worker_t;
+
+static worker_t workers[ARCBENCH_MAX_THREADS];
+
+static void
+usage(void)
+{
+	(void) fprintf(stderr, "Usage: arcbench [-d dir] [-t 1,2,4,...] "
+	    "[-s seconds] [-b blocks] [-l sublists]\n"
+	    "\t-d dir\tdirectory for the vdev file (default /tmp)\n"
+	    "\t-t N,..\tthread counts to run (default 1,2,4,8,16,32)\n"
+	    "\t-s N\tseconds per thread count (default 5)\n"
+	    "\t-b N\t%dK blocks per thread (default 64)\n"
+	    "\t-l N\tARC sublists per state (default: from the CPU count)\n",
+	    ARCBENCH_BLKSZ >> 10);
+	exit(64);
+}
+
+static uint64_t
+arcstat(const char *name)
+{
+	kstat_named_t *knp = arc_ksp->ks_data;
+	int i;
+
+	for (i = 0; i < arc_ksp->ks_ndata; i++) {
+		if (strcmp(knp[i].name, name) == 0)
+			return (knp[i].value.ui64);
+	}
+	return (0);
+}
+
+static nvlist_t *
+make_vdev_root(const char *path, uint64_t size)
+{
+	nvlist_t *root, *file;
+	int fd;
+
+	if ((fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0666)) == -1 ||
+	    ftruncate(fd, size) != 0) {
+		perror(path);
+		exit(1);
+	}
+	(void) close(fd);
+
+	VERIFY(nvlist_alloc(&file, NV_UNIQUE_NAME, 0) == 0);
+	VERIFY(nvlist_add_string(file, ZPOOL_CONFIG_TYPE, VDEV_TYPE_FILE) == 0);
+	VERIFY(nvlist_add_string(file, ZPOOL_CONFIG_PATH, path) == 0);
+	VERIFY(nvlist_add_uint64(file, ZPOOL_CONFIG_ASHIFT, SPA_MINBLOCKSHIFT)
+	    == 0);
+
+	VERIFY(nvlist_alloc(&root, NV_UNIQUE_NAME, 0) == 0);
+	VERIFY(nvlist_add_string(root, ZPOOL_CONFIG_TYPE, VDEV_TYPE_ROOT) == 0);
+	VERIFY(nvlist_add_nvlist_array(root, ZPOOL_CONFIG_CHILDREN,
+	    &file, 1) == 0);
+	nvlist_free(file);
+
+	return (root);
+}
+
+/*
+ * Create the objects, one per dnode block so that the threads do not
+ * share the dbuf of a dnode block either, and fill them.
+ */
+static void
+setup(void)
+{
+	size_t size = ARCBENCH_WRITE_CHUNK;
+	char *buf = umem_alloc(size, UMEM_NOFAIL);
+	uint64_t off, end = (uint64_t)nblocks * ARCBENCH_BLKSZ;
+	dmu_buf_t *db;
+	dmu_tx_t *tx;
+	int i, b;
+
+	for (i = 0; i < size; i++)
+		buf[i] = i * 13 + (i >> 12);
+
+	for (i = 0; i < ARCBENCH_MAX_THREADS; i++) {
+		worker_t *w = &workers[i];
+
+		w->w_object = (i + 1) * DNODES_PER_BLOCK;
+
+		tx = dmu_tx_create(os);
+		dmu_tx_hold_bonus(tx, DMU_NEW_OBJECT);
+		VERIFY(dmu_tx_assign(tx, TXG_WAIT) == 0);
+		VERIFY(dmu_object_claim(os, w->w_object, DMU_OT_UINT64_OTHER,
+		    ARCBENCH_BLKSZ, DMU_OT_UINT64_OTHER, sizeof (uint64_t),
+		    tx) == 0);
+		dmu_tx_commit(tx);
+
+		for (off = 0; off < end; off += size) {
+			tx = dmu_tx_create(os);
+			dmu_tx_hold_write(tx, w->w_object, off,
+			    MIN(size, end - off));
+			VERIFY(dmu_tx_assign(tx, TXG_WAIT) == 0);
+			dmu_write(os, w->w_object, off, MIN(size, end - off),
+			    buf, tx);
+			dmu_tx_commit(tx);
+		}
+	}
+	txg_wait_synced(dmu_objset_pool(os), 0);
+
+	for (i = 0; i < ARCBENCH_MAX_THREADS; i++) {
+		for (b = 0; b < nblocks; b++) {
+			VERIFY(dmu_buf_hold(os, workers[i].w_object,
+			    (uint64_t)b * ARCBENCH_BLKSZ, FTAG, &db) == 0);
+			dmu_buf_rele(db, FTAG);
+		}
+	}
+
+	umem_free(buf, size);
+}
+
+static void *
+worker_thread(void *arg)
+{
+	worker_t *w = arg;
+	uint32_t seed = (uint32_t)w->w_object;
+	dmu_buf_t *bonus, *db;
+	int i;
+
+	/* keep the dnode held, so that dmu_buf_hold() only looks it up */
+	VERIFY(dmu_bonus_hold(os, w->w_object, FTAG, &bonus) == 0);
+
+	w->w_ops = 0;
+	while (gethrtime() < deadline) {
+		for (i = 0; i < 256; i++) {
+			seed = seed * 1103515245 + 12345;
+			VERIFY(dmu_buf_hold(os, w->w_object,
+			    (uint64_t)((seed >> 8) % nblocks) * ARCBENCH_BLKSZ,
+			    FTAG, &db) == 0);
+			dmu_buf_rele(db, FTAG);
+		}
+		w->w_ops += 256;
+	}
+
+	dmu_buf_rele(bonus, FTAG);
+
+	return (NULL);
+}
+
+static void
+run(int nthreads, int seconds)
+{
+	uint64_t contended, wait_ns, ops = 0;
+	hrtime_t start;
+	int i;
+
+	contended = arcstat("sublist_contended");
+	wait_ns = arcstat("sublist_wait_ns");
+
+	start = gethrtime();
+	deadline = start + (hrtime_t)seconds * NANOSEC;
+	for (i = 0; i < nthreads; i++) {
+		VERIFY(pthread_create(&workers[i].w_thread, NULL,
+		    worker_thread, &workers[i]) == 0);
+	}
+	for (i = 0; i < nthreads; i++) {
+		VERIFY(pthread_join(workers[i].w_thread, NULL) == 0);
+		ops += workers[i].w_ops;
+	}
+
+	contended = arcstat("sublist_contended") - contended;
+	wait_ns = arcstat("sublist_wait_ns") - wait_ns;
+
+	(void) printf("%8d %12.0f %14.4f %12.1f\n", nthreads,
+	    ops / ((double)(gethrtime() - start) / NANOSEC),
+	    (double)contended / ops, (double)wait_ns / ops);
+	(void) fflush(stdout);
+}
+
+int
+main(int argc, char **argv)
+{
+	char *dir = "/tmp", *threads = "1,2,4,8,16,32";
+	char *vdev, *t;
+	uint64_t size;
+	int seconds = 5, c;
+	nvlist_t *nvroot;
+
+	while ((c = getopt(argc, argv, "d:t:s:b:l:")) != -1) {
+		switch (c) {
+		case 'd':
+			dir = optarg;
+			break;
+		case 't':
+			threads = optarg;
+			break;
+		case 's':
+			seconds = atoi(optarg);
+			break;
+		case 'b':
+			nblocks = atoi(optarg);
+			break;
+		case 'l':
+			zfs_arc_sublists = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (seconds <= 0 || nblocks <= 0 || zfs_arc_sublists < 0)
+		usage();
+
+	/* make room in the pool and in the ARC for all of the objects */
+	size = (uint64_t)ARCBENCH_MAX_THREADS * nblocks * ARCBENCH_BLKSZ;
+	zfs_arc_max = MAX(zfs_arc_max, 2 * size + (64 << 20));
+
+	(void) asprintf(&vdev, "%s/arcbench.vdev", dir);
+	(void) asprintf((char **)&spa_config_path, "%s/arcbench.cache", dir);
+
+	kernel_init(FREAD | FWRITE);
+
+	/* left over from an earlier run that did not finish */
+	(void) spa_destroy(ARCBENCH_POOL);
+
+	nvroot = make_vdev_root(vdev, MAX(4 * size, 1ULL << 30));
+	VERIFY(spa_create(ARCBENCH_POOL, nvroot, NULL, NULL, NULL) == 0);
+	nvlist_free(nvroot);
+	VERIFY(dmu_objset_hold(ARCBENCH_POOL, FTAG, &os) == 0);
+
+	setup();
+
+	(void) printf("%d objects of %d %dK blocks, %d ARC sublists per "
+	    "state\n", ARCBENCH_MAX_THREADS, nblocks, ARCBENCH_BLKSZ >> 10,
+	    (int)arcstat("sublists"));
+	(void) printf("%8s %12s %14s %12s\n", "threads", "ops/s",
+	    "contended/op", "wait ns/op");
+
+	for (t = strtok(threads, ","); t != NULL; t = strtok(NULL, ",")) {
+		int n = atoi(t);
+
+		if (n <= 0 || n > ARCBENCH_MAX_THREADS) {
+			(void) fprintf(stderr, "arcbench: thread counts go "
+			    "from 1 to %d\n", ARCBENCH_MAX_THREADS);
+			continue;
+		}
+		run(n, seconds);
+	}
+
+	dmu_objset_rele(os, FTAG);
+	VERIFY(spa_destroy(ARCBENCH_POOL) == 0);
+
+	kernel_fini();
+
+	(void) unlink(vdev);
+	(void) unlink(spa_config_path);
+
+	return (0);
+}
@@ -0,0 +1,485 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * zfs-fuse-stat: sample the ARC, L2ARC, prefetch and vdev cache kstats of a
+ * running zfs-fuse and print one line of per-second figures per interval.
+ *
+ *	zfs-fuse-stat [-av] [-f field,...] [-o table|csv|json] [-T u|d]
+ *	    [-M kstat-mount] [interval [count]]
+ *
+ * The kstats are read from the kstat mount (/zfs-kstat by default), one file
+ * per statistic.  Counters are shown as the change per second over the last
+ * interval, hit ratios are computed from the change of their hit and miss
+ * counters, and sizes are shown as they are at the end of the interval.
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "statcommon.h"
+
+#define	KSTAT_MOUNT	"/zfs-kstat"
+#define	HEADER_EVERY	20
+
+typedef enum field_type {
+	FT_RATE,	/* sum of the counters, per second */
+	FT_RATIO,	/* 100 * hits / (hits + misses) */
+	FT_SIZE		/* current value */
+} field_type_t;
+
+typedef struct field {
+	const char	*f_name;
+	int		f_width;
+	field_type_t	f_type;
+	const char	*f_kstat;
+	const char	*f_stat[2];	/* FT_RATIO: hits, misses */
+	const char	*f_desc;
+	int		f_default;
+} field_t;
+
+static field_t fields[] = {
+	{ "read", 5, FT_RATE, "arcstats", { "hits", "misses" },
+	    "ARC accesses per second", 1 },
+	{ "miss", 5, FT_RATE, "arcstats", { "misses" },
+	    "ARC misses per second", 1 },
+	{ "hit%", 4, FT_RATIO, "arcstats", { "hits", "misses" },
+	    "ARC hit ratio", 1 },
+	{ "dh%", 4, FT_RATIO, "arcstats",
+	    { "demand_data_hits", "demand_data_misses" },
+	    "demand data hit ratio", 1 },
+	{ "dmh%", 4, FT_RATIO, "arcstats",
+	    { "demand_metadata_hits", "demand_metadata_misses" },
+	    "demand metadata hit ratio", 1 },
+	{ "ph%", 4, FT_RATIO, "arcstats",
+	    { "prefetch_data_hits", "prefetch_data_misses" },
+	    "prefetch data hit ratio", 1 },
+	{ "pmh%", 4, FT_RATIO, "arcstats",
+	    { "prefetch_metadata_hits", "prefetch_metadata_misses" },
+	    "prefetch metadata hit ratio", 0 },
+	{ "mru", 5, FT_RATE, "arcstats", { "mru_hits" },
+	    "MRU hits per second", 0 },
+	{ "mfu", 5, FT_RATE, "arcstats", { "mfu_hits" },
+	    "MFU hits per second", 0 },
+	{ "ghost", 5, FT_RATE, "arcstats",
+	    { "mru_ghost_hits", "mfu_ghost_hits" },
+	    "MRU and MFU ghost hits per second", 0 },
+	{ "arcsz", 5, FT_SIZE, "arcstats", { "size" },
+	    "ARC size", 1 },
+	{ "c", 5, FT_SIZE, "arcstats", { "c" },
+	    "ARC target size", 1 },
+	{ "cmax", 5, FT_SIZE, "arcstats", { "c_max" },
+	    "ARC maximum target size", 0 },
+	{ "p", 5, FT_SIZE, "arcstats", { "p" },
+	    "MRU target size", 0 },
+	{ "l2read", 6, FT_RATE, "arcstats", { "l2_hits", "l2_misses" },
+	    "L2ARC accesses per second", 1 },
+	{ "l2hit%", 6, FT_RATIO, "arcstats", { "l2_hits", "l2_misses" },
+	    "L2ARC hit ratio", 1 },
+	{ "l2rbw", 5, FT_RATE, "arcstats", { "l2_read_bytes" },
+	    "L2ARC bytes read per second", 0 },
+	{ "l2wbw", 5, FT_RATE, "arcstats", { "l2_write_bytes" },
+	    "L2ARC bytes written per second", 0 },
+	{ "l2sz", 5, FT_SIZE, "arcstats", { "l2_size" },
+	    "L2ARC size", 1 },
+	{ "zfread", 6, FT_RATE, "zfetchstats", { "hits", "misses" },
+	    "prefetch stream lookups per second", 0 },
+	{ "zfhit%", 6, FT_RATIO, "zfetchstats", { "hits", "misses" },
+	    "prefetch stream hit ratio", 1 },
+	{ "zfstr%", 6, FT_RATIO, "zfetchstats",
+	    { "stride_hits", "stride_misses" },
+	    "prefetch stride hit ratio", 0 },
+	{ "vcread", 6, FT_RATE, "vdev_cache_stats", { "hits", "misses" },
+	    "vdev cache lookups per second", 0 },
+	{ "vchit%", 6, FT_RATIO, "vdev_cache_stats", { "hits", "misses" },
+	    "vdev cache hit ratio", 1 },
+	{ NULL }
+};
+
+#define	NFIELDS	(sizeof (fields) / sizeof (fields[0]) - 1)
+
+typedef struct sample {
+	double		s_time;
+	uint64_t	s_val[NFIELDS][2];
+	int		s_ok[NFIELDS];
+} sample_t;
+
+typedef enum out_mode {
+	OUT_TABLE,
+	OUT_CSV,
+	OUT_JSON
+} out_mode_t;
+
+static const char *kstat_mount = KSTAT_MOUNT;
+static int selected[NFIELDS];
+static int nselected;
+
+static void
+usage(void)
+{
+	(void) fprintf(stderr, "Usage: zfs-fuse-stat [-av] [-f field,...] "
+	    "[-o table|csv|json] [-T u|d]\n"
+	    "                     [-M kstat-mount] [interval [count]]\n");
+	exit(2);
+}
+
+static void
+list_fields(void)
+{
+	int i;
+
+	for (i = 0; i < NFIELDS; i++)
+		(void) printf("%-8s %-17s %s%s\n", fields[i].f_name,
+		    fields[i].f_kstat, fields[i].f_desc,
+		    fields[i].f_default ? "" : " (not shown by default)");
+	exit(0);
+}
+
+static int
+find_field(const char *name)
+{
+	int i;
+
+	for (i = 0; i < NFIELDS; i++)
+		if (strcmp(fields[i].f_name, name) == 0)
+			return (i);
+	return (-1);
+}
+
+static void
+select_fields(char *list)
+{
+	char *name, *last;
+	int f;
+
+	for (name = strtok_r(list, ",", &last); name != NULL;
+	    name = strtok_r(NULL, ",", &last)) {
+		if ((f = find_field(name)) < 0) {
+			(void) fprintf(stderr, "zfs-fuse-stat: unknown field "
+			    "'%s' (-v lists them)\n", name);
+			exit(2);
+		}
+		if (nselected < NFIELDS)
+			selected[nselected++] = f;
+	}
+}
+
+static int
+read_stat(const char *kstat, const char *stat, uint64_t *valp)
+{
+	char path[MAXPATHLEN], buf[32], *end;
+	FILE *fp;
+	int ok;
+
+	(void) snprintf(path, sizeof (path), "%s/zfs/%s/%s", kstat_mount,
+	    kstat, stat);
+	if ((fp = fopen(path, "r")) == NULL)
+		return (-1);
+	ok = fgets(buf, sizeof (buf), fp) != NULL;
+	(void) fclose(fp);
+	if (!ok)
+		return (-1);
+
+	*valp = strtoull(buf, &end, 10);
+	return (end == buf ? -1 : 0);
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	(void) clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+static void
+take_sample(sample_t *s)
+{
+	int i, j;
+
+	s->s_time = now();
+	for (i = 0; i < nselected; i++) {
+		field_t *f = &fields[selected[i]];
+
+		s->s_ok[i] = 1;
+		for (j = 0; j < 2; j++) {
+			s->s_val[i][j] = 0;
+			if (f->f_stat[j] != NULL && read_stat(f->f_kstat,
+			    f->f_stat[j], &s->s_val[i][j]) != 0)
+				s->s_ok[i] = 0;
+		}
+	}
+}
+
+/*
+ * Work out the value of field i between two samples.  Returns 0 if there is
+ * nothing to show, either because a kstat is missing or because a ratio had
+ * no events to be computed from.
+ */
+static int
+field_value(int i, const sample_t *old, const sample_t *new, double *valp)
+{
+	field_t *f = &fields[selected[i]];
+	double secs = new->s_time - old->s_time;
+	double d[2];
+	int j;
+
+	if (!old->s_ok[i] || !new->s_ok[i])
+		return (0);
+
+	/* the daemon may have been restarted under us */
+	for (j = 0; j < 2; j++)
+		d[j] = new->s_val[i][j] >= old->s_val[i][j] ?
+		    (double)(new->s_val[i][j] - old->s_val[i][j]) : 0;
+
+	switch (f->f_type) {
+	case FT_RATE:
+		*valp = secs > 0 ? (d[0] + d[1]) / secs : 0;
+		return (1);
+	case FT_RATIO:
+		if (d[0] + d[1] == 0)
+			return (0);
+		*valp = 100.0 * d[0] / (d[0] + d[1]);
+		return (1);
+	case FT_SIZE:
+		*valp = (double)new->s_val[i][0];
+		return (1);
+	}
+	return (0);
+}
+
+/*
+ * Scale a number to fit in a few columns, in the style of zfs_nicenum().
+ */
+static void
+nicenum(double num, char *buf, size_t len)
+{
+	static const char units[] = " KMGTPE";
+	int u = 0;
+
+	while (num >= 1024 && u < sizeof (units) - 2) {
+		num /= 1024;
+		u++;
+	}
+
+	if (u == 0)
+		(void) snprintf(buf, len, "%.0f", num);
+	else if (num < 10)
+		(void) snprintf(buf, len, "%.1f%c", num, units[u]);
+	else
+		(void) snprintf(buf, len, "%.0f%c", num, units[u]);
+}
+
+static void
+print_header(out_mode_t mode)
+{
+	int i;
+
+	if (mode == OUT_JSON)
+		return;
+
+	if (mode == OUT_CSV) {
+		(void) printf("time");
+		for (i = 0; i < nselected; i++)
+			(void) printf(",%s", fields[selected[i]].f_name);
+	} else {
+		(void) printf("%8s", "time");
+		for (i = 0; i < nselected; i++)
+			(void) printf(" %*s", fields[selected[i]].f_width,
+			    fields[selected[i]].f_name);
+	}
+	(void) printf("\n");
+}
+
+static void
+print_line(out_mode_t mode, const sample_t *old, const sample_t *new)
+{
+	time_t t = time(NULL);
+	char buf[32];
+	double val;
+	int i, have;
+
+	switch (mode) {
+	case OUT_TABLE:
+		(void) strftime(buf, sizeof (buf), "%H:%M:%S", localtime(&t));
+		(void) printf("%8s", buf);
+		break;
+	case OUT_CSV:
+		(void) printf("%ld", (long)t);
+		break;
+	case OUT_JSON:
+		(void) printf("{\"time\": %ld", (long)t);
+		break;
+	}
+
+	for (i = 0; i < nselected; i++) {
+		field_t *f = &fields[selected[i]];
+
+		have = field_value(i, old, new, &val);
+		switch (mode) {
+		case OUT_TABLE:
+			if (!have)
+				(void) strcpy(buf, "-");
+			else if (f->f_type == FT_RATIO)
+				(void) snprintf(buf, sizeof (buf), "%.0f", val);
+			else
+				nicenum(val, buf, sizeof (buf));
+			(void) printf(" %*s", f->f_width, buf);
+			break;
+		case OUT_CSV:
+			if (!have)
+				(void) printf(",");
+			else if (f->f_type == FT_RATIO)
+				(void) printf(",%.1f", val);
+			else
+				(void) printf(",%.0f", val);
+			break;
+		case OUT_JSON:
+			(void) printf(", \"%s\": ", f->f_name);
+			if (!have)
+				(void) printf("null");
+			else if (f->f_type == FT_RATIO)
+				(void) printf("%.1f", val);
+			else
+				(void) printf("%.0f", val);
+			break;
+		}
+	}
+
+	(void) printf(mode == OUT_JSON ? "}\n" : "\n");
+	(void) fflush(stdout);
+}
+
+int
+main(int argc, char **argv)
+{
+	out_mode_t mode = OUT_TABLE;
+	uint_t timestamp_fmt = NODATE;
+	unsigned long interval = 1, count = 0, n;
+	sample_t *old, *new, *tmp;
+	char *end;
+	int c, i, all = 0;
+
+	while ((c = getopt(argc, argv, "af:M:o:T:v")) != -1) {
+		switch (c) {
+		case 'a':
+			all = 1;
+			break;
+		case 'f':
+			select_fields(optarg);
+			break;
+		case 'M':
+			kstat_mount = optarg;
+			break;
+		case 'o':
+			if (strcmp(optarg, "table") == 0)
+				mode = OUT_TABLE;
+			else if (strcmp(optarg, "csv") == 0)
+				mode = OUT_CSV;
+			else if (strcmp(optarg, "json") == 0)
+				mode = OUT_JSON;
+			else
+				usage();
+			break;
+		case 'T':
+			if (strcmp(optarg, "u") == 0)
+				timestamp_fmt = UDATE;
+			else if (strcmp(optarg, "d") == 0)
+				timestamp_fmt = DDATE;
+			else
+				usage();
+			break;
+		case 'v':
+			list_fields();
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc > 2)
+		usage();
+	if (argc > 0) {
+		interval = strtoul(argv[0], &end, 10);
+		if (*end != '\0' || interval == 0)
+			usage();
+	}
+	if (argc > 1) {
+		count = strtoul(argv[1], &end, 10);
+		if (*end != '\0' || count == 0)
+			usage();
+	}
+
+	if (nselected == 0) {
+		for (i = 0; i < NFIELDS; i++)
+			if (all || fields[i].f_default)
+				selected[nselected++] = i;
+	}
+
+	old = calloc(1, sizeof (sample_t));
+	new = calloc(1, sizeof (sample_t));
+	if (old == NULL || new == NULL) {
+		(void) fprintf(stderr, "zfs-fuse-stat: out of memory\n");
+		return (1);
+	}
+
+	take_sample(old);
+	for (i = 0; i < nselected; i++)
+		if (old->s_ok[i])
+			break;
+	if (i == nselected) {
+		(void) fprintf(stderr, "zfs-fuse-stat: no kstats under %s/zfs, "
+		    "is zfs-fuse running with kstats mounted?\n", kstat_mount);
+		return (1);
+	}
+
+	for (n = 0; count == 0 || n < count; n++) {
+		(void) sleep(interval);
+		take_sample(new);
+
+		if (mode != OUT_TABLE) {
+			if (n == 0)
+				print_header(mode);
+		} else {
+			if (timestamp_fmt != NODATE)
+				print_timestamp(timestamp_fmt);
+			if (n % HEADER_EVERY == 0)
+				print_header(mode);
+		}
+		print_line(mode, old, new);
+
+		tmp = old;
+		old = new;
+		new = tmp;
+	}
+
+	free(old);
+	free(new);
+	return (0);
+}
@@ -0,0 +1,261 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * ziobench: checksum and compression throughput over an ARC-sized working
+ * set of zio buffers.  sha256 is also run through the batched interface
+ * the write pipeline uses, 1 to 8 blocks at a time.  gzip is run on the
+ * first ZIOBENCH_GZIP_BUFS buffers only, both through gzip_compress() and
+ * through zlib's one-shot compress2() that it used to call, to show what
+ * reusing the zlib streams saves.
+ *
+ * The buffers come from a kmem cache set up the way zio_init() sets up the
+ * zio_data_buf caches, on zio_alloc_arena when -H is given (the arena
+ * zfs-fuse --hugepages uses) and on the default umem heap otherwise.  They
+ * are visited in random order, as the ARC would, so that the working set
+ * rather than the prefetcher decides how many TLB misses we take.  Run it
+ * once with and once without -H to compare.
+ */
+
+#include <sys/types.h>
+#include <sys/kmem.h>
+#include <sys/time.h>
+#include <sys/zio.h>
+#include <sys/zio_checksum.h>
+#include <sys/zio_compress.h>
+#include <zfs_fletcher.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define	ZIOBENCH_GZIP_BUFS	256
+
+static const int gzip_levels[] = { 1, 6, 9 };
+
+extern int no_kstat_mount;
+extern void libsolkerncompat_init();
+extern void libsolkerncompat_exit();
+
+/*
+ * libsolkerncompat expects these from the zfs-fuse daemon: kstat.c mounts
+ * its filesystem through the fuse listener (never, since no_kstat_mount
+ * is set) and thread.c sizes thread stacks.
+ */
+struct fuse_chan;
+size_t stack_size = 0;
+int fuse_listener_ready = 0;
+
+/*ARGSUSED*/
+int
+zfsfuse_newfs(char *mntpoint, struct fuse_chan *ch)
+{
+	return (-1);
+}
+
+static void
+usage(void)
+{
+	(void) fprintf(stderr, "Usage: ziobench [-H] [-s MB] [-b KB] "
+	    "[-p passes]\n"
+	    "\t-H\tallocate the buffers from the hugepage zio arena\n"
+	    "\t-s MB\tsize of the working set (default 1024)\n"
+	    "\t-b KB\tbuffer size (default 128)\n"
+	    "\t-p N\tpasses over the working set (default 4)\n");
+	exit(64);
+}
+
+static double
+now(void)
+{
+	struct timeval tv;
+
+	(void) gettimeofday(&tv, NULL);
+	return (tv.tv_sec + tv.tv_usec / 1e6);
+}
+
+/*
+ * Fill a buffer with data lzjb can do something with: runs of repeated
+ * words mixed with random ones, about 2:1 compressible.
+ */
+static void
+fill(uint64_t *buf, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < size / sizeof (uint64_t); i++)
+		buf[i] = (i & 4) ? buf[i & ~7] : ((uint64_t)random() << 32 |
+		    random());
+}
+
+int
+main(int argc, char **argv)
+{
+	size_t wsize = 1024ULL << 20, bsize = 128 << 10;
+	int passes = 4, c;
+	size_t nbufs, i, p;
+	size_t *order;
+	void **bufs, *dst;
+	kmem_cache_t *cache;
+	zio_cksum_t zc, zcs[8], *zcps[8];
+	const void *mbufs[8];
+	uint64_t msizes[8];
+	int n, j;
+	uint64_t sum = 0;
+	double t;
+
+	while ((c = getopt(argc, argv, "Hs:b:p:")) != -1) {
+		switch (c) {
+		case 'H':
+			zio_arena_hugepages = 1;
+			break;
+		case 's':
+			wsize = strtoull(optarg, NULL, 0) << 20;
+			break;
+		case 'b':
+			bsize = strtoull(optarg, NULL, 0) << 10;
+			break;
+		case 'p':
+			passes = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (wsize == 0 || bsize == 0 || bsize > SPA_MAXBLOCKSIZE ||
+	    passes <= 0)
+		usage();
+
+	no_kstat_mount = 1;
+	libsolkerncompat_init();
+
+	if (zio_arena_hugepages && zio_alloc_arena == NULL)
+		(void) fprintf(stderr, "ziobench: no hugepages, using the "
+		    "default heap\n");
+
+	cache = kmem_cache_create("ziobench_buf", bsize, PAGESIZE,
+	    NULL, NULL, NULL, NULL, zio_alloc_arena, KMC_NODEBUG);
+
+	nbufs = wsize / bsize;
+	bufs = malloc(nbufs * sizeof (void *));
+	order = malloc(nbufs * sizeof (size_t));
+	dst = malloc(bsize);
+	VERIFY(bufs != NULL && order != NULL && dst != NULL);
+
+	srandom(1);
+	for (i = 0; i < nbufs; i++) {
+		bufs[i] = kmem_cache_alloc(cache, KM_SLEEP);
+		fill(bufs[i], bsize);
+		order[i] = i;
+	}
+	for (i = nbufs - 1; i > 0; i--) {
+		size_t j = random() % (i + 1), tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+
+	(void) printf("arena %s, working set %zu MB, %zu KB buffers\n",
+	    zio_alloc_arena != NULL ? "zio_alloc (hugepages)" : "default",
+	    wsize >> 20, bsize >> 10);
+
+	t = now();
+	for (p = 0; p < passes; p++) {
+		for (i = 0; i < nbufs; i++) {
+			fletcher_4_native(bufs[order[i]], bsize, &zc);
+			sum += zc.zc_word[0];
+		}
+	}
+	t = now() - t;
+	(void) printf("%-10s %10.1f MB/s\n", "fletcher4",
+	    (double)passes * wsize / t / (1 << 20));
+
+	t = now();
+	for (p = 0; p < passes; p++) {
+		for (i = 0; i < nbufs; i++)
+			sum += lzjb_compress(bufs[order[i]], dst, bsize,
+			    bsize, 0);
+	}
+	t = now() - t;
+	(void) printf("%-10s %10.1f MB/s\n", "lzjb",
+	    (double)passes * wsize / t / (1 << 20));
+
+	for (j = 0; j < sizeof (gzip_levels) / sizeof (gzip_levels[0]); j++) {
+		size_t gbufs = MIN(nbufs, ZIOBENCH_GZIP_BUFS);
+		uLongf len;
+
+		n = gzip_levels[j];
+
+		t = now();
+		for (i = 0; i < gbufs; i++) {
+			len = bsize;
+			(void) compress2(dst, &len, bufs[order[i]], bsize, n);
+			sum += len;
+		}
+		t = now() - t;
+		(void) printf("gzip-%d     %10.1f MB/s one-shot\n", n,
+		    (double)gbufs * bsize / t / (1 << 20));
+
+		t = now();
+		for (i = 0; i < gbufs; i++)
+			sum += gzip_compress(bufs[order[i]], dst, bsize,
+			    bsize, n);
+		t = now() - t;
+		(void) printf("gzip-%d     %10.1f MB/s\n", n,
+		    (double)gbufs * bsize / t / (1 << 20));
+	}
+
+	zio_sha256_init();
+	(void) printf("sha256 multi-buffer lanes: %d\n", zio_sha256_lanes());
+	for (n = 1; n <= 8; n++) {
+		for (j = 0; j < n; j++) {
+			msizes[j] = bsize;
+			zcps[j] = &zcs[j];
+		}
+		t = now();
+		for (p = 0; p < passes; p++) {
+			for (i = 0; i + n <= nbufs; i += n) {
+				for (j = 0; j < n; j++)
+					mbufs[j] = bufs[order[i + j]];
+				zio_checksum_SHA256_multi(mbufs, msizes, zcps,
+				    n);
+				sum += zcs[0].zc_word[0];
+			}
+		}
+		t = now() - t;
+		(void) printf("sha256 x%d  %10.1f MB/s\n", n,
+		    (double)passes * (nbufs - nbufs % n) * bsize / t /
+		    (1 << 20));
+	}
+	zio_sha256_fini();
+
+	for (i = 0; i < nbufs; i++)
+		kmem_cache_free(cache, bufs[i]);
+	kmem_cache_destroy(cache);
+	free(bufs);
+	free(order);
+	free(dst);
+
+	libsolkerncompat_exit();
+
+	/* keep the compiler from dropping the work */
+	return (sum == 0x5a5a5a5a);
+}
@@ -3700,7 +3700,7 @@ upgrade_cb(zpool_handle_t *zhp, void *arg)
 	verify(nvlist_lookup_uint64(config, ZPOOL_CONFIG_VERSION,
 	    &version) == 0);
 
-	if (!cbp->cb_newer && version < SPA_VERSION) {
+	if (!cbp->cb_newer && version < SPA_VERSION_DEFAULT) {
 		if (!cbp->cb_all) {
 			if (cbp->cb_first) {
 				(void) printf(gettext("The following pools are "
@@ -3838,7 +3838,7 @@ zpool_do_upgrade(int argc, char **argv)
 	argv += optind;
 
 	if (cb.cb_version == 0) {
-		cb.cb_version = SPA_VERSION;
+		cb.cb_version = SPA_VERSION_DEFAULT;
 	} else if (!cb.cb_all && argc == 0) {
 		(void) fprintf(stderr, gettext("-V option is "
 		    "incompatible with other arguments\n"));
@@ -3896,6 +3896,8 @@ zpool_do_upgrade(int argc, char **argv)
 		(void) printf(gettext(" 21  Deduplication\n"));
 		(void) printf(gettext(" 22  Received properties\n"));
 		(void) printf(gettext(" 23  Slim ZIL\n"));
+		(void) printf(gettext(" 24  Compression using lz4 (zfs-fuse "
+		    "only, see zfs(8))\n"));
 		(void) printf(gettext("\nFor more information on a particular "
 		    "version, including supported releases, see:\n\n"));
 		(void) printf("http://www.opensolaris.org/os/community/zfs/"
@@ -33,6 +33,7 @@
 #include <sys/dmu.h>
 #include <sys/zfs_ioctl.h>
 #include <zfs_fletcher.h>
+#include <zfs_prop.h>
 #include "format.h"
 
 uint64_t drr_record_count[DRR_NUMTYPES];
@@ -76,6 +77,17 @@ ssread(void *buf, size_t len, zio_cksum_t *cksum)
 	return (outlen);
 }
 
+static const char *
+compress_name(uint64_t compress)
+{
+	const char *name;
+
+	if (zfs_prop_index_to_string(ZFS_PROP_COMPRESSION, compress,
+	    &name) != 0)
+		return ("unknown");
+	return (name);
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -124,6 +136,8 @@ main(int argc, char *argv[])
 		exit(1);
 	}
 
+	zfs_prop_init();
+
 	send_stream = stdin;
 	pcksum = zc;
 	while (ssread(drr, sizeof (dmu_replay_record_t), &zc)) {
@@ -273,12 +287,14 @@ main(int argc, char *argv[])
 			}
 			if (verbose) {
 				(void) printf("OBJECT object = %llu type = %u "
-				    "bonustype = %u blksz = %u bonuslen = %u\n",
+				    "bonustype = %u blksz = %u bonuslen = %u "
+				    "compress = %s\n",
 				    (u_longlong_t)drro->drr_object,
 				    drro->drr_type,
 				    drro->drr_bonustype,
 				    drro->drr_blksz,
-				    drro->drr_bonuslen);
+				    drro->drr_bonuslen,
+				    compress_name(drro->drr_compress));
 			}
 			if (drro->drr_bonuslen > 0) {
 				(void) ssread(buf, P2ROUNDUP(drro->drr_bonuslen,
@@ -0,0 +1,99 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * ztune: show and change the tunables of a running zfs-fuse.
+ *
+ *	ztune			list all of them
+ *	ztune name ...		show these
+ *	ztune name=value ...	change these (root only)
+ *
+ * The same tunables can be read and written through the kstat mount, in
+ * /zfs-kstat/zfs-fuse/tunables.
+ */
+
+#include <sys/types.h>
+#include <sys/zfs_ioctl.h>
+#include <zfsfuse.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static int
+ztune(int sock, char *arg)
+{
+	char *eq = strchr(arg, '=');
+	char *list, *end;
+	uint64_t value;
+
+	if (eq != NULL) {
+		*eq = '\0';
+		errno = 0;
+		value = strtoull(eq + 1, &end, 0);
+		if (errno != 0 || end == eq + 1 || *end != '\0') {
+			(void) fprintf(stderr, "ztune: bad value for %s: %s\n",
+			    arg, eq + 1);
+			return (1);
+		}
+	}
+
+	if ((list = zfsfuse_tunable(sock, arg, eq != NULL ? &value : NULL))
+	    == NULL) {
+		(void) fprintf(stderr, "ztune: %s: %s\n", *arg ? arg :
+		    "tunables", errno == ENOENT ? "no such tunable" :
+		    strerror(errno));
+		return (1);
+	}
+
+	(void) fputs(list, stdout);
+	free(list);
+
+	return (0);
+}
+
+int
+main(int argc, char **argv)
+{
+	int sock, i, ret = 0;
+
+	if (argc > 1 && argv[1][0] == '-') {
+		(void) fprintf(stderr, "Usage: ztune [name[=value]] ...\n");
+		return (2);
+	}
+
+	if ((sock = zfsfuse_open(ZFS_SOCK_NAME, O_RDWR)) == -1) {
+		(void) fprintf(stderr, "ztune: cannot connect to zfs-fuse: "
+		    "%s\n", strerror(errno));
+		return (1);
+	}
+
+	if (argc == 1)
+		ret = ztune(sock, "");
+	for (i = 1; i < argc; i++)
+		ret |= ztune(sock, argv[i]);
+
+	(void) close(sock);
+
+	return (ret);
+}
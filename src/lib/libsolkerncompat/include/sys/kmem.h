@@ -31,7 +31,7 @@
 #include <sys/types.h>
 #include <umem.h>
 
-/* Maximum zfs-fuse memory usage */
+/* Smallest default ARC size limit; see arc_init() */
 #define ZFSFUSE_MAX_ARCSIZE (128<<20)
 
 /*
@@ -64,7 +64,17 @@ extern void kmem_cache_free(kmem_cache_t *, void *);
 
 #define kmem_debugging() 0
 #define kmem_cache_reap_now(c)
+#define kmem_reap() umem_reap()
+#define kmem_reap_urgent() umem_reap_urgent()
 
 extern uint64_t get_real_memusage();
+extern void kmem_init();
+extern void kmem_fini();
+
+/* Hugepage-backed arena for the zio buffer caches, see zio_arena.c */
+extern int zio_arena_hugepages;
+extern vmem_t *zio_alloc_arena;
+extern void zio_arena_init(void);
+extern void zio_arena_fini(void);
 
 #endif
@@ -184,6 +184,20 @@ typedef enum uio_rw { UIO_READ, UIO_WRITE } uio_rw_t;
 
 #define	UIO_ASYNC		0x0002	/* uio_t is really a uioa_t */
 
+/*
+ * ZFSFUSE: uio_t is really a uiofd_t.  The data is not in memory but has
+ * to be read(2) from uiofd_fd, typically a pipe the fuse request was
+ * spliced into, so that it can land directly in its final buffer.  The
+ * iovecs only carry lengths.  Reading consumes the data, so uiocopy()
+ * consumes it too and a following uioskip() only does the accounting.
+ */
+#define	UIO_FDREAD		0x0004
+
+typedef struct uiofd_s {
+	uio_t		uiofd_uio;	/* must be first */
+	int		uiofd_fd;	/* where the data comes from */
+} uiofd_t;
+
 /*
  * Global uioasync capability shadow state.
  */
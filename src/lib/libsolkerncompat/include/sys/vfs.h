@@ -54,6 +54,8 @@ typedef struct vfs {
 	uint_t        vfs_count;
 	refstr_t     *vfs_resource;
 	int	      fuse_attribute;
+	void         *fuse_inodes; /* zfs-fuse inode table, see zfsfuse_inode.c */
+	void         *fuse_opstats; /* zfs-fuse op statistics, see zfsfuse_opstats.c */
 } vfs_t;
 
 /*
@@ -0,0 +1,53 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef _SYS_VMSYSTM_H
+#define _SYS_VMSYSTM_H
+
+#include <sys/types.h>
+
+/*
+ * ZFSFUSE: memory pressure, Linux style (see mempressure.c).  This stands
+ * in for the freemem, lotsfree and needfree the Solaris ARC looks at: the
+ * memory we may still use is the smaller of MemAvailable and the headroom
+ * left under the cgroup v2 limits we run in, and the kernel tells us when
+ * tasks stall on memory through a PSI trigger.
+ */
+
+/* Memory we may use in total: physical memory or the cgroup limit */
+extern uint64_t mem_total(void);
+
+/* Memory still available to us, in bytes.  Reads /proc and /sys. */
+extern uint64_t mem_avail(void);
+
+/*
+ * Returns B_TRUE, once, if the PSI trigger fired since the last call.
+ */
+extern boolean_t mem_pressure_pending(void);
+
+/*
+ * Arm the PSI trigger; func is called from a private thread each time it
+ * fires.  Without PSI support, mem_pressure_pending() always returns false.
+ */
+extern void mem_pressure_init(void (*func)(void));
+extern void mem_pressure_fini(void);
+
+#endif
@@ -24,6 +24,7 @@
  */
 
 #include <sys/kmem.h>
+#include <sys/kstat.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -74,3 +75,53 @@ error:
 
 	exit(1);
 }
+
+/*
+ * umem gives the pages of free buffers and segments back to the system
+ * after a reap once its caches are idle, or right away when memory is
+ * short (see umem_reclaim()); the "umem" kstat shows how much that has
+ * released.
+ */
+static struct {
+	kstat_named_t reclaim_calls;
+	kstat_named_t reclaim_bytes;
+	kstat_named_t rss_bytes;
+} kmem_stats = {
+	{ "reclaim_calls",	KSTAT_DATA_UINT64 },
+	{ "reclaim_bytes",	KSTAT_DATA_UINT64 },
+	{ "rss_bytes",		KSTAT_DATA_UINT64 },
+};
+
+static kstat_t *kmem_ksp;
+
+static int kmem_kstat_update(kstat_t *ksp, int rw)
+{
+	if(rw == KSTAT_WRITE)
+		return EACCES;
+
+	umem_reclaim_stats(&kmem_stats.reclaim_calls.value.ui64,
+	    &kmem_stats.reclaim_bytes.value.ui64);
+	kmem_stats.rss_bytes.value.ui64 = get_real_memusage();
+
+	return 0;
+}
+
+void kmem_init()
+{
+	kmem_ksp = kstat_create("unix", 0, "umem", "misc", KSTAT_TYPE_NAMED,
+	    sizeof(kmem_stats) / sizeof(kstat_named_t), KSTAT_FLAG_VIRTUAL);
+
+	if(kmem_ksp != NULL) {
+		kmem_ksp->ks_data = &kmem_stats;
+		kmem_ksp->ks_update = kmem_kstat_update;
+		kstat_install(kmem_ksp);
+	}
+}
+
+void kmem_fini()
+{
+	if(kmem_ksp != NULL) {
+		kstat_delete(kmem_ksp);
+		kmem_ksp = NULL;
+	}
+}
@@ -29,10 +29,17 @@
  * Notice that multiple kstats with the same name (which appear as arrays in
  * solaris) are not handled here, in this case only the 1st name appears, the
  * others are discarded. I didn't find any place where it could be useful
- * anyway (taskq kstats are not updated in zfs-fuse !) */
+ * anyway (taskq kstats are not updated in zfs-fuse !)
+ * A name containing slashes creates the intermediate directories, and
+ * ks_update, when set, is called before a value is read.
+ * The values of a kstat created with KSTAT_FLAG_WRITABLE can be written to:
+ * the new value is stored in the kstat_named_t, then ks_update is called
+ * with KSTAT_WRITE to act on it, and its error is returned to the writer. */
 
 #include <sys/kstat.h>
+#include <sys/mutex.h>
 #include <string.h>
+#include <stdlib.h>
 #include <unistd.h>
 #define FUSE_USE_VERSION 26
 
@@ -53,6 +60,7 @@ struct dir_s {
     dir_t **dirs,*parent;
     int nb_files;
     kstat_named_t **files;
+    kstat_t *ksp;
 };
 
 static int used_files;
@@ -72,13 +80,31 @@ static dir_t *add_dir(dir_t *root, const char *name) {
 	root->dirs = realloc(root->dirs,root->alloc_dirs*sizeof(dir_t));
     }
     dir_t *dir = (dir_t*)calloc(1,sizeof(dir_t));
-    dir->name = name;
+    dir->name = strdup(name);
     dir->inode = next_inode++;
     dir->parent = root;
     root->dirs[root->nb_dirs++] = dir;
     return dir;
 }
 
+static void remove_dir(dir_t *dir) {
+    dir_t *parent = dir->parent;
+    int n;
+    for (n=0; n<parent->nb_dirs; n++) {
+	if (parent->dirs[n] == dir) {
+	    if (n < parent->nb_dirs-1) {
+		memmove(&parent->dirs[n],&parent->dirs[n+1],
+			(parent->nb_dirs-n-1)*sizeof(dir_t*));
+	    }
+	    parent->nb_dirs--;
+	    break;
+	}
+    }
+    free(dir->dirs);
+    free((char *)dir->name);
+    free(dir);
+}
+
 // find the dir with this inode, or the one containing the file with this inode
 static dir_t* find_dir(dir_t *dir, fuse_ino_t inode) {
     if (dir->inode == inode || (dir->inode < inode &&
@@ -108,7 +134,11 @@ kstat_t *kstat_create(const char *module, int instance, const char *name, const
     dir_t *dir = add_dir(root,module);
     // class is *always* "misc" in zfs, so we can probably get rid of it !
     // dir = add_dir(dir,class);
-    dir = add_dir(dir,name);
+    char *path = strdup(name), *last;
+    for (char *tok = strtok_r(path, "/", &last); tok;
+	    tok = strtok_r(NULL, "/", &last))
+	dir = add_dir(dir,tok);
+    free(path);
 
     if (dir->nb_files) {
 	/* It's not a bug, apparently these kstats create arrays of values
@@ -122,8 +152,10 @@ kstat_t *kstat_create(const char *module, int instance, const char *name, const
     kstat_t *kstat = (kstat_t*)calloc(1,sizeof(kstat_t));
     if (kstat) {
 	kstat->ks_crtime = gethrtime(); // usefull ?
+	kstat->ks_flags = ks_flag;
 	kstat->ks_private = dir;
 	kstat->ks_kid = dir->inode;
+	dir->ksp = kstat;
 	dir->nb_files = ndata;
 	next_inode += ndata; // reserve inodes for future files of this dir
 	used_files += ndata;
@@ -184,17 +216,13 @@ kstat_delete(kstat_t *ksp)
 	next_inode -= dir->nb_files + 1;
     }
     dir->files = NULL;
-    int n;
-    for (n=0; n<parent->nb_dirs; n++) {
-	if (parent->dirs[n] == dir) {
-	    if (n < parent->nb_dirs-1) {
-		memmove(&parent->dirs[n],&parent->dirs[n+1],
-			(parent->nb_dirs-n-1)*sizeof(dir_t*));
-	    }
-	    parent->nb_dirs--;
-	    free(dir);
-	    break;
-	}
+    remove_dir(dir);
+    /* Names like "pool/fs/ops/lookup" create intermediate dirs which would
+     * otherwise stay behind, empty, once their last kstat is gone */
+    while (parent != root && !parent->nb_dirs && !parent->nb_files) {
+	dir = parent;
+	parent = dir->parent;
+	remove_dir(dir);
     }
     if (!used_files)
 	umount_kstat();
@@ -202,9 +230,22 @@ kstat_delete(kstat_t *ksp)
 
 /* fuse part, heavily inspired from hello_ll.c */
 
-static char kstat_str[80];
+static __thread char kstat_str[80];
+
+static int is_writable(dir_t *dir) {
+    return (dir->ksp && (dir->ksp->ks_flags & KSTAT_FLAG_WRITABLE) &&
+	    dir->ksp->ks_update);
+}
 
 static void get_value(dir_t *dir, fuse_ino_t ino) {
+    kstat_t *ksp = dir->ksp;
+    if (ksp && ksp->ks_update) {
+	if (ksp->ks_lock)
+	    mutex_enter(ksp->ks_lock);
+	ksp->ks_update(ksp, KSTAT_READ);
+	if (ksp->ks_lock)
+	    mutex_exit(ksp->ks_lock);
+    }
     kstat_named_t *file = dir->files[ino-1-dir->inode];
     switch (file->data_type) {
     case KSTAT_DATA_INT32:
@@ -234,7 +275,7 @@ static int kstat_stat(fuse_ino_t ino, struct stat *stbuf)
 	stbuf->st_mode = S_IFDIR | 0755;
 	stbuf->st_nlink = 2;
     } else {
-	stbuf->st_mode = S_IFREG | 0444;
+	stbuf->st_mode = S_IFREG | (is_writable(dir) ? 0644 : 0444);
 	stbuf->st_nlink = 1;
 	get_value(dir,ino);
 	stbuf->st_size = strlen(kstat_str);
@@ -353,10 +394,36 @@ static void kstat_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size,
     free(b.p);
 }
 
+static void kstat_ll_setattr(fuse_req_t req, fuse_ino_t ino,
+			     struct stat *attr, int to_set,
+			     struct fuse_file_info *fi)
+{
+	struct stat stbuf;
+
+	(void) fi;
+
+	/* Only the truncation done by "echo value > file" is accepted, and
+	 * ignored: the value is replaced by the write that follows it */
+	if (to_set & ~FUSE_SET_ATTR_SIZE) {
+		fuse_reply_err(req, EPERM);
+		return;
+	}
+
+	memset(&stbuf, 0, sizeof(stbuf));
+	if (kstat_stat(ino, &stbuf) == -1)
+		fuse_reply_err(req, ENOENT);
+	else if (!S_ISREG(stbuf.st_mode) || !(stbuf.st_mode & S_IWUSR))
+		fuse_reply_err(req, EACCES);
+	else
+		fuse_reply_attr(req, &stbuf, 1.0);
+}
+
 static void kstat_ll_open(fuse_req_t req, fuse_ino_t ino,
 			  struct fuse_file_info *fi)
 {
-	if ((fi->flags & 3) != O_RDONLY)
+	dir_t *dir = find_dir(root,ino);
+
+	if ((fi->flags & 3) != O_RDONLY && !is_writable(dir))
 		fuse_reply_err(req, EACCES);
 	else
 		fuse_reply_open(req, fi);
@@ -372,23 +439,88 @@ static void kstat_ll_read(fuse_req_t req, fuse_ino_t ino, size_t size,
 	reply_buf_limited(req, kstat_str, strlen(kstat_str), off, size);
 }
 
+static void kstat_ll_write(fuse_req_t req, fuse_ino_t ino, const char *buf,
+			   size_t size, off_t off, struct fuse_file_info *fi)
+{
+	(void) fi;
+
+	dir_t *dir = find_dir(root,ino);
+	kstat_t *ksp = dir->ksp;
+	kstat_named_t *file, old;
+	char str[sizeof(kstat_str)], *end;
+	int err = 0;
+
+	if (dir->inode == ino || !is_writable(dir)) {
+	    fuse_reply_err(req, EACCES);
+	    return;
+	}
+	/* A value is written in one go */
+	if (off != 0 || size >= sizeof(str)) {
+	    fuse_reply_err(req, EINVAL);
+	    return;
+	}
+	memcpy(str, buf, size);
+	str[size] = 0;
+
+	if (ksp->ks_lock)
+	    mutex_enter(ksp->ks_lock);
+	/* so that only the value written differs from the source */
+	ksp->ks_update(ksp, KSTAT_READ);
+	file = dir->files[ino-1-dir->inode];
+	old = *file;
+	errno = 0;
+	switch (file->data_type) {
+	case KSTAT_DATA_INT32:
+	    file->value.i32 = strtol(str, &end, 0);
+	    break;
+	case KSTAT_DATA_UINT32:
+	    file->value.ui32 = strtoul(str, &end, 0);
+	    break;
+	case KSTAT_DATA_INT64:
+	    file->value.i64 = strtoll(str, &end, 0);
+	    break;
+	case KSTAT_DATA_UINT64:
+	    file->value.ui64 = strtoull(str, &end, 0);
+	    break;
+	default:
+	    end = str;
+	}
+	while (*end == ' ' || *end == '\n')
+	    end++;
+	if (errno != 0 || end == str || *end != 0)
+	    err = EINVAL;
+	else
+	    err = ksp->ks_update(ksp, KSTAT_WRITE);
+	if (err)
+	    *file = old;
+	if (ksp->ks_lock)
+	    mutex_exit(ksp->ks_lock);
+
+	if (err)
+	    fuse_reply_err(req, err);
+	else
+	    fuse_reply_write(req, size);
+}
+
 static struct fuse_lowlevel_ops kstat_ll_oper = {
 	.lookup		= kstat_ll_lookup,
 	.getattr	= kstat_ll_getattr,
+	.setattr	= kstat_ll_setattr,
 	.readdir	= kstat_ll_readdir,
 	.open		= kstat_ll_open,
 	.read		= kstat_ll_read,
+	.write		= kstat_ll_write,
 };
 
 // zfs-fuse directory is not included from here, it's faster to copy the
 // prototype here then
 extern int zfsfuse_newfs(char *mntpoint, struct fuse_chan *ch);
-extern int newfs_fd[2];
+extern int fuse_listener_ready;
 
 static struct fuse_chan *ch;
 
 static void mount_kstat() {
-    if (!newfs_fd[1]) {
+    if (!fuse_listener_ready) {
 	// printf("zfs-fuse not ready to mount, delaying...\n");
 	return;
     }
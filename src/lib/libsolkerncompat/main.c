@@ -69,9 +69,14 @@ void libsolkerncompat_init()
 	printf("pwd_buflen = %li, grp_buflen = %li\n\n", pwd_buflen, grp_buflen);
 #endif
 
+	kmem_init();
+
 	vnode_cache = kmem_cache_create("vnode_t", sizeof(vnode_t), 0, NULL, NULL, NULL, NULL, NULL, 0);
 	VERIFY(vnode_cache != NULL);
 
+	/* Needs umem to be up, which the first kmem_cache_create() ensures */
+	zio_arena_init();
+
 	vfs_init();
 
 	/* Carefull here : umem_init is called on another core when using a multi core cpu
@@ -84,6 +89,8 @@ void libsolkerncompat_init()
 void libsolkerncompat_exit()
 {
 	kmem_cache_destroy(vnode_cache);
+	zio_arena_fini();
+	kmem_fini();
 
 	vfs_exit();
 	taskq_destroy(system_taskq);
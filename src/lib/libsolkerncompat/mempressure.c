@@ -0,0 +1,285 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Where the memory goes on Linux: see sys/vmsystm.h.
+ *
+ * The cgroup we are in is looked up once, at mem_pressure_init() time.
+ * Every limit on the way up to the root counts, since a parent's
+ * memory.max applies to all of its children.
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/debug.h>
+#include <sys/atomic.h>
+#include <sys/cmn_err.h>
+#include <sys/vmsystm.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+
+#define	CGROUP_ROOT	"/sys/fs/cgroup"
+
+/*
+ * PSI trigger: wake us up when tasks spend more than 150ms of any second
+ * stalled on memory.
+ */
+#define	PSI_TRIGGER	"some 150000 1000000"
+
+static char mem_cgroup[PATH_MAX];	/* our cgroup v2 directory, or "" */
+
+static int psi_fd = -1;
+static int psi_pipe[2] = { -1, -1 };
+static pthread_t psi_thread;
+static void (*psi_func)(void);
+static volatile uint32_t psi_pending;
+
+/* Reads a cgroup value; "max" reads as UINT64_MAX. */
+static int
+mem_read_value(const char *dir, const char *file, uint64_t *val)
+{
+	char path[PATH_MAX + 32], buf[64];
+	FILE *f;
+	int ret = -1;
+
+	(void) snprintf(path, sizeof (path), "%s/%s", dir, file);
+	if ((f = fopen(path, "r")) == NULL)
+		return (-1);
+
+	if (fgets(buf, sizeof (buf), f) != NULL) {
+		if (strncmp(buf, "max", 3) == 0)
+			*val = UINT64_MAX;
+		else
+			*val = strtoull(buf, NULL, 10);
+		ret = 0;
+	}
+	(void) fclose(f);
+
+	return (ret);
+}
+
+/* Reads one "key value" line of a file like memory.stat or meminfo */
+static int
+mem_read_key(const char *path, const char *key, uint64_t *val)
+{
+	char buf[256];
+	size_t len = strlen(key);
+	FILE *f;
+	int ret = -1;
+
+	if ((f = fopen(path, "r")) == NULL)
+		return (-1);
+
+	while (fgets(buf, sizeof (buf), f) != NULL) {
+		if (strncmp(buf, key, len) == 0 &&
+		    (buf[len] == ' ' || buf[len] == ':')) {
+			*val = strtoull(buf + len + 1, NULL, 10);
+			ret = 0;
+			break;
+		}
+	}
+	(void) fclose(f);
+
+	return (ret);
+}
+
+static void
+mem_cgroup_init(void)
+{
+	char buf[PATH_MAX];
+	FILE *f;
+
+	mem_cgroup[0] = '\0';
+
+	if (access(CGROUP_ROOT "/cgroup.controllers", F_OK) != 0)
+		return;		/* no unified hierarchy */
+
+	if ((f = fopen("/proc/self/cgroup", "r")) == NULL)
+		return;
+
+	while (fgets(buf, sizeof (buf), f) != NULL) {
+		if (strncmp(buf, "0::", 3) == 0) {
+			buf[strcspn(buf, "\n")] = '\0';
+			/* A path too long to open is as good as no limit. */
+			if (snprintf(mem_cgroup, sizeof (mem_cgroup), "%s%s",
+			    CGROUP_ROOT, strcmp(buf + 3, "/") == 0 ? "" :
+			    buf + 3) >= (int)sizeof (mem_cgroup))
+				mem_cgroup[0] = '\0';
+			break;
+		}
+	}
+	(void) fclose(f);
+}
+
+/*
+ * Walk from our cgroup up to the root, and return the lowest limit and the
+ * least headroom found on the way.  Inactive file pages count as headroom,
+ * since the kernel drops them before it touches us.
+ */
+static void
+mem_cgroup_limits(uint64_t *limitp, uint64_t *headroomp)
+{
+	char dir[PATH_MAX];
+	uint64_t limit = UINT64_MAX, headroom = UINT64_MAX;
+
+	(void) strlcpy(dir, mem_cgroup, sizeof (dir));
+
+	while (strlen(dir) > strlen(CGROUP_ROOT)) {
+		uint64_t max = UINT64_MAX, high = UINT64_MAX;
+		uint64_t current, inactive = 0, lim;
+		char *slash;
+
+		(void) mem_read_value(dir, "memory.max", &max);
+		(void) mem_read_value(dir, "memory.high", &high);
+		lim = MIN(max, high);
+
+		if (lim != UINT64_MAX &&
+		    mem_read_value(dir, "memory.current", &current) == 0) {
+			char path[PATH_MAX + 32];
+
+			(void) snprintf(path, sizeof (path), "%s/memory.stat",
+			    dir);
+			(void) mem_read_key(path, "inactive_file", &inactive);
+
+			current = current > inactive ? current - inactive : 0;
+			limit = MIN(limit, lim);
+			headroom = MIN(headroom, lim > current ?
+			    lim - current : 0);
+		}
+
+		if ((slash = strrchr(dir, '/')) == NULL)
+			break;
+		*slash = '\0';
+	}
+
+	*limitp = limit;
+	*headroomp = headroom;
+}
+
+uint64_t
+mem_total(void)
+{
+	uint64_t limit, headroom;
+
+	mem_cgroup_limits(&limit, &headroom);
+
+	return (MIN(limit, (uint64_t)physmem * PAGESIZE));
+}
+
+uint64_t
+mem_avail(void)
+{
+	uint64_t avail, limit, headroom;
+
+	if (mem_read_key("/proc/meminfo", "MemAvailable", &avail) == 0)
+		avail <<= 10;
+	else
+		avail = UINT64_MAX;
+
+	mem_cgroup_limits(&limit, &headroom);
+
+	return (MIN(avail, headroom));
+}
+
+boolean_t
+mem_pressure_pending(void)
+{
+	return (atomic_swap_32(&psi_pending, 0) != 0);
+}
+
+static void *
+mem_pressure_thread(void *arg)
+{
+	struct pollfd fds[2];
+
+	fds[0].fd = psi_fd;
+	fds[0].events = POLLPRI;
+	fds[1].fd = psi_pipe[0];
+	fds[1].events = POLLIN;
+
+	for (;;) {
+		if (poll(fds, 2, -1) < 0)
+			continue;
+
+		if (fds[1].revents != 0 || (fds[0].revents & POLLERR))
+			break;		/* shutting down, or cgroup is gone */
+
+		if (fds[0].revents & POLLPRI) {
+			psi_pending = 1;
+			if (psi_func != NULL)
+				psi_func();
+		}
+	}
+
+	return (NULL);
+}
+
+void
+mem_pressure_init(void (*func)(void))
+{
+	char path[PATH_MAX + 32];
+
+	mem_cgroup_init();
+
+	/* Prefer the pressure of our own cgroup over the system's */
+	(void) snprintf(path, sizeof (path), "%s/memory.pressure", mem_cgroup);
+	if (mem_cgroup[0] == '\0' || access(path, F_OK) != 0)
+		(void) strlcpy(path, "/proc/pressure/memory", sizeof (path));
+
+	if ((psi_fd = open(path, O_RDWR | O_NONBLOCK)) < 0)
+		return;
+
+	if (write(psi_fd, PSI_TRIGGER, strlen(PSI_TRIGGER) + 1) < 0 ||
+	    pipe(psi_pipe) != 0) {
+		cmn_err(CE_NOTE, "PSI memory trigger unavailable (%s), "
+		    "polling free memory only", path);
+		(void) close(psi_fd);
+		psi_fd = -1;
+		return;
+	}
+
+	psi_func = func;
+	VERIFY(pthread_create(&psi_thread, NULL, mem_pressure_thread,
+	    NULL) == 0);
+}
+
+void
+mem_pressure_fini(void)
+{
+	if (psi_fd < 0)
+		return;
+
+	(void) write(psi_pipe[1], "", 1);
+	VERIFY(pthread_join(psi_thread, NULL) == 0);
+
+	(void) close(psi_pipe[0]);
+	(void) close(psi_pipe[1]);
+	(void) close(psi_fd);
+	psi_pipe[0] = psi_pipe[1] = psi_fd = -1;
+	psi_func = NULL;
+}
@@ -25,8 +25,32 @@
 
 #include <sys/uio.h>
 #include <string.h>
+#include <unistd.h>
+#include <errno.h>
 #include <sys/systm.h>
 
+/*
+ * Read exactly "n" bytes of a UIO_FDREAD uio into "p".
+ */
+static int
+uiofd_read(uio_t *uio, void *p, size_t n)
+{
+	int fd = ((uiofd_t *)uio)->uiofd_fd;
+
+	while (n > 0) {
+		ssize_t res = read(fd, p, n);
+		if (res == -1 && errno == EINTR)
+			continue;
+		if (res == -1)
+			return (errno);
+		if (res == 0)
+			return (EIO);
+		p = (caddr_t)p + res;
+		n -= res;
+	}
+	return (0);
+}
+
 /*
  * Move "n" bytes at byte address "p"; "rw" indicates the direction
  * of the move, and the I/O parameters are provided in "uio", which is
@@ -47,7 +71,13 @@ uiomove(void *p, size_t n, enum uio_rw rw, struct uio *uio)
 			uio->uio_iovcnt--;
 			continue;
 		}
-		if (rw == UIO_READ)
+		if (uio->uio_extflg & UIO_FDREAD) {
+			int error;
+
+			ASSERT(rw == UIO_WRITE);
+			if ((error = uiofd_read(uio, p, cnt)) != 0)
+				return (error);
+		} else if (rw == UIO_READ)
 			memmove(iov->iov_base, p, cnt);
 		else
 			memmove(p, iov->iov_base, cnt);
@@ -65,6 +95,7 @@ uiomove(void *p, size_t n, enum uio_rw rw, struct uio *uio)
 /*
  * same as uiomove() but doesn't modify uio structure.
  * return in cbytes how many bytes were copied.
+ * (a UIO_FDREAD uio is consumed nonetheless, see <sys/uio.h>)
  */
 int
 uiocopy(void *p, size_t n, enum uio_rw rw, struct uio *uio, size_t *cbytes)
@@ -81,7 +112,19 @@ uiocopy(void *p, size_t n, enum uio_rw rw, struct uio *uio, size_t *cbytes)
 		if (cnt == 0)
 			continue;
 
-		if (rw == UIO_READ) {
+		if (uio->uio_extflg & UIO_FDREAD) {
+			int error;
+
+			ASSERT(rw == UIO_WRITE);
+			if ((error = uiofd_read(uio, p, cnt)) != 0)
+				return (error);
+		} else if (uio->uio_segflg == UIO_SYSSPACE) {
+			/* ZFSFUSE: xcopyin() only works on the ioctl socket */
+			if (rw == UIO_READ)
+				memmove(iov->iov_base, p, cnt);
+			else
+				memmove(p, iov->iov_base, cnt);
+		} else if (rw == UIO_READ) {
 			 xcopyout(p, iov->iov_base, cnt);
 		} else {
 			 xcopyin(iov->iov_base, p, cnt);
@@ -0,0 +1,270 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * zio_alloc_arena: the arena the zio_buf_* and zio_data_buf_* caches draw
+ * their slabs from.  On Solaris it is set up by segkmem; here it only
+ * exists when zfs-fuse is started with --hugepages, in which case it is
+ * backed by 2MB pages so that checksumming, compression and copying of a
+ * large ARC do not spend their time on TLB misses.
+ *
+ * The arena imports from zio_huge_top, whose quantum is the hugepage size.
+ * zio_huge_top grows one span at a time, preferring:
+ *
+ *	1. hugetlbfs pages (MAP_HUGETLB), if the admin reserved some;
+ *	2. transparent hugepages, by aligning the span and madvise()ing it
+ *	   MADV_HUGEPAGE;
+ *	3. plain pages, once neither of the above works any more.
+ *
+ * Spans are never unmapped.  umem's reclaim pass must not madvise() the
+ * free ranges of zio_alloc_arena, or of the caches on top of it, away:
+ * those are smaller than a hugepage, so MADV_DONTNEED would split a
+ * transparent hugepage or fail with EINVAL on hugetlbfs.  The arena is
+ * therefore created VMC_NORECLAIM.  Whole spans that zio_alloc_arena hands
+ * back to zio_huge_top are still reclaimed there, and those are always
+ * hugepage aligned multiples of the hugepage size.  If neither kind of
+ * hugepage is available when zfs-fuse starts, no arena is created and the
+ * caches use the default umem heap, as they always did.
+ */
+
+#include <sys/types.h>
+#include <sys/kmem.h>
+#include <sys/vmem.h>
+#include <sys/kstat.h>
+#include <sys/mutex.h>
+#include <sys/cmn_err.h>
+#include <sys/sysmacros.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#define	ZIO_HUGEPAGE_SIZE	(2ULL << 20)
+
+int zio_arena_hugepages = 0;	/* set by --hugepages */
+vmem_t *zio_alloc_arena = NULL;
+
+static vmem_t *zio_huge_top;
+static kmutex_t zio_huge_lock;
+static boolean_t zio_huge_hugetlb;	/* MAP_HUGETLB still worth trying */
+static boolean_t zio_huge_thp;		/* MADV_HUGEPAGE is accepted */
+
+static struct {
+	kstat_named_t hugetlb_bytes;
+	kstat_named_t thp_bytes;
+	kstat_named_t small_bytes;
+	kstat_named_t inuse_bytes;
+} zio_arena_stats = {
+	{ "hugetlb_bytes",	KSTAT_DATA_UINT64 },
+	{ "thp_bytes",		KSTAT_DATA_UINT64 },
+	{ "small_bytes",	KSTAT_DATA_UINT64 },
+	{ "inuse_bytes",	KSTAT_DATA_UINT64 },
+};
+
+static kstat_t *zio_arena_ksp;
+
+static void *
+zio_huge_map_hugetlb(size_t size)
+{
+#ifdef MAP_HUGETLB
+	void *buf = mmap(NULL, size, PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+	if (buf != MAP_FAILED)
+		return (buf);
+#endif
+	return (NULL);
+}
+
+/*
+ * Map size bytes aligned to ZIO_HUGEPAGE_SIZE, so that khugepaged (or the
+ * fault handler) can back the whole span with transparent hugepages.
+ */
+static void *
+zio_huge_map_aligned(size_t size)
+{
+	size_t len = size + ZIO_HUGEPAGE_SIZE;
+	uintptr_t buf, start;
+
+	buf = (uintptr_t)mmap(NULL, len, PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if ((void *)buf == MAP_FAILED)
+		return (NULL);
+
+	start = P2ROUNDUP(buf, ZIO_HUGEPAGE_SIZE);
+	if (start != buf)
+		(void) munmap((void *)buf, start - buf);
+	if (start + size != buf + len)
+		(void) munmap((void *)(start + size), buf + len - start - size);
+
+	return ((void *)start);
+}
+
+/*
+ * Import function of zio_huge_top: satisfy the allocation from the spans
+ * we already have, or map a new one.
+ */
+static void *
+zio_huge_top_alloc(vmem_t *vmp, size_t size, int vmflag)
+{
+	size_t span = P2ROUNDUP(size, ZIO_HUGEPAGE_SIZE);
+	kstat_named_t *stat;
+	void *buf;
+
+	mutex_enter(&zio_huge_lock);
+
+	if ((buf = vmem_alloc(vmp, size, VM_NOSLEEP)) != NULL) {
+		mutex_exit(&zio_huge_lock);
+		return (buf);
+	}
+
+	buf = NULL;
+	if (zio_huge_hugetlb) {
+		if ((buf = zio_huge_map_hugetlb(span)) != NULL) {
+			stat = &zio_arena_stats.hugetlb_bytes;
+		} else {
+			/* The reserved pool is exhausted, stop trying. */
+			cmn_err(CE_NOTE, "zio arena: out of hugetlbfs pages, "
+			    "falling back to %s pages",
+			    zio_huge_thp ? "transparent huge" : "normal");
+			zio_huge_hugetlb = B_FALSE;
+		}
+	}
+	if (buf == NULL && (buf = zio_huge_map_aligned(span)) != NULL) {
+		stat = &zio_arena_stats.small_bytes;
+#ifdef MADV_HUGEPAGE
+		if (zio_huge_thp && madvise(buf, span, MADV_HUGEPAGE) == 0)
+			stat = &zio_arena_stats.thp_bytes;
+#endif
+	}
+
+	if (buf == NULL ||
+	    vmem_add(vmp, buf, span, VM_NOSLEEP) == NULL) {
+		if (buf != NULL)
+			(void) munmap(buf, span);
+		mutex_exit(&zio_huge_lock);
+		return (NULL);
+	}
+	stat->value.ui64 += span;
+
+	buf = vmem_alloc(vmp, size, vmflag);
+	mutex_exit(&zio_huge_lock);
+
+	return (buf);
+}
+
+static int
+zio_arena_kstat_update(kstat_t *ksp, int rw)
+{
+	if (rw == KSTAT_WRITE)
+		return (EACCES);
+
+	zio_arena_stats.inuse_bytes.value.ui64 =
+	    vmem_size(zio_alloc_arena, VMEM_ALLOC);
+
+	return (0);
+}
+
+/*
+ * Find out which kinds of hugepages this system will give us.
+ */
+static void
+zio_arena_probe(void)
+{
+	void *buf;
+
+	if ((buf = zio_huge_map_hugetlb(ZIO_HUGEPAGE_SIZE)) != NULL) {
+		(void) munmap(buf, ZIO_HUGEPAGE_SIZE);
+		zio_huge_hugetlb = B_TRUE;
+	}
+
+#ifdef MADV_HUGEPAGE
+	if ((buf = zio_huge_map_aligned(ZIO_HUGEPAGE_SIZE)) != NULL) {
+		char mode[64] = "";
+		FILE *f;
+
+		/* madvise() succeeds even when THP is set to "never" */
+		if ((f = fopen("/sys/kernel/mm/transparent_hugepage/enabled",
+		    "r")) != NULL) {
+			if (fgets(mode, sizeof (mode), f) == NULL)
+				mode[0] = '\0';
+			(void) fclose(f);
+		}
+		if (madvise(buf, ZIO_HUGEPAGE_SIZE, MADV_HUGEPAGE) == 0 &&
+		    strstr(mode, "[never]") == NULL)
+			zio_huge_thp = B_TRUE;
+		(void) munmap(buf, ZIO_HUGEPAGE_SIZE);
+	}
+#endif
+}
+
+void
+zio_arena_init(void)
+{
+	if (!zio_arena_hugepages)
+		return;
+
+	zio_arena_probe();
+	if (!zio_huge_hugetlb && !zio_huge_thp) {
+		cmn_err(CE_NOTE, "zio arena: no hugepages available, "
+		    "using the default heap");
+		return;
+	}
+
+	mutex_init(&zio_huge_lock, NULL, MUTEX_DEFAULT, NULL);
+
+	zio_huge_top = vmem_create("zio_huge_top", NULL, 0,
+	    ZIO_HUGEPAGE_SIZE, NULL, NULL, NULL, 0, VM_NOSLEEP);
+	zio_alloc_arena = vmem_create("zio_alloc", NULL, 0, PAGESIZE,
+	    zio_huge_top_alloc, vmem_free, zio_huge_top, 0,
+	    VM_NOSLEEP | VMC_NORECLAIM);
+	VERIFY(zio_huge_top != NULL && zio_alloc_arena != NULL);
+
+	zio_arena_ksp = kstat_create("unix", 0, "zio_arena", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (zio_arena_stats) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+	if (zio_arena_ksp != NULL) {
+		zio_arena_ksp->ks_data = &zio_arena_stats;
+		zio_arena_ksp->ks_update = zio_arena_kstat_update;
+		kstat_install(zio_arena_ksp);
+	}
+}
+
+void
+zio_arena_fini(void)
+{
+	if (zio_alloc_arena == NULL)
+		return;
+
+	if (zio_arena_ksp != NULL) {
+		kstat_delete(zio_arena_ksp);
+		zio_arena_ksp = NULL;
+	}
+
+	/*
+	 * The spans of zio_huge_top stay mapped until exit: vmem_destroy()
+	 * does not hand added spans back, and the daemon is going away.
+	 */
+	vmem_destroy(zio_alloc_arena);
+	zio_alloc_arena = NULL;
+
+	mutex_destroy(&zio_huge_lock);
+}
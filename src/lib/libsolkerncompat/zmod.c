@@ -23,17 +23,194 @@
  * Use is subject to license terms.
  */
 
+/*
+ * Every gzip block used to go through zlib's one-shot compress2() and
+ * uncompress(), which set up and tear down a whole deflate (about 256K)
+ * or inflate state per call.  Instead each thread keeps one stream of
+ * each kind in thread-specific data and rewinds it with deflateReset() /
+ * inflateReset() between blocks, so the state is allocated once per
+ * thread.  The output is the same as compress2() at the same level.
+ *
+ * A block at another level than the last one gets a fresh deflate stream.
+ * deflateParams() would be cheaper, but in zlib 1.2.9 to 1.2.11 it
+ * flushes a stream that has ever compressed anything, even once reset,
+ * through whatever next_out was left behind, and the next block then
+ * lacks its zlib header.
+ *
+ * zlib's memory comes from kmem_alloc(), i.e. from the umem size-class
+ * caches, with the size kept in front of each buffer as the zmod
+ * allocator in the Solaris kernel does.
+ */
+
 #include <zlib.h>
+#include <pthread.h>
 #include <sys/types.h>
+#include <sys/debug.h>
+#include <sys/kmem.h>
+
+typedef struct zmod_streams {
+	z_stream	zs_deflate;
+	int		zs_deflate_level;	/* -1 until initialized */
+	z_stream	zs_inflate;
+	boolean_t	zs_inflate_ready;
+} zmod_streams_t;
+
+static pthread_key_t zmod_key;
+static pthread_once_t zmod_once = PTHREAD_ONCE_INIT;
+
+/*ARGSUSED*/
+static voidpf
+zmod_zalloc(voidpf opaque, uInt items, uInt size)
+{
+	size_t nbytes = sizeof (uint64_t) + (size_t)items * size;
+	uint64_t *p = kmem_alloc(nbytes, KM_NOSLEEP);
+
+	if (p == NULL)
+		return (Z_NULL);
+	*p = nbytes;
+	return (p + 1);
+}
+
+/*ARGSUSED*/
+static void
+zmod_zfree(voidpf opaque, voidpf ptr)
+{
+	uint64_t *p = (uint64_t *)ptr - 1;
+
+	kmem_free(p, *p);
+}
+
+static void
+zmod_streams_destroy(void *arg)
+{
+	zmod_streams_t *zs = arg;
+
+	if (zs->zs_deflate_level != -1)
+		(void) deflateEnd(&zs->zs_deflate);
+	if (zs->zs_inflate_ready)
+		(void) inflateEnd(&zs->zs_inflate);
+	kmem_free(zs, sizeof (zmod_streams_t));
+}
+
+static void
+zmod_key_create(void)
+{
+	VERIFY(pthread_key_create(&zmod_key, zmod_streams_destroy) == 0);
+}
+
+static zmod_streams_t *
+zmod_streams_get(void)
+{
+	zmod_streams_t *zs;
+
+	(void) pthread_once(&zmod_once, zmod_key_create);
+
+	if ((zs = pthread_getspecific(zmod_key)) != NULL)
+		return (zs);
+
+	if ((zs = kmem_zalloc(sizeof (zmod_streams_t), KM_NOSLEEP)) == NULL)
+		return (NULL);
+	zs->zs_deflate.zalloc = zs->zs_inflate.zalloc = zmod_zalloc;
+	zs->zs_deflate.zfree = zs->zs_inflate.zfree = zmod_zfree;
+	zs->zs_deflate_level = -1;
+	zs->zs_inflate_ready = B_FALSE;
+
+	if (pthread_setspecific(zmod_key, zs) != 0) {
+		kmem_free(zs, sizeof (zmod_streams_t));
+		return (NULL);
+	}
+	return (zs);
+}
+
+/*
+ * Forget the caller's buffers once a block is done: when the output did
+ * not fit, the stream is left pointing into them.
+ */
+static void
+zmod_stream_clear(z_stream *strm)
+{
+	strm->next_in = Z_NULL;
+	strm->avail_in = 0;
+	strm->next_out = Z_NULL;
+	strm->avail_out = 0;
+}
+
+/*
+ * Return this thread's deflate stream, set up for the given level, or NULL
+ * if there is no memory for it.
+ */
+static z_stream *
+zmod_deflate_stream(int level)
+{
+	zmod_streams_t *zs = zmod_streams_get();
+
+	if (zs == NULL)
+		return (NULL);
+
+	if (zs->zs_deflate_level != -1 && zs->zs_deflate_level != level) {
+		(void) deflateEnd(&zs->zs_deflate);
+		zs->zs_deflate_level = -1;
+	}
+	if (zs->zs_deflate_level == -1) {
+		zmod_stream_clear(&zs->zs_deflate);
+		if (deflateInit(&zs->zs_deflate, level) != Z_OK)
+			return (NULL);
+		zs->zs_deflate_level = level;
+	}
+
+	return (&zs->zs_deflate);
+}
+
+static z_stream *
+zmod_inflate_stream(void)
+{
+	zmod_streams_t *zs = zmod_streams_get();
+
+	if (zs == NULL)
+		return (NULL);
+
+	if (!zs->zs_inflate_ready) {
+		zmod_stream_clear(&zs->zs_inflate);
+		if (inflateInit(&zs->zs_inflate) != Z_OK)
+			return (NULL);
+		zs->zs_inflate_ready = B_TRUE;
+	}
+
+	return (&zs->zs_inflate);
+}
 
 int
 z_uncompress(void *dst, size_t *dstlen, const void *src, size_t srclen)
 {
+	z_stream *strm = zmod_inflate_stream();
 	int ret;
-	uLongf len = *dstlen;
 
-	if ((ret = uncompress(dst, &len, src, srclen)) == Z_OK)
-		*dstlen = (size_t)len;
+	if (strm == NULL) {
+		uLongf len = *dstlen;
+
+		if ((ret = uncompress(dst, &len, src, srclen)) == Z_OK)
+			*dstlen = (size_t)len;
+		return (ret);
+	}
+
+	strm->next_in = (Bytef *)src;
+	strm->avail_in = srclen;
+	strm->next_out = dst;
+	strm->avail_out = *dstlen;
+
+	/* map the results the way uncompress() does */
+	ret = inflate(strm, Z_FINISH);
+	if (ret == Z_STREAM_END) {
+		*dstlen = strm->total_out;
+		ret = Z_OK;
+	} else if (ret == Z_NEED_DICT ||
+	    (ret == Z_BUF_ERROR && strm->avail_in == 0)) {
+		ret = Z_DATA_ERROR;
+	} else if (ret == Z_OK) {
+		ret = Z_BUF_ERROR;
+	}
+	(void) inflateReset(strm);
+	zmod_stream_clear(strm);
 
 	return (ret);
 }
@@ -42,11 +219,31 @@ int
 z_compress_level(void *dst, size_t *dstlen, const void *src, size_t srclen,
     int level)
 {
+	z_stream *strm = zmod_deflate_stream(level);
 	int ret;
-	uLongf len = *dstlen;
 
-	if ((ret = compress2(dst, &len, src, srclen, level)) == Z_OK)
-		*dstlen = (size_t)len;
+	if (strm == NULL) {
+		uLongf len = *dstlen;
+
+		if ((ret = compress2(dst, &len, src, srclen, level)) == Z_OK)
+			*dstlen = (size_t)len;
+		return (ret);
+	}
+
+	strm->next_in = (Bytef *)src;
+	strm->avail_in = srclen;
+	strm->next_out = dst;
+	strm->avail_out = *dstlen;
+
+	ret = deflate(strm, Z_FINISH);
+	if (ret == Z_STREAM_END) {
+		*dstlen = strm->total_out;
+		ret = Z_OK;
+	} else if (ret == Z_OK) {
+		ret = Z_BUF_ERROR;
+	}
+	(void) deflateReset(strm);
+	zmod_stream_clear(strm);
 
 	return (ret);
 }
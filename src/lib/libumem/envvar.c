@@ -143,6 +143,10 @@ static umem_env_item_t umem_options_items[] = {
 		"Minimum time between reaps and updates, in seconds.",
 		NULL, 0,	&umem_reap_interval
 	},
+	{ "reclaim_min",	"Private",	ITEM_SIZE,
+		"Smallest free vmem segment returned to the system.",
+		NULL, 0, NULL,	&vmem_reclaim_min
+	},
 
 #ifndef _WIN32
 #ifndef UMEM_STANDALONE
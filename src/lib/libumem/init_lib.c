@@ -45,6 +45,7 @@
 #endif
 
 #include <fcntl.h>
+#include <stdlib.h>
 #include <string.h>
 
 #ifdef __FreeBSD__
@@ -108,6 +109,38 @@ umem_get_max_ncpus(void)
   int fd;
   int ncpus = 1;
 
+  /*
+   * CPUHINT() is the cpu id, so we want one cache per online cpu id.
+   * The online mask ("0-3,8-11") is short even on large machines, where
+   * the cpu lines would not all fit in the /proc/stat buffer.
+   */
+  fd = open("/sys/devices/system/cpu/online", O_RDONLY);
+  if (fd >= 0) {
+    const ssize_t n = read(fd, proc_stat, sizeof(proc_stat) - 1);
+
+    close(fd);
+    if (n > 0) {
+      const char *cur = proc_stat;
+      char *next;
+
+      proc_stat[n] = '\0';
+      ncpus = 0;
+      for (;;) {
+        long id = strtol(cur, &next, 10);
+        if (next == cur)
+          break;
+        if (id + 1 > ncpus)
+          ncpus = id + 1;
+        if (*next != ',' && *next != '-')
+          break;
+        cur = next + 1;
+      }
+      if (ncpus > 0)
+        return ncpus;
+      ncpus = 1;
+    }
+  }
+
   fd = open("/proc/stat", O_RDONLY);
   if (fd >= 0) {
     const ssize_t n = read(fd, proc_stat, sizeof(proc_stat) - 1);
@@ -71,6 +71,7 @@ extern "C" {
 #define	VMC_POPULATOR	0x00010000
 #define	VMC_NO_QCACHE	0x00020000	/* cannot use quantum caches */
 #define	VMC_IDENTIFIER	0x00040000	/* not backed by memory */
+#define	VMC_NORECLAIM	0x00100000	/* skipped by vmem_reclaim() */
 /*
  * internal use only;	the import function uses the vmem_ximport_t interface
  *			and may increase the request size if it so desires
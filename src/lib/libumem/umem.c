@@ -365,6 +365,9 @@
  * \endcode
  */
 
+#ifdef __linux__
+#define	_GNU_SOURCE	/* for sched_getcpu() */
+#endif
 #include "config.h"
 /* #include "mtlib.h" */
 #include <umem_impl.h>
@@ -398,6 +401,9 @@
 #include <atomic.h>
 #endif
 #include <syslog.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
 
 #include "misc.h"
 
@@ -464,6 +470,11 @@ uint32_t umem_max_ncpus;	/* # of CPU caches. */
 
 uint32_t umem_stack_depth = 15; /* # stack frames in a bufctl_audit */
 uint32_t umem_reap_interval = 10; /* max reaping rate (seconds) */
+static uint64_t umem_reclaim_calls;	/* umem_reclaim() passes */
+static uint64_t umem_reclaim_bytes;	/* resident bytes given back */
+static uint64_t umem_reclaim_activity;	/* umem_activity() at the last pass */
+static int umem_reclaim_done;		/* nothing allocated since a pass */
+static volatile int umem_reclaim_urgent; /* next pass skips the idle test */
 uint_t umem_depot_contention = 2; /* max failed trylocks per real interval */
 uint_t umem_abort = 1;		/* whether to abort on error */
 uint_t umem_output = 0;		/* whether to write to standard error */
@@ -523,6 +534,28 @@ extern thread_t _thr_self(void);
 # define CPUHINT()	((int)(_thr_self()))
 #endif
 
+#ifdef __linux__
+/*
+ * pthread_self() is the address of the thread's descriptor, so its low bits
+ * are the same in every thread and CPU() would hand most threads the same
+ * cache.  Use the cpu we are running on instead, like kmem does; the
+ * descriptor's address with the low bits shifted out is the fallback for
+ * kernels without getcpu.
+ */
+static INLINE int
+umem_cpuhint(void)
+{
+	int cpu = sched_getcpu();
+
+	if (cpu < 0) {
+		uintptr_t self = (uintptr_t)_thr_self();
+		cpu = (int)((self >> 12) ^ (self >> 20)) & INT_MAX;
+	}
+	return (cpu);
+}
+#define	CPUHINT()		umem_cpuhint()
+#endif
+
 #ifndef CPUHINT
 #define	CPUHINT()		(_thr_self())
 #endif
@@ -2354,6 +2387,10 @@ umem_st_update(void)
 
 	umem_process_updates();	/* does all of the requested work */
 
+	(void) mutex_unlock(&umem_update_lock);
+	umem_reclaim();		/* hand the freed pages back */
+	(void) mutex_lock(&umem_update_lock);
+
 	umem_reap_next = gethrtime() +
 	    (hrtime_t)umem_reap_interval * NANOSEC;
 
@@ -2416,6 +2453,116 @@ umem_reap(void)
 	(void) mutex_unlock(&umem_update_lock);
 }
 
+/*
+ * Return the pages behind the free buffers of a cache's partially used
+ * slabs to the system.  Only hashed caches keep their free-list linkage
+ * outside the buffers, and only caches without a constructor or debugging
+ * don't care what a free buffer contains, so everything else is skipped,
+ * as are the caches of VMC_NORECLAIM arenas.
+ */
+static void
+umem_cache_reclaim(umem_cache_t *cp)
+{
+	umem_slab_t *sp;
+	umem_bufctl_t *bcp;
+	size_t bytes = 0;
+
+	if (!(cp->cache_flags & UMF_HASH) || (cp->cache_flags & UMF_BUFTAG) ||
+	    cp->cache_constructor != NULL || cp->cache_bufsize < pagesize ||
+	    (cp->cache_arena->vm_cflags & VMC_NORECLAIM))
+		return;
+
+	(void) mutex_lock(&cp->cache_lock);
+	for (sp = cp->cache_freelist; sp != &cp->cache_nullslab;
+	    sp = sp->slab_next) {
+		for (bcp = sp->slab_head; bcp != NULL; bcp = bcp->bc_next)
+			bytes += vmem_reclaim_range(bcp->bc_addr,
+			    cp->cache_bufsize);
+	}
+	(void) mutex_unlock(&cp->cache_lock);
+
+	umem_reclaim_bytes += bytes;
+}
+
+/*
+ * Number of allocations that went down to the slab layer, over all caches.
+ * Read without the cache locks, since it is only compared with an earlier
+ * value to tell whether the process allocated anything in between.
+ */
+static uint64_t
+umem_activity(void)
+{
+	umem_cache_t *cp;
+	uint64_t count = 0;
+
+	(void) mutex_lock(&umem_cache_lock);
+	for (cp = umem_null_cache.cache_next; cp != &umem_null_cache;
+	    cp = cp->cache_next)
+		count += cp->cache_slab_alloc;
+	(void) mutex_unlock(&umem_cache_lock);
+
+	return (count);
+}
+
+/*
+ * Give the memory a reap has released back to the system.  Called by the
+ * update thread (or inline by umem_st_update()), with no locks held, once
+ * the reap has finished.
+ *
+ * Reaps come at most once per umem_reap_interval, and the pages are only
+ * returned once the slab layer has been idle for a whole interval: pages
+ * freed in the middle of a burst would just be faulted in again.  Once a
+ * pass has run, later ones are skipped until something gets allocated,
+ * since there is nothing new to return.  umem_reap_urgent() bypasses all
+ * this for the next pass.
+ */
+void
+umem_reclaim(void)
+{
+	uint64_t activity = umem_activity();
+
+	if (umem_reclaim_urgent) {
+		umem_reclaim_urgent = 0;
+	} else if (activity != umem_reclaim_activity) {
+		umem_reclaim_activity = activity;
+		umem_reclaim_done = 0;
+		return;
+	} else if (umem_reclaim_done) {
+		return;
+	}
+
+	umem_cache_applyall(umem_cache_reclaim);
+	umem_reclaim_bytes += vmem_reclaim();
+	umem_reclaim_calls++;
+
+	umem_reclaim_activity = activity;
+	umem_reclaim_done = 1;
+}
+
+/*
+ * Reap, and return the freed pages to the system whether or not umem is
+ * idle.  For callers which know that memory is short.
+ */
+void
+umem_reap_urgent(void)
+{
+	umem_reclaim_urgent = 1;
+	umem_reap();
+}
+
+/*
+ * Report how many reclaim passes have run and how many resident bytes
+ * they have returned to the system.
+ */
+void
+umem_reclaim_stats(uint64_t *calls, uint64_t *bytes)
+{
+	if (calls != NULL)
+		*calls = umem_reclaim_calls;
+	if (bytes != NULL)
+		*bytes = umem_reclaim_bytes;
+}
+
 umem_cache_t *
 umem_cache_create(
 	char *name,		/* descriptive name for this cache */
@@ -32,6 +32,7 @@
 #include <sys/types.h>
 #include <sys/vmem.h>
 #include <stdlib.h>
+#include <stdint.h>
 
 #ifdef	__cplusplus
 extern "C" {
@@ -80,6 +81,8 @@ extern void *umem_cache_alloc(umem_cache_t *, int);
 extern void umem_cache_free(umem_cache_t *, void *);
 
 extern void umem_reap(void);
+extern void umem_reap_urgent(void);
+extern void umem_reclaim_stats(uint64_t *, uint64_t *);
 // in vmem_mmap.c
 extern void init_mmap();
 
@@ -119,6 +119,7 @@ extern int umem_get_max_ncpus(void);
 extern void umem_process_updates(void);
 extern void umem_cache_applyall(void (*)(umem_cache_t *));
 extern void umem_cache_update(umem_cache_t *);
+extern void umem_reclaim(void);
 
 /*
  * umem_fork.c: private interfaces
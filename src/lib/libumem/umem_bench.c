@@ -0,0 +1,99 @@
+/*
+ * Multi-threaded allocation benchmark.
+ *
+ * Every thread allocates and frees batches of small buffers, from a shared
+ * cache and from the umem_alloc() caches, which is what the zfs-fuse
+ * threads do through kmem_cache_alloc()/kmem_alloc().  The throughput only
+ * scales with the number of threads if they get different per-cpu caches
+ * (see CPUHINT() in umem.c).
+ *
+ * Usage: umem_bench [max threads] [iterations per thread]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "umem.h"
+
+#define BATCH 16
+
+static umem_cache_t *cache;
+static long iterations = 1000000;
+
+static void *
+worker(void *arg)
+{
+  void *bufs[BATCH];
+  long i;
+  int j;
+
+  for (i = 0; i < iterations; i += BATCH)
+  {
+    for (j = 0; j < BATCH; j++)
+      bufs[j] = (j & 1) ? umem_cache_alloc(cache, UMEM_DEFAULT) :
+        umem_alloc(64 << (j & 6), UMEM_DEFAULT);
+    for (j = 0; j < BATCH; j++)
+    {
+      if (j & 1)
+        umem_cache_free(cache, bufs[j]);
+      else
+        umem_free(bufs[j], 64 << (j & 6));
+    }
+  }
+
+  return NULL;
+}
+
+static double
+now(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+int
+main (int argc, char *argv[])
+{
+  long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int maxthreads = argc > 1 ? atoi(argv[1]) : 2 * (ncpus > 0 ? ncpus : 1);
+  pthread_t *threads;
+  int nthreads, i;
+
+  if (argc > 2)
+    iterations = atol(argv[2]);
+
+  umem_startup(NULL, 0, 0, NULL, NULL);
+  cache = umem_cache_create("umem_bench", 256, 0, NULL, NULL, NULL, NULL,
+      NULL, 0);
+  threads = calloc(maxthreads, sizeof (pthread_t));
+  if (cache == NULL || threads == NULL)
+  {
+    fprintf(stderr, "umem_bench: setup failed\n");
+    return 1;
+  }
+
+  printf("%8s %12s\n", "threads", "Mops/s");
+  for (nthreads = 1; nthreads <= maxthreads; nthreads *= 2)
+  {
+    double start = now(), elapsed;
+
+    for (i = 0; i < nthreads; i++)
+      pthread_create(&threads[i], NULL, worker, NULL);
+    for (i = 0; i < nthreads; i++)
+      pthread_join(threads[i], NULL);
+
+    elapsed = now() - start;
+    /* an alloc and a free per buffer */
+    printf("%8d %12.2f\n", nthreads,
+        2.0 * nthreads * iterations / elapsed / 1e6);
+    fflush(stdout);
+  }
+
+  umem_cache_destroy(cache);
+  free(threads);
+  return 0;
+}
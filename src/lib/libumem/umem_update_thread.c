@@ -46,6 +46,7 @@ THR_API umem_update_thread(void *arg)
 {
 	struct timeval now;
 	int in_update = 0;
+	int reclaim;
 
 	(void) mutex_lock(&umem_update_lock);
 
@@ -65,6 +66,7 @@ THR_API umem_update_thread(void *arg)
 			umem_update_next.tv_sec += umem_reap_interval;
 		}
 
+		reclaim = 0;
 		switch (umem_reaping) {
 		case UMEM_REAP_DONE:
 		case UMEM_REAP_ADDING:
@@ -74,6 +76,7 @@ THR_API umem_update_thread(void *arg)
 			umem_reap_next = gethrtime() +
 			    (hrtime_t)umem_reap_interval * NANOSEC;
 			umem_reaping = UMEM_REAP_DONE;
+			reclaim = 1;
 			break;
 
 		default:
@@ -83,6 +86,16 @@ THR_API umem_update_thread(void *arg)
 			break;
 		}
 
+		if (reclaim) {
+			/*
+			 * The reap has pushed the cached buffers back into
+			 * their arenas; return the now-free pages.
+			 */
+			(void) mutex_unlock(&umem_update_lock);
+			umem_reclaim();
+			(void) mutex_lock(&umem_update_lock);
+		}
+
 		(void) gettimeofday(&now, NULL);
 		if (now.tv_sec > umem_update_next.tv_sec ||
 		    (now.tv_sec == umem_update_next.tv_sec &&
@@ -106,6 +106,19 @@
  *
  * In order to increase the usefulness of extending, non-imported spans are
  * sorted in address order.
+ *
+ *
+ * 6. Returning free memory
+ * ------------------------
+ * Spans are only handed back to the backend once they are entirely free,
+ * so a long-running process keeps every page it ever touched inside the
+ * free segments of partially used spans.  After a reap, once the caches
+ * have gone idle (see umem_reclaim()), vmem_reclaim() walks the free
+ * segments of every memory-backed arena and tells the kernel (via
+ * madvise(MADV_DONTNEED)) that their resident pages can be dropped.
+ * The pages read back as zero on next use, which is fine since the contents
+ * of free segments are undefined anyway.  umem_reclaim() does the same for
+ * the free buffers of partially used slabs.
  */
 
 #include "config.h"
@@ -124,6 +137,9 @@
 #if HAVE_ATOMIC_H
 #include <atomic.h>
 #endif
+#if HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
 
 #include "vmem_base.h"
 #include "umem_base.h"
@@ -228,6 +244,7 @@ vmem_alloc_t *vmem_heap_alloc;
 vmem_free_t *vmem_heap_free;
 
 uint32_t vmem_mtbf;		/* mean time between failures [default: off] */
+size_t vmem_reclaim_min;	/* smallest free range worth reclaiming */
 size_t vmem_seg_size = sizeof (vmem_seg_t);
 
 /*
@@ -1666,6 +1683,78 @@ vmem_update(void *dummy)
 	(void) mutex_unlock(&vmem_list_lock);
 }
 
+#define	VMEM_RECLAIM_CHUNK	256	/* pages checked per mincore() call */
+
+/*
+ * Tell the kernel that the whole pages inside [start, start + size) hold
+ * nothing of value, and return how many resident bytes that released.
+ * mincore() is used so that ranges which were already reclaimed (or never
+ * touched) are neither advised again nor counted.
+ */
+size_t
+vmem_reclaim_range(void *start, size_t size)
+{
+	size_t bytes = 0;
+#if defined(MADV_DONTNEED)
+	uintptr_t addr = P2ROUNDUP((uintptr_t)start, pagesize);
+	uintptr_t end = P2ALIGN((uintptr_t)start + size, pagesize);
+	unsigned char vec[VMEM_RECLAIM_CHUNK];
+
+	if (end <= addr || end - addr < MAX(vmem_reclaim_min, pagesize))
+		return (0);
+
+	while (addr < end) {
+		size_t len = MIN(end - addr, VMEM_RECLAIM_CHUNK * pagesize);
+		size_t npages = len / pagesize;
+		size_t i, resident = 0;
+
+		if (mincore((void *)addr, len, (void *)vec) != 0)
+			break;
+
+		for (i = 0; i < npages; i++)
+			if (vec[i] & 1)
+				resident++;
+
+		if (resident != 0 &&
+		    madvise((void *)addr, len, MADV_DONTNEED) == 0)
+			bytes += resident * pagesize;
+
+		addr += len;
+	}
+#endif
+	return (bytes);
+}
+
+static void
+vmem_reclaim_seg(void *arg, void *start, size_t size)
+{
+	*(size_t *)arg += vmem_reclaim_range(start, size);
+}
+
+/*
+ * Return the resident pages of every free segment to the kernel, and return
+ * the number of bytes released.  Identifier arenas are skipped since their
+ * segments are not memory, and so are VMC_NORECLAIM arenas, whose owner
+ * knows better (e.g. hugepage backed ones, where advising a range smaller
+ * than a hugepage splits it or fails).
+ */
+size_t
+vmem_reclaim(void)
+{
+	vmem_t *vmp;
+	size_t bytes = 0;
+
+	(void) mutex_lock(&vmem_list_lock);
+	for (vmp = vmem_list; vmp != NULL; vmp = vmp->vm_next) {
+		if (vmp->vm_cflags & (VMC_IDENTIFIER | VMC_NORECLAIM))
+			continue;
+		vmem_walk(vmp, VMEM_FREE, vmem_reclaim_seg, &bytes);
+	}
+	(void) mutex_unlock(&vmem_list_lock);
+
+	return (bytes);
+}
+
 /*
  * If vmem_init is called again, we need to be able to reset the world.
  * That includes resetting the statics back to their original values.
@@ -57,6 +57,10 @@ extern vmem_t *vmem_stand_arena(vmem_alloc_t **, vmem_free_t **);
 
 extern void vmem_update(void *);
 extern void vmem_reap(void);		/* vmem_populate()-safe reap */
+extern size_t vmem_reclaim(void);	/* madvise() away free segments */
+extern size_t vmem_reclaim_range(void *, size_t);
+
+extern size_t vmem_reclaim_min;
 
 extern size_t pagesize;
 extern size_t vmem_sbrk_pagesize;
@@ -75,6 +75,7 @@ struct libzfs_handle {
 	boolean_t libzfs_mnttab_enable;
 	avl_tree_t libzfs_mnttab_cache;
 	int libzfs_pool_iter;
+	boolean_t libzfs_no_list_batch;	/* daemon lacks ZFS_IOC_LIST_BATCH */
 	/*
 	topo_hdl_t *libzfs_topo_hdl;
 	libzfs_fru_t **libzfs_fru_hash;
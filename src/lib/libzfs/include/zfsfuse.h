@@ -26,7 +26,12 @@
 #ifndef _ZFSFUSE_H
 #define _ZFSFUSE_H
 
+#include <sys/types.h>
+
 extern int zfsfuse_open(const char *pathname, int flags);
+extern int zfsfuse_shm_attach(int sock);
+extern void zfsfuse_shm_detach(int sock);
+extern char *zfsfuse_tunable(int sock, const char *name, const uint64_t *value);
 
 /* For now, zfsfuse_ioctl is defined in sys/ioctl.h */
 #endif
@@ -375,16 +375,13 @@ get_recvd_props_ioctl(zfs_handle_t *zhp)
 	return (0);
 }
 
+/*
+ * Stores the given property nvlist in the handle, which takes ownership of it.
+ */
 static int
-put_stats_zhdl(zfs_handle_t *zhp, zfs_cmd_t *zc)
+put_props_zhdl(zfs_handle_t *zhp, nvlist_t *allprops)
 {
-	nvlist_t *allprops, *userprops;
-
-	zhp->zfs_dmustats = zc->zc_objset_stats; /* structure assignment */
-
-	if (zcmd_read_dst_nvlist(zhp->zfs_hdl, zc, &allprops) != 0) {
-		return (-1);
-	}
+	nvlist_t *userprops;
 
 	/*
 	 * XXX Why do we store the user props separately, in addition to
@@ -404,6 +401,20 @@ put_stats_zhdl(zfs_handle_t *zhp, zfs_cmd_t *zc)
 	return (0);
 }
 
+static int
+put_stats_zhdl(zfs_handle_t *zhp, zfs_cmd_t *zc)
+{
+	nvlist_t *allprops;
+
+	zhp->zfs_dmustats = zc->zc_objset_stats; /* structure assignment */
+
+	if (zcmd_read_dst_nvlist(zhp->zfs_hdl, zc, &allprops) != 0) {
+		return (-1);
+	}
+
+	return (put_props_zhdl(zhp, allprops));
+}
+
 static int
 get_stats(zfs_handle_t *zhp)
 {
@@ -430,15 +441,11 @@ zfs_refresh_properties(zfs_handle_t *zhp)
 }
 
 /*
- * Makes a handle from the given dataset name.  Used by zfs_open() and
- * zfs_iter_* to create child handles on the fly.
+ * Determines the types of a handle whose stats have been filled in.
  */
 static int
-make_dataset_handle_common(zfs_handle_t *zhp, zfs_cmd_t *zc)
+make_dataset_handle_types(zfs_handle_t *zhp)
 {
-	if (put_stats_zhdl(zhp, zc) != 0)
-		return (-1);
-
 	/*
 	 * We've managed to open the dataset and gather statistics.  Determine
 	 * the high-level type.
@@ -463,6 +470,19 @@ make_dataset_handle_common(zfs_handle_t *zhp, zfs_cmd_t *zc)
 	return (0);
 }
 
+/*
+ * Makes a handle from the given dataset name.  Used by zfs_open() and
+ * zfs_iter_* to create child handles on the fly.
+ */
+static int
+make_dataset_handle_common(zfs_handle_t *zhp, zfs_cmd_t *zc)
+{
+	if (put_stats_zhdl(zhp, zc) != 0)
+		return (-1);
+
+	return (make_dataset_handle_types(zhp));
+}
+
 zfs_handle_t *
 make_dataset_handle(libzfs_handle_t *hdl, const char *path)
 {
@@ -509,6 +529,46 @@ make_dataset_handle_zc(libzfs_handle_t *hdl, zfs_cmd_t *zc)
 	return (zhp);
 }
 
+/*
+ * Makes a handle from one entry of a ZFS_IOC_LIST_BATCH reply.
+ */
+static zfs_handle_t *
+make_dataset_handle_batch(libzfs_handle_t *hdl, nvpair_t *pair)
+{
+	zfs_handle_t *zhp;
+	nvlist_t *nv, *props, *allprops;
+	uint8_t *stats;
+	uint_t len;
+
+	if (nvpair_value_nvlist(pair, &nv) != 0 ||
+	    nvlist_lookup_uint8_array(nv, ZFS_LIST_BATCH_STATS,
+	    &stats, &len) != 0 || len != sizeof (dmu_objset_stats_t) ||
+	    nvlist_lookup_nvlist(nv, ZFS_LIST_BATCH_PROPS, &props) != 0)
+		return (NULL);
+
+	if ((zhp = calloc(sizeof (zfs_handle_t), 1)) == NULL)
+		return (NULL);
+
+	zhp->zfs_hdl = hdl;
+	(void) strlcpy(zhp->zfs_name, nvpair_name(pair),
+	    sizeof (zhp->zfs_name));
+	bcopy(stats, &zhp->zfs_dmustats, sizeof (dmu_objset_stats_t));
+
+	if (nvlist_dup(props, &allprops, 0) != 0) {
+		(void) no_memory(hdl);
+		free(zhp);
+		return (NULL);
+	}
+	if (put_props_zhdl(zhp, allprops) != 0 ||
+	    make_dataset_handle_types(zhp) != 0) {
+		nvlist_free(zhp->zfs_props);
+		nvlist_free(zhp->zfs_user_props);
+		free(zhp);
+		return (NULL);
+	}
+	return (zhp);
+}
+
 /*
  * Opens the given snapshot, filesystem, or volume.   The 'types'
  * argument is a mask of acceptable types.  The function will print an
@@ -2462,6 +2522,92 @@ top:
 	return (rc);
 }
 
+/*
+ * Initial reply buffer for ZFS_IOC_LIST_BATCH; the daemon fills it with as
+ * many datasets as fit.
+ */
+#define	ZFS_LIST_BATCH_BUFSIZE	(256 * 1024)
+
+/*
+ * Iterates over the children or snapshots of a dataset with
+ * ZFS_IOC_LIST_BATCH, which returns many datasets with their stats and
+ * properties per round trip to the daemon.  If the daemon does not know the
+ * ioctl, libzfs_no_list_batch is set before any callback has run and the
+ * caller falls back to the _LIST_NEXT ioctls.
+ */
+static int
+zfs_iter_batch(zfs_handle_t *zhp, uint64_t which, zfs_iter_f func, void *data)
+{
+	libzfs_handle_t *hdl = zhp->zfs_hdl;
+	zfs_cmd_t zc = { 0 };
+	zfs_handle_t *nzhp;
+	nvlist_t *batch;
+	nvpair_t *pair;
+	size_t bufsize = ZFS_LIST_BATCH_BUFSIZE;
+	int ret = 0;
+
+	if (hdl->libzfs_no_list_batch)
+		return (0);
+
+	if (zcmd_alloc_dst_nvlist(hdl, &zc, bufsize) != 0)
+		return (-1);
+
+	for (;;) {
+		(void) strlcpy(zc.zc_name, zhp->zfs_name, sizeof (zc.zc_name));
+		zc.zc_objset_type = which;
+		zc.zc_nvlist_dst_size = bufsize;
+
+		if (ioctl(hdl->libzfs_fd, ZFS_IOC_LIST_BATCH, &zc) != 0) {
+			switch (errno) {
+			case ENOMEM:
+				/* a single dataset did not fit, grow the buffer */
+				if (zcmd_expand_dst_nvlist(hdl, &zc) != 0)
+					return (-1);
+				bufsize = zc.zc_nvlist_dst_size;
+				continue;
+			/* normal completion, see zfs_do_list_ioctl() */
+			case ESRCH:
+			case ENOENT:
+				break;
+			case EINVAL:
+			case ENOTSUP:
+				if (zc.zc_cookie == 0) {
+					hdl->libzfs_no_list_batch = B_TRUE;
+					break;
+				}
+				/* FALLTHROUGH */
+			default:
+				ret = zfs_standard_error(hdl, errno,
+				    dgettext(TEXT_DOMAIN,
+				    "cannot iterate filesystems"));
+				break;
+			}
+			break;
+		}
+
+		if (zcmd_read_dst_nvlist(hdl, &zc, &batch) != 0) {
+			ret = -1;
+			break;
+		}
+
+		for (pair = nvlist_next_nvpair(batch, NULL); pair != NULL;
+		    pair = nvlist_next_nvpair(batch, pair)) {
+			/* see zfs_iter_filesystems() */
+			if ((nzhp = make_dataset_handle_batch(hdl,
+			    pair)) == NULL)
+				continue;
+
+			if ((ret = func(nzhp, data)) != 0)
+				break;
+		}
+		nvlist_free(batch);
+		if (ret != 0)
+			break;
+	}
+	zcmd_free_nvlists(&zc);
+	return (ret);
+}
+
 /*
  * Iterate over all child filesystems
  */
@@ -2475,6 +2621,10 @@ zfs_iter_filesystems(zfs_handle_t *zhp, zfs_iter_f func, void *data)
 	if (zhp->zfs_type != ZFS_TYPE_FILESYSTEM)
 		return (0);
 
+	ret = zfs_iter_batch(zhp, ZFS_LIST_BATCH_CHILDREN, func, data);
+	if (!zhp->zfs_hdl->libzfs_no_list_batch)
+		return (ret);
+
 	if (zcmd_alloc_dst_nvlist(zhp->zfs_hdl, &zc, 0) != 0)
 		return (-1);
 
@@ -2513,6 +2663,10 @@ zfs_iter_snapshots(zfs_handle_t *zhp, zfs_iter_f func, void *data)
 	if (zhp->zfs_type == ZFS_TYPE_SNAPSHOT)
 		return (0);
 
+	ret = zfs_iter_batch(zhp, ZFS_LIST_BATCH_SNAPSHOTS, func, data);
+	if (!zhp->zfs_hdl->libzfs_no_list_batch)
+		return (ret);
+
 	if (zcmd_alloc_dst_nvlist(zhp->zfs_hdl, &zc, 0) != 0)
 		return (-1);
 	while ((ret = zfs_do_list_ioctl(zhp, ZFS_IOC_SNAPSHOT_LIST_NEXT,
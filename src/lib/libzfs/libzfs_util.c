@@ -595,6 +595,9 @@ libzfs_init(void)
 
 	hdl->libzfs_sharetab = fopen("/var/lib/nfs/etab", "r");
 
+	/* ZFSFUSE: optional, the socket is used if the daemon lacks it */
+	(void) zfsfuse_shm_attach(hdl->libzfs_fd);
+
 	zfs_prop_init();
 	zpool_prop_init();
 	libzfs_mnttab_init(hdl);
@@ -605,6 +608,7 @@ libzfs_init(void)
 void
 libzfs_fini(libzfs_handle_t *hdl)
 {
+	zfsfuse_shm_detach(hdl->libzfs_fd);
 	(void) close(hdl->libzfs_fd);
 	if (hdl->libzfs_mnttab)
 		(void) endmntent(hdl->libzfs_mnttab);
@@ -24,21 +24,38 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <sys/uio.h>
+#include <sys/mman.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <errno.h>
 #include <syslog.h>
 
 #include <sys/mntent.h>
 
 #include "libzfs_impl.h"
+#include <zfsfuse.h>
 
 int aok=0;
 
+/*
+ * Shared memory region attached to a daemon connection by
+ * zfsfuse_shm_attach().  Only one connection per process uses it, which is
+ * the libzfs handle's; other sockets (e.g. zpool freeze's) go the slow way.
+ */
+typedef struct zfsfuse_shm {
+	int zs_sock;
+	char *zs_base;
+	size_t zs_size;
+} zfsfuse_shm_t;
+
+static zfsfuse_shm_t zfsfuse_shm = { -1, NULL, 0 };
+
 int zfsfuse_open(const char *pathname, int flags)
 {
 	struct sockaddr_un name;
@@ -74,7 +91,6 @@ int zfsfuse_open(const char *pathname, int flags)
 
 /*
  * This function is repeated in zfs-fuse/zfsfuse_socket.c
- * and in zfs-fuse/fuse_listener.c
  */
 int zfsfuse_ioctl_read_loop(int fd, void *buf, int bytes)
 {
@@ -136,14 +152,14 @@ int zfsfuse_sendfd(int sock, int fd)
 	return sendmsg(sock, &msg, 0) < 0 ? -1 : 0;
 }
 
-int zfsfuse_ioctl(int fd, int32_t request, void *arg)
+static int zfsfuse_ioctl_sock(int fd, int32_t request, uint64_t arg)
 {
 	zfsfuse_cmd_t cmd;
 	int ret;
 
 	cmd.cmd_type = IOCTL_REQ;
 	cmd.cmd_u.ioctl_req.cmd = request;
-	cmd.cmd_u.ioctl_req.arg = (uint64_t)(uintptr_t) arg;
+	cmd.cmd_u.ioctl_req.arg = arg;
 	cmd.uid = getuid();
 	cmd.gid = getgid();
 
@@ -195,6 +211,132 @@ int zfsfuse_ioctl(int fd, int32_t request, void *arg)
 	}
 }
 
+/*
+ * Moves one buffer of a zfs_cmd_t into the shared region, if it fits.
+ * Buffers that do not fit keep their address and are copied over the socket.
+ */
+static void zfsfuse_shm_reloc(char **nextp, char *end, uint64_t *ptrp, size_t size, boolean_t copy)
+{
+	char *p = *nextp;
+
+	if(*ptrp == 0 || size == 0 || size > end - p)
+		return;
+
+	if(copy)
+		memcpy(p, (void *)(uintptr_t) *ptrp, size);
+	*ptrp = (uint64_t)(uintptr_t) p;
+	*nextp = p + P2ROUNDUP(size, 8);
+}
+
+static int zfsfuse_ioctl_shm(int fd, int32_t request, zfs_cmd_t *zc)
+{
+	zfs_cmd_t *szc = (zfs_cmd_t *) zfsfuse_shm.zs_base;
+	char *next = zfsfuse_shm.zs_base + P2ROUNDUP(sizeof(zfs_cmd_t), 8);
+	char *end = zfsfuse_shm.zs_base + zfsfuse_shm.zs_size;
+	size_t histlen;
+	int ret;
+
+	*szc = *zc;
+
+	/* zc_history is either an output buffer or the history log string */
+	histlen = zc->zc_history_len;
+	if(histlen == 0 && zc->zc_history != 0)
+		histlen = strlen((char *)(uintptr_t) zc->zc_history) + 1;
+
+	zfsfuse_shm_reloc(&next, end, &szc->zc_nvlist_conf, zc->zc_nvlist_conf_size, B_TRUE);
+	zfsfuse_shm_reloc(&next, end, &szc->zc_nvlist_src, zc->zc_nvlist_src_size, B_TRUE);
+	zfsfuse_shm_reloc(&next, end, &szc->zc_nvlist_dst, zc->zc_nvlist_dst_size, B_FALSE);
+	zfsfuse_shm_reloc(&next, end, &szc->zc_history, histlen, B_TRUE);
+
+	ret = zfsfuse_ioctl_sock(fd, request, (uint64_t)(uintptr_t) szc);
+
+	/* Copy back what the daemon wrote, like COPYOUT_REQ would have */
+	if(szc->zc_nvlist_dst != zc->zc_nvlist_dst)
+		memcpy((void *)(uintptr_t) zc->zc_nvlist_dst, (void *)(uintptr_t) szc->zc_nvlist_dst,
+		    MIN(szc->zc_nvlist_dst_size, zc->zc_nvlist_dst_size));
+	if(szc->zc_history != zc->zc_history && zc->zc_history_len != 0)
+		memcpy((void *)(uintptr_t) zc->zc_history, (void *)(uintptr_t) szc->zc_history,
+		    MIN(szc->zc_history_len, zc->zc_history_len));
+
+	szc->zc_nvlist_conf = zc->zc_nvlist_conf;
+	szc->zc_nvlist_src = zc->zc_nvlist_src;
+	szc->zc_nvlist_dst = zc->zc_nvlist_dst;
+	szc->zc_history = zc->zc_history;
+	*zc = *szc;
+
+	return ret;
+}
+
+int zfsfuse_ioctl(int fd, int32_t request, void *arg)
+{
+	if(fd == zfsfuse_shm.zs_sock)
+		return zfsfuse_ioctl_shm(fd, request, arg);
+
+	return zfsfuse_ioctl_sock(fd, request, (uint64_t)(uintptr_t) arg);
+}
+
+/*
+ * Sets up the shared memory ioctl transport on a daemon connection.  The
+ * memfd is sealed against shrinking so that the daemon cannot be made to
+ * fault on its mapping.  Failure is not an error: the socket keeps working.
+ */
+int zfsfuse_shm_attach(int sock)
+{
+#if defined(MFD_ALLOW_SEALING) && defined(F_SEAL_SHRINK)
+	zfsfuse_shm_req_t req = { 0 };
+	void *base;
+	int fd;
+
+	fd = memfd_create("zfs-fuse-ioctl", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if(fd == -1)
+		return -1;
+
+	if(ftruncate(fd, ZFSFUSE_SHM_SIZE) != 0 ||
+	    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_SEAL) != 0) {
+		close(fd);
+		return -1;
+	}
+
+	base = mmap(NULL, ZFSFUSE_SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(base == MAP_FAILED) {
+		close(fd);
+		return -1;
+	}
+
+	req.zsr_base = (uint64_t)(uintptr_t) base;
+	req.zsr_size = ZFSFUSE_SHM_SIZE;
+	req.zsr_fd = fd;
+
+	/* The daemon has its own reference to the memfd once this returns */
+	if(zfsfuse_ioctl_sock(sock, ZFSFUSE_IOC_SHM_ATTACH, (uint64_t)(uintptr_t) &req) != 0) {
+		munmap(base, ZFSFUSE_SHM_SIZE);
+		close(fd);
+		return -1;
+	}
+	close(fd);
+
+	zfsfuse_shm_detach(zfsfuse_shm.zs_sock);
+	zfsfuse_shm.zs_sock = sock;
+	zfsfuse_shm.zs_base = base;
+	zfsfuse_shm.zs_size = ZFSFUSE_SHM_SIZE;
+
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+void zfsfuse_shm_detach(int sock)
+{
+	if(sock == -1 || sock != zfsfuse_shm.zs_sock)
+		return;
+
+	munmap(zfsfuse_shm.zs_base, zfsfuse_shm.zs_size);
+	zfsfuse_shm.zs_sock = -1;
+	zfsfuse_shm.zs_base = NULL;
+	zfsfuse_shm.zs_size = 0;
+}
+
 /* If you change this, check _sol_mount in lib/libsolcompat/include/sys/mount.h */
 int zfsfuse_mount(libzfs_handle_t *hdl, const char *spec, const char *dir, int mflag, char *fstype, char *dataptr, int datalen, char *optptr, int optlen)
 {
@@ -238,3 +380,50 @@ int zfsfuse_mount(libzfs_handle_t *hdl, const char *spec, const char *dir, int m
 	errno = error;
 	return -1;
 }
+
+/*
+ * Asks the daemon about its tunable called name, or all of them if name is
+ * "", setting it to *value first if value is not NULL.  Returns the
+ * "name value min max" lines the daemon sent back, to be free()d, or NULL
+ * with errno set.
+ */
+char *zfsfuse_tunable(int sock, const char *name, const uint64_t *value)
+{
+	zfsfuse_cmd_t cmd;
+	uint32_t namelen = strlen(name);
+	int32_t error;
+	uint32_t len;
+	char *buf;
+
+	memset(&cmd, 0, sizeof(zfsfuse_cmd_t));
+	cmd.cmd_type = TUNABLE_REQ;
+	cmd.cmd_u.tunable_req.namelen = namelen;
+	cmd.cmd_u.tunable_req.set = value != NULL;
+	cmd.cmd_u.tunable_req.value = value != NULL ? *value : 0;
+	cmd.uid = getuid();
+	cmd.gid = getgid();
+
+	if(write(sock, &cmd, sizeof(zfsfuse_cmd_t)) != sizeof(zfsfuse_cmd_t) ||
+	    write(sock, name, namelen) != namelen)
+		return NULL;
+
+	if(zfsfuse_ioctl_read_loop(sock, &error, sizeof(int32_t)) != 0 ||
+	    zfsfuse_ioctl_read_loop(sock, &len, sizeof(uint32_t)) != 0)
+		return NULL;
+
+	if((buf = malloc(len + 1)) == NULL)
+		return NULL;
+	if(len > 0 && zfsfuse_ioctl_read_loop(sock, buf, len) != 0) {
+		free(buf);
+		return NULL;
+	}
+	buf[len] = '\0';
+
+	if(error != 0) {
+		free(buf);
+		errno = error;
+		return NULL;
+	}
+
+	return buf;
+}
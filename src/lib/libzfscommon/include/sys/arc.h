@@ -40,6 +40,8 @@ typedef struct arc_buf_hdr arc_buf_hdr_t;
 typedef struct arc_buf arc_buf_t;
 typedef void arc_done_func_t(zio_t *zio, arc_buf_t *buf, void *private);
 typedef int arc_evict_func_t(void *private);
+typedef void arc_walk_func_t(const blkptr_t *bp, int mru, clock_t atime,
+    void *arg);
 
 /* generic arc_done_func_t's which you can use */
 arc_done_func_t arc_bcopy_func;
@@ -95,6 +97,7 @@ int arc_released(arc_buf_t *buf);
 int arc_has_callback(arc_buf_t *buf);
 void arc_buf_freeze(arc_buf_t *buf);
 void arc_buf_thaw(arc_buf_t *buf);
+boolean_t arc_prefetch_room(void);
 #ifdef ZFS_DEBUG
 int arc_referenced(arc_buf_t *buf);
 #endif
@@ -115,11 +118,23 @@ void arc_set_callback(arc_buf_t *buf, arc_evict_func_t *func, void *private);
 int arc_buf_evict(arc_buf_t *buf);
 
 void arc_flush(spa_t *spa);
+void arc_walk_cached(spa_t *spa, arc_walk_func_t *func, void *arg);
 void arc_tempreserve_clear(uint64_t reserve);
 int arc_tempreserve_space(uint64_t reserve, uint64_t txg);
 
 void arc_init(void);
 void arc_fini(void);
+int arc_tuning_update(void);
+
+/*
+ * ARC warm start
+ */
+
+void arc_warm_save(spa_t *spa);
+void arc_warm_load(spa_t *spa);
+void arc_warm_stop(spa_t *spa);
+void arc_warm_stat_init(void);
+void arc_warm_stat_fini(void);
 
 /*
  * Level 2 ARC
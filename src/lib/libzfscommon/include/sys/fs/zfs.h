@@ -324,14 +324,24 @@ typedef enum zfs_cache_type {
 #define	SPA_VERSION_21			21ULL
 #define	SPA_VERSION_22			22ULL
 #define	SPA_VERSION_23			23ULL
+#define	SPA_VERSION_24			24ULL
 /*
  * When bumping up SPA_VERSION, make sure GRUB ZFS understands the on-disk
  * format change. Go to usr/src/grub/grub-0.97/stage2/{zfs-include/, fsys_zfs*},
  * and do the appropriate changes.  Also bump the version number in
  * usr/src/grub/capability.
  */
-#define	SPA_VERSION			SPA_VERSION_23
-#define	SPA_VERSION_STRING		"23"
+#define	SPA_VERSION			SPA_VERSION_24
+#define	SPA_VERSION_STRING		"24"
+
+/*
+ * ZFSFUSE: version 24 only means lz4 compression to zfs-fuse; everybody
+ * else uses it for system attributes.  So pools are still created and
+ * upgraded to version 23 unless 24 is asked for, version 24 pools are
+ * marked in the MOS (DMU_POOL_ZFSFUSE_LZ4) and those without the mark are
+ * refused.
+ */
+#define	SPA_VERSION_DEFAULT		SPA_VERSION_23
 
 /*
  * Symbolic names for the changes that caused a SPA_VERSION switch.
@@ -376,6 +386,7 @@ typedef enum zfs_cache_type {
 #define	SPA_VERSION_DEDUP		SPA_VERSION_21
 #define	SPA_VERSION_RECVD_PROPS		SPA_VERSION_22
 #define	SPA_VERSION_SLIM_ZIL		SPA_VERSION_23
+#define	SPA_VERSION_LZ4_COMPRESSION	SPA_VERSION_24
 
 /*
  * ZPL version - rev'd whenever an incompatible on-disk format change
@@ -722,7 +733,8 @@ typedef enum zfs_ioc {
 	ZFS_IOC_RELEASE,
 	ZFS_IOC_GET_HOLDS,
 	ZFS_IOC_OBJSET_RECVD_PROPS,
-	ZFS_IOC_VDEV_SPLIT
+	ZFS_IOC_VDEV_SPLIT,
+	ZFS_IOC_LIST_BATCH
 } zfs_ioc_t;
 
 /*
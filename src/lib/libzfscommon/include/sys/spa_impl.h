@@ -145,6 +145,14 @@ struct spa {
 	int		spa_async_suspended;	/* async tasks suspended */
 	kcondvar_t	spa_async_cv;		/* wait for thread_exit() */
 	uint16_t	spa_async_tasks;	/* async task mask */
+	kmutex_t	spa_warm_lock;		/* protect warm start state */
+	kthread_t	*spa_warm_thread;	/* warm start prefetcher */
+	boolean_t	spa_warm_exit;		/* tell it to stop */
+	kcondvar_t	spa_warm_cv;		/* wait for thread_exit() */
+	kmutex_t	spa_cksum_batch_lock;	/* protect checksum batching */
+	zio_t		*spa_cksum_batch[ZIO_CHECKSUM_BATCH_MAX]; /* queued */
+	int		spa_cksum_batch_queued;	/* zios in spa_cksum_batch */
+	int		spa_cksum_batch_busy;	/* threads hashing batches */
 	char		*spa_root;		/* alternate root directory */
 	uint64_t	spa_ena;		/* spa-wide ereport ENA */
 	int		spa_last_open_failed;	/* error if last open failed */
@@ -108,7 +108,8 @@ typedef enum drr_headertype {
  */
 
 enum {
-	IOCTL_REQ, IOCTL_ANS, COPYIN_REQ, COPYINSTR_REQ, COPYINSTR_ANS, COPYOUT_REQ, MOUNT_REQ, GETF_REQ
+	IOCTL_REQ, IOCTL_ANS, COPYIN_REQ, COPYINSTR_REQ, COPYINSTR_ANS, COPYOUT_REQ, MOUNT_REQ, GETF_REQ,
+	TUNABLE_REQ
 };
 
 typedef struct {
@@ -138,12 +139,40 @@ typedef struct {
 			int32_t optlen;
 		} mount_req;
 
+		/*
+		 * Followed by the name of the tunable ("" for all of them).
+		 * Answered by an int32_t error, a uint32_t length and that
+		 * many bytes of "name value min max" lines.
+		 */
+		struct tunable_req {
+			uint32_t namelen;
+			int32_t set;		/* set it to value first */
+			uint64_t value;
+		} tunable_req;
+
 		int32_t getf_req_fd;
 	} cmd_u __attribute__ ((aligned(8)));
 	uid_t uid;
 	gid_t gid;
 } zfsfuse_cmd_t __attribute__ ((aligned(8)));
 
+/*
+ * Pseudo ioctl that attaches a shared memory region to a zfs-fuse socket
+ * connection.  The client passes a sealed memfd (fetched by the daemon with
+ * GETF_REQ) and the address it is mapped at; copyin/copyout of buffers that
+ * lie inside the region become memcpy()s in the daemon.  Daemons that do
+ * not know it fail it with EINVAL like any unknown ioctl.
+ */
+#define	ZFSFUSE_IOC_SHM_ATTACH	(ZFS_IOC + 0xff)
+#define	ZFSFUSE_SHM_SIZE	(1024 * 1024)
+#define	ZFSFUSE_SHM_MAX		(64 * 1024 * 1024)
+
+typedef struct zfsfuse_shm_req {
+	uint64_t zsr_base;	/* address of the region in the client */
+	uint64_t zsr_size;
+	int32_t zsr_fd;		/* memfd in the client */
+} zfsfuse_shm_req_t;
+
 /*
  * flags in the drr_checksumflags field in the DRR_WRITE and
  * DRR_WRITE_BYREF blocks
@@ -312,6 +341,17 @@ typedef struct zfs_useracct {
 
 #define	ZPOOL_EXPORT_AFTER_SPLIT 0x1
 
+/*
+ * ZFS_IOC_LIST_BATCH: zc_objset_type selects what to list, zc_obj caps the
+ * number of datasets returned.  Every dataset in the returned nvlist is an
+ * nvlist holding its dmu_objset_stats_t and its property nvlist.
+ */
+#define	ZFS_LIST_BATCH_CHILDREN		0
+#define	ZFS_LIST_BATCH_SNAPSHOTS	1
+#define	ZFS_LIST_BATCH_MAX		1024
+#define	ZFS_LIST_BATCH_STATS		"stats"
+#define	ZFS_LIST_BATCH_PROPS		"props"
+
 #ifdef _KERNEL
 
 typedef struct zfs_creat {
@@ -34,6 +34,7 @@
 #include <sys/dmu.h>
 #include <sys/zfs_vfsops.h>
 #include <sys/rrwlock.h>
+#include <sys/zap.h>
 #endif
 #include <sys/zfs_acl.h>
 #include <sys/zil.h>
@@ -200,6 +201,7 @@ typedef struct znode {
 	uint8_t		z_zn_prefetch;	/* Prefetch znodes? */
 	uint_t		z_blksz;	/* block size in bytes */
 	uint_t		z_seq;		/* modification sequence number */
+	uint64_t	z_wseq;		/* ZFSFUSE: data change counter */
 	uint64_t	z_mapcnt;	/* number of pages mapped to file */
 	uint64_t	z_last_itx;	/* last ZIL itx on this znode */
 	uint64_t	z_gen;		/* generation (same as zp_gen) */
@@ -306,6 +308,8 @@ extern void	zfs_time_stamper(znode_t *, uint_t, dmu_tx_t *);
 extern void	zfs_time_stamper_locked(znode_t *, uint_t, dmu_tx_t *);
 extern void	zfs_grow_blocksize(znode_t *, uint64_t, dmu_tx_t *);
 extern int	zfs_freesp(znode_t *, uint64_t, uint64_t, int, boolean_t);
+extern int	zfs_fallocate(znode_t *, uint64_t, uint64_t, int, boolean_t,
+    boolean_t);
 extern void	zfs_znode_init(void);
 extern void	zfs_znode_fini(void);
 extern int	zfs_zget(zfsvfs_t *, uint64_t, znode_t **, boolean_t);
@@ -321,6 +325,47 @@ extern int	zfs_get_zplprop(objset_t *os, zfs_prop_t prop, uint64_t *value);
 extern int	zfs_get_stats(objset_t *os, nvlist_t *nv);
 extern void	zfs_znode_dmu_fini(znode_t *);
 
+/*
+ * ZFSFUSE: directory cursor kept in an opendir handle, so that a directory
+ * is walked with a single zap cursor instead of one per entry.
+ */
+typedef struct zfs_dircursor {
+	kmutex_t	zd_lock;	/* serializes readdirs on the handle */
+	zap_cursor_t	zd_zc;		/* zap cursor, valid if zd_active */
+	boolean_t	zd_active;
+	uint64_t	zd_offset;	/* offset of the entry zd_zc is on */
+} zfs_dircursor_t;
+
+/*
+ * Called for each directory entry, with the offset of the next entry.
+ * Returns non-zero if the entry could not be consumed (buffer full).
+ */
+typedef int zfs_filldir_t(void *arg, const char *name, uint64_t objnum,
+    uint8_t type, uint64_t nextoff);
+
+extern void	zfs_dircursor_init(zfs_dircursor_t *);
+extern void	zfs_dircursor_fini(zfs_dircursor_t *);
+extern int	zfs_readdir_batch(vnode_t *, zfs_dircursor_t *, uint64_t,
+    zfs_filldir_t *, void *, cred_t *, int *);
+
+/*
+ * ZFSFUSE: dbufs held for a zero-copy read.  zr_iov points into the held
+ * buffers and stays valid (and stable, thanks to the range lock) until
+ * zfs_read_rele() is called.
+ */
+typedef struct zfs_readhold {
+	struct rl	*zr_rl;		/* range lock over the read */
+	dmu_buf_t	**zr_dbp;	/* held dbufs */
+	int		zr_numbufs;
+	iovec_t		*zr_iov;	/* one entry per held dbuf */
+	int		zr_iovcnt;
+	size_t		zr_len;		/* bytes covered, 0 at/past EOF */
+} zfs_readhold_t;
+
+extern int	zfs_read_hold(vnode_t *, offset_t, size_t, cred_t *,
+    zfs_readhold_t *);
+extern void	zfs_read_rele(vnode_t *, zfs_readhold_t *);
+
 extern void zfs_log_create(zilog_t *zilog, dmu_tx_t *tx, uint64_t txtype,
     znode_t *dzp, znode_t *zp, char *name, vsecattr_t *, zfs_fuid_info_t *,
     vattr_t *vap);
@@ -64,6 +64,11 @@ extern zio_checksum_info_t zio_checksum_table[ZIO_CHECKSUM_FUNCTIONS];
  * Checksum routines.
  */
 extern zio_checksum_t zio_checksum_SHA256;
+extern void zio_checksum_SHA256_multi(const void **bufs,
+    const uint64_t *sizes, zio_cksum_t **zcps, int n);
+extern int zio_sha256_lanes(void);
+extern void zio_sha256_init(void);
+extern void zio_sha256_fini(void);
 
 extern void zio_checksum_compute(zio_t *zio, enum zio_checksum checksum,
     void *data, uint64_t size);
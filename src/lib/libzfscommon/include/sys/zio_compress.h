@@ -68,6 +68,12 @@ extern size_t zle_compress(void *src, void *dst, size_t s_len, size_t d_len,
     int level);
 extern int zle_decompress(void *src, void *dst, size_t s_len, size_t d_len,
     int level);
+extern size_t lz4_compress(void *src, void *dst, size_t s_len, size_t d_len,
+    int level);
+extern int lz4_decompress(void *src, void *dst, size_t s_len, size_t d_len,
+    int level);
+extern void lz4_init(void);
+extern void lz4_fini(void);
 
 /*
  * Compress and decompress data if necessary.
@@ -76,6 +82,8 @@ extern size_t zio_compress_data(enum zio_compress c, void *src, void *dst,
     size_t s_len);
 extern int zio_decompress_data(enum zio_compress c, void *src, void *dst,
     size_t s_len, size_t d_len);
+extern void zio_compress_init(void);
+extern void zio_compress_fini(void);
 
 #ifdef	__cplusplus
 }
@@ -46,6 +46,27 @@ void fletcher_4_incremental_native(const void *, uint64_t,
 void fletcher_4_incremental_byteswap(const void *, uint64_t,
    zio_cksum_t *);
 
+/*
+ * fletcher-4 comes in several versions, all giving the same result.  The
+ * one used is set by zfs_fletcher_4_impl: FLETCHER_4_IMPL_FASTEST picks the
+ * fastest this CPU can run, timed at first use or in fletcher_4_init().
+ * fletcher_4_impl_update() applies a new zfs_fletcher_4_impl, or returns
+ * EINVAL if that version isn't available here.
+ */
+#define	FLETCHER_4_IMPL_FASTEST	0
+#define	FLETCHER_4_IMPL_SCALAR	1
+#define	FLETCHER_4_IMPL_SSE2	2
+#define	FLETCHER_4_IMPL_SSSE3	3
+#define	FLETCHER_4_IMPL_AVX2	4
+#define	FLETCHER_4_IMPL_NEON	5
+#define	FLETCHER_4_IMPL_MAX	5
+
+extern int zfs_fletcher_4_impl;
+
+void fletcher_4_init(void);
+void fletcher_4_fini(void);
+int fletcher_4_impl_update(void);
+
 #ifdef	__cplusplus
 }
 #endif
@@ -0,0 +1,782 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+/*
+ * Copyright 2009 Sun Microsystems, Inc.  All rights reserved.
+ * Use is subject to license terms.
+ */
+
+/*
+ * Fletcher Checksums
+ * ------------------
+ *
+ * ZFS's 2nd and 4th order Fletcher checksums are defined by the following
+ * recurrence relations:
+ *
+ *	a  = a    + f
+ *	 i    i-1    i-1
+ *
+ *	b  = b    + a
+ *	 i    i-1    i
+ *
+ *	c  = c    + b		(fletcher-4 only)
+ *	 i    i-1    i
+ *
+ *	d  = d    + c		(fletcher-4 only)
+ *	 i    i-1    i
+ *
+ * Where
+ *	a_0 = b_0 = c_0 = d_0 = 0
+ * and
+ *	f_0 .. f_(n-1) are the input data.
+ *
+ * Using standard techniques, these translate into the following series:
+ *
+ *	     __n_			     __n_
+ *	     \   |			     \   |
+ *	a  =  >     f			b  =  >     i * f
+ *	 n   /___|   n - i		 n   /___|	 n - i
+ *	     i = 1			     i = 1
+ *
+ *
+ *	     __n_			     __n_
+ *	     \   |  i*(i+1)		     \   |  i*(i+1)*(i+2)
+ *	c  =  >     ------- f		d  =  >     ------------- f
+ *	 n   /___|     2     n - i	 n   /___|	  6	   n - i
+ *	     i = 1			     i = 1
+ *
+ * For fletcher-2, the f_is are 64-bit, and [ab]_i are 64-bit accumulators.
+ * Since the additions are done mod (2^64), errors in the high bits may not
+ * be noticed.  For this reason, fletcher-2 is deprecated.
+ *
+ * For fletcher-4, the f_is are 32-bit, and [abcd]_i are 64-bit accumulators.
+ * A conservative estimate of how big the buffer can get before we overflow
+ * can be estimated using f_i = 0xffffffff for all i:
+ *
+ * % bc
+ *  f=2^32-1;d=0; for (i = 1; d<2^64; i++) { d += f*i*(i+1)*(i+2)/6 }; (i-1)*4
+ * 2264
+ *  quit
+ * %
+ *
+ * So blocks of up to 2k will not overflow.  Our largest block size is
+ * 128k, which has 32k 4-byte words, so we can compute the largest possible
+ * accumulators, then divide by 2^64 to figure the max amount of overflow:
+ *
+ * % bc
+ *  a=b=c=d=0; f=2^32-1; for (i=1; i<=32*1024; i++) { a+=f; b+=a; c+=b; d+=c }
+ *  a/2^64;b/2^64;c/2^64;d/2^64
+ * 0
+ * 0
+ * 1365
+ * 11186858
+ *  quit
+ * %
+ *
+ * So a and b cannot overflow.  To make sure each bit of input has some
+ * effect on the contents of c and d, we can look at what the factors of
+ * the coefficients in the equations for c_n and d_n are.  The number of 2s
+ * in the factors determines the lowest set bit in the multiplier.  Running
+ * through the cases for n*(n+1)/2 reveals that the highest power of 2 is
+ * 2^14, and for n*(n+1)*(n+2)/6 it is 2^15.  So while some data may overflow
+ * the 64-bit accumulators, every bit of every f_i effects every accumulator,
+ * even for 128k blocks.
+ *
+ * If we wanted to make a stronger version of fletcher4 (fletcher4c?),
+ * we could do our calculations mod (2^32 - 1) by adding in the carries
+ * periodically, and store the number of carries in the top 32-bits.
+ *
+ * --------------------
+ * Checksum Performance
+ * --------------------
+ *
+ * There are two interesting components to checksum performance: cached and
+ * uncached performance.  With cached data, fletcher-2 is about four times
+ * faster than fletcher-4.  With uncached data, the performance difference is
+ * negligible, since the cost of a cache fill dominates the processing time.
+ * Even though fletcher-4 is slower than fletcher-2, it is still a pretty
+ * efficient pass over the data.
+ *
+ * In normal operation, the data which is being checksummed is in a buffer
+ * which has been filled either by:
+ *
+ *	1. a compression step, which will be mostly cached, or
+ *	2. a bcopy() or copyin(), which will be uncached (because the
+ *	   copy is cache-bypassing).
+ *
+ * For both cached and uncached data, both fletcher checksums are much faster
+ * than sha-256, and slower than 'off', which doesn't touch the data at all.
+ *
+ * ---------------------
+ * Vectorized fletcher-4
+ * ---------------------
+ *
+ * The scalar fletcher-4 loop is one long dependency chain: every word goes
+ * through a, b, c and d in turn.  The vector versions instead run N
+ * independent sets of accumulators ("lanes"), lane j summing the words
+ * f_j, f_(j+N), f_(j+2N), ...  Writing t for the number of N-word groups
+ * left after a word, a word at position i = kN + j has n - i = Nt - j words
+ * left, and each of the scalar coefficients 1, (n - i), (n - i)(n - i + 1)/2
+ * and (n - i)(n - i + 1)(n - i + 2)/6 is a combination with small integer
+ * factors of the lane coefficients 1, t, t(t + 1)/2 and t(t + 1)(t + 2)/6.
+ * So the lanes are folded back into exactly the scalar a, b, c and d, mod
+ * 2^64, by fletcher_4_fini_2() and fletcher_4_fini_4() below.
+ *
+ * The vector code only handles whole 16-byte groups; fletcher_4_combine()
+ * adds their sums to any earlier state and the scalar loop does the rest.
+ * Which version runs is decided at first use by timing all the ones this
+ * CPU supports, see fletcher_4_select().
+ */
+
+#include <sys/types.h>
+#include <sys/sysmacros.h>
+#include <sys/byteorder.h>
+#include <sys/spa.h>
+#include <sys/time.h>
+#ifdef _KERNEL
+#include <sys/kstat.h>
+#endif
+#include <zfs_fletcher.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+void
+fletcher_2_native(const void *buf, uint64_t size, zio_cksum_t *zcp)
+{
+	const uint64_t *ip = buf;
+	const uint64_t *ipend = ip + (size / sizeof (uint64_t));
+	uint64_t a0, b0, a1, b1;
+
+	for (a0 = b0 = a1 = b1 = 0; ip < ipend; ip += 2) {
+		a0 += ip[0];
+		a1 += ip[1];
+		b0 += a0;
+		b1 += a1;
+	}
+
+	ZIO_SET_CHECKSUM(zcp, a0, a1, b0, b1);
+}
+
+void
+fletcher_2_byteswap(const void *buf, uint64_t size, zio_cksum_t *zcp)
+{
+	const uint64_t *ip = buf;
+	const uint64_t *ipend = ip + (size / sizeof (uint64_t));
+	uint64_t a0, b0, a1, b1;
+
+	for (a0 = b0 = a1 = b1 = 0; ip < ipend; ip += 2) {
+		a0 += BSWAP_64(ip[0]);
+		a1 += BSWAP_64(ip[1]);
+		b0 += a0;
+		b1 += a1;
+	}
+
+	ZIO_SET_CHECKSUM(zcp, a0, a1, b0, b1);
+}
+
+/*
+ * Scalar fletcher-4.  These also finish off whatever the vector versions
+ * leave over at the end of a buffer.
+ */
+static void
+fletcher_4_scalar_incremental_native(const void *buf, uint64_t size,
+    zio_cksum_t *zcp)
+{
+	const uint32_t *ip = buf;
+	const uint32_t *ipend = ip + (size / sizeof (uint32_t));
+	uint64_t a, b, c, d;
+
+	a = zcp->zc_word[0];
+	b = zcp->zc_word[1];
+	c = zcp->zc_word[2];
+	d = zcp->zc_word[3];
+
+	for (; ip < ipend; ip++) {
+		a += ip[0];
+		b += a;
+		c += b;
+		d += c;
+	}
+
+	ZIO_SET_CHECKSUM(zcp, a, b, c, d);
+}
+
+static void
+fletcher_4_scalar_incremental_byteswap(const void *buf, uint64_t size,
+    zio_cksum_t *zcp)
+{
+	const uint32_t *ip = buf;
+	const uint32_t *ipend = ip + (size / sizeof (uint32_t));
+	uint64_t a, b, c, d;
+
+	a = zcp->zc_word[0];
+	b = zcp->zc_word[1];
+	c = zcp->zc_word[2];
+	d = zcp->zc_word[3];
+
+	for (; ip < ipend; ip++) {
+		a += BSWAP_32(ip[0]);
+		b += a;
+		c += b;
+		d += c;
+	}
+
+	ZIO_SET_CHECKSUM(zcp, a, b, c, d);
+}
+
+static void
+fletcher_4_scalar_native(const void *buf, uint64_t size, zio_cksum_t *zcp)
+{
+	ZIO_SET_CHECKSUM(zcp, 0, 0, 0, 0);
+	fletcher_4_scalar_incremental_native(buf, size, zcp);
+}
+
+static void
+fletcher_4_scalar_byteswap(const void *buf, uint64_t size, zio_cksum_t *zcp)
+{
+	ZIO_SET_CHECKSUM(zcp, 0, 0, 0, 0);
+	fletcher_4_scalar_incremental_byteswap(buf, size, zcp);
+}
+
+/*
+ * Fold the lanes of a vector run back into the scalar checksum, see the
+ * comment at the top of this file.
+ */
+static void
+fletcher_4_fini_2(const uint64_t *a, const uint64_t *b, const uint64_t *c,
+    const uint64_t *d, zio_cksum_t *zcp)
+{
+	ZIO_SET_CHECKSUM(zcp,
+	    a[0] + a[1],
+	    2 * (b[0] + b[1]) - a[1],
+	    4 * (c[0] + c[1]) - b[0] - 3 * b[1],
+	    8 * (d[0] + d[1]) - 4 * c[0] - 8 * c[1] + b[1]);
+}
+
+static void
+fletcher_4_fini_4(const uint64_t *a, const uint64_t *b, const uint64_t *c,
+    const uint64_t *d, zio_cksum_t *zcp)
+{
+	ZIO_SET_CHECKSUM(zcp,
+	    a[0] + a[1] + a[2] + a[3],
+	    4 * (b[0] + b[1] + b[2] + b[3]) - a[1] - 2 * a[2] - 3 * a[3],
+	    16 * (c[0] + c[1] + c[2] + c[3]) -
+	    6 * b[0] - 10 * b[1] - 14 * b[2] - 18 * b[3] + a[2] + 3 * a[3],
+	    64 * (d[0] + d[1] + d[2] + d[3]) -
+	    48 * c[0] - 64 * c[1] - 80 * c[2] - 96 * c[3] +
+	    4 * b[0] + 10 * b[1] + 20 * b[2] + 34 * b[3] - a[3]);
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+	(__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define	FLETCHER_4_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__) && defined(__aarch64__)
+#define	FLETCHER_4_NEON
+#include <arm_neon.h>
+#endif
+
+#ifdef FLETCHER_4_X86
+
+static boolean_t
+fletcher_4_cpuid(int leaf, int reg, unsigned int bit)
+{
+	unsigned int r[4];
+
+	if (__get_cpuid_max(0, NULL) < leaf)
+		return (B_FALSE);
+	__cpuid_count(leaf, 0, r[0], r[1], r[2], r[3]);
+	return ((r[reg] & bit) != 0);
+}
+
+static boolean_t
+fletcher_4_sse2_valid(void)
+{
+	return (fletcher_4_cpuid(1, 3, bit_SSE2));
+}
+
+static boolean_t
+fletcher_4_ssse3_valid(void)
+{
+	return (fletcher_4_sse2_valid() && fletcher_4_cpuid(1, 2, bit_SSSE3));
+}
+
+static boolean_t
+fletcher_4_avx2_valid(void)
+{
+	unsigned int lo, hi;
+
+	/* the OS must also save the ymm registers */
+	if (!fletcher_4_cpuid(1, 2, bit_OSXSAVE) ||
+	    !fletcher_4_cpuid(1, 2, bit_AVX) || !fletcher_4_cpuid(7, 1, 1 << 5))
+		return (B_FALSE);
+	__asm__ __volatile__("xgetbv" : "=a" (lo), "=d" (hi) : "c" (0));
+	return ((lo & 0x6) == 0x6);
+}
+
+/*
+ * Two lanes: each 16-byte load is split into two pairs of words, which are
+ * widened to 64 bits and added to the accumulators.
+ */
+#define	FLETCHER_4_SSE_STEP(v)			\
+	a = _mm_add_epi64(a, (v));		\
+	b = _mm_add_epi64(b, a);		\
+	c = _mm_add_epi64(c, b);		\
+	d = _mm_add_epi64(d, c)
+
+#define	FLETCHER_4_SSE_LOOP(swap)					\
+	const __m128i *ip = buf;					\
+	const __m128i *ipend = ip + (size / sizeof (__m128i));		\
+	__m128i zero = _mm_setzero_si128();				\
+	__m128i a = zero, b = zero, c = zero, d = zero, t;		\
+	uint64_t A[2], B[2], C[2], D[2];				\
+									\
+	for (; ip < ipend; ip++) {					\
+		t = _mm_loadu_si128(ip);				\
+		swap;							\
+		FLETCHER_4_SSE_STEP(_mm_unpacklo_epi32(t, zero));	\
+		FLETCHER_4_SSE_STEP(_mm_unpackhi_epi32(t, zero));	\
+	}								\
+									\
+	_mm_storeu_si128((__m128i *)A, a);				\
+	_mm_storeu_si128((__m128i *)B, b);				\
+	_mm_storeu_si128((__m128i *)C, c);				\
+	_mm_storeu_si128((__m128i *)D, d);				\
+	fletcher_4_fini_2(A, B, C, D, zcp)
+
+static void __attribute__((target("sse2")))
+fletcher_4_sse2_native(const void *buf, uint64_t size, zio_cksum_t *zcp)
+{
+	FLETCHER_4_SSE_LOOP(;);
+}
+
+static void __attribute__((target("sse2")))
+fletcher_4_sse2_byteswap(const void *buf, uint64_t size, zio_cksum_t *zcp)
+{
+	/* swap the bytes of each half word, then the half words */
+	FLETCHER_4_SSE_LOOP(
+	    t = _mm_or_si128(_mm_slli_epi16(t, 8), _mm_srli_epi16(t, 8));
+	    t = _mm_shufflehi_epi16(_mm_shufflelo_epi16(t, 0xb1), 0xb1));
+}
+
+static void __attribute__((target("ssse3")))
+fletcher_4_ssse3_byteswap(const void *buf, uint64_t size, zio_cksum_t *zcp)
+{
+	__m128i mask = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11,
+	    4, 5, 6, 7, 0, 1, 2, 3);
+
+	FLETCHER_4_SSE_LOOP(t = _mm_shuffle_epi8(t, mask));
+}
+
+/*
+ * Four lanes: each 16-byte load is widened to four 64-bit words at once.
+ */
+#define	FLETCHER_4_AVX2_LOOP(swap)					\
+	const __m128i *ip = buf;					\
+	const __m128i *ipend = ip + (size / sizeof (__m128i));		\
+	__m256i a, b, c, d;						\
+	__m128i t;							\
+	uint64_t A[4], B[4], C[4], D[4];				\
+									\
+	a = b = c = d = _mm256_setzero_si256();				\
+	for (; ip < ipend; ip++) {					\
+		t = _mm_loadu_si128(ip);				\
+		swap;							\
+		a = _mm256_add_epi64(a, _mm256_cvtepu32_epi64(t));	\
+		b = _mm256_add_epi64(b, a);				\
+		c = _mm256_add_epi64(c, b);				\
+		d = _mm256_add_epi64(d, c);				\
+	}								\
+									\
+	_mm256_storeu_si256((__m256i *)A, a);				\
+	_mm256_storeu_si256((__m256i *)B, b);				\
+	_mm256_storeu_si256((__m256i *)C, c);				\
+	_mm256_storeu_si256((__m256i *)D, d);				\
+	fletcher_4_fini_4(A, B, C, D, zcp)
+
+static void __attribute__((target("avx2")))
+fletcher_4_avx2_native(const void *buf, uint64_t size, zio_cksum_t *zcp)
+{
+	FLETCHER_4_AVX2_LOOP(;);
+}
+
+static void __attribute__((target("avx2")))
+fletcher_4_avx2_byteswap(const void *buf, uint64_t size, zio_cksum_t *zcp)
+{
+	__m128i mask = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11,
+	    4, 5, 6, 7, 0, 1, 2, 3);
+
+	FLETCHER_4_AVX2_LOOP(t = _mm_shuffle_epi8(t, mask));
+}
+
+#endif	/* FLETCHER_4_X86 */
+
+#ifdef FLETCHER_4_NEON
+
+static boolean_t
+fletcher_4_neon_valid(void)
+{
+	return (B_TRUE);
+}
+
+/*
+ * Two lanes, as for SSE2.
+ */
+#define	FLETCHER_4_NEON_STEP(v)			\
+	a = vaddq_u64(a, (v));			\
+	b = vaddq_u64(b, a);			\
+	c = vaddq_u64(c, b);			\
+	d = vaddq_u64(d, c)
+
+#define	FLETCHER_4_NEON_LOOP(swap)					\
+	const uint32_t *ip = buf;					\
+	const uint32_t *ipend = ip + (size / sizeof (uint32_t));	\
+	uint64x2_t a, b, c, d;						\
+	uint32x4_t t;							\
+	uint64_t A[2], B[2], C[2], D[2];				\
+									\
+	a = b = c = d = vdupq_n_u64(0);					\
+	for (; ip < ipend; ip += 4) {					\
+		t = vld1q_u32(ip);					\
+		swap;							\
+		FLETCHER_4_NEON_STEP(vmovl_u32(vget_low_u32(t)));	\
+		FLETCHER_4_NEON_STEP(vmovl_u32(vget_high_u32(t)));	\
+	}								\
+									\
+	vst1q_u64(A, a);						\
+	vst1q_u64(B, b);						\
+	vst1q_u64(C, c);						\
+	vst1q_u64(D, d);						\
+	fletcher_4_fini_2(A, B, C, D, zcp)
+
+static void
+fletcher_4_neon_native(const void *buf, uint64_t size, zio_cksum_t *zcp)
+{
+	FLETCHER_4_NEON_LOOP(;);
+}
+
+static void
+fletcher_4_neon_byteswap(const void *buf, uint64_t size, zio_cksum_t *zcp)
+{
+	FLETCHER_4_NEON_LOOP(
+	    t = vreinterpretq_u32_u8(vrev32q_u8(vreinterpretq_u8_u32(t))));
+}
+
+#endif	/* FLETCHER_4_NEON */
+
+typedef struct fletcher_4_ops {
+	const char	*fo_name;
+	boolean_t	(*fo_valid)(void);	/* NULL if always usable */
+	/* start from zero; size is a multiple of 16 except for scalar */
+	void		(*fo_native)(const void *, uint64_t, zio_cksum_t *);
+	void		(*fo_byteswap)(const void *, uint64_t, zio_cksum_t *);
+} fletcher_4_ops_t;
+
+/* indexed by FLETCHER_4_IMPL_*; NULL where not built for this machine */
+static const fletcher_4_ops_t *fletcher_4_impls[FLETCHER_4_IMPL_MAX + 1] = {
+	[FLETCHER_4_IMPL_SCALAR] = &(const fletcher_4_ops_t){ "scalar", NULL,
+	    fletcher_4_scalar_native, fletcher_4_scalar_byteswap },
+#ifdef FLETCHER_4_X86
+	[FLETCHER_4_IMPL_SSE2] = &(const fletcher_4_ops_t){ "sse2",
+	    fletcher_4_sse2_valid, fletcher_4_sse2_native,
+	    fletcher_4_sse2_byteswap },
+	[FLETCHER_4_IMPL_SSSE3] = &(const fletcher_4_ops_t){ "ssse3",
+	    fletcher_4_ssse3_valid, fletcher_4_sse2_native,
+	    fletcher_4_ssse3_byteswap },
+	[FLETCHER_4_IMPL_AVX2] = &(const fletcher_4_ops_t){ "avx2",
+	    fletcher_4_avx2_valid, fletcher_4_avx2_native,
+	    fletcher_4_avx2_byteswap },
+#endif
+#ifdef FLETCHER_4_NEON
+	[FLETCHER_4_IMPL_NEON] = &(const fletcher_4_ops_t){ "neon",
+	    fletcher_4_neon_valid, fletcher_4_neon_native,
+	    fletcher_4_neon_byteswap },
+#endif
+};
+
+/* below this the setup of the vector versions is not worth it */
+#define	FLETCHER_4_MIN_SIMD	64
+
+#define	FLETCHER_4_BENCH_SIZE	(16 << 10)
+#define	FLETCHER_4_BENCH_USEC	2000
+
+int zfs_fletcher_4_impl = FLETCHER_4_IMPL_FASTEST;
+
+static const fletcher_4_ops_t *fletcher_4_active;
+static int fletcher_4_selected;
+static int fletcher_4_fastest = FLETCHER_4_IMPL_SCALAR;
+static uint64_t fletcher_4_mbps[FLETCHER_4_IMPL_MAX + 1];	/* MB/s */
+static pthread_once_t fletcher_4_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Append the checksum zc of n words, computed from zero, to the running
+ * checksum in zcp.  Starting from a, b, c and d, n more words add n * a to
+ * b, n * b + n(n + 1)/2 * a to c, and so on.
+ */
+static void
+fletcher_4_combine(zio_cksum_t *zcp, const zio_cksum_t *zc, uint64_t n)
+{
+	uint64_t a = zcp->zc_word[0];
+	uint64_t b = zcp->zc_word[1];
+	uint64_t c = zcp->zc_word[2];
+	uint64_t d = zcp->zc_word[3];
+	uint64_t f[3] = { n, n + 1, n + 2 };
+	uint64_t n2, n3;
+
+	/* n(n + 1)/2 and n(n + 1)(n + 2)/6, dividing before multiplying */
+	n2 = (n & 1) ? n * ((n + 1) / 2) : (n / 2) * (n + 1);
+	f[n & 1] /= 2;
+	f[(3 - n % 3) % 3] /= 3;
+	n3 = f[0] * f[1] * f[2];
+
+	ZIO_SET_CHECKSUM(zcp,
+	    a + zc->zc_word[0],
+	    b + n * a + zc->zc_word[1],
+	    c + n * b + n2 * a + zc->zc_word[2],
+	    d + n * c + n2 * b + n3 * a + zc->zc_word[3]);
+}
+
+static void
+fletcher_4_run(const fletcher_4_ops_t *ops, boolean_t swap, const void *buf,
+    uint64_t size, zio_cksum_t *zcp)
+{
+	uint64_t len = 0;
+	zio_cksum_t zc;
+
+	if (ops != fletcher_4_impls[FLETCHER_4_IMPL_SCALAR] &&
+	    size >= FLETCHER_4_MIN_SIMD) {
+		len = P2ALIGN(size, 16);
+		if (swap)
+			ops->fo_byteswap(buf, len, &zc);
+		else
+			ops->fo_native(buf, len, &zc);
+		fletcher_4_combine(zcp, &zc, len / sizeof (uint32_t));
+	}
+
+	if (swap)
+		fletcher_4_scalar_incremental_byteswap((char *)buf + len,
+		    size - len, zcp);
+	else
+		fletcher_4_scalar_incremental_native((char *)buf + len,
+		    size - len, zcp);
+}
+
+static uint64_t
+fletcher_4_usec(void)
+{
+	struct timeval tv;
+
+	(void) gettimeofday(&tv, NULL);
+	return (tv.tv_sec * 1000000ULL + tv.tv_usec);
+}
+
+/*
+ * Check every version this CPU can run against the scalar one, both ways
+ * and with a tail the vector code doesn't cover, and time the good ones.
+ */
+static void
+fletcher_4_benchmark(void)
+{
+	const fletcher_4_ops_t *scalar = fletcher_4_impls[FLETCHER_4_IMPL_SCALAR];
+	uint32_t *buf;
+	uint64_t start, now, bytes, best = 0;
+	zio_cksum_t ref[2], zc;
+	int i, s;
+
+	if ((buf = malloc(FLETCHER_4_BENCH_SIZE)) == NULL)
+		return;
+	for (i = 0; i < FLETCHER_4_BENCH_SIZE / sizeof (uint32_t); i++)
+		buf[i] = 0x9e3779b9 * (i + 1);
+
+	for (s = 0; s < 2; s++) {
+		ZIO_SET_CHECKSUM(&ref[s], 0, 0, 0, 0);
+		fletcher_4_run(scalar, s, buf, FLETCHER_4_BENCH_SIZE - 12,
+		    &ref[s]);
+	}
+
+	for (i = FLETCHER_4_IMPL_SCALAR; i <= FLETCHER_4_IMPL_MAX; i++) {
+		const fletcher_4_ops_t *ops = fletcher_4_impls[i];
+
+		if (ops == NULL || (ops->fo_valid != NULL && !ops->fo_valid()))
+			continue;
+
+		for (s = 0; s < 2; s++) {
+			ZIO_SET_CHECKSUM(&zc, 0, 0, 0, 0);
+			fletcher_4_run(ops, s, buf, FLETCHER_4_BENCH_SIZE - 12,
+			    &zc);
+			if (!ZIO_CHECKSUM_EQUAL(zc, ref[s]))
+				break;
+		}
+		if (s < 2)
+			continue;
+
+		bytes = 0;
+		start = fletcher_4_usec();
+		do {
+			fletcher_4_run(ops, B_FALSE, buf,
+			    FLETCHER_4_BENCH_SIZE, &zc);
+			fletcher_4_run(ops, B_TRUE, buf,
+			    FLETCHER_4_BENCH_SIZE, &zc);
+			bytes += 2 * FLETCHER_4_BENCH_SIZE;
+		} while ((now = fletcher_4_usec()) - start <
+		    FLETCHER_4_BENCH_USEC);
+
+		/* bytes per usec is MB/s, near enough */
+		fletcher_4_mbps[i] = MAX(bytes / (now - start), 1);
+		if (fletcher_4_mbps[i] > best) {
+			best = fletcher_4_mbps[i];
+			fletcher_4_fastest = i;
+		}
+	}
+
+	free(buf);
+}
+
+#ifdef _KERNEL
+static kstat_t *fletcher_4_ksp;
+static kstat_named_t fletcher_4_kstat[2 + FLETCHER_4_IMPL_MAX];
+#endif
+
+/*
+ * Switch to the version asked for in zfs_fletcher_4_impl, or to the fastest
+ * one.  Fails if that version can't run here.
+ */
+int
+fletcher_4_impl_update(void)
+{
+	int impl = zfs_fletcher_4_impl;
+
+	(void) pthread_once(&fletcher_4_once, fletcher_4_benchmark);
+
+	if (impl == FLETCHER_4_IMPL_FASTEST)
+		impl = fletcher_4_fastest;
+	if (impl < 0 || impl > FLETCHER_4_IMPL_MAX ||
+	    fletcher_4_mbps[impl] == 0)
+		return (EINVAL);
+
+	fletcher_4_selected = impl;
+	fletcher_4_active = fletcher_4_impls[impl];
+#ifdef _KERNEL
+	fletcher_4_kstat[0].value.ui64 = impl;
+#endif
+	return (0);
+}
+
+static const fletcher_4_ops_t *
+fletcher_4_ops(void)
+{
+	const fletcher_4_ops_t *ops = fletcher_4_active;
+
+	if (ops == NULL) {
+		if (fletcher_4_impl_update() != 0) {
+			zfs_fletcher_4_impl = FLETCHER_4_IMPL_FASTEST;
+			(void) fletcher_4_impl_update();
+		}
+		ops = fletcher_4_active;
+	}
+	return (ops);
+}
+
+/*
+ * Pick the fletcher-4 version now rather than at the first checksum, and
+ * publish the timings in the zfs::fletcher_4_bench kstat: "selected" is the
+ * version in use, "fastest" the one picked when zfs_fletcher_4_impl is 0,
+ * and every version this build has gets its speed in MB/s, 0 if this CPU
+ * can't run it.  Numbers are the FLETCHER_4_IMPL_* values.
+ */
+void
+fletcher_4_init(void)
+{
+	(void) fletcher_4_ops();
+
+#ifdef _KERNEL
+	kstat_named_t *knp = fletcher_4_kstat;
+	int i;
+
+	(void) strlcpy(knp->name, "selected", KSTAT_STRLEN);
+	knp->data_type = KSTAT_DATA_UINT64;
+	knp->value.ui64 = fletcher_4_selected;
+	knp++;
+	(void) strlcpy(knp->name, "fastest", KSTAT_STRLEN);
+	knp->data_type = KSTAT_DATA_UINT64;
+	knp->value.ui64 = fletcher_4_fastest;
+	knp++;
+	for (i = FLETCHER_4_IMPL_SCALAR; i <= FLETCHER_4_IMPL_MAX; i++) {
+		if (fletcher_4_impls[i] == NULL)
+			continue;
+		(void) strlcpy(knp->name, fletcher_4_impls[i]->fo_name,
+		    KSTAT_STRLEN);
+		knp->data_type = KSTAT_DATA_UINT64;
+		knp->value.ui64 = fletcher_4_mbps[i];
+		knp++;
+	}
+
+	fletcher_4_ksp = kstat_create("zfs", 0, "fletcher_4_bench", "misc",
+	    KSTAT_TYPE_NAMED, knp - fletcher_4_kstat, KSTAT_FLAG_VIRTUAL);
+	if (fletcher_4_ksp != NULL) {
+		fletcher_4_ksp->ks_data = fletcher_4_kstat;
+		kstat_install(fletcher_4_ksp);
+	}
+#endif
+}
+
+void
+fletcher_4_fini(void)
+{
+#ifdef _KERNEL
+	if (fletcher_4_ksp != NULL) {
+		kstat_delete(fletcher_4_ksp);
+		fletcher_4_ksp = NULL;
+	}
+#endif
+}
+
+void
+fletcher_4_native(const void *buf, uint64_t size, zio_cksum_t *zcp)
+{
+	ZIO_SET_CHECKSUM(zcp, 0, 0, 0, 0);
+	fletcher_4_run(fletcher_4_ops(), B_FALSE, buf, size, zcp);
+}
+
+void
+fletcher_4_byteswap(const void *buf, uint64_t size, zio_cksum_t *zcp)
+{
+	ZIO_SET_CHECKSUM(zcp, 0, 0, 0, 0);
+	fletcher_4_run(fletcher_4_ops(), B_TRUE, buf, size, zcp);
+}
+
+void
+fletcher_4_incremental_native(const void *buf, uint64_t size,
+    zio_cksum_t *zcp)
+{
+	fletcher_4_run(fletcher_4_ops(), B_FALSE, buf, size, zcp);
+}
+
+void
+fletcher_4_incremental_byteswap(const void *buf, uint64_t size,
+    zio_cksum_t *zcp)
+{
+	fletcher_4_run(fletcher_4_ops(), B_TRUE, buf, size, zcp);
+}
@@ -88,7 +88,7 @@ zpool_prop_init(void)
 	    ZFS_TYPE_POOL, "<1.00x or higher if deduped>", "DEDUP");
 
 	/* default number properties */
-	register_number(ZPOOL_PROP_VERSION, "version", SPA_VERSION,
+	register_number(ZPOOL_PROP_VERSION, "version", SPA_VERSION_DEFAULT,
 	    PROP_DEFAULT, ZFS_TYPE_POOL, "<version>", "VERSION");
 	register_number(ZPOOL_PROP_DEDUPDITTO, "dedupditto", 0,
 	    PROP_DEFAULT, ZFS_TYPE_POOL, "<threshold (min 100)>", "DEDUPDITTO");
@@ -119,6 +119,7 @@
 
 #include <sys/spa.h>
 #include <sys/zio.h>
+#include <sys/zio_compress.h>
 #include <sys/zfs_context.h>
 #include <sys/arc.h>
 #include <sys/refcount.h>
@@ -184,6 +185,8 @@ uint64_t zfs_arc_meta_limit = 0;
 int zfs_arc_grow_retry = 0;
 int zfs_arc_shrink_shift = 0;
 int zfs_arc_p_min_shift = 0;
+int zfs_arc_sublists = 0;	/* 0: two per CPU, from 4 up to 64 */
+int zfs_arc_compressed = 0;	/* keep compressed blocks compressed */
 
 /*
  * Note that buffers can be in one of 6 states:
@@ -217,11 +220,46 @@ int zfs_arc_p_min_shift = 0;
  * second level ARC benefit from these fast lookups.
  */
 
+/*
+ * ZFSFUSE: the evictable buffers of a state are spread over arc_sublists
+ * sublists, each with its own lock, so that threads taking and dropping
+ * references to cached buffers do not all serialize on a single state
+ * mutex.  Every header belongs to the same sublist in all states
+ * (b_sublist), so moving it between the lists of two states only ever
+ * needs the two locks of that sublist, always taken in the order: live
+ * state, then ghost state, then arc_l2c_only.  Each sublist is kept in
+ * LRU order by itself; the eviction code approximates a global LRU by
+ * taking an even share from the tail of every sublist.
+ */
+
+/*
+ * ZFSFUSE: compressed ARC.  With zfs_arc_compressed set, blocks that are
+ * compressed on disk are read raw, and the header keeps that compressed
+ * copy (b_cdata, b_psize bytes) next to the usual uncompressed arc_buf.
+ * When eviction reaches an unreferenced header that has one, only the
+ * uncompressed copy goes: the header moves back to the head of its list
+ * holding nothing but b_cdata.  A read hitting such a header decompresses
+ * a fresh arc_buf from it; the header goes to the ghost state only when
+ * eviction reaches it a second time.  The size of a header in a state is
+ * thus b_datacnt * b_size plus b_psize if it has a compressed copy
+ * (HDR_RESIDENT_SIZE()).  Compressed copies are dropped whenever the
+ * header leaves for a ghost or the anonymous state.
+ */
+#define	ARC_SUBLIST_PAD	64
+
+typedef struct arc_sublist {
+	kmutex_t asl_mtx;
+	list_t	asl_list[ARC_BUFC_NUMTYPES];	/* evictable buffers */
+	unsigned char asl_pad[ARC_SUBLIST_PAD -
+	    (sizeof (kmutex_t) + ARC_BUFC_NUMTYPES * sizeof (list_t)) %
+	    ARC_SUBLIST_PAD];
+} arc_sublist_t;
+
 typedef struct arc_state {
-	list_t	arcs_list[ARC_BUFC_NUMTYPES];	/* list of evictable buffers */
+	arc_sublist_t *arcs_sublists;	/* arc_sublists evictable lists */
+	uint32_t arcs_evict_next[ARC_BUFC_NUMTYPES];	/* eviction rotor */
 	uint64_t arcs_lsize[ARC_BUFC_NUMTYPES];	/* amount of evictable data */
 	uint64_t arcs_size;	/* total amount of data in this state */
-	kmutex_t arcs_mtx;
 } arc_state_t;
 
 /* The 6 states: */
@@ -286,6 +324,18 @@ typedef struct arc_stats {
 	kstat_named_t arcstat_l2_size;
 	kstat_named_t arcstat_l2_hdr_size;
 	kstat_named_t arcstat_memory_throttle_count;
+	kstat_named_t arcstat_sublists;
+	kstat_named_t arcstat_sublist_contended;
+	kstat_named_t arcstat_sublist_wait_ns;
+	kstat_named_t arcstat_compressed_size;
+	kstat_named_t arcstat_uncompressed_size;
+	kstat_named_t arcstat_compressed_hits;
+	kstat_named_t arcstat_compressed_demoted;
+	kstat_named_t arcstat_l2_log_blk_writes;
+	kstat_named_t arcstat_l2_rebuild_log_blks;
+	kstat_named_t arcstat_l2_rebuild_bufs;
+	kstat_named_t arcstat_l2_rebuild_bufs_precached;
+	kstat_named_t arcstat_l2_rebuild_abort_lowmem;
 } arc_stats_t;
 
 static arc_stats_t arc_stats = {
@@ -341,7 +391,19 @@ static arc_stats_t arc_stats = {
 	{ "l2_io_error",		KSTAT_DATA_UINT64 },
 	{ "l2_size",			KSTAT_DATA_UINT64 },
 	{ "l2_hdr_size",		KSTAT_DATA_UINT64 },
-	{ "memory_throttle_count",	KSTAT_DATA_UINT64 }
+	{ "memory_throttle_count",	KSTAT_DATA_UINT64 },
+	{ "sublists",			KSTAT_DATA_UINT64 },
+	{ "sublist_contended",		KSTAT_DATA_UINT64 },
+	{ "sublist_wait_ns",		KSTAT_DATA_UINT64 },
+	{ "compressed_size",		KSTAT_DATA_UINT64 },
+	{ "uncompressed_size",		KSTAT_DATA_UINT64 },
+	{ "compressed_hits",		KSTAT_DATA_UINT64 },
+	{ "compressed_demoted",		KSTAT_DATA_UINT64 },
+	{ "l2_log_blk_writes",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_log_blks",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_bufs",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_bufs_precached",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_abort_lowmem",	KSTAT_DATA_UINT64 }
 };
 
 #define	ARCSTAT(stat)	(arc_stats.stat.value.ui64)
@@ -405,6 +467,17 @@ static arc_state_t	*arc_l2c_only;
 #define	arc_c_max	ARCSTAT(arcstat_c_max)	/* max target cache size */
 
 static int		arc_no_grow;	/* Don't try to grow cache size */
+#ifdef _KERNEL
+/*
+ * ZFSFUSE: our stand-ins for lotsfree and needfree, in bytes, and the
+ * reclaim verdict arc_mem_update() last came to.
+ */
+static uint64_t		arc_lotsfree;
+static uint64_t		arc_needfree;
+static int		arc_mem_short;
+#endif
+static uint32_t		arc_sublists;	/* sublists per state */
+static uint32_t		arc_sublist_rotor; /* for hdr_cons() */
 static uint64_t		arc_tempreserve;
 static uint64_t		arc_loaned_bytes;
 static uint64_t		arc_meta_used;
@@ -436,7 +509,8 @@ struct arc_buf_hdr {
 	/* protected by hash lock */
 	dva_t			b_dva;
 	uint64_t		b_birth;
-	uint64_t		b_cksum0;
+	zio_cksum_t		b_cksum;
+	uint64_t		b_blkprop;	/* blk_prop, 0 if unknown */
 
 	kmutex_t		b_freeze_lock;
 	zio_cksum_t		*b_freeze_cksum;
@@ -449,15 +523,23 @@ struct arc_buf_hdr {
 	arc_callback_t		*b_acb;
 	kcondvar_t		b_cv;
 
+	/* compressed copy, see above; protected by hash lock */
+	void			*b_cdata;
+	uint32_t		b_psize;
+	uint8_t			b_compress;
+
 	/* immutable */
 	arc_buf_contents_t	b_type;
 	uint64_t		b_size;
 	uint64_t		b_spa;
 
-	/* protected by arc state mutex */
+	/* protected by arc state sublist mutex */
 	arc_state_t		*b_state;
 	list_node_t		b_arc_node;
 
+	/* immutable, set by the constructor */
+	uint32_t		b_sublist;
+
 	/* updated atomically */
 	clock_t			b_arc_access;
 
@@ -482,6 +564,10 @@ static boolean_t l2arc_write_eligible(uint64_t spa_guid, arc_buf_hdr_t *ab);
 	((state) == arc_mru_ghost || (state) == arc_mfu_ghost ||	\
 	(state) == arc_l2c_only)
 
+#define	HDR_RESIDENT_SIZE(ab)	\
+	((ab)->b_datacnt * (ab)->b_size +	\
+	((ab)->b_cdata != NULL ? (ab)->b_psize : 0))
+
 /*
  * Private ARC flags.  These flags are private ARC only flags that will show up
  * in b_flags in the arc_hdr_buf_t.  Some flags are publicly declared, and can
@@ -576,8 +662,81 @@ uint64_t l2arc_feed_min_ms = L2ARC_FEED_MIN_MS;	/* min interval milliseconds */
 boolean_t l2arc_noprefetch = B_TRUE;		/* don't cache prefetch bufs */
 boolean_t l2arc_feed_again = B_TRUE;		/* turbo warmup */
 boolean_t l2arc_norw = B_TRUE;			/* no reads during writes */
+boolean_t l2arc_rebuild_enabled = B_TRUE;	/* reload devices on import */
 uint64_t max_arc_size = 0;
 
+/*
+ * ZFSFUSE: persistent L2ARC.  So that a cache device does not come back
+ * cold after a restart or an export, its contents are described on the
+ * device itself:
+ *
+ *  - every feed pass ends with one or more log blocks, written right
+ *    after the buffers of the pass, listing what was written where.
+ *    Each log block points back to the one written before it.
+ *  - the device header, in the first block after the front labels, points
+ *    to the newest log block and records the write hand.  It is rewritten
+ *    after every pass that completed without errors.
+ *
+ * When a device is added (pool import or zpool add), l2arc_rebuild_thread()
+ * walks the log blocks from the newest backwards and recreates an
+ * arc_l2c_only header for every buffer that has not been overwritten
+ * since.  The feed thread leaves the device alone until it is done.
+ * The walk stops at the first log block that does not checksum, points
+ * the wrong way or lies where the device has been written over again;
+ * buffers are checked against their checksum when they are read anyway,
+ * so a stale entry costs a read from the pool, not bad data.
+ *
+ * The on-disk structures are in host byte order; a device moved to a host
+ * of the other endianness just starts empty.
+ */
+#define	L2ARC_DEV_HDR_MAGIC	0x4c32415243646576ULL	/* "L2ARCdev" */
+#define	L2ARC_LOG_BLK_MAGIC	0x4c324152436c6f67ULL	/* "L2ARClog" */
+#define	L2ARC_DEV_HDR_VERSION	1
+#define	L2ARC_DEV_HDR_FIRST	0x1	/* still on the first sweep */
+#define	L2ARC_DEV_HDR_SIZE	SPA_MINBLOCKSIZE
+#define	L2ARC_LOG_BLK_ENTRIES	1024
+
+typedef struct l2arc_log_ptr {
+	uint64_t	lp_daddr;	/* device address, 0 if none */
+	uint64_t	lp_psize;	/* bytes written */
+	zio_cksum_t	lp_cksum;	/* fletcher4 of those bytes */
+} l2arc_log_ptr_t;
+
+typedef struct l2arc_dev_hdr_phys {
+	uint64_t	dh_magic;
+	uint64_t	dh_version;
+	uint64_t	dh_spa_guid;
+	uint64_t	dh_vdev_guid;
+	uint64_t	dh_start;	/* l2ad_start and l2ad_end, so that */
+	uint64_t	dh_end;		/* a resized device starts empty */
+	uint64_t	dh_hand;
+	uint64_t	dh_evict;
+	uint64_t	dh_flags;
+	l2arc_log_ptr_t	dh_log;		/* newest log block */
+	zio_cksum_t	dh_cksum;	/* fletcher4 of the fields above */
+} l2arc_dev_hdr_phys_t;
+
+typedef struct l2arc_log_ent_phys {
+	dva_t		le_dva;
+	uint64_t	le_birth;
+	uint64_t	le_cksum0;
+	uint64_t	le_size;
+	uint64_t	le_type;	/* arc_buf_contents_t */
+	uint64_t	le_daddr;
+	zio_cksum_t	le_freeze_cksum; /* checked by l2arc_read_done() */
+} l2arc_log_ent_phys_t;
+
+typedef struct l2arc_log_blk_phys {
+	uint64_t	lb_magic;
+	uint64_t	lb_nents;
+	l2arc_log_ptr_t	lb_prev;	/* the log block written before */
+	l2arc_log_ent_phys_t lb_entries[L2ARC_LOG_BLK_ENTRIES];
+} l2arc_log_blk_phys_t;
+
+/* bytes written for a log block of n entries */
+#define	L2ARC_LOG_BLK_PSIZE(n)	P2ROUNDUP(offsetof(l2arc_log_blk_phys_t, \
+	lb_entries) + (n) * sizeof (l2arc_log_ent_phys_t), SPA_MINBLOCKSIZE)
+
 /*
  * L2ARC Internals
  */
@@ -594,6 +753,9 @@ typedef struct l2arc_dev {
 	boolean_t		l2ad_writing;	/* currently writing */
 	list_t			*l2ad_buflist;	/* buffer list */
 	list_node_t		l2ad_node;	/* device list node */
+	l2arc_log_ptr_t		l2ad_log;	/* newest log block on the device */
+	boolean_t		l2ad_rebuild;	/* being rebuilt, don't write */
+	boolean_t		l2ad_rebuild_cancel; /* device is going away */
 } l2arc_dev_t;
 
 static list_t L2ARC_dev_list;			/* device list */
@@ -605,6 +767,7 @@ static list_t L2ARC_free_on_write;		/* free after write buf list */
 static list_t *l2arc_free_on_write;		/* free after write list ptr */
 static kmutex_t l2arc_free_on_write_mtx;	/* mutex for list */
 static uint64_t l2arc_ndev;			/* number of devices */
+static uint32_t l2arc_sublist_next;		/* sublist feed rotor */
 
 typedef struct l2arc_read_callback {
 	arc_buf_t	*l2rcb_buf;		/* read buffer */
@@ -617,6 +780,7 @@ typedef struct l2arc_read_callback {
 typedef struct l2arc_write_callback {
 	l2arc_dev_t	*l2wcb_dev;		/* device info */
 	arc_buf_hdr_t	*l2wcb_head;		/* head of write buflist */
+	l2arc_log_ptr_t	l2wcb_log;		/* newest log block written */
 } l2arc_write_callback_t;
 
 struct l2arc_buf_hdr {
@@ -636,6 +800,7 @@ typedef struct l2arc_data_free {
 static kmutex_t l2arc_feed_thr_lock;
 static kcondvar_t l2arc_feed_thr_cv;
 static uint8_t l2arc_thread_exit;
+static kcondvar_t l2arc_rebuild_cv;		/* a rebuild has finished */
 
 static void l2arc_read_done(zio_t *zio);
 static void l2arc_hdr_stat_add(void);
@@ -786,6 +951,7 @@ hdr_cons(void *vbuf, void *unused, int kmflag)
 	arc_buf_hdr_t *buf = vbuf;
 
 	bzero(buf, sizeof (arc_buf_hdr_t));
+	buf->b_sublist = atomic_inc_32_nv(&arc_sublist_rotor) % arc_sublists;
 	refcount_create(&buf->b_refcnt);
 	cv_init(&buf->b_cv, NULL, CV_DEFAULT, NULL);
 	mutex_init(&buf->b_freeze_lock, NULL, MUTEX_DEFAULT, NULL);
@@ -972,6 +1138,25 @@ arc_buf_freeze(arc_buf_t *buf)
 	arc_cksum_compute(buf, B_FALSE);
 }
 
+#define	ARC_SUBLIST(state, ab)	\
+	(&(state)->arcs_sublists[(ab)->b_sublist])
+
+/*
+ * Lock a state sublist, counting how often somebody else had it and how
+ * long we waited for it then.
+ */
+static void
+arc_sublist_enter(arc_sublist_t *sl)
+{
+	if (!mutex_tryenter(&sl->asl_mtx)) {
+		hrtime_t start = gethrtime();
+
+		mutex_enter(&sl->asl_mtx);
+		ARCSTAT_BUMP(arcstat_sublist_contended);
+		ARCSTAT_INCR(arcstat_sublist_wait_ns, gethrtime() - start);
+	}
+}
+
 static void
 add_reference(arc_buf_hdr_t *ab, kmutex_t *hash_lock, void *tag)
 {
@@ -979,12 +1164,13 @@ add_reference(arc_buf_hdr_t *ab, kmutex_t *hash_lock, void *tag)
 
 	if ((refcount_add(&ab->b_refcnt, tag) == 1) &&
 	    (ab->b_state != arc_anon)) {
-		uint64_t delta = ab->b_size * ab->b_datacnt;
-		list_t *list = &ab->b_state->arcs_list[ab->b_type];
+		uint64_t delta = HDR_RESIDENT_SIZE(ab);
+		arc_sublist_t *sl = ARC_SUBLIST(ab->b_state, ab);
+		list_t *list = &sl->asl_list[ab->b_type];
 		uint64_t *size = &ab->b_state->arcs_lsize[ab->b_type];
 
-		ASSERT(!MUTEX_HELD(&ab->b_state->arcs_mtx));
-		mutex_enter(&ab->b_state->arcs_mtx);
+		ASSERT(!MUTEX_HELD(&sl->asl_mtx));
+		arc_sublist_enter(sl);
 		ASSERT(list_link_active(&ab->b_arc_node));
 		list_remove(list, ab);
 		if (GHOST_STATE(ab->b_state)) {
@@ -995,7 +1181,7 @@ add_reference(arc_buf_hdr_t *ab, kmutex_t *hash_lock, void *tag)
 		ASSERT(delta > 0);
 		ASSERT3U(*size, >=, delta);
 		atomic_add_64(size, -delta);
-		mutex_exit(&ab->b_state->arcs_mtx);
+		mutex_exit(&sl->asl_mtx);
 		/* remove the prefetch flag if we get a reference */
 		if (ab->b_flags & ARC_PREFETCH)
 			ab->b_flags &= ~ARC_PREFETCH;
@@ -1013,19 +1199,92 @@ remove_reference(arc_buf_hdr_t *ab, kmutex_t *hash_lock, void *tag)
 
 	if (((cnt = refcount_remove(&ab->b_refcnt, tag)) == 0) &&
 	    (state != arc_anon)) {
+		arc_sublist_t *sl = ARC_SUBLIST(state, ab);
 		uint64_t *size = &state->arcs_lsize[ab->b_type];
 
-		ASSERT(!MUTEX_HELD(&state->arcs_mtx));
-		mutex_enter(&state->arcs_mtx);
+		ASSERT(!MUTEX_HELD(&sl->asl_mtx));
+		arc_sublist_enter(sl);
 		ASSERT(!list_link_active(&ab->b_arc_node));
-		list_insert_head(&state->arcs_list[ab->b_type], ab);
+		list_insert_head(&sl->asl_list[ab->b_type], ab);
 		ASSERT(ab->b_datacnt > 0);
-		atomic_add_64(size, ab->b_size * ab->b_datacnt);
-		mutex_exit(&state->arcs_mtx);
+		atomic_add_64(size, HDR_RESIDENT_SIZE(ab));
+		mutex_exit(&sl->asl_mtx);
 	}
 	return (cnt);
 }
 
+static void
+arc_cdata_free(arc_buf_contents_t type, void *cdata, uint64_t psize)
+{
+	if (type == ARC_BUFC_METADATA)
+		zio_buf_free(cdata, psize);
+	else
+		zio_data_buf_free(cdata, psize);
+}
+
+/*
+ * Give a header the compressed copy of its block, or take it away again.
+ * The copy counts towards the size of the header's state and the arc.
+ */
+static void
+arc_hdr_set_cdata(arc_buf_hdr_t *ab, void *cdata, uint32_t psize,
+    enum zio_compress compress)
+{
+	arc_state_t *state = ab->b_state;
+
+	ASSERT(ab->b_cdata == NULL);
+	ASSERT(!GHOST_STATE(state));
+	ASSERT3U(psize, <, ab->b_size);
+
+	ab->b_cdata = cdata;
+	ab->b_psize = psize;
+	ab->b_compress = compress;
+
+	if (ab->b_type == ARC_BUFC_METADATA) {
+		arc_space_consume(psize, ARC_SPACE_DATA);
+	} else {
+		ARCSTAT_INCR(arcstat_data_size, psize);
+		atomic_add_64(&arc_size, psize);
+	}
+	ARCSTAT_INCR(arcstat_compressed_size, psize);
+	ARCSTAT_INCR(arcstat_uncompressed_size, ab->b_size);
+
+	atomic_add_64(&state->arcs_size, psize);
+	if (list_link_active(&ab->b_arc_node))
+		atomic_add_64(&state->arcs_lsize[ab->b_type], psize);
+}
+
+static void
+arc_hdr_free_cdata(arc_buf_hdr_t *ab)
+{
+	arc_state_t *state = ab->b_state;
+	uint64_t psize = ab->b_psize;
+
+	ASSERT(ab->b_cdata != NULL);
+
+	if (list_link_active(&ab->b_arc_node)) {
+		uint64_t *size = &state->arcs_lsize[ab->b_type];
+
+		ASSERT3U(*size, >=, psize);
+		atomic_add_64(size, -psize);
+	}
+	ASSERT3U(state->arcs_size, >=, psize);
+	atomic_add_64(&state->arcs_size, -psize);
+
+	arc_cdata_free(ab->b_type, ab->b_cdata, psize);
+	if (ab->b_type == ARC_BUFC_METADATA) {
+		arc_space_return(psize, ARC_SPACE_DATA);
+	} else {
+		ARCSTAT_INCR(arcstat_data_size, -psize);
+		atomic_add_64(&arc_size, -psize);
+	}
+	ARCSTAT_INCR(arcstat_compressed_size, -psize);
+	ARCSTAT_INCR(arcstat_uncompressed_size, -ab->b_size);
+
+	ab->b_cdata = NULL;
+	ab->b_psize = 0;
+}
+
 /*
  * Move the supplied buffer to the indicated state.  The mutex
  * for the buffer must be held by the caller.
@@ -1044,7 +1303,12 @@ arc_change_state(arc_state_t *new_state, arc_buf_hdr_t *ab, kmutex_t *hash_lock)
 	ASSERT(ab->b_datacnt <= 1 || new_state != arc_anon);
 	ASSERT(ab->b_datacnt <= 1 || old_state != arc_anon);
 
-	from_delta = to_delta = ab->b_datacnt * ab->b_size;
+	/* only cached headers keep a compressed copy */
+	if (ab->b_cdata != NULL &&
+	    (GHOST_STATE(new_state) || new_state == arc_anon))
+		arc_hdr_free_cdata(ab);
+
+	from_delta = to_delta = HDR_RESIDENT_SIZE(ab);
 
 	/*
 	 * If this buffer is evictable, transfer it from the
@@ -1052,14 +1316,15 @@ arc_change_state(arc_state_t *new_state, arc_buf_hdr_t *ab, kmutex_t *hash_lock)
 	 */
 	if (refcnt == 0) {
 		if (old_state != arc_anon) {
-			int use_mutex = !MUTEX_HELD(&old_state->arcs_mtx);
+			arc_sublist_t *sl = ARC_SUBLIST(old_state, ab);
+			int use_mutex = !MUTEX_HELD(&sl->asl_mtx);
 			uint64_t *size = &old_state->arcs_lsize[ab->b_type];
 
 			if (use_mutex)
-				mutex_enter(&old_state->arcs_mtx);
+				arc_sublist_enter(sl);
 
 			ASSERT(list_link_active(&ab->b_arc_node));
-			list_remove(&old_state->arcs_list[ab->b_type], ab);
+			list_remove(&sl->asl_list[ab->b_type], ab);
 
 			/*
 			 * If prefetching out of the ghost cache,
@@ -1074,16 +1339,17 @@ arc_change_state(arc_state_t *new_state, arc_buf_hdr_t *ab, kmutex_t *hash_lock)
 			atomic_add_64(size, -from_delta);
 
 			if (use_mutex)
-				mutex_exit(&old_state->arcs_mtx);
+				mutex_exit(&sl->asl_mtx);
 		}
 		if (new_state != arc_anon) {
-			int use_mutex = !MUTEX_HELD(&new_state->arcs_mtx);
+			arc_sublist_t *sl = ARC_SUBLIST(new_state, ab);
+			int use_mutex = !MUTEX_HELD(&sl->asl_mtx);
 			uint64_t *size = &new_state->arcs_lsize[ab->b_type];
 
 			if (use_mutex)
-				mutex_enter(&new_state->arcs_mtx);
+				arc_sublist_enter(sl);
 
-			list_insert_head(&new_state->arcs_list[ab->b_type], ab);
+			list_insert_head(&sl->asl_list[ab->b_type], ab);
 
 			/* ghost elements have a ghost size */
 			if (GHOST_STATE(new_state)) {
@@ -1094,7 +1360,7 @@ arc_change_state(arc_state_t *new_state, arc_buf_hdr_t *ab, kmutex_t *hash_lock)
 			atomic_add_64(size, to_delta);
 
 			if (use_mutex)
-				mutex_exit(&new_state->arcs_mtx);
+				mutex_exit(&sl->asl_mtx);
 		}
 	}
 
@@ -1431,7 +1697,8 @@ arc_hdr_destroy(arc_buf_hdr_t *hdr)
 		ASSERT(!HDR_IN_HASH_TABLE(hdr));
 		bzero(&hdr->b_dva, sizeof (dva_t));
 		hdr->b_birth = 0;
-		hdr->b_cksum0 = 0;
+		bzero(&hdr->b_cksum, sizeof (zio_cksum_t));
+		hdr->b_blkprop = 0;
 	}
 	while (hdr->b_buf) {
 		arc_buf_t *buf = hdr->b_buf;
@@ -1459,6 +1726,7 @@ arc_hdr_destroy(arc_buf_hdr_t *hdr)
 	ASSERT(!list_link_active(&hdr->b_arc_node));
 	ASSERT3P(hdr->b_hash_next, ==, NULL);
 	ASSERT3P(hdr->b_acb, ==, NULL);
+	ASSERT3P(hdr->b_cdata, ==, NULL);
 	kmem_cache_free(hdr_cache, hdr);
 }
 
@@ -1547,69 +1815,83 @@ arc_buf_size(arc_buf_t *buf)
 }
 
 /*
- * Evict buffers from list until we've removed the specified number of
- * bytes.  Move the removed buffers to the appropriate evict state.
- * If the recycle flag is set, then attempt to "recycle" a buffer:
- * - look for a buffer to evict that is `bytes' long.
- * - return the data block from this buffer rather than freeing it.
- * This flag is used by callers that are trying to make space for a
- * new buffer in a full arc cache.
+ * How much the i'th sublist visited by an eviction pass should give up to
+ * bring the bytes done so far up to the bytes wanted: an even share of
+ * what is left among the sublists not yet visited.  Negative means all.
+ */
+static int64_t
+arc_evict_share(int64_t bytes, uint64_t done, int i)
+{
+	if (bytes < 0)
+		return (-1);
+	return (MAX((bytes - (int64_t)done) / (int64_t)(arc_sublists - i), 1));
+}
+
+/*
+ * Evict buffers from the tail of one sublist of a state until we've
+ * removed the specified number of bytes, and move them to the same
+ * sublist of evicted_state.  If recycle_sz is non-zero, the data block
+ * of the first evicted buffer that is recycle_sz long is returned in
+ * *stolenp rather than freed.
  *
- * This function makes a "best effort".  It skips over any buffers
- * it can't get a hash_lock on, and so may not catch all candidates.
- * It may also return without evicting as much space as requested.
+ * A header with a compressed copy only loses its uncompressed buffers
+ * the first time round, and is put back at the head of the list; when
+ * a flush (bytes < 0) or a later pass finds it that way it goes to
+ * evicted_state like any other.
  */
-static void *
-arc_evict(arc_state_t *state, uint64_t spa, int64_t bytes, boolean_t recycle,
-    arc_buf_contents_t type)
+static uint64_t
+arc_evict_sublist(arc_state_t *state, arc_state_t *evicted_state, int idx,
+    uint64_t spa, int64_t bytes, uint64_t recycle_sz, void **stolenp,
+    arc_buf_contents_t type, uint64_t *skippedp, uint64_t *missedp)
 {
-	arc_state_t *evicted_state;
-	uint64_t bytes_evicted = 0, skipped = 0, missed = 0;
-	arc_buf_hdr_t *ab, *ab_prev = NULL;
-	list_t *list = &state->arcs_list[type];
+	arc_sublist_t *sl = &state->arcs_sublists[idx];
+	list_t *list = &sl->asl_list[type];
+	uint64_t bytes_evicted = 0;
+	arc_buf_hdr_t *ab, *ab_prev = NULL, *demoted = NULL;
 	kmutex_t *hash_lock;
 	boolean_t have_lock;
 	void *stolen = NULL;
 
-	ASSERT(state == arc_mru || state == arc_mfu);
-
-	evicted_state = (state == arc_mru) ? arc_mru_ghost : arc_mfu_ghost;
-
-	mutex_enter(&state->arcs_mtx);
-	mutex_enter(&evicted_state->arcs_mtx);
+	mutex_enter(&sl->asl_mtx);
+	mutex_enter(&evicted_state->arcs_sublists[idx].asl_mtx);
 
 	for (ab = list_tail(list); ab; ab = ab_prev) {
+		/* the rest of the list was demoted by this very pass */
+		if (ab == demoted)
+			break;
 		ab_prev = list_prev(list, ab);
 		/* prefetch buffers have a minimum lifespan */
 		if (HDR_IO_IN_PROGRESS(ab) ||
 		    (spa && ab->b_spa != spa) ||
 		    (ab->b_flags & (ARC_PREFETCH|ARC_INDIRECT) &&
 		    lbolt - ab->b_arc_access < arc_min_prefetch_lifespan)) {
-			skipped++;
+			*skippedp += 1;
 			continue;
 		}
 		/* "lookahead" for better eviction candidate */
-		if (recycle && ab->b_size != bytes &&
-		    ab_prev && ab_prev->b_size == bytes)
+		if (recycle_sz && ab->b_size != recycle_sz &&
+		    ab_prev && ab_prev->b_size == recycle_sz)
 			continue;
 		hash_lock = HDR_LOCK(ab);
 		have_lock = MUTEX_HELD(hash_lock);
 		if (have_lock || mutex_tryenter(hash_lock)) {
+			boolean_t had_data = (ab->b_datacnt > 0);
+
 			ASSERT3U(refcount_count(&ab->b_refcnt), ==, 0);
-			ASSERT(ab->b_datacnt > 0);
+			ASSERT(had_data || ab->b_cdata != NULL);
 			while (ab->b_buf) {
 				arc_buf_t *buf = ab->b_buf;
 				if (!rw_tryenter(&buf->b_lock, RW_WRITER)) {
-					missed += 1;
+					*missedp += 1;
 					break;
 				}
 				if (buf->b_data) {
 					bytes_evicted += ab->b_size;
-					if (recycle && ab->b_type == type &&
-					    ab->b_size == bytes &&
+					if (recycle_sz && ab->b_type == type &&
+					    ab->b_size == recycle_sz &&
 					    !HDR_L2_WRITING(ab)) {
 						stolen = buf->b_data;
-						recycle = FALSE;
+						recycle_sz = 0;
 					}
 				}
 				if (buf->b_efunc) {
@@ -1629,6 +1911,23 @@ arc_evict(arc_state_t *state, uint64_t spa, int64_t bytes, boolean_t recycle,
 				}
 			}
 
+			if (ab->b_datacnt == 0 && ab->b_cdata != NULL) {
+				if (had_data && bytes >= 0) {
+					ab->b_flags &= ~ARC_BUF_AVAILABLE;
+					list_remove(list, ab);
+					list_insert_head(list, ab);
+					if (demoted == NULL)
+						demoted = ab;
+					ARCSTAT_BUMP(arcstat_compressed_demoted);
+					if (!have_lock)
+						mutex_exit(hash_lock);
+					if (bytes_evicted >= bytes)
+						break;
+					continue;
+				}
+				bytes_evicted += ab->b_psize;
+			}
+
 			if (ab->b_l2hdr) {
 				ARCSTAT_INCR(arcstat_evict_l2_cached,
 				    ab->b_size);
@@ -1655,12 +1954,71 @@ arc_evict(arc_state_t *state, uint64_t spa, int64_t bytes, boolean_t recycle,
 			if (bytes >= 0 && bytes_evicted >= bytes)
 				break;
 		} else {
-			missed += 1;
+			*missedp += 1;
 		}
 	}
 
-	mutex_exit(&evicted_state->arcs_mtx);
-	mutex_exit(&state->arcs_mtx);
+	mutex_exit(&evicted_state->arcs_sublists[idx].asl_mtx);
+	mutex_exit(&sl->asl_mtx);
+
+	if (stolen != NULL)
+		*stolenp = stolen;
+
+	return (bytes_evicted);
+}
+
+/*
+ * Evict buffers from state until we've removed the specified number of
+ * bytes.  Move the removed buffers to the appropriate evict state.
+ * If the recycle flag is set, then attempt to "recycle" a buffer:
+ * - look for a buffer to evict that is `bytes' long.
+ * - return the data block from this buffer rather than freeing it.
+ * This flag is used by callers that are trying to make space for a
+ * new buffer in a full arc cache.
+ *
+ * The sublists are visited round-robin, starting with a different one
+ * on every call, each giving up its share of the bytes; passes are
+ * repeated while they make progress.  A recycling caller usually needs
+ * a single buffer, which the first sublist that has one provides.
+ *
+ * This function makes a "best effort".  It skips over any buffers
+ * it can't get a hash_lock on, and so may not catch all candidates.
+ * It may also return without evicting as much space as requested.
+ */
+static void *
+arc_evict(arc_state_t *state, uint64_t spa, int64_t bytes, boolean_t recycle,
+    arc_buf_contents_t type)
+{
+	arc_state_t *evicted_state;
+	uint64_t bytes_evicted = 0, skipped = 0, missed = 0, progress;
+	void *stolen = NULL;
+	uint32_t first;
+	int i;
+
+	ASSERT(state == arc_mru || state == arc_mfu);
+
+	evicted_state = (state == arc_mru) ? arc_mru_ghost : arc_mfu_ghost;
+
+	do {
+		progress = bytes_evicted;
+		first = atomic_inc_32_nv(&state->arcs_evict_next[type]);
+		for (i = 0; i < arc_sublists; i++) {
+			int64_t share;
+
+			if (bytes >= 0 && bytes_evicted >= bytes)
+				break;
+			if (recycle && stolen == NULL)
+				share = bytes - bytes_evicted;
+			else
+				share = arc_evict_share(bytes, bytes_evicted,
+				    i);
+			bytes_evicted += arc_evict_sublist(state, evicted_state,
+			    (first + i) % arc_sublists, spa, share,
+			    recycle && stolen == NULL ? bytes : 0, &stolen,
+			    type, &skipped, &missed);
+		}
+	} while (bytes >= 0 && bytes_evicted < bytes &&
+	    bytes_evicted > progress);
 
 	if (bytes_evicted < bytes)
 		dprintf("only evicted %lld bytes from %x",
@@ -1697,22 +2055,22 @@ arc_evict(arc_state_t *state, uint64_t spa, int64_t bytes, boolean_t recycle,
 }
 
 /*
- * Remove buffers from list until we've removed the specified number of
- * bytes.  Destroy the buffers that are removed.
+ * Remove buffers from one sublist of a ghost state until we've removed
+ * the specified number of bytes.  Destroy the buffers that are removed.
  */
-static void
-arc_evict_ghost(arc_state_t *state, uint64_t spa, int64_t bytes)
+static uint64_t
+arc_evict_ghost_sublist(arc_state_t *state, int idx, uint64_t spa,
+    int64_t bytes, arc_buf_contents_t type, uint64_t *skippedp)
 {
+	arc_sublist_t *sl = &state->arcs_sublists[idx];
+	list_t *list = &sl->asl_list[type];
 	arc_buf_hdr_t *ab, *ab_prev;
-	list_t *list = &state->arcs_list[ARC_BUFC_DATA];
 	kmutex_t *hash_lock;
 	uint64_t bytes_deleted = 0;
-	uint64_t bufs_skipped = 0;
 	boolean_t have_lock;
 
-	ASSERT(GHOST_STATE(state));
 top:
-	mutex_enter(&state->arcs_mtx);
+	mutex_enter(&sl->asl_mtx);
 	for (ab = list_tail(list); ab; ab = ab_prev) {
 		ab_prev = list_prev(list, ab);
 		if (spa && ab->b_spa != spa)
@@ -1745,19 +2103,51 @@ top:
 				break;
 		} else {
 			if (bytes < 0) {
-				mutex_exit(&state->arcs_mtx);
+				mutex_exit(&sl->asl_mtx);
 				mutex_enter(hash_lock);
 				mutex_exit(hash_lock);
 				goto top;
 			}
-			bufs_skipped += 1;
+			*skippedp += 1;
 		}
 	}
-	mutex_exit(&state->arcs_mtx);
+	mutex_exit(&sl->asl_mtx);
+
+	return (bytes_deleted);
+}
+
+/*
+ * Remove buffers from a ghost state until we've removed the specified
+ * number of bytes, data before metadata, visiting the sublists the way
+ * arc_evict() does.
+ */
+static void
+arc_evict_ghost(arc_state_t *state, uint64_t spa, int64_t bytes)
+{
+	arc_buf_contents_t type = ARC_BUFC_DATA;
+	uint64_t bytes_deleted = 0, progress;
+	uint64_t bufs_skipped = 0;
+	uint32_t first;
+	int i;
+
+	ASSERT(GHOST_STATE(state));
+top:
+	do {
+		progress = bytes_deleted;
+		first = atomic_inc_32_nv(&state->arcs_evict_next[type]);
+		for (i = 0; i < arc_sublists; i++) {
+			if (bytes >= 0 && bytes_deleted >= bytes)
+				break;
+			bytes_deleted += arc_evict_ghost_sublist(state,
+			    (first + i) % arc_sublists, spa,
+			    arc_evict_share(bytes, bytes_deleted, i), type,
+			    &bufs_skipped);
+		}
+	} while (bytes >= 0 && bytes_deleted < bytes &&
+	    bytes_deleted > progress);
 
-	if (list == &state->arcs_list[ARC_BUFC_DATA] &&
-	    (bytes < 0 || bytes_deleted < bytes)) {
-		list = &state->arcs_list[ARC_BUFC_METADATA];
+	if (type == ARC_BUFC_DATA && (bytes < 0 || bytes_deleted < bytes)) {
+		type = ARC_BUFC_METADATA;
 		goto top;
 	}
 
@@ -1857,6 +2247,21 @@ arc_do_user_evicts(void)
 	mutex_exit(&arc_eviction_mtx);
 }
 
+/*
+ * Does any sublist of state still hold evictable buffers of the given type?
+ */
+static boolean_t
+arc_state_evictable(arc_state_t *state, arc_buf_contents_t type)
+{
+	int i;
+
+	for (i = 0; i < arc_sublists; i++) {
+		if (list_head(&state->arcs_sublists[i].asl_list[type]) != NULL)
+			return (B_TRUE);
+	}
+	return (B_FALSE);
+}
+
 /*
  * Flush all *evictable* data from the cache for the given spa.
  * NOTE: this will not touch "active" (i.e. referenced) data.
@@ -1869,22 +2274,22 @@ arc_flush(spa_t *spa)
 	if (spa)
 		guid = spa_guid(spa);
 
-	while (list_head(&arc_mru->arcs_list[ARC_BUFC_DATA])) {
+	while (arc_state_evictable(arc_mru, ARC_BUFC_DATA)) {
 		(void) arc_evict(arc_mru, guid, -1, FALSE, ARC_BUFC_DATA);
 		if (spa)
 			break;
 	}
-	while (list_head(&arc_mru->arcs_list[ARC_BUFC_METADATA])) {
+	while (arc_state_evictable(arc_mru, ARC_BUFC_METADATA)) {
 		(void) arc_evict(arc_mru, guid, -1, FALSE, ARC_BUFC_METADATA);
 		if (spa)
 			break;
 	}
-	while (list_head(&arc_mfu->arcs_list[ARC_BUFC_DATA])) {
+	while (arc_state_evictable(arc_mfu, ARC_BUFC_DATA)) {
 		(void) arc_evict(arc_mfu, guid, -1, FALSE, ARC_BUFC_DATA);
 		if (spa)
 			break;
 	}
-	while (list_head(&arc_mfu->arcs_list[ARC_BUFC_METADATA])) {
+	while (arc_state_evictable(arc_mfu, ARC_BUFC_METADATA)) {
 		(void) arc_evict(arc_mfu, guid, -1, FALSE, ARC_BUFC_METADATA);
 		if (spa)
 			break;
@@ -1905,8 +2310,8 @@ arc_shrink(void)
 	if (arc_c > arc_c_min) {
 		uint64_t to_free;
 
-#if 0
-		to_free = MAX(arc_c >> arc_shrink_shift, ptob(needfree));
+#ifdef _KERNEL
+		to_free = MAX(arc_c >> arc_shrink_shift, arc_needfree);
 #else
 		to_free = arc_c >> arc_shrink_shift;
 #endif
@@ -1928,6 +2333,37 @@ arc_shrink(void)
 		arc_adjust();
 }
 
+/*
+ * ZFSFUSE: apply new values of the zfs_arc_* tunables, set while we are
+ * running (see zfs-fuse/zfsfuse_tunables.c).  The cache is shrunk right
+ * away if it is over its new limit.
+ */
+int
+arc_tuning_update(void)
+{
+	if (zfs_arc_min > zfs_arc_max || zfs_arc_meta_limit > zfs_arc_max ||
+	    zfs_arc_grow_retry <= 0 || zfs_arc_shrink_shift <= 0 ||
+	    zfs_arc_shrink_shift >= 64)
+		return (EINVAL);
+
+	arc_c_max = zfs_arc_max;
+	arc_c_min = zfs_arc_min;
+	arc_meta_limit = zfs_arc_meta_limit;
+	arc_grow_retry = zfs_arc_grow_retry;
+	arc_shrink_shift = zfs_arc_shrink_shift;
+
+	if (arc_c > arc_c_max)
+		arc_c = arc_c_max;
+	if (arc_c < arc_c_min)
+		arc_c = arc_c_min;
+	if (arc_p > arc_c)
+		arc_p = arc_c >> 1;
+
+	arc_adjust();
+
+	return (0);
+}
+
 static int
 arc_reclaim_needed(void)
 {
@@ -1986,9 +2422,61 @@ arc_reclaim_needed(void)
 		return (1);
 #endif
 #endif
+#ifdef _KERNEL
+	/*
+	 * ZFSFUSE: there is no freemem to look at.  Reading /proc and the
+	 * cgroup files on every call would be too slow, so the reclaim
+	 * thread samples them (see arc_mem_update()) and we return what it
+	 * found.
+	 */
+	return (arc_mem_short);
+#else
 	return (0);
+#endif
 }
 
+#ifdef _KERNEL
+/*
+ * ZFSFUSE: decide whether we are short of memory.  We are when less than
+ * arc_lotsfree bytes are available to us, counting both MemAvailable and
+ * the headroom under our cgroup limits, or when the PSI trigger fired
+ * since we last looked.
+ */
+static void
+arc_mem_update(void)
+{
+	uint64_t avail = mem_avail();
+
+	arc_needfree = avail < arc_lotsfree ? arc_lotsfree - avail : 0;
+	arc_mem_short = mem_pressure_pending() || arc_needfree > 0;
+}
+
+/*
+ * Only let the cache grow again once there is a good margin, or we would be
+ * back to reclaiming right away.
+ */
+static int
+arc_mem_roomy(void)
+{
+	return (mem_avail() >= 2 * arc_lotsfree);
+}
+
+/*
+ * Called from the PSI thread when tasks start stalling on memory: don't
+ * wait for the next sample, start evicting now.
+ */
+static void
+arc_mem_pressure(void)
+{
+	mutex_enter(&arc_reclaim_thr_lock);
+	arc_mem_short = 1;
+	cv_signal(&arc_reclaim_thr_cv);
+	mutex_exit(&arc_reclaim_thr_lock);
+}
+#else
+#define	arc_mem_roomy()	(1)
+#endif
+
 static void
 arc_kmem_reap_now(arc_reclaim_strategy_t strat)
 {
@@ -2013,6 +2501,13 @@ arc_kmem_reap_now(arc_reclaim_strategy_t strat)
 	kmem_reap();
 #endif
 #endif
+	/*
+	 * ZFSFUSE: umem only reaps on its own when an allocation fails,
+	 * so ask for a reap whenever we are short of memory.  Once the
+	 * reap is done umem hands the freed pages back to the system,
+	 * busy or not.
+	 */
+	kmem_reap_urgent();
 
 	/*
 	 * An aggressive reclamation will shrink the cache size as well as
@@ -2039,6 +2534,7 @@ static void
 arc_reclaim_thread(void)
 {
 	uint64_t			growtime = 0;
+	uint64_t			accesses, last_accesses = 0;
 	arc_reclaim_strategy_t	last_reclaim = ARC_RECLAIM_CONS;
 	callb_cpr_t		cpr;
 
@@ -2046,6 +2542,9 @@ arc_reclaim_thread(void)
 
 	mutex_enter(&arc_reclaim_thr_lock);
 	while (arc_thread_exit == 0) {
+#ifdef _KERNEL
+		arc_mem_update();
+#endif
 		if (arc_reclaim_needed()) {
 
 			if (arc_no_grow) {
@@ -2066,7 +2565,8 @@ arc_reclaim_thread(void)
 			arc_kmem_reap_now(last_reclaim);
 			arc_warm = B_TRUE;
 
-		} else if (arc_no_grow && lbolt64 >= growtime) {
+		} else if (arc_no_grow && lbolt64 >= growtime &&
+		    arc_mem_roomy()) {
 			arc_no_grow = FALSE;
 		}
 
@@ -2077,6 +2577,19 @@ arc_reclaim_thread(void)
 		if (arc_eviction_list != NULL)
 			arc_do_user_evicts();
 
+		/*
+		 * ZFSFUSE: also reap once the ARC has gone idle, so that the
+		 * memory freed by a burst of activity does not stay in the
+		 * caches for good.  Any hit or miss since the last tick means
+		 * we are not idle.  umem limits this to one reap per
+		 * reap_interval, and only returns the pages once its own
+		 * caches have been idle as well.
+		 */
+		accesses = ARCSTAT(arcstat_hits) + ARCSTAT(arcstat_misses);
+		if (accesses == last_accesses)
+			kmem_reap();
+		last_accesses = accesses;
+
 		/* block until needed, or one second, whichever is shorter */
 		CALLB_CPR_SAFE_BEGIN(&cpr);
 		(void) cv_timedwait(&arc_reclaim_thr_cv,
@@ -2440,6 +2953,44 @@ arc_getbuf_func(zio_t *zio, arc_buf_t *buf, void *arg)
 	}
 }
 
+/*
+ * A read hit a header that only has its compressed copy left: give it an
+ * uncompressed buffer again.
+ */
+static arc_buf_t *
+arc_buf_decompress(arc_buf_hdr_t *hdr, const blkptr_t *bp)
+{
+	arc_buf_t *buf;
+
+	ASSERT(hdr->b_state == arc_mru || hdr->b_state == arc_mfu);
+	ASSERT(hdr->b_datacnt == 0 && hdr->b_cdata != NULL);
+	ASSERT3P(hdr->b_buf, ==, NULL);
+
+	buf = kmem_cache_alloc(buf_cache, KM_PUSHPAGE);
+	buf->b_hdr = hdr;
+	buf->b_data = NULL;
+	buf->b_efunc = NULL;
+	buf->b_private = NULL;
+	buf->b_next = NULL;
+	hdr->b_buf = buf;
+	hdr->b_datacnt = 1;
+	arc_get_data_buf(buf);
+
+	/* it was decompressed once already, on its way in */
+	VERIFY(zio_decompress_data(hdr->b_compress, hdr->b_cdata,
+	    buf->b_data, hdr->b_psize, hdr->b_size) == 0);
+	if (BP_SHOULD_BYTESWAP(bp)) {
+		arc_byteswap_func_t *func = BP_GET_LEVEL(bp) > 0 ?
+		    byteswap_uint64_array :
+		    dmu_ot[BP_GET_TYPE(bp)].ot_byteswap;
+		func(buf->b_data, hdr->b_size);
+	}
+	arc_cksum_compute(buf, B_FALSE);
+	ARCSTAT_BUMP(arcstat_compressed_hits);
+
+	return (buf);
+}
+
 static void
 arc_read_done(zio_t *zio)
 {
@@ -2449,6 +3000,7 @@ arc_read_done(zio_t *zio)
 	kmutex_t	*hash_lock;
 	arc_callback_t	*callback_list, *acb;
 	int		freeable = FALSE;
+	void		*cdata = NULL;
 
 	buf = zio->io_private;
 	hdr = buf->b_hdr;
@@ -2472,6 +3024,15 @@ arc_read_done(zio_t *zio)
 	if (l2arc_noprefetch && (hdr->b_flags & ARC_PREFETCH))
 		hdr->b_flags &= ~ARC_L2CACHE;
 
+	/* a raw read for the compressed ARC: decompress it ourselves */
+	if ((zio->io_flags & ZIO_FLAG_RAW) && zio->io_data != buf->b_data) {
+		cdata = zio->io_data;
+		if (zio->io_error == 0 &&
+		    zio_decompress_data(BP_GET_COMPRESS(zio->io_bp), cdata,
+		    buf->b_data, zio->io_size, hdr->b_size) != 0)
+			zio->io_error = EIO;
+	}
+
 	/* byteswap if necessary */
 	callback_list = hdr->b_acb;
 	ASSERT(callback_list != NULL);
@@ -2484,6 +3045,14 @@ arc_read_done(zio_t *zio)
 
 	arc_cksum_compute(buf, B_FALSE);
 
+	if (cdata != NULL) {
+		if (hash_lock && zio->io_error == 0)
+			arc_hdr_set_cdata(hdr, cdata, zio->io_size,
+			    BP_GET_COMPRESS(zio->io_bp));
+		else
+			arc_cdata_free(hdr->b_type, cdata, zio->io_size);
+	}
+
 	if (hash_lock && zio->io_error == 0 && hdr->b_state == arc_anon) {
 		/*
 		 * Only call arc_access on anonymous buffers.  This is because
@@ -2616,7 +3185,7 @@ arc_read_nolock(zio_t *pio, spa_t *spa, const blkptr_t *bp,
 top:
 	hdr = buf_hash_find(guid, BP_IDENTITY(bp), BP_PHYSICAL_BIRTH(bp),
 	    &hash_lock);
-	if (hdr && hdr->b_datacnt > 0) {
+	if (hdr && (hdr->b_datacnt > 0 || hdr->b_cdata != NULL)) {
 
 		*arc_flags |= ARC_CACHED;
 
@@ -2661,12 +3230,14 @@ top:
 			 * that arc_release() will always succeed.
 			 */
 			buf = hdr->b_buf;
-			ASSERT(buf);
-			ASSERT(buf->b_data);
-			if (HDR_BUF_AVAILABLE(hdr)) {
+			if (hdr->b_datacnt == 0) {
+				buf = arc_buf_decompress(hdr, bp);
+			} else if (HDR_BUF_AVAILABLE(hdr)) {
+				ASSERT(buf->b_data);
 				ASSERT(buf->b_efunc == NULL);
 				hdr->b_flags &= ~ARC_BUF_AVAILABLE;
 			} else {
+				ASSERT(buf->b_data);
 				buf = arc_buf_clone(buf);
 			}
 
@@ -2701,14 +3272,16 @@ top:
 			hdr = buf->b_hdr;
 			hdr->b_dva = *BP_IDENTITY(bp);
 			hdr->b_birth = BP_PHYSICAL_BIRTH(bp);
-			hdr->b_cksum0 = bp->blk_cksum.zc_word[0];
+			hdr->b_cksum = bp->blk_cksum;
+			hdr->b_blkprop = bp->blk_prop;
 			exists = buf_hash_insert(hdr, &hash_lock);
 			if (exists) {
 				/* somebody beat us to the hash insert */
 				mutex_exit(hash_lock);
 				bzero(&hdr->b_dva, sizeof (dva_t));
 				hdr->b_birth = 0;
-				hdr->b_cksum0 = 0;
+				bzero(&hdr->b_cksum, sizeof (zio_cksum_t));
+				hdr->b_blkprop = 0;
 				(void) arc_buf_remove_ref(buf, private);
 				goto top; /* restart the IO request */
 			}
@@ -2729,6 +3302,10 @@ top:
 			ASSERT3U(refcount_count(&hdr->b_refcnt), ==, 0);
 			ASSERT(hdr->b_buf == NULL);
 
+			/* unknown if the header was rebuilt from the L2ARC */
+			hdr->b_cksum = bp->blk_cksum;
+			hdr->b_blkprop = bp->blk_prop;
+
 			/* if this is a prefetch, we don't have a reference */
 			if (*arc_flags & ARC_PREFETCH)
 				hdr->b_flags |= ARC_PREFETCH;
@@ -2849,8 +3426,24 @@ top:
 			}
 		}
 
-		rzio = zio_read(pio, spa, bp, buf->b_data, size,
-		    arc_read_done, buf, priority, zio_flags, zb);
+		if (zfs_arc_compressed &&
+		    BP_GET_COMPRESS(bp) != ZIO_COMPRESS_OFF &&
+		    BP_GET_PSIZE(bp) < size) {
+			/*
+			 * Read the block as it is on disk, so that
+			 * arc_read_done() can keep the compressed copy.
+			 */
+			uint64_t psize = BP_GET_PSIZE(bp);
+			void *cdata = hdr->b_type == ARC_BUFC_METADATA ?
+			    zio_buf_alloc(psize) : zio_data_buf_alloc(psize);
+
+			rzio = zio_read(pio, spa, bp, cdata, psize,
+			    arc_read_done, buf, priority,
+			    zio_flags | ZIO_FLAG_RAW, zb);
+		} else {
+			rzio = zio_read(pio, spa, bp, buf->b_data, size,
+			    arc_read_done, buf, priority, zio_flags, zb);
+		}
 
 		if (*arc_flags & ARC_WAIT)
 			return (zio_wait(rzio));
@@ -2924,7 +3517,8 @@ arc_buf_evict(arc_buf_t *buf)
 	ASSERT(buf->b_data != NULL);
 	arc_buf_destroy(buf, FALSE, FALSE);
 
-	if (hdr->b_datacnt == 0) {
+	/* with a compressed copy left, the header stays cached */
+	if (hdr->b_datacnt == 0 && hdr->b_cdata == NULL) {
 		arc_state_t *old_state = hdr->b_state;
 		arc_state_t *evicted_state;
 
@@ -2933,16 +3527,16 @@ arc_buf_evict(arc_buf_t *buf)
 		evicted_state =
 		    (old_state == arc_mru) ? arc_mru_ghost : arc_mfu_ghost;
 
-		mutex_enter(&old_state->arcs_mtx);
-		mutex_enter(&evicted_state->arcs_mtx);
+		mutex_enter(&ARC_SUBLIST(old_state, hdr)->asl_mtx);
+		mutex_enter(&ARC_SUBLIST(evicted_state, hdr)->asl_mtx);
 
 		arc_change_state(evicted_state, hdr, hash_lock);
 		ASSERT(HDR_IN_HASH_TABLE(hdr));
 		hdr->b_flags |= ARC_IN_HASH_TABLE;
 		hdr->b_flags &= ~ARC_BUF_AVAILABLE;
 
-		mutex_exit(&evicted_state->arcs_mtx);
-		mutex_exit(&old_state->arcs_mtx);
+		mutex_exit(&ARC_SUBLIST(evicted_state, hdr)->asl_mtx);
+		mutex_exit(&ARC_SUBLIST(old_state, hdr)->asl_mtx);
 	}
 	mutex_exit(hash_lock);
 	rw_exit(&buf->b_lock);
@@ -3060,7 +3654,8 @@ arc_release(arc_buf_t *buf, void *tag)
 
 		bzero(&hdr->b_dva, sizeof (dva_t));
 		hdr->b_birth = 0;
-		hdr->b_cksum0 = 0;
+		bzero(&hdr->b_cksum, sizeof (zio_cksum_t));
+		hdr->b_blkprop = 0;
 		arc_buf_thaw(buf);
 	}
 	buf->b_efunc = NULL;
@@ -3097,6 +3692,54 @@ arc_has_callback(arc_buf_t *buf)
 	return (callback);
 }
 
+/*
+ * Call func on every header of the pool that has data in the MRU or MFU
+ * state and whose block pointer is known, with its hash lock held: with
+ * the block pointer rebuilt from the header (only its first DVA), 0 for
+ * MFU or 1 for MRU, and the time of the last access.  func must not
+ * block.
+ */
+void
+arc_walk_cached(spa_t *spa, arc_walk_func_t *func, void *arg)
+{
+	uint64_t guid = spa_guid(spa);
+	arc_buf_hdr_t *ab;
+	blkptr_t bp;
+	uint64_t idx;
+
+	for (idx = 0; idx <= buf_hash_table.ht_mask; idx++) {
+		mutex_enter(BUF_HASH_LOCK(idx));
+		for (ab = buf_hash_table.ht_table[idx]; ab != NULL;
+		    ab = ab->b_hash_next) {
+			if (ab->b_spa != guid || ab->b_blkprop == 0 ||
+			    (ab->b_state != arc_mru && ab->b_state != arc_mfu))
+				continue;
+
+			bzero(&bp, sizeof (blkptr_t));
+			bp.blk_dva[0] = ab->b_dva;
+			bp.blk_prop = ab->b_blkprop;
+			BP_SET_BIRTH(&bp, ab->b_birth, ab->b_birth);
+			bp.blk_fill = 1;
+			bp.blk_cksum = ab->b_cksum;
+
+			func(&bp, ab->b_state == arc_mfu ? 0 : 1,
+			    ab->b_arc_access, arg);
+		}
+		mutex_exit(BUF_HASH_LOCK(idx));
+	}
+}
+
+/*
+ * Is there room to prefetch into the ARC without evicting anything?
+ * Some headroom is left below arc_c so that the warm start does not
+ * push out what is read in the meantime.
+ */
+boolean_t
+arc_prefetch_room(void)
+{
+	return (!arc_reclaim_needed() && arc_size < arc_c - (arc_c >> 3));
+}
+
 #ifdef ZFS_DEBUG
 int
 arc_referenced(arc_buf_t *buf)
@@ -3150,7 +3793,8 @@ arc_write_done(zio_t *zio)
 	if (zio->io_error == 0) {
 		hdr->b_dva = *BP_IDENTITY(zio->io_bp);
 		hdr->b_birth = BP_PHYSICAL_BIRTH(zio->io_bp);
-		hdr->b_cksum0 = zio->io_bp->blk_cksum.zc_word[0];
+		hdr->b_cksum = zio->io_bp->blk_cksum;
+		hdr->b_blkprop = zio->io_bp->blk_prop;
 	} else {
 		ASSERT(BUF_EMPTY(hdr));
 	}
@@ -3265,7 +3909,8 @@ arc_free(spa_t *spa, const blkptr_t *bp)
 			ab->b_arc_access = 0;
 			bzero(&ab->b_dva, sizeof (dva_t));
 			ab->b_birth = 0;
-			ab->b_cksum0 = 0;
+			bzero(&ab->b_cksum, sizeof (zio_cksum_t));
+			ab->b_blkprop = 0;
 			ab->b_buf->b_efunc = NULL;
 			ab->b_buf->b_private = NULL;
 			mutex_exit(hash_lock);
@@ -3397,6 +4042,42 @@ arc_tempreserve_space(uint64_t reserve, uint64_t txg)
 	return (0);
 }
 
+static void
+arc_state_init(arc_state_t *state)
+{
+	int i;
+
+	state->arcs_sublists = kmem_zalloc(arc_sublists *
+	    sizeof (arc_sublist_t), KM_SLEEP);
+	for (i = 0; i < arc_sublists; i++) {
+		arc_sublist_t *sl = &state->arcs_sublists[i];
+
+		mutex_init(&sl->asl_mtx, NULL, MUTEX_DEFAULT, NULL);
+		list_create(&sl->asl_list[ARC_BUFC_METADATA],
+		    sizeof (arc_buf_hdr_t),
+		    offsetof(arc_buf_hdr_t, b_arc_node));
+		list_create(&sl->asl_list[ARC_BUFC_DATA],
+		    sizeof (arc_buf_hdr_t),
+		    offsetof(arc_buf_hdr_t, b_arc_node));
+	}
+}
+
+static void
+arc_state_fini(arc_state_t *state)
+{
+	int i;
+
+	for (i = 0; i < arc_sublists; i++) {
+		arc_sublist_t *sl = &state->arcs_sublists[i];
+
+		list_destroy(&sl->asl_list[ARC_BUFC_METADATA]);
+		list_destroy(&sl->asl_list[ARC_BUFC_DATA]);
+		mutex_destroy(&sl->asl_mtx);
+	}
+	kmem_free(state->arcs_sublists, arc_sublists * sizeof (arc_sublist_t));
+	state->arcs_sublists = NULL;
+}
+
 void
 arc_init(void)
 {
@@ -3409,6 +4090,15 @@ arc_init(void)
 	/* Start out with 1/8 of all memory */
 	arc_c = physmem * PAGESIZE / 8;
 
+#ifdef _KERNEL
+	/*
+	 * ZFSFUSE: start reclaiming when less than 1/64th of our memory,
+	 * but at least 32MB, is left.
+	 */
+	mem_pressure_init(arc_mem_pressure);
+	arc_lotsfree = MAX(mem_total() >> 6, 32ULL << 20);
+#endif
+
 #if 0
 	/*
 	 * On architectures where the physical memory can be larger
@@ -3429,8 +4119,13 @@ arc_init(void)
 		}
 	} else {
 #ifdef _KERNEL
-	/* set max cache to ZFSFUSE_MAX_ARCSIZE */
-	arc_c_max = ZFSFUSE_MAX_ARCSIZE;
+	/*
+	 * ZFSFUSE: set max cache to 1/4 of the memory we may use, but no
+	 * less than ZFSFUSE_MAX_ARCSIZE.  Reads through FUSE are cached
+	 * in the page cache as well, so taking more would cache the same
+	 * data twice.  The ARC shrinks when memory gets short anyway.
+	 */
+	arc_c_max = MAX(ZFSFUSE_MAX_ARCSIZE, mem_total() / 4);
 #else
 	arc_c_max = 64<<20;
 #endif
@@ -3469,6 +4164,18 @@ arc_init(void)
 	if (zfs_arc_p_min_shift > 0)
 		arc_p_min_shift = zfs_arc_p_min_shift;
 
+#ifdef _KERNEL
+	/*
+	 * ZFSFUSE: the tunables can be changed at run time, make them show
+	 * the limits in effect (see arc_tuning_update()).
+	 */
+	zfs_arc_max = arc_c_max;
+	zfs_arc_min = arc_c_min;
+	zfs_arc_meta_limit = arc_meta_limit;
+	zfs_arc_grow_retry = arc_grow_retry;
+	zfs_arc_shrink_shift = arc_shrink_shift;
+#endif
+
 	/* if kmem_flags are set, lets try to use less memory */
 	if (kmem_debugging())
 		arc_c = arc_c / 2;
@@ -3483,33 +4190,21 @@ arc_init(void)
 	arc_l2c_only = &ARC_l2c_only;
 	arc_size = 0;
 
-	mutex_init(&arc_anon->arcs_mtx, NULL, MUTEX_DEFAULT, NULL);
-	mutex_init(&arc_mru->arcs_mtx, NULL, MUTEX_DEFAULT, NULL);
-	mutex_init(&arc_mru_ghost->arcs_mtx, NULL, MUTEX_DEFAULT, NULL);
-	mutex_init(&arc_mfu->arcs_mtx, NULL, MUTEX_DEFAULT, NULL);
-	mutex_init(&arc_mfu_ghost->arcs_mtx, NULL, MUTEX_DEFAULT, NULL);
-	mutex_init(&arc_l2c_only->arcs_mtx, NULL, MUTEX_DEFAULT, NULL);
-
-	list_create(&arc_mru->arcs_list[ARC_BUFC_METADATA],
-	    sizeof (arc_buf_hdr_t), offsetof(arc_buf_hdr_t, b_arc_node));
-	list_create(&arc_mru->arcs_list[ARC_BUFC_DATA],
-	    sizeof (arc_buf_hdr_t), offsetof(arc_buf_hdr_t, b_arc_node));
-	list_create(&arc_mru_ghost->arcs_list[ARC_BUFC_METADATA],
-	    sizeof (arc_buf_hdr_t), offsetof(arc_buf_hdr_t, b_arc_node));
-	list_create(&arc_mru_ghost->arcs_list[ARC_BUFC_DATA],
-	    sizeof (arc_buf_hdr_t), offsetof(arc_buf_hdr_t, b_arc_node));
-	list_create(&arc_mfu->arcs_list[ARC_BUFC_METADATA],
-	    sizeof (arc_buf_hdr_t), offsetof(arc_buf_hdr_t, b_arc_node));
-	list_create(&arc_mfu->arcs_list[ARC_BUFC_DATA],
-	    sizeof (arc_buf_hdr_t), offsetof(arc_buf_hdr_t, b_arc_node));
-	list_create(&arc_mfu_ghost->arcs_list[ARC_BUFC_METADATA],
-	    sizeof (arc_buf_hdr_t), offsetof(arc_buf_hdr_t, b_arc_node));
-	list_create(&arc_mfu_ghost->arcs_list[ARC_BUFC_DATA],
-	    sizeof (arc_buf_hdr_t), offsetof(arc_buf_hdr_t, b_arc_node));
-	list_create(&arc_l2c_only->arcs_list[ARC_BUFC_METADATA],
-	    sizeof (arc_buf_hdr_t), offsetof(arc_buf_hdr_t, b_arc_node));
-	list_create(&arc_l2c_only->arcs_list[ARC_BUFC_DATA],
-	    sizeof (arc_buf_hdr_t), offsetof(arc_buf_hdr_t, b_arc_node));
+	if (zfs_arc_sublists > 0) {
+		arc_sublists = MIN(zfs_arc_sublists, max_ncpus);
+	} else {
+		for (arc_sublists = 4; arc_sublists < 2 * ncpus &&
+		    arc_sublists < max_ncpus; arc_sublists <<= 1)
+			continue;
+	}
+	ARCSTAT(arcstat_sublists) = arc_sublists;
+
+	arc_state_init(arc_anon);
+	arc_state_init(arc_mru);
+	arc_state_init(arc_mru_ghost);
+	arc_state_init(arc_mfu);
+	arc_state_init(arc_mfu_ghost);
+	arc_state_init(arc_l2c_only);
 
 	buf_init();
 
@@ -3548,6 +4243,10 @@ arc_fini(void)
 		cv_wait(&arc_reclaim_thr_cv, &arc_reclaim_thr_lock);
 	mutex_exit(&arc_reclaim_thr_lock);
 
+#ifdef _KERNEL
+	mem_pressure_fini();
+#endif
+
 	arc_flush(NULL);
 
 	arc_dead = TRUE;
@@ -3561,21 +4260,12 @@ arc_fini(void)
 	mutex_destroy(&arc_reclaim_thr_lock);
 	cv_destroy(&arc_reclaim_thr_cv);
 
-	list_destroy(&arc_mru->arcs_list[ARC_BUFC_METADATA]);
-	list_destroy(&arc_mru_ghost->arcs_list[ARC_BUFC_METADATA]);
-	list_destroy(&arc_mfu->arcs_list[ARC_BUFC_METADATA]);
-	list_destroy(&arc_mfu_ghost->arcs_list[ARC_BUFC_METADATA]);
-	list_destroy(&arc_mru->arcs_list[ARC_BUFC_DATA]);
-	list_destroy(&arc_mru_ghost->arcs_list[ARC_BUFC_DATA]);
-	list_destroy(&arc_mfu->arcs_list[ARC_BUFC_DATA]);
-	list_destroy(&arc_mfu_ghost->arcs_list[ARC_BUFC_DATA]);
-
-	mutex_destroy(&arc_anon->arcs_mtx);
-	mutex_destroy(&arc_mru->arcs_mtx);
-	mutex_destroy(&arc_mru_ghost->arcs_mtx);
-	mutex_destroy(&arc_mfu->arcs_mtx);
-	mutex_destroy(&arc_mfu_ghost->arcs_mtx);
-	mutex_destroy(&arc_l2c_only->arcs_mtx);
+	arc_state_fini(arc_anon);
+	arc_state_fini(arc_mru);
+	arc_state_fini(arc_mru_ghost);
+	arc_state_fini(arc_mfu);
+	arc_state_fini(arc_mfu_ghost);
+	arc_state_fini(arc_l2c_only);
 
 	mutex_destroy(&zfs_write_limit_lock);
 
@@ -3825,10 +4515,10 @@ l2arc_dev_get_next(void)
 		else if (next == first)
 			break;
 
-	} while (vdev_is_dead(next->l2ad_vdev));
+	} while (vdev_is_dead(next->l2ad_vdev) || next->l2ad_rebuild);
 
 	/* if we were unable to find any usable vdevs, return NULL */
-	if (vdev_is_dead(next->l2ad_vdev))
+	if (vdev_is_dead(next->l2ad_vdev) || next->l2ad_rebuild)
 		next = NULL;
 
 	l2arc_dev_last = next;
@@ -3896,8 +4586,15 @@ l2arc_write_done(zio_t *zio)
 	DTRACE_PROBE2(l2arc__iodone, zio_t *, zio,
 	    l2arc_write_callback_t *, cb);
 
-	if (zio->io_error != 0)
+	/*
+	 * Only link the log blocks of this write into the chain once
+	 * they and the buffers they describe are all on the device.
+	 */
+	if (zio->io_error != 0) {
 		ARCSTAT_BUMP(arcstat_l2_writes_error);
+	} else {
+		dev->l2ad_log = cb->l2wcb_log;
+	}
 
 	mutex_enter(&l2arc_buflist_mtx);
 
@@ -4025,34 +4722,37 @@ l2arc_read_done(zio_t *zio)
  * performance.
  *
  * Currently the metadata lists are hit first, MFU then MRU, followed by
- * the data lists.  This function returns a locked list, and also returns
- * the lock pointer.
+ * the data lists.  This function returns the given sublist of a list
+ * locked, and also returns the lock pointer.
  */
 static list_t *
-l2arc_list_locked(int list_num, kmutex_t **lock)
+l2arc_list_locked(int list_num, int sublist, kmutex_t **lock)
 {
+	arc_sublist_t *sl;
 	list_t *list;
 
 	ASSERT(list_num >= 0 && list_num <= 3);
+	ASSERT(sublist >= 0 && sublist < arc_sublists);
 
 	switch (list_num) {
 	case 0:
-		list = &arc_mfu->arcs_list[ARC_BUFC_METADATA];
-		*lock = &arc_mfu->arcs_mtx;
+		sl = &arc_mfu->arcs_sublists[sublist];
+		list = &sl->asl_list[ARC_BUFC_METADATA];
 		break;
 	case 1:
-		list = &arc_mru->arcs_list[ARC_BUFC_METADATA];
-		*lock = &arc_mru->arcs_mtx;
+		sl = &arc_mru->arcs_sublists[sublist];
+		list = &sl->asl_list[ARC_BUFC_METADATA];
 		break;
 	case 2:
-		list = &arc_mfu->arcs_list[ARC_BUFC_DATA];
-		*lock = &arc_mfu->arcs_mtx;
+		sl = &arc_mfu->arcs_sublists[sublist];
+		list = &sl->asl_list[ARC_BUFC_DATA];
 		break;
 	case 3:
-		list = &arc_mru->arcs_list[ARC_BUFC_DATA];
-		*lock = &arc_mru->arcs_mtx;
+		sl = &arc_mru->arcs_sublists[sublist];
+		list = &sl->asl_list[ARC_BUFC_DATA];
 		break;
 	}
+	*lock = &sl->asl_mtx;
 
 	ASSERT(!(MUTEX_HELD(*lock)));
 	mutex_enter(*lock);
@@ -4190,6 +4890,84 @@ top:
 	dev->l2ad_evict = taddr;
 }
 
+static void
+l2arc_log_blk_write_done(zio_t *zio)
+{
+	zio_buf_free(zio->io_private, zio->io_orig_size);
+}
+
+/*
+ * Write the log block lb at the write hand, as a child of pio, and make it
+ * the newest one of the write described by cb.  l2arc_write_done() makes it
+ * the newest one of the device if the write succeeds.  Returns the space it
+ * took on the device.
+ */
+static uint64_t
+l2arc_log_blk_commit(l2arc_write_callback_t *cb, zio_t *pio,
+    l2arc_log_blk_phys_t *lb)
+{
+	l2arc_dev_t *dev = cb->l2wcb_dev;
+	uint64_t psize = L2ARC_LOG_BLK_PSIZE(lb->lb_nents);
+	uint64_t asize = vdev_psize_to_asize(dev->l2ad_vdev, psize);
+	void *data;
+
+	ASSERT3U(lb->lb_nents, >, 0);
+
+	lb->lb_magic = L2ARC_LOG_BLK_MAGIC;
+	lb->lb_prev = cb->l2wcb_log;
+
+	data = zio_buf_alloc(psize);
+	bzero(data, psize);
+	bcopy(lb, data, offsetof(l2arc_log_blk_phys_t,
+	    lb_entries[lb->lb_nents]));
+
+	cb->l2wcb_log.lp_daddr = dev->l2ad_hand;
+	cb->l2wcb_log.lp_psize = psize;
+	fletcher_4_native(data, psize, &cb->l2wcb_log.lp_cksum);
+
+	(void) zio_nowait(zio_write_phys(pio, dev->l2ad_vdev, dev->l2ad_hand,
+	    psize, data, ZIO_CHECKSUM_OFF, l2arc_log_blk_write_done, data,
+	    ZIO_PRIORITY_ASYNC_WRITE, ZIO_FLAG_CANFAIL, B_FALSE));
+	ARCSTAT_BUMP(arcstat_l2_log_blk_writes);
+
+	dev->l2ad_hand += asize;
+	lb->lb_nents = 0;
+
+	return (asize);
+}
+
+/*
+ * Point the device header at the newest log block.  Called once the
+ * buffers and log blocks of a feed pass are safely on the device.
+ */
+static void
+l2arc_dev_hdr_update(l2arc_dev_t *dev)
+{
+	l2arc_dev_hdr_phys_t *dh;
+
+	dh = zio_buf_alloc(L2ARC_DEV_HDR_SIZE);
+	bzero(dh, L2ARC_DEV_HDR_SIZE);
+
+	dh->dh_magic = L2ARC_DEV_HDR_MAGIC;
+	dh->dh_version = L2ARC_DEV_HDR_VERSION;
+	dh->dh_spa_guid = spa_guid(dev->l2ad_spa);
+	dh->dh_vdev_guid = dev->l2ad_vdev->vdev_guid;
+	dh->dh_start = dev->l2ad_start;
+	dh->dh_end = dev->l2ad_end;
+	dh->dh_hand = dev->l2ad_hand;
+	dh->dh_evict = dev->l2ad_evict;
+	dh->dh_flags = dev->l2ad_first ? L2ARC_DEV_HDR_FIRST : 0;
+	dh->dh_log = dev->l2ad_log;
+	fletcher_4_native(dh, offsetof(l2arc_dev_hdr_phys_t, dh_cksum),
+	    &dh->dh_cksum);
+
+	(void) zio_wait(zio_write_phys(NULL, dev->l2ad_vdev,
+	    VDEV_LABEL_START_SIZE, L2ARC_DEV_HDR_SIZE, dh, ZIO_CHECKSUM_OFF,
+	    NULL, NULL, ZIO_PRIORITY_ASYNC_WRITE, ZIO_FLAG_CANFAIL, B_FALSE));
+
+	zio_buf_free(dh, L2ARC_DEV_HDR_SIZE);
+}
+
 /*
  * Find and write ARC buffers to the L2ARC device.
  *
@@ -4207,8 +4985,11 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 	kmutex_t *hash_lock, *list_lock;
 	boolean_t have_lock, full;
 	l2arc_write_callback_t *cb;
+	l2arc_log_blk_phys_t *lb = NULL;
+	l2arc_log_ent_phys_t *le;
 	zio_t *pio, *wzio;
 	uint64_t guid = spa_guid(spa);
+	uint64_t log_sz, log_write_sz = 0;
 
 	ASSERT(dev->l2ad_vdev != NULL);
 
@@ -4222,9 +5003,20 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 	 * Copy buffers for L2ARC writing.
 	 */
 	mutex_enter(&l2arc_buflist_mtx);
-	for (int try = 0; try <= 3; try++) {
-		list = l2arc_list_locked(try, &list_lock);
+	for (int pass = 0; pass < 4 * arc_sublists; pass++) {
+		int try = pass / arc_sublists;
+
+		/*
+		 * Visit every sublist of each list in turn, starting with
+		 * a different one on every feed.  A sublist holds about
+		 * 1/arc_sublists of its list, so search that share of the
+		 * headroom in it.
+		 */
+		list = l2arc_list_locked(try,
+		    (l2arc_sublist_next + pass) % arc_sublists, &list_lock);
 		passed_sz = 0;
+		headroom = MAX(target_sz * l2arc_headroom / arc_sublists,
+		    SPA_MAXBLOCKSIZE);
 
 		/*
 		 * L2ARC fast warmup.
@@ -4232,7 +5024,6 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 		 * Until the ARC is warm and starts to evict, read from the
 		 * head of the ARC lists rather than the tail.
 		 */
-		headroom = target_sz * l2arc_headroom;
 		if (arc_warm == B_FALSE)
 			ab = list_head(list);
 		else
@@ -4262,12 +5053,19 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 				break;
 			}
 
-			if (!l2arc_write_eligible(guid, ab)) {
+			/* the L2ARC only takes uncompressed buffers */
+			if (ab->b_buf == NULL ||
+			    !l2arc_write_eligible(guid, ab)) {
 				mutex_exit(hash_lock);
 				continue;
 			}
 
-			if ((write_sz + ab->b_size) > target_sz) {
+			/* leave room for the log block describing it */
+			log_sz = vdev_psize_to_asize(dev->l2ad_vdev,
+			    L2ARC_LOG_BLK_PSIZE(lb == NULL ? 1 :
+			    lb->lb_nents + 1));
+			if ((write_sz + log_write_sz + ab->b_size + log_sz) >
+			    target_sz) {
 				full = B_TRUE;
 				mutex_exit(hash_lock);
 				break;
@@ -4285,8 +5083,12 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 				    sizeof (l2arc_write_callback_t), KM_SLEEP);
 				cb->l2wcb_dev = dev;
 				cb->l2wcb_head = head;
+				cb->l2wcb_log = dev->l2ad_log;
 				pio = zio_root(spa, l2arc_write_done, cb,
 				    ZIO_FLAG_CANFAIL);
+
+				lb = kmem_zalloc(sizeof (l2arc_log_blk_phys_t),
+				    KM_SLEEP);
 			}
 
 			/*
@@ -4309,6 +5111,15 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 			arc_cksum_verify(ab->b_buf);
 			arc_cksum_compute(ab->b_buf, B_TRUE);
 
+			le = &lb->lb_entries[lb->lb_nents++];
+			le->le_dva = ab->b_dva;
+			le->le_birth = ab->b_birth;
+			le->le_cksum0 = ab->b_cksum.zc_word[0];
+			le->le_size = ab->b_size;
+			le->le_type = ab->b_type;
+			le->le_daddr = dev->l2ad_hand;
+			le->le_freeze_cksum = *ab->b_freeze_cksum;
+
 			mutex_exit(hash_lock);
 
 			wzio = zio_write_phys(pio, dev->l2ad_vdev,
@@ -4327,6 +5138,10 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 
 			write_sz += buf_sz;
 			dev->l2ad_hand += buf_sz;
+
+			if (lb->lb_nents == L2ARC_LOG_BLK_ENTRIES)
+				log_write_sz +=
+				    l2arc_log_blk_commit(cb, pio, lb);
 		}
 
 		mutex_exit(list_lock);
@@ -4334,6 +5149,7 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 		if (full == B_TRUE)
 			break;
 	}
+	l2arc_sublist_next++;
 	mutex_exit(&l2arc_buflist_mtx);
 
 	if (pio == NULL) {
@@ -4342,10 +5158,15 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 		return (0);
 	}
 
-	ASSERT3U(write_sz, <=, target_sz);
+	if (lb->lb_nents > 0)
+		log_write_sz += l2arc_log_blk_commit(cb, pio, lb);
+	kmem_free(lb, sizeof (l2arc_log_blk_phys_t));
+
 	ARCSTAT_BUMP(arcstat_l2_writes_sent);
-	ARCSTAT_INCR(arcstat_l2_write_bytes, write_sz);
+	ARCSTAT_INCR(arcstat_l2_write_bytes, write_sz + log_write_sz);
 	ARCSTAT_INCR(arcstat_l2_size, write_sz);
+	write_sz += log_write_sz;
+	ASSERT3U(write_sz, <=, target_sz);
 	vdev_space_update(dev->l2ad_vdev, write_sz, 0, 0);
 
 	/*
@@ -4361,7 +5182,8 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 	}
 
 	dev->l2ad_writing = B_TRUE;
-	(void) zio_wait(pio);
+	if (zio_wait(pio) == 0)
+		l2arc_dev_hdr_update(dev);
 	dev->l2ad_writing = B_FALSE;
 
 	return (write_sz);
@@ -4454,6 +5276,231 @@ l2arc_feed_thread(void)
 	thread_exit();
 }
 
+/*
+ * Take the config lock the way arc_read() does for its L2ARC reads.  It is
+ * held as writer while the pool adds the device, so wait for that, unless
+ * the device is on its way out.
+ */
+static boolean_t
+l2arc_rebuild_enter(l2arc_dev_t *dev)
+{
+	while (!spa_config_tryenter(dev->l2ad_spa, SCL_L2ARC, dev,
+	    RW_READER)) {
+		if (dev->l2ad_rebuild_cancel)
+			return (B_FALSE);
+		delay(hz / 10);
+	}
+	if (dev->l2ad_rebuild_cancel) {
+		spa_config_exit(dev->l2ad_spa, SCL_L2ARC, dev);
+		return (B_FALSE);
+	}
+	return (B_TRUE);
+}
+
+static int
+l2arc_rebuild_read(l2arc_dev_t *dev, uint64_t daddr, uint64_t psize,
+    void *data)
+{
+	return (zio_wait(zio_read_phys(NULL, dev->l2ad_vdev, daddr, psize,
+	    data, ZIO_CHECKSUM_OFF, NULL, NULL, ZIO_PRIORITY_ASYNC_READ,
+	    ZIO_FLAG_DONT_CACHE | ZIO_FLAG_CANFAIL | ZIO_FLAG_DONT_PROPAGATE |
+	    ZIO_FLAG_DONT_RETRY, B_FALSE)));
+}
+
+/*
+ * Is this the header l2arc_dev_hdr_update() wrote for this very device?
+ */
+static boolean_t
+l2arc_dev_hdr_valid(l2arc_dev_t *dev, l2arc_dev_hdr_phys_t *dh)
+{
+	zio_cksum_t cksum;
+
+	if (dh->dh_magic != L2ARC_DEV_HDR_MAGIC ||
+	    dh->dh_version != L2ARC_DEV_HDR_VERSION)
+		return (B_FALSE);
+
+	fletcher_4_native(dh, offsetof(l2arc_dev_hdr_phys_t, dh_cksum),
+	    &cksum);
+	if (!ZIO_CHECKSUM_EQUAL(cksum, dh->dh_cksum))
+		return (B_FALSE);
+
+	return (dh->dh_spa_guid == spa_guid(dev->l2ad_spa) &&
+	    dh->dh_vdev_guid == dev->l2ad_vdev->vdev_guid &&
+	    dh->dh_start == dev->l2ad_start && dh->dh_end == dev->l2ad_end &&
+	    dh->dh_hand >= dh->dh_start && dh->dh_hand <= dh->dh_end &&
+	    dh->dh_evict >= dh->dh_start && dh->dh_evict <= dh->dh_end);
+}
+
+/*
+ * Recreate the header of a buffer found in a log block, as l2arc_evict()
+ * would have left it: in arc_l2c_only, with no data in memory.
+ */
+static void
+l2arc_rebuild_buf(l2arc_dev_t *dev, l2arc_log_ent_phys_t *le)
+{
+	arc_buf_hdr_t *hdr, *exists;
+	l2arc_buf_hdr_t *l2hdr;
+	kmutex_t *hash_lock;
+
+	hdr = kmem_cache_alloc(hdr_cache, KM_PUSHPAGE);
+	ASSERT(BUF_EMPTY(hdr));
+	hdr->b_dva = le->le_dva;
+	hdr->b_birth = le->le_birth;
+	hdr->b_cksum.zc_word[0] = le->le_cksum0;
+	hdr->b_size = le->le_size;
+	hdr->b_type = le->le_type;
+	hdr->b_spa = spa_guid(dev->l2ad_spa);
+	hdr->b_state = arc_anon;
+	hdr->b_arc_access = 0;
+	hdr->b_flags = ARC_L2CACHE;
+
+	exists = buf_hash_insert(hdr, &hash_lock);
+	if (exists != NULL) {
+		/* read back in since the device was added */
+		mutex_exit(hash_lock);
+		bzero(&hdr->b_dva, sizeof (dva_t));
+		hdr->b_birth = 0;
+		bzero(&hdr->b_cksum, sizeof (zio_cksum_t));
+		hdr->b_blkprop = 0;
+		kmem_cache_free(hdr_cache, hdr);
+		ARCSTAT_BUMP(arcstat_l2_rebuild_bufs_precached);
+		return;
+	}
+
+	hdr->b_freeze_cksum = kmem_alloc(sizeof (zio_cksum_t), KM_SLEEP);
+	*hdr->b_freeze_cksum = le->le_freeze_cksum;
+
+	l2hdr = kmem_zalloc(sizeof (l2arc_buf_hdr_t), KM_SLEEP);
+	l2hdr->b_dev = dev;
+	l2hdr->b_daddr = le->le_daddr;
+	hdr->b_l2hdr = l2hdr;
+
+	/*
+	 * We go from the newest buffers to the oldest, so they end up in
+	 * the order l2arc_evict() expects.
+	 */
+	mutex_enter(&l2arc_buflist_mtx);
+	list_insert_tail(dev->l2ad_buflist, hdr);
+	mutex_exit(&l2arc_buflist_mtx);
+	ARCSTAT_INCR(arcstat_l2_size, hdr->b_size);
+
+	arc_change_state(arc_l2c_only, hdr, hash_lock);
+	mutex_exit(hash_lock);
+
+	ARCSTAT_BUMP(arcstat_l2_rebuild_bufs);
+}
+
+/*
+ * Reload the contents of a cache device from its log blocks; see the
+ * comment above L2ARC_DEV_HDR_MAGIC.  The device is not fed until we are
+ * done.
+ *
+ * Log blocks are written in address order, one lap of the device after
+ * the other, so walking back from the newest one their addresses must go
+ * down: first below the hand, in the current lap, then, once only and if
+ * the device has wrapped, from the end of the device down to where
+ * l2arc_evict() got to, in the previous lap.  Anything else has been
+ * written over.
+ */
+static void
+l2arc_rebuild_thread(l2arc_dev_t *dev)
+{
+	vdev_t *vd = dev->l2ad_vdev;
+	uint64_t lbsize = L2ARC_LOG_BLK_PSIZE(L2ARC_LOG_BLK_ENTRIES);
+	l2arc_dev_hdr_phys_t *dh;
+	l2arc_log_blk_phys_t *lb;
+	l2arc_log_ent_phys_t *le;
+	l2arc_log_ptr_t lp;
+	zio_cksum_t cksum;
+	uint64_t lo, hi, asize;
+	boolean_t wrapped = B_FALSE;
+	int i;
+
+	dh = zio_buf_alloc(L2ARC_DEV_HDR_SIZE);
+	lb = zio_buf_alloc(lbsize);
+
+	if (!l2arc_rebuild_enter(dev))
+		goto out;
+
+	if (l2arc_rebuild_read(dev, VDEV_LABEL_START_SIZE, L2ARC_DEV_HDR_SIZE,
+	    dh) != 0 || !l2arc_dev_hdr_valid(dev, dh)) {
+		spa_config_exit(dev->l2ad_spa, SCL_L2ARC, dev);
+		goto out;
+	}
+
+	/* carry on where the device left off */
+	dev->l2ad_hand = dh->dh_hand;
+	dev->l2ad_evict = dh->dh_evict;
+	dev->l2ad_first = (dh->dh_flags & L2ARC_DEV_HDR_FIRST) != 0;
+	dev->l2ad_log = dh->dh_log;
+	vdev_space_update(vd, dev->l2ad_hand - dev->l2ad_start +
+	    (dev->l2ad_first ? 0 : dev->l2ad_end - dev->l2ad_evict), 0, 0);
+
+	lo = dev->l2ad_start;
+	hi = dev->l2ad_hand;
+	lp = dh->dh_log;
+
+	while (lp.lp_daddr != 0) {
+		asize = vdev_psize_to_asize(vd, lp.lp_psize);
+		if (lp.lp_daddr < lo || lp.lp_daddr + asize > hi) {
+			if (wrapped || dev->l2ad_first)
+				break;
+			wrapped = B_TRUE;
+			lo = dev->l2ad_evict;
+			hi = dev->l2ad_end;
+			continue;
+		}
+
+		if (lp.lp_psize < L2ARC_LOG_BLK_PSIZE(1) ||
+		    lp.lp_psize > lbsize ||
+		    l2arc_rebuild_read(dev, lp.lp_daddr, lp.lp_psize, lb) != 0)
+			break;
+
+		fletcher_4_native(lb, lp.lp_psize, &cksum);
+		if (!ZIO_CHECKSUM_EQUAL(cksum, lp.lp_cksum) ||
+		    lb->lb_magic != L2ARC_LOG_BLK_MAGIC ||
+		    lb->lb_nents == 0 || lb->lb_nents > L2ARC_LOG_BLK_ENTRIES ||
+		    L2ARC_LOG_BLK_PSIZE(lb->lb_nents) != lp.lp_psize)
+			break;
+
+		/* the buffers of a log block were written just before it */
+		for (i = lb->lb_nents - 1; i >= 0; i--) {
+			le = &lb->lb_entries[i];
+			if (le->le_size == 0 || le->le_size > SPA_MAXBLOCKSIZE ||
+			    le->le_type >= ARC_BUFC_NUMTYPES ||
+			    le->le_daddr < lo || le->le_daddr +
+			    vdev_psize_to_asize(vd, le->le_size) > lp.lp_daddr)
+				continue;
+			l2arc_rebuild_buf(dev, le);
+		}
+		ARCSTAT_BUMP(arcstat_l2_rebuild_log_blks);
+
+		hi = lp.lp_daddr;
+		lp = lb->lb_prev;
+
+		/* let device removal and the rest of the pool get a look in */
+		spa_config_exit(dev->l2ad_spa, SCL_L2ARC, dev);
+		if (arc_reclaim_needed()) {
+			ARCSTAT_BUMP(arcstat_l2_rebuild_abort_lowmem);
+			goto out;
+		}
+		if (!l2arc_rebuild_enter(dev))
+			goto out;
+	}
+	spa_config_exit(dev->l2ad_spa, SCL_L2ARC, dev);
+
+out:
+	zio_buf_free(dh, L2ARC_DEV_HDR_SIZE);
+	zio_buf_free(lb, lbsize);
+
+	mutex_enter(&l2arc_dev_mtx);
+	dev->l2ad_rebuild = B_FALSE;
+	cv_broadcast(&l2arc_rebuild_cv);
+	mutex_exit(&l2arc_dev_mtx);
+
+	thread_exit();
+}
+
 boolean_t
 l2arc_vdev_present(vdev_t *vd)
 {
@@ -4489,7 +5536,8 @@ l2arc_add_vdev(spa_t *spa, vdev_t *vd)
 	adddev->l2ad_vdev = vd;
 	adddev->l2ad_write = l2arc_write_max;
 	adddev->l2ad_boost = l2arc_write_boost;
-	adddev->l2ad_start = VDEV_LABEL_START_SIZE;
+	adddev->l2ad_start = VDEV_LABEL_START_SIZE +
+	    vdev_psize_to_asize(vd, L2ARC_DEV_HDR_SIZE);
 	adddev->l2ad_end = VDEV_LABEL_START_SIZE + vdev_get_min_asize(vd);
 	adddev->l2ad_hand = adddev->l2ad_start;
 	adddev->l2ad_evict = adddev->l2ad_start;
@@ -4510,10 +5558,15 @@ l2arc_add_vdev(spa_t *spa, vdev_t *vd)
 	/*
 	 * Add device to global list
 	 */
+	adddev->l2ad_rebuild = l2arc_rebuild_enabled;
 	mutex_enter(&l2arc_dev_mtx);
 	list_insert_head(l2arc_dev_list, adddev);
 	atomic_inc_64(&l2arc_ndev);
 	mutex_exit(&l2arc_dev_mtx);
+
+	if (adddev->l2ad_rebuild)
+		(void) thread_create(NULL, 0, l2arc_rebuild_thread, adddev, 0,
+		    &p0, TS_RUN, minclsyspri);
 }
 
 /*
@@ -4543,6 +5596,13 @@ l2arc_remove_vdev(vdev_t *vd)
 	list_remove(l2arc_dev_list, remdev);
 	l2arc_dev_last = NULL;		/* may have been invalidated */
 	atomic_dec_64(&l2arc_ndev);
+
+	/*
+	 * Stop a rebuild still in progress.
+	 */
+	remdev->l2ad_rebuild_cancel = B_TRUE;
+	while (remdev->l2ad_rebuild)
+		cv_wait(&l2arc_rebuild_cv, &l2arc_dev_mtx);
 	mutex_exit(&l2arc_dev_mtx);
 
 	/*
@@ -4564,6 +5624,7 @@ l2arc_init(void)
 
 	mutex_init(&l2arc_feed_thr_lock, NULL, MUTEX_DEFAULT, NULL);
 	cv_init(&l2arc_feed_thr_cv, NULL, CV_DEFAULT, NULL);
+	cv_init(&l2arc_rebuild_cv, NULL, CV_DEFAULT, NULL);
 	mutex_init(&l2arc_dev_mtx, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&l2arc_buflist_mtx, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&l2arc_free_on_write_mtx, NULL, MUTEX_DEFAULT, NULL);
@@ -4589,6 +5650,7 @@ l2arc_fini(void)
 
 	mutex_destroy(&l2arc_feed_thr_lock);
 	cv_destroy(&l2arc_feed_thr_cv);
+	cv_destroy(&l2arc_rebuild_cv);
 	mutex_destroy(&l2arc_dev_mtx);
 	mutex_destroy(&l2arc_buflist_mtx);
 	mutex_destroy(&l2arc_free_on_write_mtx);
@@ -0,0 +1,453 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+#include <sys/zfs_context.h>
+#include <sys/spa.h>
+#include <sys/spa_impl.h>
+#include <sys/arc.h>
+#include <sys/dmu.h>
+#include <sys/txg.h>
+#include <sys/avl.h>
+#include <sys/kstat.h>
+#include <sys/fs/zfs.h>
+#include <zfs_fletcher.h>
+#ifdef _KERNEL
+#include <sys/kobj.h>
+#endif
+
+/*
+ * ARC warm start.
+ *
+ * When a pool is unloaded (export or daemon shutdown), the block pointers
+ * of the hottest buffers it has in the ARC are written to
+ * <zfs_arc_warm_dir>/<pool guid>.warm: metadata first, then MFU before
+ * MRU, most recently used first, at most zfs_arc_warm_max of them.  The
+ * next time the pool is loaded the file is read and removed, and a thread
+ * prefetches the blocks back into the ARC, zfs_arc_warm_rate blocks per
+ * second at most, until the list is done or the ARC is nearly full.
+ *
+ * The list is only used if the pool has not moved on since it was
+ * written, i.e. if it was not imported and written to somewhere else in
+ * between.  Blocks are read as speculative prefetches, checked against
+ * their checksum like any other, so a stale entry costs one read.
+ */
+
+int zfs_arc_warm = 0;				/* save and reload the list */
+uint64_t zfs_arc_warm_max = 65536;		/* blocks in the list */
+uint64_t zfs_arc_warm_rate = 2000;		/* blocks per second */
+char *zfs_arc_warm_dir = ZPOOL_CACHE_DIR;
+
+#define	ARC_WARM_MAGIC		0x41524357726d7374ULL	/* "ARCWrmst" */
+#define	ARC_WARM_VERSION	1
+
+/*
+ * Txgs a pool may sync between the list being written and the end of
+ * spa_unload(): the final sync of an export, and txg_sync_stop() syncing
+ * out the open and deferred txgs.
+ */
+#define	ARC_WARM_TXG_SLACK	(TXG_CONCURRENT_STATES + TXG_DEFER_SIZE + 1)
+
+/* reads are issued this many times per second */
+#define	ARC_WARM_TICKS		10
+
+typedef struct arc_warm_phys {
+	uint64_t	awp_magic;
+	uint64_t	awp_version;
+	uint64_t	awp_pool_guid;
+	uint64_t	awp_txg;	/* last synced txg when written */
+	uint64_t	awp_nents;
+	zio_cksum_t	awp_cksum;	/* fletcher4 of the block pointers */
+	blkptr_t	awp_bps[1];
+} arc_warm_phys_t;
+
+#define	ARC_WARM_PHYS_SIZE(n)	\
+	(offsetof(arc_warm_phys_t, awp_bps) + (n) * sizeof (blkptr_t))
+
+typedef struct arc_warm_node {
+	avl_node_t	awn_avl;
+	int		awn_rank;	/* lower is hotter */
+	clock_t		awn_atime;
+	blkptr_t	awn_bp;
+} arc_warm_node_t;
+
+typedef struct arc_warm_walk {
+	avl_tree_t	aww_tree;
+	arc_warm_node_t	*aww_nodes;
+	uint64_t	aww_used;
+	uint64_t	aww_max;
+} arc_warm_walk_t;
+
+typedef struct arc_warm_list {
+	spa_t		*awl_spa;
+	arc_warm_phys_t	*awl_phys;
+	uint64_t	awl_size;
+	uint64_t	awl_load_txg;	/* txg the pool was loaded at */
+} arc_warm_list_t;
+
+typedef struct arc_warm_stats {
+	kstat_named_t awstat_saved;
+	kstat_named_t awstat_loaded;
+	kstat_named_t awstat_stale;
+	kstat_named_t awstat_reads;
+	kstat_named_t awstat_cached;
+	kstat_named_t awstat_skipped;
+	kstat_named_t awstat_arc_full;
+} arc_warm_stats_t;
+
+static arc_warm_stats_t arc_warm_stats = {
+	{ "saved",			KSTAT_DATA_UINT64 },
+	{ "loaded",			KSTAT_DATA_UINT64 },
+	{ "stale_lists",		KSTAT_DATA_UINT64 },
+	{ "reads",			KSTAT_DATA_UINT64 },
+	{ "cached",			KSTAT_DATA_UINT64 },
+	{ "skipped",			KSTAT_DATA_UINT64 },
+	{ "arc_full",			KSTAT_DATA_UINT64 },
+};
+
+#define	AWSTAT_INCR(stat, val) \
+	atomic_add_64(&arc_warm_stats.stat.value.ui64, (val))
+
+#define	AWSTAT_BUMP(stat)	AWSTAT_INCR(stat, 1)
+
+static kstat_t *arc_warm_ksp;
+
+static void
+arc_warm_path(spa_t *spa, char *path)
+{
+	(void) snprintf(path, MAXPATHLEN, "%s/%llx.warm", zfs_arc_warm_dir,
+	    (u_longlong_t)spa_guid(spa));
+}
+
+static int
+arc_warm_compare(const void *x1, const void *x2)
+{
+	const arc_warm_node_t *n1 = x1;
+	const arc_warm_node_t *n2 = x2;
+	const blkptr_t *bp1 = &n1->awn_bp;
+	const blkptr_t *bp2 = &n2->awn_bp;
+
+	if (n1->awn_rank != n2->awn_rank)
+		return (n1->awn_rank < n2->awn_rank ? -1 : 1);
+	if (n1->awn_atime != n2->awn_atime)
+		return (n1->awn_atime > n2->awn_atime ? -1 : 1);
+	if (bp1->blk_dva[0].dva_word[1] != bp2->blk_dva[0].dva_word[1])
+		return (bp1->blk_dva[0].dva_word[1] <
+		    bp2->blk_dva[0].dva_word[1] ? -1 : 1);
+	if (bp1->blk_dva[0].dva_word[0] != bp2->blk_dva[0].dva_word[0])
+		return (bp1->blk_dva[0].dva_word[0] <
+		    bp2->blk_dva[0].dva_word[0] ? -1 : 1);
+	if (bp1->blk_birth != bp2->blk_birth)
+		return (bp1->blk_birth < bp2->blk_birth ? -1 : 1);
+	return (0);
+}
+
+/*
+ * arc_walk_cached() callback: keep the zfs_arc_warm_max hottest blocks.
+ * Runs with an ARC hash lock held, so the nodes were allocated up front.
+ */
+static void
+arc_warm_add(const blkptr_t *bp, int mru, clock_t atime, void *arg)
+{
+	arc_warm_walk_t *aww = arg;
+	arc_buf_contents_t type = BP_GET_BUFC_TYPE(bp);
+	arc_warm_node_t an, *node;
+	avl_index_t where;
+
+	an.awn_rank = mru + (type == ARC_BUFC_METADATA ? 0 : 2);
+	an.awn_atime = atime;
+	an.awn_bp = *bp;
+
+	if (avl_find(&aww->aww_tree, &an, &where) != NULL)
+		return;
+
+	if (aww->aww_used < aww->aww_max) {
+		node = &aww->aww_nodes[aww->aww_used++];
+		*node = an;
+		avl_insert(&aww->aww_tree, node, where);
+		return;
+	}
+
+	/* full: replace the coldest one if this one is hotter */
+	node = avl_last(&aww->aww_tree);
+	if (arc_warm_compare(&an, node) >= 0)
+		return;
+	avl_remove(&aww->aww_tree, node);
+	*node = an;
+	avl_add(&aww->aww_tree, node);
+}
+
+static void
+arc_warm_write(char *path, void *buf, uint64_t buflen)
+{
+	int oflags = FWRITE | FTRUNC | FCREAT | FOFFMAX;
+	char *temp;
+	vnode_t *vp;
+
+	/* same dance as spa_config_write() */
+	temp = kmem_zalloc(MAXPATHLEN, KM_SLEEP);
+	(void) snprintf(temp, MAXPATHLEN, "%s.tmp", path);
+
+	if (vn_open(temp, UIO_SYSSPACE, oflags, 0644, &vp, CRCREAT, 0) == 0) {
+		if (vn_rdwr(UIO_WRITE, vp, buf, buflen, 0, UIO_SYSSPACE,
+		    0, RLIM64_INFINITY, kcred, NULL) == 0 &&
+		    VOP_FSYNC(vp, FSYNC, kcred, NULL) == 0) {
+			(void) vn_rename(temp, path, UIO_SYSSPACE);
+		}
+		(void) VOP_CLOSE(vp, oflags, 1, 0, kcred, NULL);
+		VN_RELE(vp);
+	}
+
+	(void) vn_remove(temp, UIO_SYSSPACE, RMFILE);
+
+	kmem_free(temp, MAXPATHLEN);
+}
+
+/*
+ * Write the warm start list of the pool.  Called from spa_unload(), before
+ * dsl_pool_close() flushes the buffers of the pool out of the ARC.
+ */
+void
+arc_warm_save(spa_t *spa)
+{
+	arc_warm_walk_t aww;
+	arc_warm_node_t *node;
+	arc_warm_phys_t *awp;
+	uint64_t size, n, i;
+	char *path;
+	void *cookie = NULL;
+
+	if (!zfs_arc_warm || zfs_arc_warm_max == 0)
+		return;
+
+	aww.aww_max = zfs_arc_warm_max;
+	aww.aww_used = 0;
+	aww.aww_nodes = kmem_alloc(aww.aww_max * sizeof (arc_warm_node_t),
+	    KM_SLEEP);
+	avl_create(&aww.aww_tree, arc_warm_compare, sizeof (arc_warm_node_t),
+	    offsetof(arc_warm_node_t, awn_avl));
+
+	arc_walk_cached(spa, arc_warm_add, &aww);
+
+	n = avl_numnodes(&aww.aww_tree);
+	size = ARC_WARM_PHYS_SIZE(n);
+	awp = kmem_alloc(size, KM_SLEEP);
+	awp->awp_magic = ARC_WARM_MAGIC;
+	awp->awp_version = ARC_WARM_VERSION;
+	awp->awp_pool_guid = spa_guid(spa);
+	awp->awp_txg = spa_last_synced_txg(spa);
+	awp->awp_nents = n;
+	for (node = avl_first(&aww.aww_tree), i = 0; node != NULL;
+	    node = AVL_NEXT(&aww.aww_tree, node), i++)
+		awp->awp_bps[i] = node->awn_bp;
+	fletcher_4_native(awp->awp_bps, n * sizeof (blkptr_t), &awp->awp_cksum);
+
+	while (avl_destroy_nodes(&aww.aww_tree, &cookie) != NULL)
+		continue;
+	avl_destroy(&aww.aww_tree);
+	kmem_free(aww.aww_nodes, aww.aww_max * sizeof (arc_warm_node_t));
+
+	path = kmem_alloc(MAXPATHLEN, KM_SLEEP);
+	arc_warm_path(spa, path);
+	if (n > 0)
+		arc_warm_write(path, awp, size);
+	else
+		(void) vn_remove(path, UIO_SYSSPACE, RMFILE);
+	kmem_free(path, MAXPATHLEN);
+	kmem_free(awp, size);
+
+	AWSTAT_INCR(awstat_saved, n);
+}
+
+static void
+arc_warm_thread(arc_warm_list_t *awl)
+{
+	spa_t *spa = awl->awl_spa;
+	arc_warm_phys_t *awp = awl->awl_phys;
+	zbookmark_t zb = { 0 };
+	blkptr_t *bp;
+	uint64_t i = 0, batch;
+	clock_t next;
+	zio_t *pio;
+
+	mutex_enter(&spa->spa_warm_lock);
+	while (!spa->spa_warm_exit && i < awp->awp_nents) {
+		mutex_exit(&spa->spa_warm_lock);
+
+		if (!arc_prefetch_room()) {
+			AWSTAT_BUMP(awstat_arc_full);
+			mutex_enter(&spa->spa_warm_lock);
+			break;
+		}
+
+		next = lbolt + MAX(hz / ARC_WARM_TICKS, 1);
+		batch = MAX(zfs_arc_warm_rate / ARC_WARM_TICKS, 1);
+
+		pio = zio_root(spa, NULL, NULL, ZIO_FLAG_CANFAIL);
+		for (; batch > 0 && i < awp->awp_nents; batch--, i++) {
+			uint32_t aflags = ARC_NOWAIT | ARC_PREFETCH;
+
+			bp = &awp->awp_bps[i];
+			/* from after the txg we loaded: the pool rewound */
+			if (bp->blk_birth > awl->awl_load_txg) {
+				AWSTAT_BUMP(awstat_skipped);
+				continue;
+			}
+			zb.zb_level = BP_GET_LEVEL(bp);
+			(void) arc_read_nolock(pio, spa, bp, NULL, NULL,
+			    ZIO_PRIORITY_ASYNC_READ,
+			    ZIO_FLAG_CANFAIL | ZIO_FLAG_SPECULATIVE, &aflags, &zb);
+			if (aflags & ARC_CACHED)
+				AWSTAT_BUMP(awstat_cached);
+			else
+				AWSTAT_BUMP(awstat_reads);
+		}
+		(void) zio_wait(pio);
+
+		mutex_enter(&spa->spa_warm_lock);
+		while (!spa->spa_warm_exit && lbolt < next)
+			(void) cv_timedwait(&spa->spa_warm_cv,
+			    &spa->spa_warm_lock, next);
+	}
+
+	spa->spa_warm_thread = NULL;
+	cv_broadcast(&spa->spa_warm_cv);
+	mutex_exit(&spa->spa_warm_lock);
+
+	kmem_free(awp, awl->awl_size);
+	kmem_free(awl, sizeof (arc_warm_list_t));
+
+	thread_exit();
+}
+
+/*
+ * Read the warm start list of the pool, if there is one, and start
+ * prefetching it.  Called at the end of spa_load(), with the pool
+ * writeable and syncing.
+ */
+void
+arc_warm_load(spa_t *spa)
+{
+	arc_warm_phys_t *awp = NULL;
+	arc_warm_list_t *awl;
+	struct _buf *file;
+	zio_cksum_t cksum;
+	uint64_t fsize;
+	char *path;
+
+	if (!zfs_arc_warm)
+		return;
+
+	path = kmem_alloc(MAXPATHLEN, KM_SLEEP);
+	arc_warm_path(spa, path);
+
+	file = kobj_open_file(path);
+	if (file == (struct _buf *)-1) {
+		kmem_free(path, MAXPATHLEN);
+		return;
+	}
+
+	if (kobj_get_filesize(file, &fsize) != 0 ||
+	    fsize < ARC_WARM_PHYS_SIZE(1)) {
+		fsize = 0;
+	} else {
+		awp = kmem_alloc(fsize, KM_SLEEP);
+		if (kobj_read_file(file, (char *)awp, fsize, 0) < 0) {
+			kmem_free(awp, fsize);
+			awp = NULL;
+		}
+	}
+	kobj_close_file(file);
+
+	/* used once: a crash from now on must not find it again */
+	(void) vn_remove(path, UIO_SYSSPACE, RMFILE);
+	kmem_free(path, MAXPATHLEN);
+
+	if (awp == NULL)
+		return;
+
+	if (awp->awp_magic != ARC_WARM_MAGIC ||
+	    awp->awp_version != ARC_WARM_VERSION ||
+	    awp->awp_pool_guid != spa_guid(spa) ||
+	    awp->awp_nents == 0 ||
+	    ARC_WARM_PHYS_SIZE(awp->awp_nents) != fsize ||
+	    spa->spa_load_txg < awp->awp_txg ||
+	    spa->spa_load_txg > awp->awp_txg + ARC_WARM_TXG_SLACK)
+		goto stale;
+
+	fletcher_4_native(awp->awp_bps, awp->awp_nents * sizeof (blkptr_t),
+	    &cksum);
+	if (!ZIO_CHECKSUM_EQUAL(cksum, awp->awp_cksum))
+		goto stale;
+
+	AWSTAT_INCR(awstat_loaded, awp->awp_nents);
+
+	awl = kmem_alloc(sizeof (arc_warm_list_t), KM_SLEEP);
+	awl->awl_spa = spa;
+	awl->awl_phys = awp;
+	awl->awl_size = fsize;
+	awl->awl_load_txg = spa->spa_load_txg;
+
+	mutex_enter(&spa->spa_warm_lock);
+	ASSERT(spa->spa_warm_thread == NULL);
+	spa->spa_warm_exit = B_FALSE;
+	spa->spa_warm_thread = thread_create(NULL, 0, arc_warm_thread,
+	    awl, 0, &p0, TS_RUN, minclsyspri);
+	mutex_exit(&spa->spa_warm_lock);
+	return;
+
+stale:
+	AWSTAT_BUMP(awstat_stale);
+	kmem_free(awp, fsize);
+}
+
+/*
+ * Stop the warm start prefetcher of the pool and wait for it to exit.
+ */
+void
+arc_warm_stop(spa_t *spa)
+{
+	mutex_enter(&spa->spa_warm_lock);
+	spa->spa_warm_exit = B_TRUE;
+	cv_broadcast(&spa->spa_warm_cv);
+	while (spa->spa_warm_thread != NULL)
+		cv_wait(&spa->spa_warm_cv, &spa->spa_warm_lock);
+	mutex_exit(&spa->spa_warm_lock);
+}
+
+void
+arc_warm_stat_init(void)
+{
+	arc_warm_ksp = kstat_create("zfs", 0, "arc_warm_stats", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (arc_warm_stats) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+	if (arc_warm_ksp != NULL) {
+		arc_warm_ksp->ks_data = &arc_warm_stats;
+		kstat_install(arc_warm_ksp);
+	}
+}
+
+void
+arc_warm_stat_fini(void)
+{
+	if (arc_warm_ksp != NULL) {
+		kstat_delete(arc_warm_ksp);
+		arc_warm_ksp = NULL;
+	}
+}
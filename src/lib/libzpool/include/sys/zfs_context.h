@@ -317,6 +317,8 @@ extern void kstat_delete(kstat_t *);
 #define	kmem_cache_free(_c, _b)	umem_cache_free(_c, _b)
 #define	kmem_debugging()	0
 #define	kmem_cache_reap_now(c)
+#define	kmem_reap()		umem_reap()
+#define	kmem_reap_urgent()	umem_reap_urgent()
 
 typedef umem_cache_t kmem_cache_t;
 
@@ -475,6 +477,7 @@ extern void delay(clock_t ticks);
 
 #define	ptob(x)		((x) * PAGESIZE)
 
+extern int ncpus;
 extern uint64_t physmem;
 
 extern int highbit(ulong_t i);
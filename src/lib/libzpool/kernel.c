@@ -42,6 +42,7 @@
  * Emulation of kernel services in userland.
  */
 
+int ncpus;
 uint64_t physmem;
 vnode_t *rootdir = (vnode_t *)0xabcd1234;
 char hw_serial[HW_HOSTID_LEN];
@@ -72,12 +73,31 @@ zk_thread_create(void (*func)(), void *arg)
  * kstats
  * =========================================================================
  */
+/*
+ * ZFSFUSE: there is nowhere to export kstats to from here, but we still
+ * hand out the headers (of virtual kstats only) so that test programs can
+ * look at the counters through them.
+ */
 /*ARGSUSED*/
 kstat_t *
 kstat_create(char *module, int instance, char *name, char *class,
     uchar_t type, ulong_t ndata, uchar_t ks_flag)
 {
-	return (NULL);
+	kstat_t *ksp;
+
+	if (!(ks_flag & KSTAT_FLAG_VIRTUAL))
+		return (NULL);
+
+	ksp = umem_zalloc(sizeof (kstat_t), UMEM_NOFAIL);
+	(void) strlcpy(ksp->ks_module, module, KSTAT_STRLEN);
+	(void) strlcpy(ksp->ks_name, name, KSTAT_STRLEN);
+	(void) strlcpy(ksp->ks_class, class, KSTAT_STRLEN);
+	ksp->ks_instance = instance;
+	ksp->ks_type = type;
+	ksp->ks_ndata = ndata;
+	ksp->ks_flags = ks_flag;
+
+	return (ksp);
 }
 
 /*ARGSUSED*/
@@ -85,10 +105,12 @@ void
 kstat_install(kstat_t *ksp)
 {}
 
-/*ARGSUSED*/
 void
 kstat_delete(kstat_t *ksp)
-{}
+{
+	if (ksp != NULL)
+		umem_free(ksp, sizeof (kstat_t));
+}
 
 /*
  * =========================================================================
@@ -802,6 +824,7 @@ kernel_init(int mode)
 {
 	umem_nofail_callback(umem_out_of_memory);
 
+	ncpus = sysconf(_SC_NPROCESSORS_CONF);
 	physmem = sysconf(_SC_PHYS_PAGES);
 
 	dprintf("physmem = %llu pages (%.2f GB)\n", physmem,
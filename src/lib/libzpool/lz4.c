@@ -0,0 +1,393 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * LZ4 block compression.
+ *
+ * The compressed block is a sequence of (literals, match) pairs, each
+ * introduced by a token byte: the high nibble is the literal count and
+ * the low nibble the match length minus LZ4_MINMATCH.  A nibble of 15
+ * means the count continues in following bytes, each adding up to 255.
+ * The literals are copied as is, then a 16-bit little-endian offset back
+ * into the output says where the match starts.  The last sequence holds
+ * only literals.
+ *
+ * The physical block is padded up to the sector size, so the decoder
+ * cannot tell where the stream ends by itself.  Like the illumos
+ * implementation we therefore prefix the stream with its length as a
+ * 32-bit big-endian word, which keeps the on-disk format the same.
+ *
+ * The compressor is the usual greedy single-pass one: a hash table of
+ * the last position each 4-byte sequence was seen at, and a skip that
+ * grows while no match turns up so incompressible data is passed over
+ * quickly.  The table lives in a kmem cache rather than on the stack.
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/zio_compress.h>
+
+#define	LZ4_MINMATCH		4
+#define	LZ4_LASTLITERALS	5	/* the last 5 bytes are always literals */
+#define	LZ4_MFLIMIT		12	/* no match may start after iend - 12 */
+#define	LZ4_MAX_DISTANCE	65535
+#define	LZ4_SKIPSTRENGTH	6
+#define	LZ4_RUN_MASK		15
+#define	LZ4_HASHLOG		12
+#define	LZ4_HASHSIZE		(1 << LZ4_HASHLOG)
+
+#define	LZ4_HASH(v)	(((v) * 2654435761U) >> (32 - LZ4_HASHLOG))
+
+static kmem_cache_t *lz4_cache;
+
+static inline uint32_t
+lz4_read32(const uchar_t *p)
+{
+	uint32_t v;
+
+	bcopy(p, &v, sizeof (v));
+	return (v);
+}
+
+static inline uint64_t
+lz4_read64(const uchar_t *p)
+{
+	uint64_t v;
+
+	bcopy(p, &v, sizeof (v));
+	return (v);
+}
+
+/*
+ * Number of leading bytes two words have in common, given their xor.
+ */
+static inline int
+lz4_common_bytes(uint64_t diff)
+{
+#ifdef _BIG_ENDIAN
+	return (__builtin_clzll(diff) >> 3);
+#else
+	return (__builtin_ctzll(diff) >> 3);
+#endif
+}
+
+/*
+ * Copy len bytes eight at a time, possibly writing up to seven bytes past
+ * dst + len.  Also valid for overlapping matches as long as the source
+ * is at least eight bytes behind the destination.
+ */
+static inline void
+lz4_wildcopy(uchar_t *dst, const uchar_t *src, size_t len)
+{
+	uchar_t *end = dst + len;
+
+	do {
+		uint64_t v = lz4_read64(src);
+
+		bcopy(&v, dst, sizeof (v));
+		dst += sizeof (v);
+		src += sizeof (v);
+	} while (dst < end);
+}
+
+/*
+ * Emit the extra bytes of a length that did not fit into its nibble.
+ */
+static inline uchar_t *
+lz4_put_length(uchar_t *op, size_t len)
+{
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = (uchar_t)len;
+	return (op);
+}
+
+/*
+ * Compress src into dst.  Returns the compressed size, or 0 if the
+ * result would not fit into d_len bytes.
+ */
+static size_t
+lz4_compress_block(const uchar_t *src, uchar_t *dst, size_t s_len,
+    size_t d_len, uint32_t *htab)
+{
+	const uchar_t *ip = src;
+	const uchar_t *anchor = src;
+	const uchar_t *iend = src + s_len;
+	const uchar_t *mflimit = iend - LZ4_MFLIMIT;
+	const uchar_t *matchlimit = iend - LZ4_LASTLITERALS;
+	uchar_t *op = dst;
+	uchar_t *oend = dst + d_len;
+	uchar_t *token;
+	size_t len;
+
+	if (s_len < LZ4_MFLIMIT + 1)
+		goto last_literals;
+
+	bzero(htab, LZ4_HASHSIZE * sizeof (uint32_t));
+	ip++;
+
+	for (;;) {
+		const uchar_t *ref;
+		uint32_t search = 1 << LZ4_SKIPSTRENGTH;
+		uint32_t step = 1;
+		uint32_t h;
+
+		/* Find a match, skipping faster the longer we fail. */
+		for (;;) {
+			if (ip > mflimit)
+				goto last_literals;
+			h = LZ4_HASH(lz4_read32(ip));
+			ref = src + htab[h];
+			htab[h] = (uint32_t)(ip - src);
+			if (ip - ref <= LZ4_MAX_DISTANCE &&
+			    lz4_read32(ref) == lz4_read32(ip))
+				break;
+			ip += step;
+			step = search++ >> LZ4_SKIPSTRENGTH;
+		}
+
+		/* Grow the match backwards over the pending literals. */
+		while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+			ip--;
+			ref--;
+		}
+
+		/* Literal run; leave room for the offset and last literals. */
+		len = ip - anchor;
+		token = op++;
+		if (op + len + len / 255 + 2 + 1 + LZ4_LASTLITERALS > oend)
+			return (0);
+		if (len >= LZ4_RUN_MASK) {
+			*token = LZ4_RUN_MASK << 4;
+			op = lz4_put_length(op, len - LZ4_RUN_MASK);
+		} else {
+			*token = (uchar_t)(len << 4);
+		}
+		bcopy(anchor, op, len);
+		op += len;
+
+		*op++ = (uchar_t)(ip - ref);
+		*op++ = (uchar_t)((ip - ref) >> 8);
+
+		/* Extend the match forwards, a word at a time. */
+		ip += LZ4_MINMATCH;
+		ref += LZ4_MINMATCH;
+		anchor = ip;
+		while (ip + sizeof (uint64_t) <= matchlimit) {
+			uint64_t diff = lz4_read64(ip) ^ lz4_read64(ref);
+
+			if (diff != 0) {
+				ip += lz4_common_bytes(diff);
+				goto match_done;
+			}
+			ip += sizeof (uint64_t);
+			ref += sizeof (uint64_t);
+		}
+		while (ip < matchlimit && *ip == *ref) {
+			ip++;
+			ref++;
+		}
+match_done:
+		len = ip - anchor;
+		if (op + len / 255 + 1 + LZ4_LASTLITERALS > oend)
+			return (0);
+		if (len >= LZ4_RUN_MASK) {
+			*token += LZ4_RUN_MASK;
+			op = lz4_put_length(op, len - LZ4_RUN_MASK);
+		} else {
+			*token += (uchar_t)len;
+		}
+		anchor = ip;
+
+		if (ip > mflimit)
+			break;
+		h = LZ4_HASH(lz4_read32(ip - 2));
+		htab[h] = (uint32_t)(ip - 2 - src);
+	}
+
+last_literals:
+	len = iend - anchor;
+	if (op + 1 + len + (len + 255 - LZ4_RUN_MASK) / 255 > oend)
+		return (0);
+	if (len >= LZ4_RUN_MASK) {
+		*op++ = LZ4_RUN_MASK << 4;
+		op = lz4_put_length(op, len - LZ4_RUN_MASK);
+	} else {
+		*op++ = (uchar_t)(len << 4);
+	}
+	bcopy(anchor, op, len);
+	op += len;
+
+	return (op - dst);
+}
+
+/*
+ * Decompress s_len bytes of src into dst, never reading or writing out
+ * of bounds whatever the input.  Returns the decompressed size, or -1
+ * if the stream is malformed or does not fit into d_len bytes.
+ */
+static int
+lz4_decompress_block(const uchar_t *src, uchar_t *dst, size_t s_len,
+    size_t d_len)
+{
+	const uchar_t *ip = src;
+	const uchar_t *iend = src + s_len;
+	uchar_t *op = dst;
+	uchar_t *oend = dst + d_len;
+
+	for (;;) {
+		const uchar_t *ref;
+		size_t len, off;
+		uint_t token, s;
+
+		if (ip >= iend)
+			return (-1);
+		token = *ip++;
+
+		len = token >> 4;
+		if (len == LZ4_RUN_MASK) {
+			do {
+				if (ip >= iend)
+					return (-1);
+				s = *ip++;
+				len += s;
+			} while (s == 255);
+		}
+		if (len > iend - ip || len > oend - op)
+			return (-1);
+		if (iend - ip >= len + 8 && oend - op >= len + 8)
+			lz4_wildcopy(op, ip, len);
+		else
+			bcopy(ip, op, len);
+		ip += len;
+		op += len;
+
+		/* Only the last sequence ends without a match. */
+		if (ip == iend)
+			break;
+
+		if (iend - ip < 2)
+			return (-1);
+		off = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (off == 0 || off > op - dst)
+			return (-1);
+		ref = op - off;
+
+		len = token & LZ4_RUN_MASK;
+		if (len == LZ4_RUN_MASK) {
+			do {
+				if (ip >= iend)
+					return (-1);
+				s = *ip++;
+				len += s;
+			} while (s == 255);
+		}
+		len += LZ4_MINMATCH;
+		if (len > oend - op)
+			return (-1);
+
+		if (off >= 8 && oend - op >= len + 8) {
+			lz4_wildcopy(op, ref, len);
+			op += len;
+		} else if (off >= len) {
+			bcopy(ref, op, len);
+			op += len;
+		} else {
+			/* Overlapping match: replicate the last off bytes. */
+			while (len-- != 0)
+				*op++ = *ref++;
+		}
+	}
+
+	return ((int)(op - dst));
+}
+
+/*ARGSUSED*/
+size_t
+lz4_compress(void *s_start, void *d_start, size_t s_len, size_t d_len, int n)
+{
+	uchar_t *dst = d_start;
+	uint32_t *htab;
+	size_t bufsiz;
+
+	if (d_len < sizeof (uint32_t))
+		return (s_len);
+
+	htab = kmem_cache_alloc(lz4_cache, KM_NOSLEEP);
+	if (htab == NULL)
+		return (s_len);
+
+	bufsiz = lz4_compress_block(s_start, dst + sizeof (uint32_t), s_len,
+	    d_len - sizeof (uint32_t), htab);
+
+	kmem_cache_free(lz4_cache, htab);
+
+	if (bufsiz == 0)
+		return (s_len);
+
+	dst[0] = (uchar_t)(bufsiz >> 24);
+	dst[1] = (uchar_t)(bufsiz >> 16);
+	dst[2] = (uchar_t)(bufsiz >> 8);
+	dst[3] = (uchar_t)bufsiz;
+
+	return (bufsiz + sizeof (uint32_t));
+}
+
+/*ARGSUSED*/
+int
+lz4_decompress(void *s_start, void *d_start, size_t s_len, size_t d_len, int n)
+{
+	const uchar_t *src = s_start;
+	size_t bufsiz;
+
+	if (s_len < sizeof (uint32_t))
+		return (-1);
+
+	bufsiz = ((size_t)src[0] << 24) | ((size_t)src[1] << 16) |
+	    ((size_t)src[2] << 8) | (size_t)src[3];
+	if (bufsiz > s_len - sizeof (uint32_t))
+		return (-1);
+
+	if (lz4_decompress_block(src + sizeof (uint32_t), d_start, bufsiz,
+	    d_len) != (int)d_len)
+		return (-1);
+
+	return (0);
+}
+
+void
+lz4_init(void)
+{
+	lz4_cache = kmem_cache_create("lz4_cache",
+	    LZ4_HASHSIZE * sizeof (uint32_t), 0, NULL, NULL, NULL, NULL,
+	    NULL, 0);
+}
+
+void
+lz4_fini(void)
+{
+	if (lz4_cache != NULL) {
+		kmem_cache_destroy(lz4_cache);
+		lz4_cache = NULL;
+	}
+}
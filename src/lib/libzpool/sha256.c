@@ -24,6 +24,8 @@
  */
 #include <sys/zfs_context.h>
 #include <sys/zio.h>
+#include <sys/zio_checksum.h>
+#include <sys/kstat.h>
 #include <openssl/sha.h>
 
 void
@@ -48,3 +50,473 @@ zio_checksum_SHA256(const void *buf, uint64_t size, zio_cksum_t *zcp)
 	zcp->zc_word[2] = BE_64(tmp.zc_word[2]);
 	zcp->zc_word[3] = BE_64(tmp.zc_word[3]);
 }
+
+/*
+ * Multi-buffer SHA-256.
+ *
+ * SHA-256 can't be sped up much within one buffer, every round depending on
+ * the one before, but several buffers can be hashed side by side with one
+ * buffer per 32-bit lane of a vector register: 4 lanes with SSE2 or NEON,
+ * 8 with AVX2.  Buffers shorter than the others drop out when their last
+ * block is done, and once a single lane is left it is finished with plain C.
+ *
+ * OpenSSL's own code, which uses the SHA extensions (SHA-NI) where the CPU
+ * has them, can still be faster than any of this, so zio_sha256_init() times
+ * them all and zio_sha256_lanes() tells the write pipeline whether batching
+ * blocks up for zio_checksum_SHA256_multi() is worth it.
+ */
+
+static const uint32_t sha256_K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const uint32_t sha256_H0[8] = {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+	0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+#define	SHA256_MB_MAXLANES	8
+
+/*
+ * The round functions, written so that they work on plain uint32_t and on
+ * GCC vectors of them alike.
+ */
+#define	ROTR(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+#define	SIGMA0(x)	(ROTR(x, 2) ^ ROTR(x, 13) ^ ROTR(x, 22))
+#define	SIGMA1(x)	(ROTR(x, 6) ^ ROTR(x, 11) ^ ROTR(x, 25))
+#define	sigma0(x)	(ROTR(x, 7) ^ ROTR(x, 18) ^ ((x) >> 3))
+#define	sigma1(x)	(ROTR(x, 17) ^ ROTR(x, 19) ^ ((x) >> 10))
+#define	CH(x, y, z)	(((x) & (y)) ^ (~(x) & (z)))
+#define	MAJ(x, y, z)	(((x) & (y)) | ((z) & ((x) | (y))))
+
+/*
+ * One round, with the roles of the working variables passed in rather than
+ * shifted along, and the message schedule for rounds 16 to 63 kept in a
+ * ring of 16 words in w[].
+ */
+#define	SHA256_W(t)							\
+	(w[(t) & 15] += sigma1(w[((t) - 2) & 15]) + w[((t) - 7) & 15] +	\
+	    sigma0(w[((t) - 15) & 15]))
+
+#define	SHA256_ROUND(a, b, c, d, e, f, g, h, t, wt)			\
+	t1 = h + SIGMA1(e) + CH(e, f, g) + sha256_K[t] + (wt);		\
+	d += t1;							\
+	h = t1 + SIGMA0(a) + MAJ(a, b, c)
+
+#define	SHA256_ROUNDS8(t, W)						\
+	SHA256_ROUND(a, b, c, d, e, f, g, h, (t) + 0, W((t) + 0));	\
+	SHA256_ROUND(h, a, b, c, d, e, f, g, (t) + 1, W((t) + 1));	\
+	SHA256_ROUND(g, h, a, b, c, d, e, f, (t) + 2, W((t) + 2));	\
+	SHA256_ROUND(f, g, h, a, b, c, d, e, (t) + 3, W((t) + 3));	\
+	SHA256_ROUND(e, f, g, h, a, b, c, d, (t) + 4, W((t) + 4));	\
+	SHA256_ROUND(d, e, f, g, h, a, b, c, (t) + 5, W((t) + 5));	\
+	SHA256_ROUND(c, d, e, f, g, h, a, b, (t) + 6, W((t) + 6));	\
+	SHA256_ROUND(b, c, d, e, f, g, h, a, (t) + 7, W((t) + 7))
+
+#define	SHA256_W0(t)	w[t]
+
+/*
+ * 64 rounds on s[0..7] with the 16 words of the block already in w[].
+ */
+#define	SHA256_ROUNDS(s, w, type)					\
+{									\
+	type a = s[0], b = s[1], c = s[2], d = s[3];			\
+	type e = s[4], f = s[5], g = s[6], h = s[7], t1;		\
+	int t;								\
+									\
+	SHA256_ROUNDS8(0, SHA256_W0);					\
+	SHA256_ROUNDS8(8, SHA256_W0);					\
+	for (t = 16; t < 64; t += 8) {					\
+		SHA256_ROUNDS8(t, SHA256_W);				\
+	}								\
+	s[0] += a; s[1] += b; s[2] += c; s[3] += d;			\
+	s[4] += e; s[5] += f; s[6] += g; s[7] += h;			\
+}
+
+static uint32_t
+sha256_be32(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+	    (uint32_t)p[2] << 8 | p[3]);
+}
+
+static void
+sha256_compress(uint32_t *s, const uint8_t *blk)
+{
+	uint32_t w[16];
+	int t;
+
+	for (t = 0; t < 16; t++)
+		w[t] = sha256_be32(blk + 4 * t);
+	SHA256_ROUNDS(s, w, uint32_t);
+}
+
+/*
+ * One buffer being hashed: its whole blocks straight from the buffer, then
+ * one or two blocks of the tail and padding from sl_pad.
+ */
+typedef struct sha256_lane {
+	const uint8_t	*sl_data;
+	uint64_t	sl_blocks;	/* whole blocks left in sl_data */
+	int		sl_npad;	/* blocks left in sl_pad */
+	int		sl_done;
+	uint8_t		*sl_padp;
+	uint8_t		sl_pad[128];
+	zio_cksum_t	*sl_zcp;
+} sha256_lane_t;
+
+static void
+sha256_lane_init(sha256_lane_t *sl, const void *buf, uint64_t size,
+    zio_cksum_t *zcp)
+{
+	uint64_t tail = size & 63, bits = size << 3;
+	int i, padlen;
+
+	sl->sl_data = buf;
+	sl->sl_blocks = size >> 6;
+	sl->sl_npad = tail + 9 > 64 ? 2 : 1;
+	sl->sl_done = 0;
+	sl->sl_padp = sl->sl_pad;
+	sl->sl_zcp = zcp;
+
+	padlen = sl->sl_npad * 64;
+	bzero(sl->sl_pad, padlen);
+	bcopy((const uint8_t *)buf + size - tail, sl->sl_pad, tail);
+	sl->sl_pad[tail] = 0x80;
+	for (i = 0; i < 8; i++)
+		sl->sl_pad[padlen - 1 - i] = bits >> (8 * i);
+}
+
+/* the next block of a lane, NULL once it has none left */
+static const uint8_t *
+sha256_lane_next(sha256_lane_t *sl)
+{
+	const uint8_t *blk;
+
+	if (sl->sl_blocks != 0) {
+		blk = sl->sl_data;
+		sl->sl_data += 64;
+		sl->sl_blocks--;
+	} else if (sl->sl_npad != 0) {
+		blk = sl->sl_padp;
+		sl->sl_padp += 64;
+		sl->sl_npad--;
+	} else {
+		blk = NULL;
+	}
+	return (blk);
+}
+
+static boolean_t
+sha256_lane_empty(const sha256_lane_t *sl)
+{
+	return (sl->sl_blocks == 0 && sl->sl_npad == 0);
+}
+
+/* see zio_checksum_SHA256() for the order of the words */
+static void
+sha256_lane_done(sha256_lane_t *sl, const uint32_t *s)
+{
+	sl->sl_zcp->zc_word[0] = (uint64_t)s[0] << 32 | s[1];
+	sl->sl_zcp->zc_word[1] = (uint64_t)s[2] << 32 | s[3];
+	sl->sl_zcp->zc_word[2] = (uint64_t)s[4] << 32 | s[5];
+	sl->sl_zcp->zc_word[3] = (uint64_t)s[6] << 32 | s[7];
+	sl->sl_done = 1;
+}
+
+static const uint8_t sha256_zero_block[64];
+
+/*
+ * Hash n <= lanes buffers side by side; vec_t is a GCC vector of lanes
+ * uint32_t.  Lanes that are done, or were never used, hash a block of
+ * zeroes that nobody looks at.
+ */
+#define	SHA256_MB_BODY(vec_t, lanes, sl, n)				\
+{									\
+	vec_t s[8], w[16];						\
+	const uint8_t *blk[lanes];					\
+	uint32_t st[8];							\
+	int i, j, t, left = (n);					\
+									\
+	for (j = 0; j < 8; j++)						\
+		for (i = 0; i < (lanes); i++)				\
+			s[j][i] = sha256_H0[j];				\
+									\
+	while (left > 1) {						\
+		for (i = 0; i < (lanes); i++) {				\
+			blk[i] = i < (n) ? sha256_lane_next(&sl[i]) :	\
+			    NULL;					\
+			if (blk[i] == NULL)				\
+				blk[i] = sha256_zero_block;		\
+		}							\
+		for (t = 0; t < 16; t++)				\
+			for (i = 0; i < (lanes); i++)			\
+				w[t][i] = sha256_be32(blk[i] + 4 * t);	\
+		SHA256_ROUNDS(s, w, vec_t);				\
+		for (i = 0; i < (n); i++) {				\
+			if (sl[i].sl_done || !sha256_lane_empty(&sl[i]))\
+				continue;				\
+			for (j = 0; j < 8; j++)				\
+				st[j] = s[j][i];			\
+			sha256_lane_done(&sl[i], st);			\
+			left--;						\
+		}							\
+	}								\
+									\
+	for (i = 0; i < (n); i++) {					\
+		const uint8_t *b;					\
+									\
+		if (sl[i].sl_done)					\
+			continue;					\
+		for (j = 0; j < 8; j++)					\
+			st[j] = s[j][i];				\
+		while ((b = sha256_lane_next(&sl[i])) != NULL)		\
+			sha256_compress(st, b);				\
+		sha256_lane_done(&sl[i], st);				\
+	}								\
+}
+
+typedef uint32_t sha256_v4_t __attribute__((vector_size(16)));
+
+static void
+sha256_mb_x4(sha256_lane_t *sl, int n)
+{
+	SHA256_MB_BODY(sha256_v4_t, 4, sl, n);
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+	(__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define	SHA256_MB_AVX2
+#include <cpuid.h>
+
+typedef uint32_t sha256_v8_t __attribute__((vector_size(32)));
+
+static void __attribute__((target("avx2")))
+sha256_mb_x8(sha256_lane_t *sl, int n)
+{
+	SHA256_MB_BODY(sha256_v8_t, 8, sl, n);
+}
+
+static boolean_t
+sha256_avx2_valid(void)
+{
+	unsigned int a, b, c, d, lo, hi;
+
+	if (!__get_cpuid(1, &a, &b, &c, &d) || !(c & bit_OSXSAVE) ||
+	    !(c & bit_AVX) || __get_cpuid_max(0, NULL) < 7)
+		return (B_FALSE);
+	__cpuid_count(7, 0, a, b, c, d);
+	if (!(b & (1 << 5)))
+		return (B_FALSE);
+	__asm__ __volatile__("xgetbv" : "=a" (lo), "=d" (hi) : "c" (0));
+	return ((lo & 0x6) == 0x6);
+}
+#endif
+
+typedef struct sha256_impl {
+	const char	*si_name;
+	int		si_lanes;	/* 1: zio_checksum_SHA256() */
+	void		(*si_func)(sha256_lane_t *, int);
+} sha256_impl_t;
+
+static sha256_impl_t sha256_impls[] = {
+	{ "single", 1, NULL },
+	{ "x4", 4, sha256_mb_x4 },
+#ifdef SHA256_MB_AVX2
+	{ "x8", 8, sha256_mb_x8 },
+#endif
+};
+
+#define	SHA256_NIMPLS	(sizeof (sha256_impls) / sizeof (sha256_impls[0]))
+
+static sha256_impl_t *sha256_impl = &sha256_impls[0];
+
+typedef struct sha256_stats {
+	kstat_named_t sha256_impl_lanes;
+	kstat_named_t sha256_single_mbps;
+	kstat_named_t sha256_x4_mbps;
+	kstat_named_t sha256_x8_mbps;
+	kstat_named_t sha256_batches;
+	kstat_named_t sha256_batched_blocks;
+} sha256_stats_t;
+
+static sha256_stats_t sha256_stats = {
+	{ "lanes",		KSTAT_DATA_UINT64 },
+	{ "single_mbps",	KSTAT_DATA_UINT64 },
+	{ "x4_mbps",		KSTAT_DATA_UINT64 },
+	{ "x8_mbps",		KSTAT_DATA_UINT64 },
+	{ "batches",		KSTAT_DATA_UINT64 },
+	{ "batched_blocks",	KSTAT_DATA_UINT64 }
+};
+
+#define	SHA256STAT(stat)	sha256_stats.stat.value.ui64
+#define	SHA256STAT_INCR(stat, val) \
+	atomic_add_64(&sha256_stats.stat.value.ui64, (val))
+
+static kstat_t *sha256_ksp;
+
+/*
+ * Hash n buffers at once, each into its own zcp, with the same result as
+ * calling zio_checksum_SHA256() on each of them.
+ */
+void
+zio_checksum_SHA256_multi(const void **bufs, const uint64_t *sizes,
+    zio_cksum_t **zcps, int n)
+{
+	sha256_impl_t *si = sha256_impl;
+	sha256_lane_t sl[SHA256_MB_MAXLANES];
+	int i, k;
+
+	if (si->si_lanes == 1 || n == 1) {
+		for (i = 0; i < n; i++)
+			zio_checksum_SHA256(bufs[i], sizes[i], zcps[i]);
+		return;
+	}
+
+	SHA256STAT_INCR(sha256_batches, 1);
+	SHA256STAT_INCR(sha256_batched_blocks, n);
+
+	for (i = 0; i < n; i += k) {
+		k = MIN(n - i, si->si_lanes);
+		if (k == 1) {
+			zio_checksum_SHA256(bufs[i], sizes[i], zcps[i]);
+			continue;
+		}
+		for (int j = 0; j < k; j++)
+			sha256_lane_init(&sl[j], bufs[i + j], sizes[i + j],
+			    zcps[i + j]);
+		si->si_func(sl, k);
+	}
+}
+
+/*
+ * How many blocks zio_checksum_SHA256_multi() hashes at once, 1 if it is
+ * no faster than hashing them one by one.
+ */
+int
+zio_sha256_lanes(void)
+{
+	return (sha256_impl->si_lanes);
+}
+
+#define	SHA256_BENCH_BUFS	SHA256_MB_MAXLANES
+#define	SHA256_BENCH_SIZE	(16 << 10)
+#define	SHA256_BENCH_NSEC	(NANOSEC / MILLISEC * 5)
+
+/*
+ * Time every implementation on a batch of 16K buffers, after checking it
+ * against OpenSSL on buffers of assorted sizes, and use the fastest.
+ */
+static void
+sha256_benchmark(void)
+{
+	sha256_impl_t *fastest = &sha256_impls[0];
+	const void *bufs[SHA256_BENCH_BUFS];
+	uint64_t sizes[SHA256_BENCH_BUFS];
+	zio_cksum_t ref[SHA256_BENCH_BUFS], zc[SHA256_BENCH_BUFS];
+	zio_cksum_t *zcps[SHA256_BENCH_BUFS];
+	uint64_t best = 0, mbps, bytes;
+	hrtime_t start, now;
+	uint32_t *data;
+	int i, b;
+
+	data = kmem_alloc(SHA256_BENCH_BUFS * SHA256_BENCH_SIZE, KM_SLEEP);
+	for (i = 0; i < SHA256_BENCH_BUFS * SHA256_BENCH_SIZE / 4; i++)
+		data[i] = 0x9e3779b9 * (i + 1);
+
+	for (b = 0; b < SHA256_BENCH_BUFS; b++) {
+		bufs[b] = (char *)data + b * SHA256_BENCH_SIZE;
+		zcps[b] = &zc[b];
+	}
+
+	for (i = 0; i < SHA256_NIMPLS; i++) {
+		sha256_impl_t *si = &sha256_impls[i];
+
+#ifdef SHA256_MB_AVX2
+		if (si->si_func == sha256_mb_x8 && !sha256_avx2_valid())
+			continue;
+#endif
+		sha256_impl = si;
+
+		/* odd sizes, so that lanes finish at different times */
+		for (b = 0; b < SHA256_BENCH_BUFS; b++) {
+			sizes[b] = SHA256_BENCH_SIZE - b * 1000 - b * b;
+			zio_checksum_SHA256(bufs[b], sizes[b], &ref[b]);
+		}
+		zio_checksum_SHA256_multi(bufs, sizes, zcps,
+		    SHA256_BENCH_BUFS);
+		for (b = 0; b < SHA256_BENCH_BUFS; b++)
+			if (!ZIO_CHECKSUM_EQUAL(zc[b], ref[b]))
+				break;
+		if (b < SHA256_BENCH_BUFS)
+			continue;
+
+		for (b = 0; b < SHA256_BENCH_BUFS; b++)
+			sizes[b] = SHA256_BENCH_SIZE;
+		bytes = 0;
+		start = gethrtime();
+		do {
+			zio_checksum_SHA256_multi(bufs, sizes, zcps,
+			    SHA256_BENCH_BUFS);
+			bytes += SHA256_BENCH_BUFS * SHA256_BENCH_SIZE;
+		} while ((now = gethrtime()) - start < SHA256_BENCH_NSEC);
+
+		mbps = MAX(bytes * (NANOSEC / MICROSEC) / (now - start), 1);
+		if (si->si_lanes == 1)
+			SHA256STAT(sha256_single_mbps) = mbps;
+		else if (si->si_lanes == 4)
+			SHA256STAT(sha256_x4_mbps) = mbps;
+		else
+			SHA256STAT(sha256_x8_mbps) = mbps;
+		if (mbps > best) {
+			best = mbps;
+			fastest = si;
+		}
+	}
+	sha256_impl = fastest;
+
+	/* the timing runs aren't batches of the write pipeline */
+	SHA256STAT(sha256_batches) = 0;
+	SHA256STAT(sha256_batched_blocks) = 0;
+	SHA256STAT(sha256_impl_lanes) = sha256_impl->si_lanes;
+
+	kmem_free(data, SHA256_BENCH_BUFS * SHA256_BENCH_SIZE);
+}
+
+void
+zio_sha256_init(void)
+{
+	sha256_benchmark();
+
+	sha256_ksp = kstat_create("zfs", 0, "sha256_stats", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (sha256_stats) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+	if (sha256_ksp != NULL) {
+		sha256_ksp->ks_data = &sha256_stats;
+		kstat_install(sha256_ksp);
+	}
+}
+
+void
+zio_sha256_fini(void)
+{
+	if (sha256_ksp != NULL) {
+		kstat_delete(sha256_ksp);
+		sha256_ksp = NULL;
+	}
+}
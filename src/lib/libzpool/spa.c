@@ -779,9 +779,18 @@ spa_unload(spa_t *spa)
 	ASSERT(MUTEX_HELD(&spa_namespace_lock));
 
 	/*
-	 * Stop async tasks.
+	 * Stop async tasks, and the warm start if it is still going.
 	 */
 	spa_async_suspend(spa);
+	arc_warm_stop(spa);
+
+	/*
+	 * Remember what is in the ARC, so that the next load can read it
+	 * back in.  Only pools that were fully loaded and are not going
+	 * away for good.
+	 */
+	if (spa->spa_sync_on && spa->spa_state != POOL_STATE_DESTROYED)
+		arc_warm_save(spa);
 
 	/*
 	 * Stop syncing.
@@ -1354,6 +1363,19 @@ spa_prop_find(spa_t *spa, zpool_prop_t prop, uint64_t *val)
 	    zpool_prop_to_name(prop), sizeof (uint64_t), 1, val);
 }
 
+/*
+ * Record in the pool directory that this pool's version 24 is the lz4 one
+ * of zfs-fuse (see SPA_VERSION_DEFAULT).
+ */
+static void
+spa_mark_lz4(spa_t *spa, dmu_tx_t *tx)
+{
+	uint64_t one = 1;
+
+	VERIFY(zap_add(spa->spa_meta_objset, DMU_POOL_DIRECTORY_OBJECT,
+	    DMU_POOL_ZFSFUSE_LZ4, sizeof (uint64_t), 1, &one, tx) == 0);
+}
+
 /*
  * Find a value in the pool directory object.
  */
@@ -1699,6 +1721,21 @@ spa_load_impl(spa_t *spa, uint64_t pool_guid, nvlist_t *config,
 	    &spa->spa_deferred_bplist_obj) != 0)
 		return (spa_vdev_err(rvd, VDEV_AUX_CORRUPT_DATA, EIO));
 
+	/*
+	 * A version 24 pool which zfs-fuse did not write uses system
+	 * attributes, not lz4, and we don't know about those.
+	 */
+	if (spa_version(spa) >= SPA_VERSION_LZ4_COMPRESSION) {
+		uint64_t lz4;
+
+		error = spa_dir_prop(spa, DMU_POOL_ZFSFUSE_LZ4, &lz4);
+		if (error == ENOENT)
+			return (spa_vdev_err(rvd, VDEV_AUX_VERSION_NEWER,
+			    ENOTSUP));
+		if (error != 0)
+			return (spa_vdev_err(rvd, VDEV_AUX_CORRUPT_DATA, EIO));
+	}
+
 	/*
 	 * Load the bit that tells us to use the new accounting function
 	 * (raid-z deflation).  If we have an older pool, this will not
@@ -1946,6 +1983,12 @@ spa_load_impl(spa_t *spa, uint64_t pool_guid, nvlist_t *config,
 		 * Clean up any stale temporary dataset userrefs.
 		 */
 		dsl_pool_clean_tmp_userrefs(spa->spa_dsl_pool);
+
+		/*
+		 * Read back what was in the ARC when the pool was last
+		 * unloaded.
+		 */
+		arc_warm_load(spa);
 	}
 
 	return (0);
@@ -2576,7 +2619,7 @@ spa_create(const char *pool, nvlist_t *nvroot, nvlist_t *props,
 
 	if (nvlist_lookup_uint64(props, zpool_prop_to_name(ZPOOL_PROP_VERSION),
 	    &version) != 0)
-		version = SPA_VERSION;
+		version = SPA_VERSION_DEFAULT;
 	ASSERT(version <= SPA_VERSION);
 
 	spa->spa_first_txg = txg;
@@ -2678,6 +2721,9 @@ spa_create(const char *pool, nvlist_t *nvroot, nvlist_t *props,
 		cmn_err(CE_PANIC, "failed to add pool config");
 	}
 
+	if (version >= SPA_VERSION_LZ4_COMPRESSION)
+		spa_mark_lz4(spa, tx);
+
 	/* Newly created pools with the right version are always deflated. */
 	if (version >= SPA_VERSION_RAIDZ_DEFLATE) {
 		spa->spa_deflate = TRUE;
@@ -5131,6 +5177,10 @@ spa_sync(spa_t *spa, uint64_t txg)
 		dsl_pool_upgrade_clones(dp, tx);
 	}
 
+	if (spa->spa_ubsync.ub_version < SPA_VERSION_LZ4_COMPRESSION &&
+	    spa->spa_uberblock.ub_version >= SPA_VERSION_LZ4_COMPRESSION)
+		spa_mark_lz4(spa, tx);
+
 	/*
 	 * If anything has changed in this txg, push the deferred frees
 	 * from the previous txg.  If not, leave them alone so that we
@@ -46,6 +46,7 @@
 #include <sys/arc.h>
 #include <sys/ddt.h>
 #include "zfs_prop.h"
+#include "zfs_fletcher.h"
 
 /*
  * SPA locking
@@ -441,10 +442,13 @@ spa_add(const char *name, nvlist_t *config, const char *altroot)
 	mutex_init(&spa->spa_props_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&spa->spa_suspend_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&spa->spa_vdev_top_lock, NULL, MUTEX_DEFAULT, NULL);
+	mutex_init(&spa->spa_warm_lock, NULL, MUTEX_DEFAULT, NULL);
+	mutex_init(&spa->spa_cksum_batch_lock, NULL, MUTEX_DEFAULT, NULL);
 
 	cv_init(&spa->spa_async_cv, NULL, CV_DEFAULT, NULL);
 	cv_init(&spa->spa_scrub_io_cv, NULL, CV_DEFAULT, NULL);
 	cv_init(&spa->spa_suspend_cv, NULL, CV_DEFAULT, NULL);
+	cv_init(&spa->spa_warm_cv, NULL, CV_DEFAULT, NULL);
 
 	for (int t = 0; t < TXG_SIZE; t++)
 		bplist_init(&spa->spa_free_bplist[t]);
@@ -530,6 +534,7 @@ spa_remove(spa_t *spa)
 	cv_destroy(&spa->spa_async_cv);
 	cv_destroy(&spa->spa_scrub_io_cv);
 	cv_destroy(&spa->spa_suspend_cv);
+	cv_destroy(&spa->spa_warm_cv);
 
 	mutex_destroy(&spa->spa_async_lock);
 	mutex_destroy(&spa->spa_scrub_lock);
@@ -539,6 +544,8 @@ spa_remove(spa_t *spa)
 	mutex_destroy(&spa->spa_props_lock);
 	mutex_destroy(&spa->spa_suspend_lock);
 	mutex_destroy(&spa->spa_vdev_top_lock);
+	mutex_destroy(&spa->spa_warm_lock);
+	mutex_destroy(&spa->spa_cksum_batch_lock);
 
 	kmem_free(spa, sizeof (spa_t));
 }
@@ -1464,10 +1471,12 @@ spa_init(int mode)
 
 	refcount_init();
 	unique_init();
+	fletcher_4_init();
 	zio_init();
 	dmu_init();
 	zil_init();
 	vdev_cache_stat_init();
+	arc_warm_stat_init();
 	zfs_prop_init();
 	zpool_prop_init();
 	spa_config_load();
@@ -1481,10 +1490,12 @@ spa_fini(void)
 
 	spa_evict_all();
 
+	arc_warm_stat_fini();
 	vdev_cache_stat_fini();
 	zil_fini();
 	dmu_fini();
 	zio_fini();
+	fletcher_4_fini();
 	unique_fini();
 	refcount_fini();
 
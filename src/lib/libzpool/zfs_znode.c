@@ -198,6 +198,7 @@ zfs_znode_move_impl(znode_t *ozp, znode_t *nzp)
 	nzp->z_zn_prefetch = ozp->z_zn_prefetch;
 	nzp->z_blksz = ozp->z_blksz;
 	nzp->z_seq = ozp->z_seq;
+	nzp->z_wseq = ozp->z_wseq;
 	nzp->z_mapcnt = ozp->z_mapcnt;
 	nzp->z_last_itx = ozp->z_last_itx;
 	nzp->z_gen = ozp->z_gen;
@@ -640,6 +641,7 @@ zfs_znode_alloc(zfsvfs_t *zfsvfs, dmu_buf_t *db, int blksz)
 	zp->z_id = db->db_object;
 	zp->z_blksz = blksz;
 	zp->z_seq = 0x7A4653;
+	zp->z_wseq = 0;
 	zp->z_sync_cnt = 0;
 
 	vp = ZTOV(zp);
@@ -1155,6 +1157,8 @@ zfs_time_stamper_locked(znode_t *zp, uint_t flag, dmu_tx_t *tx)
 
 	if (flag & AT_MTIME) {
 		ZFS_TIME_ENCODE(&now, zp->z_phys->zp_mtime);
+		/* ZFSFUSE: lets zfs-fuse tell if the page cache is stale */
+		zp->z_wseq++;
 		if (zp->z_zfsvfs->z_use_fuids)
 			zp->z_phys->zp_flags |= (ZFS_ARCHIVE | ZFS_AV_MODIFIED);
 	}
@@ -1240,17 +1244,19 @@ zfs_no_putpage(vnode_t *vp, page_t *pp, u_offset_t *offp, size_t *lenp,
  *
  *	IN:	zp	- znode of file to free data in.
  *		end	- new end-of-file
+ *		log	- TRUE if the extension should be logged, in the
+ *			  same tx so that replay can't reorder it
  *
  * 	RETURN:	0 if success
  *		error code if failure
  */
 static int
-zfs_extend(znode_t *zp, uint64_t end)
+zfs_extend(znode_t *zp, uint64_t end, boolean_t log)
 {
 	zfsvfs_t *zfsvfs = zp->z_zfsvfs;
 	dmu_tx_t *tx;
 	rl_t *rl;
-	uint64_t newblksz;
+	uint64_t newblksz, size;
 	int error;
 
 	/*
@@ -1300,8 +1306,16 @@ top:
 	if (newblksz)
 		zfs_grow_blocksize(zp, newblksz, tx);
 
+	size = zp->z_phys->zp_size;
 	zp->z_phys->zp_size = end;
 
+	if (log) {
+		/* replays as a free of the new range, which extends */
+		zfs_time_stamper(zp, CONTENT_MODIFIED, tx);
+		zfs_log_truncate(zfsvfs->z_log, tx, TX_TRUNCATE, zp, size,
+		    end - size);
+	}
+
 	zfs_range_unlock(rl);
 
 	dmu_tx_commit(tx);
@@ -1460,7 +1474,7 @@ zfs_freesp(znode_t *zp, uint64_t off, uint64_t len, int flag, boolean_t log)
 	int error;
 
 	if (off > zp->z_phys->zp_size) {
-		error =  zfs_extend(zp, off+len);
+		error =  zfs_extend(zp, off+len, B_FALSE);
 		if (error == 0 && log)
 			goto log;
 		else
@@ -1481,7 +1495,7 @@ zfs_freesp(znode_t *zp, uint64_t off, uint64_t len, int flag, boolean_t log)
 	} else {
 		if ((error = zfs_free_range(zp, off, len)) == 0 &&
 		    off + len > zp->z_phys->zp_size)
-			error = zfs_extend(zp, off+len);
+			error = zfs_extend(zp, off+len, B_FALSE);
 	}
 	if (error || !log)
 		return (error);
@@ -1506,6 +1520,69 @@ log:
 	return (0);
 }
 
+/*
+ * Free and/or preallocate space in a file, for fallocate()
+ *
+ *	IN:	zp	- znode of file.
+ *		off	- start of range
+ *		len	- length of range
+ *		flag	- current file open mode flags.
+ *		dofree	- TRUE to free the blocks of the range
+ *		keepsize - TRUE to leave the file size alone
+ *
+ * Unlike zfs_freesp(), this never shrinks the file: the size is only
+ * looked at under the range lock, so a write moving the end of file
+ * past the range meanwhile is left alone.  With keepsize, the range freed is
+ * clamped to the end of file the same way rather than extending it.
+ *
+ * 	RETURN:	0 if success
+ *		error code if failure
+ */
+int
+zfs_fallocate(znode_t *zp, uint64_t off, uint64_t len, int flag,
+    boolean_t dofree, boolean_t keepsize)
+{
+	vnode_t *vp = ZTOV(zp);
+	dmu_tx_t *tx;
+	zfsvfs_t *zfsvfs = zp->z_zfsvfs;
+	uint64_t size;
+	int error;
+
+	if (dofree) {
+		if (MANDLOCK(vp, (mode_t)zp->z_phys->zp_mode) &&
+		    (error = chklock(vp, FWRITE, off, len, flag, NULL)))
+			return (error);
+
+		if ((error = zfs_free_range(zp, off, len)) != 0)
+			return (error);
+
+		size = zp->z_phys->zp_size;
+		while (off < size) {
+			tx = dmu_tx_create(zfsvfs->z_os);
+			dmu_tx_hold_bonus(tx, zp->z_id);
+			error = dmu_tx_assign(tx, TXG_NOWAIT);
+			if (error) {
+				if (error == ERESTART) {
+					dmu_tx_wait(tx);
+					dmu_tx_abort(tx);
+					continue;
+				}
+				dmu_tx_abort(tx);
+				return (error);
+			}
+			zfs_time_stamper(zp, CONTENT_MODIFIED, tx);
+			zfs_log_truncate(zfsvfs->z_log, tx, TX_TRUNCATE, zp,
+			    off, MIN(len, size - off));
+			dmu_tx_commit(tx);
+			break;
+		}
+	}
+
+	if (keepsize)
+		return (0);
+	return (zfs_extend(zp, off + len, B_TRUE));
+}
+
 void
 zfs_create_fs(objset_t *os, cred_t *cr, nvlist_t *zplprops, dmu_tx_t *tx)
 {
@@ -82,9 +82,6 @@ kmem_cache_t *zio_link_cache;
 kmem_cache_t *zio_buf_cache[SPA_MAXBLOCKSIZE >> SPA_MINBLOCKSHIFT];
 kmem_cache_t *zio_data_buf_cache[SPA_MAXBLOCKSIZE >> SPA_MINBLOCKSHIFT];
 
-#ifdef _KERNEL
-extern vmem_t *zio_alloc_arena;
-#endif
 
 /*
  * An allocating zio is one that either currently has the DVA allocate
@@ -104,8 +101,12 @@ zio_init(void)
 	size_t c;
 	vmem_t *data_alloc_arena = NULL;
 
-#if 0
-	// zio_alloc_arena is NULL normally
+#ifdef _KERNEL
+	/*
+	 * ZFSFUSE: zio_alloc_arena is NULL unless zfs-fuse was started with
+	 * --hugepages.  Unlike Solaris we use it for metadata buffers too,
+	 * since they do not have to stay out of crash dumps here.
+	 */
 	data_alloc_arena = zio_alloc_arena;
 #endif
 	zio_cache = kmem_cache_create("zio_cache",
@@ -139,7 +140,7 @@ zio_init(void)
 			char name[36];
 			(void) sprintf(name, "zio_buf_%lu", (ulong_t)size);
 			zio_buf_cache[c] = kmem_cache_create(name, size,
-			    align, NULL, NULL, NULL, NULL, NULL,
+			    align, NULL, NULL, NULL, NULL, data_alloc_arena,
 			    size > zio_buf_debug_limit ? KMC_NODEBUG : 0);
 
 			(void) sprintf(name, "zio_data_buf_%lu", (ulong_t)size);
@@ -160,6 +161,8 @@ zio_init(void)
 	}
 
 	zio_inject_init();
+	zio_sha256_init();
+	zio_compress_init();
 }
 
 void
@@ -186,6 +189,8 @@ zio_fini(void)
 	kmem_cache_destroy(zio_link_cache);
 	kmem_cache_destroy(zio_cache);
 
+	zio_compress_fini();
+	zio_sha256_fini();
 	zio_inject_fini();
 }
 
@@ -2464,6 +2469,114 @@ zio_vdev_io_bypass(zio_t *zio)
  * Generate and verify checksums
  * ==========================================================================
  */
+
+/*
+ * sha256 blocks are hashed up to zfs_sha256_batch at a time when the
+ * multi-buffer code is faster than hashing them one by one (see sha256.c).
+ * A zio reaching the checksum stage joins the queue of its spa unless
+ * nobody is hashing yet or the queue then holds a full batch; in those
+ * cases its thread takes its own zio and the queued ones, hashes them, and
+ * sends the others on through the issue taskq.  So threads never wait for
+ * a batch to fill, and while one of them hashes, the blocks arriving in the
+ * meantime make up the next batch.  Whoever stops hashing last hands what
+ * is still queued to a task that drains it.
+ */
+int zfs_sha256_batch = ZIO_CHECKSUM_BATCH_MAX;
+
+static void
+zio_checksum_batch_run(zio_t **batch, int n, zio_t *self)
+{
+	const void *bufs[ZIO_CHECKSUM_BATCH_MAX];
+	uint64_t sizes[ZIO_CHECKSUM_BATCH_MAX];
+	zio_cksum_t *zcps[ZIO_CHECKSUM_BATCH_MAX];
+	int i;
+
+	for (i = 0; i < n; i++) {
+		bufs[i] = batch[i]->io_data;
+		sizes[i] = batch[i]->io_size;
+		zcps[i] = &batch[i]->io_bp->blk_cksum;
+	}
+
+	zio_checksum_SHA256_multi(bufs, sizes, zcps, n);
+
+	for (i = 0; i < n; i++)
+		if (batch[i] != self)
+			zio_taskq_dispatch(batch[i], ZIO_TASKQ_ISSUE);
+}
+
+/* move up to max queued zios to batch; called with the batch lock held */
+static int
+zio_checksum_batch_take(spa_t *spa, zio_t **batch, int max)
+{
+	int n = MIN(max, spa->spa_cksum_batch_queued);
+
+	ASSERT(MUTEX_HELD(&spa->spa_cksum_batch_lock));
+
+	bcopy(spa->spa_cksum_batch, batch, n * sizeof (zio_t *));
+	spa->spa_cksum_batch_queued -= n;
+	bcopy(spa->spa_cksum_batch + n, spa->spa_cksum_batch,
+	    spa->spa_cksum_batch_queued * sizeof (zio_t *));
+
+	return (n);
+}
+
+static void
+zio_checksum_batch_drain(void *arg)
+{
+	spa_t *spa = arg;
+	zio_t *batch[ZIO_CHECKSUM_BATCH_MAX];
+	int n;
+
+	mutex_enter(&spa->spa_cksum_batch_lock);
+	while ((n = zio_checksum_batch_take(spa, batch,
+	    ZIO_CHECKSUM_BATCH_MAX)) != 0) {
+		mutex_exit(&spa->spa_cksum_batch_lock);
+		zio_checksum_batch_run(batch, n, NULL);
+		mutex_enter(&spa->spa_cksum_batch_lock);
+	}
+	spa->spa_cksum_batch_busy--;
+	mutex_exit(&spa->spa_cksum_batch_lock);
+}
+
+static int
+zio_checksum_batch(zio_t *zio)
+{
+	spa_t *spa = zio->io_spa;
+	zio_t *batch[ZIO_CHECKSUM_BATCH_MAX];
+	int max = MIN(zfs_sha256_batch, ZIO_CHECKSUM_BATCH_MAX);
+	boolean_t drain = B_FALSE;
+	int n;
+
+	mutex_enter(&spa->spa_cksum_batch_lock);
+	if (spa->spa_cksum_batch_busy != 0 &&
+	    spa->spa_cksum_batch_queued + 1 < max) {
+		spa->spa_cksum_batch[spa->spa_cksum_batch_queued++] = zio;
+		mutex_exit(&spa->spa_cksum_batch_lock);
+		return (ZIO_PIPELINE_STOP);
+	}
+	batch[0] = zio;
+	n = 1 + zio_checksum_batch_take(spa, batch + 1, max - 1);
+	spa->spa_cksum_batch_busy++;
+	mutex_exit(&spa->spa_cksum_batch_lock);
+
+	zio_checksum_batch_run(batch, n, zio);
+
+	mutex_enter(&spa->spa_cksum_batch_lock);
+	if (spa->spa_cksum_batch_busy == 1 &&
+	    spa->spa_cksum_batch_queued != 0)
+		drain = B_TRUE;		/* the drain task takes our place */
+	else
+		spa->spa_cksum_batch_busy--;
+	mutex_exit(&spa->spa_cksum_batch_lock);
+
+	if (drain)
+		(void) taskq_dispatch(
+		    spa->spa_zio_taskq[ZIO_TYPE_WRITE][ZIO_TASKQ_ISSUE],
+		    zio_checksum_batch_drain, spa, TQ_SLEEP);
+
+	return (ZIO_PIPELINE_CONTINUE);
+}
+
 static int
 zio_checksum_generate(zio_t *zio)
 {
@@ -2488,6 +2601,10 @@ zio_checksum_generate(zio_t *zio)
 		} else {
 			checksum = BP_GET_CHECKSUM(bp);
 		}
+
+		if (checksum == ZIO_CHECKSUM_SHA256 && zfs_sha256_batch > 1 &&
+		    zio_sha256_lanes() > 1)
+			return (zio_checksum_batch(zio));
 	}
 
 	zio_checksum_compute(zio, checksum, zio->io_data, zio->io_size);
@@ -29,6 +29,99 @@
 #include <sys/spa.h>
 #include <sys/zio.h>
 #include <sys/zio_compress.h>
+#include <sys/kstat.h>
+
+/*
+ * Before running the compressor over a block, look at a sample of it and
+ * skip blocks that are almost certainly incompressible, such as media or
+ * archives.  Those would otherwise be compressed in full only to have the
+ * result thrown away for not saving 12.5%.
+ *
+ * ZIO_COMPRESS_SAMPLES chunks of ZIO_COMPRESS_SAMPLE_SIZE bytes spread
+ * over the block are checked two ways.  Every other chunk starts at the
+ * beginning of its stretch, so that repeats a multiple of the stride
+ * apart line up; the rest start at varying phases, so that data laid out
+ * with the same period as the samples is not missed.  A byte histogram
+ * gives the collision entropy; for random bytes, 256 * sum(count^2) / n^2
+ * comes out at about 1 + 256 / n.  A hash of the 4-byte sequences counts
+ * exact repeats, which LZ matching would find even when the byte
+ * distribution is flat.  Only a block that is flat and shows almost no
+ * repeats is skipped; a wrong guess just stores a block uncompressed.
+ */
+int zfs_compress_early_abort = 1;
+
+#define	ZIO_COMPRESS_SAMPLES		32
+#define	ZIO_COMPRESS_SAMPLE_SIZE	128
+#define	ZIO_COMPRESS_PROBE_SHIFT	8
+#define	ZIO_COMPRESS_PROBE_SIZE		(1 << ZIO_COMPRESS_PROBE_SHIFT)
+
+typedef struct zio_compress_stats {
+	kstat_named_t zcs_attempts;
+	kstat_named_t zcs_skipped;
+	kstat_named_t zcs_aborted;
+} zio_compress_stats_t;
+
+static zio_compress_stats_t zio_compress_stats = {
+	{ "attempts",		KSTAT_DATA_UINT64 },
+	{ "skipped",		KSTAT_DATA_UINT64 },
+	{ "aborted",		KSTAT_DATA_UINT64 },
+};
+
+#define	ZCSTAT_BUMP(stat)	\
+	atomic_add_64(&zio_compress_stats.stat.value.ui64, 1)
+
+static kstat_t *zio_compress_ksp;
+
+static boolean_t
+zio_compress_incompressible(const void *src, size_t s_len)
+{
+	uint32_t counts[256];
+	uint32_t probe[ZIO_COMPRESS_PROBE_SIZE];
+	uint64_t n, sumsq = 0, repeats = 0;
+	size_t stride, k, i;
+
+	stride = s_len / ZIO_COMPRESS_SAMPLES;
+	if (stride < 2 * ZIO_COMPRESS_SAMPLE_SIZE)
+		return (B_FALSE);
+
+	bzero(counts, sizeof (counts));
+	bzero(probe, sizeof (probe));
+
+	for (k = 0; k < ZIO_COMPRESS_SAMPLES; k++) {
+		const uchar_t *p = (const uchar_t *)src + k * stride;
+
+		if (k & 1)
+			p += (k * 2654435761U) %
+			    (stride - ZIO_COMPRESS_SAMPLE_SIZE + 1);
+
+		for (i = 0; i < ZIO_COMPRESS_SAMPLE_SIZE; i++)
+			counts[p[i]]++;
+
+		for (i = 0; i + sizeof (uint32_t) <= ZIO_COMPRESS_SAMPLE_SIZE;
+		    i++) {
+			uint32_t v, h;
+
+			bcopy(p + i, &v, sizeof (v));
+			h = (v * 2654435761U) >> (32 - ZIO_COMPRESS_PROBE_SHIFT);
+			if (probe[h] == v)
+				repeats++;
+			probe[h] = v;
+		}
+	}
+
+	n = 0;
+	for (i = 0; i < 256; i++) {
+		n += counts[i];
+		sumsq += (uint64_t)counts[i] * counts[i];
+	}
+
+	/* more than one repeated sequence in 64 looks like text or tables */
+	if (repeats > n / 64)
+		return (B_FALSE);
+
+	/* flat to within 1/8 of what random bytes would give */
+	return (256 * sumsq <= n * n + n * n / 8);
+}
 
 /*
  * Compression vectors.
@@ -50,6 +143,7 @@ zio_compress_info_t zio_compress_table[ZIO_COMPRESS_FUNCTIONS] = {
 	{gzip_compress,		gzip_decompress,	8,	"gzip-8"},
 	{gzip_compress,		gzip_decompress,	9,	"gzip-9"},
 	{zle_compress,		zle_decompress,		64,	"zle"},
+	{lz4_compress,		lz4_decompress,		0,	"lz4"},
 };
 
 enum zio_compress
@@ -98,10 +192,20 @@ zio_compress_data(enum zio_compress c, void *src, void *dst, size_t s_len)
 	if (d_len == 0)
 		return (s_len);
 
+	/* zle only strips zero runs, which is cheaper than the estimate */
+	if (zfs_compress_early_abort && c != ZIO_COMPRESS_ZLE &&
+	    zio_compress_incompressible(src, s_len)) {
+		ZCSTAT_BUMP(zcs_skipped);
+		return (s_len);
+	}
+
+	ZCSTAT_BUMP(zcs_attempts);
 	c_len = ci->ci_compress(src, dst, s_len, d_len, ci->ci_level);
 
-	if (c_len > d_len)
+	if (c_len > d_len) {
+		ZCSTAT_BUMP(zcs_aborted);
 		return (s_len);
+	}
 
 	/*
 	 * Cool.  We compressed at least as much as we were hoping to.
@@ -130,3 +234,28 @@ zio_decompress_data(enum zio_compress c, void *src, void *dst,
 
 	return (ci->ci_decompress(src, dst, s_len, d_len, ci->ci_level));
 }
+
+void
+zio_compress_init(void)
+{
+	lz4_init();
+
+	zio_compress_ksp = kstat_create("zfs", 0, "compress_stats", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (zio_compress_stats) /
+	    sizeof (kstat_named_t), KSTAT_FLAG_VIRTUAL);
+	if (zio_compress_ksp != NULL) {
+		zio_compress_ksp->ks_data = &zio_compress_stats;
+		kstat_install(zio_compress_ksp);
+	}
+}
+
+void
+zio_compress_fini(void)
+{
+	if (zio_compress_ksp != NULL) {
+		kstat_delete(zio_compress_ksp);
+		zio_compress_ksp = NULL;
+	}
+
+	lz4_fini();
+}
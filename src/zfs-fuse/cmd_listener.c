@@ -27,6 +27,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/poll.h>
+#include <sys/kstat.h>
 #include <errno.h>
 
 #include <stdio.h>
@@ -36,6 +37,7 @@
 
 #include "zfs_ioctl.h"
 #include "zfsfuse_socket.h"
+#include "zfsfuse_tunables.h"
 #include "util.h"
 
 #include "semaphore.h"
@@ -80,6 +82,49 @@ int cmd_mount_req(int sock, zfsfuse_cmd_t *cmd)
 	return ret;
 }
 
+int cmd_tunable_req(int sock, zfsfuse_cmd_t *cmd)
+{
+	uint32_t namelen = cmd->cmd_u.tunable_req.namelen;
+	int32_t error = 0;
+	uint32_t len = 0;
+	char *name, *list = NULL;
+	int ret = 0;
+
+	if(namelen >= KSTAT_STRLEN)
+		return -1;
+
+	name = kmem_alloc(namelen + 1, KM_SLEEP);
+	if(zfsfuse_socket_read_loop(sock, name, namelen) != 0) {
+		kmem_free(name, namelen + 1);
+		return -1;
+	}
+	name[namelen] = '\0';
+
+	if(cmd->cmd_u.tunable_req.set) {
+		if(cmd->uid != 0)
+			error = EPERM;
+		else
+			error = zfsfuse_tunable_set(name, cmd->cmd_u.tunable_req.value);
+	}
+	if(error == 0) {
+		list = zfsfuse_tunables_list(name);
+		len = strlen(list);
+		if(len == 0)
+			error = ENOENT;
+	}
+
+	if(write(sock, &error, sizeof(int32_t)) != sizeof(int32_t) ||
+	    write(sock, &len, sizeof(uint32_t)) != sizeof(uint32_t) ||
+	    (len > 0 && write(sock, list, len) != len))
+		ret = -1;
+
+	if(list != NULL)
+		strfree(list);
+	kmem_free(name, namelen + 1);
+
+	return ret;
+}
+
 /* --------------------------------------------------
  * new ioctl queue facility
  * --------------------------------------------------
@@ -107,7 +152,11 @@ static void handle_connection(int sock)
                 cr.cr_gid = cmd.gid;
                 cr.req = NULL;
                 cur_fd = sock; // thread local; used outside this module
-                int ioctl_ret = zfsdev_ioctl(dev, cmd.cmd_u.ioctl_req.cmd, (uintptr_t) cmd.cmd_u.ioctl_req.arg, 0, &cr, NULL);
+                int ioctl_ret;
+                if (cmd.cmd_u.ioctl_req.cmd == ZFSFUSE_IOC_SHM_ATTACH)
+                    ioctl_ret = zfsfuse_socket_shm_attach(cmd.cmd_u.ioctl_req.arg);
+                else
+                    ioctl_ret = zfsdev_ioctl(dev, cmd.cmd_u.ioctl_req.cmd, (uintptr_t) cmd.cmd_u.ioctl_req.arg, 0, &cr, NULL);
                 
                 if (zfsfuse_socket_ioctl_write(sock, ioctl_ret) != 0) 
                     goto done;
@@ -116,12 +165,17 @@ static void handle_connection(int sock)
                 if(cmd_mount_req(sock, &cmd) != 0)
                     goto done;
                 break;
+            case TUNABLE_REQ:
+                if(cmd_tunable_req(sock, &cmd) != 0)
+                    goto done;
+                break;
             default:
                 abort();
         }
     }
 
 done:
+    zfsfuse_socket_shm_detach();
     cur_fd = -1;
     close(sock);
 }
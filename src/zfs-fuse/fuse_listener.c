@@ -26,7 +26,9 @@
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
-#include <sys/poll.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/debug.h>
 #include <sys/types.h>
 #include <sys/disp.h>
@@ -38,33 +40,61 @@
 
 #include "fuse.h"
 #include "fuse_listener.h"
-
-#define NUM_THREADS 40
+#include "zfsfuse_inode.h"
 
 #define MAX_FILESYSTEMS 1000
 
+#ifndef EPOLLEXCLUSIVE
+#define EPOLLEXCLUSIVE (1U << 28)
+#endif
+
+/*
+ * Every mounted filesystem gets its own group of worker threads.
+ *
+ * Each worker has an epoll set of its own, containing the /dev/fuse
+ * channel of the filesystem and an eventfd shared by the group, used to
+ * wake all of them up when the filesystem goes away or the daemon exits.
+ * The channel is non-blocking and is added with EPOLLEXCLUSIVE, so a new
+ * request wakes up a single idle worker rather than the whole group.
+ * Kernels older than 4.5 reject the flag; the workers then all wake up,
+ * and all but one get EAGAIN and go back to epoll_wait().
+ * Nothing is locked on the receive path; fs_lock is only taken when a
+ * worker starts or exits.
+ *
+ * The groups share a budget of fuse_threads_max workers. A filesystem
+ * mounted once the budget is spent still gets one worker.
+ */
 typedef struct fuse_fs_info {
 	int fd;
 	size_t bufsize;
 	struct fuse_chan *ch;
 	struct fuse_session *se;
+	char *mntpoint;
 	int mntlen;
+	int wakefd;		/* eventfd, written to kick the workers */
+	int workers;		/* workers still running */
+	boolean_t dead;		/* channel closed or session exited */
+	boolean_t unmounted;	/* session already torn down */
+	pthread_mutex_t fs_lock;
 } fuse_fs_info_t;
 
 boolean_t exit_fuse_listener = B_FALSE;
 static pthread_cond_t exiting_fuse_listener = PTHREAD_COND_INITIALIZER; // a fuse listener thread is exiting
 static int fuse_listeners_count = 0;
+static boolean_t fuse_listeners_started = B_FALSE;
 
-int newfs_fd[2];
+/* number of worker threads started for each mounted filesystem */
+int fuse_threads_per_fs = FUSE_THREADS_PER_FS_DEFAULT;
 
-#define MAX_FDS (MAX_FILESYSTEMS + 1)
+/* number of worker threads for all the filesystems together */
+int fuse_threads_max = FUSE_THREADS_MAX_DEFAULT;
 
-int nfds;
-struct pollfd fds[MAX_FDS];
-static fuse_fs_info_t fsinfo[MAX_FDS];
-char *mountpoints[MAX_FDS];
+/* checked by kstat.c before mounting the kstat filesystem */
+int fuse_listener_ready = 0;
+
+static int nfs;
+static fuse_fs_info_t *fsinfo[MAX_FILESYSTEMS];
 
-pthread_t fuse_threads[NUM_THREADS];
 static pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t sysmtx = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
 
@@ -72,18 +102,13 @@ kmem_cache_t *file_info_cache = NULL;
 
 int zfsfuse_listener_init()
 {
-	if(pipe(newfs_fd) == -1) {
-		perror("pipe");
-		return -1;
-	}
-
-	fds[0].fd = newfs_fd[0];
-	fds[0].events = POLLIN;
-	nfds = 1;
-
 	file_info_cache = kmem_cache_create("file_info_t", sizeof(file_info_t), 0, NULL, NULL, NULL, NULL, NULL, 0);
 	VERIFY(file_info_cache != NULL);
 
+	zfsfuse_inode_init();
+
+	fuse_listener_ready = 1;
+
 	return 0;
 }
 
@@ -91,252 +116,348 @@ static void fuse_unmount_all();
 
 void zfsfuse_listener_exit()
 {
-    fuse_unmount_all();
-
     int ret = zfsfuse_listener_stop();
     ASSERT(0 == ret);
 
+    fuse_unmount_all();
+
 	if(file_info_cache != NULL)
 		kmem_cache_destroy(file_info_cache);
 
-	close(newfs_fd[0]);
-	close(newfs_fd[1]);
+	zfsfuse_inode_fini();
 }
 
-int zfsfuse_newfs(char *mntpoint, struct fuse_chan *ch)
+/*
+ * Wake up every worker of this filesystem. The eventfd is never drained,
+ * so it stays readable and all current and future epoll_wait() calls
+ * return immediately.
+ */
+static void fs_kick(fuse_fs_info_t *fs)
 {
-	fuse_fs_info_t info = { 0 };
+	uint64_t one = 1;
 
-	info.fd = fuse_chan_fd(ch);
-	info.bufsize = fuse_chan_bufsize(ch);
-	info.ch = ch;
-	info.se = fuse_chan_session(ch);
-	info.mntlen = strlen(mntpoint);
-
-	if(write(newfs_fd[1], &info, sizeof(info)) != sizeof(info)) {
-		perror("Warning (while writing fsinfo to newfs_fd)");
-		return -1;
-	}
-
-	if(write(newfs_fd[1], mntpoint, info.mntlen) != info.mntlen) {
-		perror("Warning (while writing mntpoint to newfs_fd)");
-		return -1;
-	}
-	return 0;
+	if(write(fs->wakefd, &one, sizeof(one)) != sizeof(one))
+		perror("Warning (while waking up fuse workers)");
 }
 
 /*
- * This function is repeated in lib/libzfs/libzfs_zfsfuse.c
- * and in zfs-fuse/zfsfuse_socket.c
+ * Tear down the fuse session of a filesystem and free its resources.
+ * Called by the last worker of the group to exit, or by
+ * fuse_unmount_all() on daemon shutdown.
+ * Must be called with sysmtx locked.
  */
-static int fd_read_loop(int fd, void *buf, int bytes)
+static void destroy_fs(fuse_fs_info_t *fs, boolean_t unmount)
 {
-	int read_bytes = 0;
-	int left_bytes = bytes;
-
-	while(left_bytes > 0) {
-		int ret = read(fd, ((char *) buf) + read_bytes, left_bytes);
-		if(ret == 0)
-			return -1;
-
-		if(ret == -1) {
-			if(errno == EINTR)
-				continue;
-			perror("read");
-			return -1;
+	if(fs->se) {
+#ifdef DEBUG
+		fprintf(stderr, "Filesystem %s is being unmounted\n", fs->mntpoint);
+#endif
+		if(unmount) {
+			/* unmount before shuting down... */
+			fuse_session_remove_chan(fs->ch);
+			fuse_session_destroy(fs->se);
+			fuse_unmount(fs->mntpoint, fs->ch);
+		} else {
+			fuse_session_reset(fs->se);
+			fuse_session_destroy(fs->se);
 		}
-		read_bytes += ret;
-		left_bytes -= ret;
+		fs->se = NULL;
+		close(fs->fd);
+		fs->fd = -1;
 	}
-	return 0;
+	fs->unmounted = B_TRUE;
 }
 
-/*
- * Add a new filesystem/file descriptor to the poll set
- * Must be called with mtx locked
- */
-static void new_fs()
+static void free_fs(fuse_fs_info_t *fs)
 {
-	fuse_fs_info_t fs;
-
-	/*
-	 * This should never fail (famous last words) since the fd
-	 * is only closed in zfsfuse_listener_exit()
-	 */
-	VERIFY(fd_read_loop(fds[0].fd, &fs, sizeof(fuse_fs_info_t)) == 0);
+	for(int i = 0; i < nfs; i++) {
+		if(fsinfo[i] == fs) {
+			fsinfo[i] = fsinfo[--nfs];
+			break;
+		}
+	}
 
-	char *mntpoint = kmem_alloc(fs.mntlen + 1,KM_SLEEP);
+	close(fs->wakefd);
+	VERIFY(pthread_mutex_destroy(&fs->fs_lock) == 0);
+	kmem_free(fs->mntpoint, fs->mntlen + 1);
+	kmem_free(fs, sizeof(fuse_fs_info_t));
+}
 
-	VERIFY(fd_read_loop(fds[0].fd, mntpoint, fs.mntlen) == 0);
+static void worker_exit(fuse_fs_info_t *fs)
+{
+	VERIFY(pthread_mutex_lock(&sysmtx) == 0);
 
-	mntpoint[fs.mntlen] = '\0';
+	VERIFY(pthread_mutex_lock(&fs->fs_lock) == 0);
+	boolean_t last = (--fs->workers == 0);
+	VERIFY(pthread_mutex_unlock(&fs->fs_lock) == 0);
 
-	if(nfds == MAX_FDS) {
-		fprintf(stderr, "Warning: filesystem limit (%i) reached, unmounting..\n", MAX_FILESYSTEMS);
-		fuse_unmount(mntpoint,fs.ch);
-		kmem_free(mntpoint,fs.mntlen+1);
-		return;
+	/*
+	 * On daemon shutdown the sessions are destroyed by
+	 * fuse_unmount_all() once every worker is gone.
+	 */
+	if(last && fs->dead && !exit_fuse_listener) {
+		destroy_fs(fs, B_FALSE);
+		free_fs(fs);
 	}
 
-#ifdef DEBUG
-	fprintf(stderr, "Adding filesystem %i at mntpoint %s\n", nfds, mntpoint);
-#endif
-
-	fsinfo[nfds] = fs;
-	mountpoints[nfds] = mntpoint;
+	VERIFY(pthread_mutex_unlock(&sysmtx) == 0);
 
-	fds[nfds].fd = fs.fd;
-	fds[nfds].events = POLLIN;
-	fds[nfds].revents = 0;
-	nfds++;
+	VERIFY(pthread_mutex_lock(&mtx) == 0);
+	fuse_listeners_count--;
+	VERIFY(0 == pthread_cond_signal(&exiting_fuse_listener));
+	VERIFY(pthread_mutex_unlock(&mtx) == 0);
 }
 
+typedef struct fuse_worker {
+	fuse_fs_info_t *fs;
+	int epfd;
+} fuse_worker_t;
+
 /*
- * Delete a filesystem/file descriptor from the poll set
- * Must be called with mtx locked
+ * Make the epoll set of a worker of fs, see the top of this file.
  */
-static void destroy_fs(int i)
+static int worker_epoll_create(fuse_fs_info_t *fs)
 {
-	VERIFY(pthread_mutex_lock(&sysmtx) == 0);
-    if (fsinfo[i].se) {
-#ifdef DEBUG
-	fprintf(stderr, "Filesystem %i (%s) is being unmounted\n", i, mountpoints[i]);
-#endif
-	fuse_session_reset(fsinfo[i].se);
-	fuse_session_destroy(fsinfo[i].se);
-	fsinfo[i].se = NULL;
-	close(fds[i].fd);
-	fds[i].fd = -1;
-	kmem_free(mountpoints[i],fsinfo[i].mntlen+1);
-    }
-	VERIFY(pthread_mutex_unlock(&sysmtx) == 0);
-}
+	static uint32_t exclusive = EPOLLEXCLUSIVE;
+	struct epoll_event ev = { 0 };
+	int epfd = epoll_create(2);
+	int error;
 
-static void *zfsfuse_listener_loop(void *arg)
-{
-	size_t bufsize = 0;
-	char *buf = NULL;
+	if(epfd == -1)
+		return -1;
 
-	VERIFY(pthread_mutex_lock(&mtx) == 0);
+	ev.events = EPOLLIN | exclusive;
+	ev.data.ptr = fs;
+	if(epoll_ctl(epfd, EPOLL_CTL_ADD, fs->fd, &ev) == -1) {
+		if(errno != EINVAL || exclusive == 0)
+			goto out;
+		syslog(LOG_NOTICE, "fuse_listener: EPOLLEXCLUSIVE not supported, all the workers of a filesystem will wake up for each request");
+		exclusive = 0;
+		ev.events = EPOLLIN;
+		if(epoll_ctl(epfd, EPOLL_CTL_ADD, fs->fd, &ev) == -1)
+			goto out;
+	}
 
-    fuse_listeners_count++;
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if(epoll_ctl(epfd, EPOLL_CTL_ADD, fs->wakefd, &ev) == -1)
+		goto out;
 
-	while(!exit_fuse_listener) {
-		int ret = poll(fds, nfds, 1000);
-		if(ret == 0 || (ret == -1 && errno == EINTR))
-			continue;
+	return epfd;
 
-		if(ret == -1) {
-			perror("poll");
-			continue;
-		}
+out:
+	error = errno;
+	close(epfd);
+	errno = error;
+	return -1;
+}
 
-		int oldfds = nfds;
+static void *zfsfuse_listener_loop(void *arg)
+{
+	fuse_worker_t *worker = (fuse_worker_t *) arg;
+	fuse_fs_info_t *fs = worker->fs;
+	int epfd = worker->epfd;
+	struct epoll_event events[2];
 
-		for(int i = 0; i < oldfds; i++) {
-			short rev = fds[i].revents;
+	kmem_free(worker, sizeof(fuse_worker_t));
 
-			if(rev == 0)
-				continue;
+	size_t bufsize = fs->bufsize;
+	char *buf = kmem_alloc(bufsize, KM_SLEEP);
 
-			fds[i].revents = 0;
+	while(!exit_fuse_listener && !fs->dead) {
+		int ret = epoll_wait(epfd, events, 2, -1);
+		if(ret == -1) {
+			if(errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			break;
+		}
 
-			if (rev & POLLNVAL) { // already closed
-			    // fuse_unmount_all triggers this
-			    fds[i].fd = -1;
-			    continue;
-			}
+		for(int i = 0; i < ret && !fs->dead; i++) {
+			if(events[i].data.ptr == NULL)
+				continue; /* wakefd, the loop condition decides */
+
+			struct fuse_chan *ch = fs->ch;
+#if FUSE_VERSION >= 29
+			/*
+			 * With FUSE_CAP_SPLICE_READ, big write payloads are
+			 * left in a pipe for zfsfuse_write_buf() to read into
+			 * their final buffer.
+			 */
+			struct fuse_buf fbuf = { .mem = buf, .size = bufsize };
+			int res = fuse_session_receive_buf(fs->se, &fbuf, &ch);
+#else
+			int res = fuse_chan_recv(&ch, buf, bufsize);
+#endif
 
-			if(!(rev & POLLIN) && !(rev & POLLERR) && !(rev & POLLHUP))
+			/* Someone else got this request first */
+			if(res == -EAGAIN || res == -EINTR)
 				continue;
 
-			if(i == 0) {
-				new_fs();
-			} else {
-				/* Handle request */
-
-				if(fsinfo[i].bufsize > bufsize) {
-					char *new_buf = realloc(buf, fsinfo[i].bufsize);
-					if(new_buf == NULL) {
-						fprintf(stderr, "Warning: out of memory!\n");
-						continue;
-					}
-					buf = new_buf;
-					bufsize = fsinfo[i].bufsize;
-				}
-
-				if (!fsinfo[i].se) {
-				    destroy_fs(i);
-				    continue;
-				}
-				int res = fuse_chan_recv(&fsinfo[i].ch, buf, fsinfo[i].bufsize);
-				if(res == -1 || fuse_session_exited(fsinfo[i].se)) {
-				    destroy_fs(i);
-				    continue;
-				}
-
-				if(res == 0)
-					continue;
-
-				struct fuse_session *se = fsinfo[i].se;
-				struct fuse_chan *ch = fsinfo[i].ch;
-
-				/*
-				 * While we process this request, we let another
-				 * thread receive new events
-				 */
-				VERIFY(pthread_mutex_unlock(&mtx) == 0);
-
-				fuse_session_process(se, buf, res, ch);
-
-				/* Acquire the mutex before proceeding */
-				VERIFY(pthread_mutex_lock(&mtx) == 0);
-
-				/*
-				 * At this point, we can no longer trust oldfds
-				 * to be accurate, so we exit this loop
-                 *
-                 * Also, exit_fuse_listener might have been set in the mean
-                 * time
-				 */
+			if(res < 0 || fuse_session_exited(fs->se)) {
+				fs->dead = B_TRUE;
+				fs_kick(fs);
 				break;
 			}
-		}
 
-		/* Free the closed file descriptors entries */
-		int write_ptr = 0;
-		for(int read_ptr = 0; read_ptr < nfds; read_ptr++) {
-			if(fds[read_ptr].fd == -1)
+			if(res == 0)
 				continue;
-			if(read_ptr != write_ptr) {
-				fds[write_ptr] = fds[read_ptr];
-				fsinfo[write_ptr] = fsinfo[read_ptr];
-				mountpoints[write_ptr] = mountpoints[read_ptr];
-			}
-			write_ptr++;
+
+#if FUSE_VERSION >= 29
+			fuse_session_process_buf(fs->se, &fbuf, ch);
+#else
+			fuse_session_process(fs->se, buf, res, ch);
+#endif
 		}
-		nfds = write_ptr;
 	}
 
-    fuse_listeners_count--;
-    VERIFY(0 == pthread_cond_signal(&exiting_fuse_listener));
-	VERIFY(pthread_mutex_unlock(&mtx) == 0);
+	kmem_free(buf, bufsize);
+	close(epfd);
+	worker_exit(fs);
 
 	return NULL;
 }
 
 extern size_t stack_size;
 
-int zfsfuse_listener_start()
+/*
+ * Start the worker group of a filesystem, as big as fuse_threads_per_fs
+ * and what is left of the fuse_threads_max budget allow.
+ * Must be called with sysmtx locked.
+ */
+static int start_fs(fuse_fs_info_t *fs)
 {
 	pthread_attr_t attr;
 	VERIFY(0 == pthread_attr_init(&attr));
+	VERIFY(0 == pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED));
 	if (stack_size)
 	    pthread_attr_setstacksize(&attr,stack_size);
-	for(int i = 0; i < NUM_THREADS; i++)
-		VERIFY(pthread_create(&fuse_threads[i], &attr, zfsfuse_listener_loop, NULL) == 0);
+
+	VERIFY(pthread_mutex_lock(&mtx) == 0);
+	int nworkers = MIN(fuse_threads_per_fs, fuse_threads_max - fuse_listeners_count);
+	VERIFY(pthread_mutex_unlock(&mtx) == 0);
+	if(nworkers < 1)
+		nworkers = 1;
+
+	int error = 0;
+	for(int i = 0; i < nworkers; i++) {
+		fuse_worker_t *worker = kmem_alloc(sizeof(fuse_worker_t), KM_SLEEP);
+		pthread_t tid;
+
+		worker->fs = fs;
+		worker->epfd = worker_epoll_create(fs);
+		if(worker->epfd == -1) {
+			error = errno;
+			kmem_free(worker, sizeof(fuse_worker_t));
+			break;
+		}
+
+		VERIFY(pthread_mutex_lock(&mtx) == 0);
+		fuse_listeners_count++;
+		VERIFY(pthread_mutex_unlock(&mtx) == 0);
+
+		VERIFY(pthread_mutex_lock(&fs->fs_lock) == 0);
+		fs->workers++;
+		VERIFY(pthread_mutex_unlock(&fs->fs_lock) == 0);
+
+		error = pthread_create(&tid, &attr, zfsfuse_listener_loop, worker);
+		if(error != 0) {
+			close(worker->epfd);
+			kmem_free(worker, sizeof(fuse_worker_t));
+
+			VERIFY(pthread_mutex_lock(&fs->fs_lock) == 0);
+			fs->workers--;
+			VERIFY(pthread_mutex_unlock(&fs->fs_lock) == 0);
+
+			VERIFY(pthread_mutex_lock(&mtx) == 0);
+			fuse_listeners_count--;
+			VERIFY(pthread_mutex_unlock(&mtx) == 0);
+			break;
+		}
+	}
 
 	VERIFY(0 == pthread_attr_destroy(&attr));
+
+	/* A filesystem with at least one worker is still usable */
+	if(error != 0 && fs->workers == 0) {
+		syslog(LOG_WARNING, "fuse_listener: cannot start workers for %s: %s", fs->mntpoint, strerror(error));
+		return -1;
+	}
+	return 0;
+}
+
+int zfsfuse_newfs(char *mntpoint, struct fuse_chan *ch)
+{
+	fuse_fs_info_t *fs = kmem_zalloc(sizeof(fuse_fs_info_t), KM_SLEEP);
+
+	fs->fd = fuse_chan_fd(ch);
+	fs->bufsize = fuse_chan_bufsize(ch);
+	fs->ch = ch;
+	fs->se = fuse_chan_session(ch);
+	fs->mntlen = strlen(mntpoint);
+	fs->mntpoint = kmem_alloc(fs->mntlen + 1, KM_SLEEP);
+	strcpy(fs->mntpoint, mntpoint);
+	VERIFY(pthread_mutex_init(&fs->fs_lock, NULL) == 0);
+
+	fs->wakefd = eventfd(0, 0);
+	if(fs->wakefd == -1) {
+		perror("Warning (while creating eventfd)");
+		goto out_free;
+	}
+
+	int flags = fcntl(fs->fd, F_GETFL);
+	if(flags == -1 || fcntl(fs->fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+		perror("Warning (while making the fuse channel non-blocking)");
+		goto out_wakefd;
+	}
+
+	VERIFY(pthread_mutex_lock(&sysmtx) == 0);
+
+	if(nfs == MAX_FILESYSTEMS) {
+		VERIFY(pthread_mutex_unlock(&sysmtx) == 0);
+		fprintf(stderr, "Warning: filesystem limit (%i) reached, unmounting..\n", MAX_FILESYSTEMS);
+		goto out_wakefd;
+	}
+
+#ifdef DEBUG
+	fprintf(stderr, "Adding filesystem %i at mntpoint %s\n", nfs, mntpoint);
+#endif
+
+	fsinfo[nfs++] = fs;
+
+	/*
+	 * Filesystems mounted before zfsfuse_listener_start() get their
+	 * workers from there.
+	 */
+	if(fuse_listeners_started && start_fs(fs) != 0) {
+		fsinfo[--nfs] = NULL;
+		VERIFY(pthread_mutex_unlock(&sysmtx) == 0);
+		goto out_wakefd;
+	}
+
+	VERIFY(pthread_mutex_unlock(&sysmtx) == 0);
+
+	return 0;
+
+out_wakefd:
+	close(fs->wakefd);
+out_free:
+	VERIFY(pthread_mutex_destroy(&fs->fs_lock) == 0);
+	kmem_free(fs->mntpoint, fs->mntlen + 1);
+	kmem_free(fs, sizeof(fuse_fs_info_t));
+	return -1;
+}
+
+int zfsfuse_listener_start()
+{
+	VERIFY(pthread_mutex_lock(&sysmtx) == 0);
+
+	fuse_listeners_started = B_TRUE;
+	for(int i = 0; i < nfs; i++)
+		if(fsinfo[i]->workers == 0)
+			VERIFY(start_fs(fsinfo[i]) == 0);
+
+	VERIFY(pthread_mutex_unlock(&sysmtx) == 0);
 	return 0;
 }
 
@@ -344,6 +465,11 @@ int zfsfuse_listener_stop()
 {
     exit_fuse_listener = B_TRUE;
 
+    VERIFY(pthread_mutex_lock(&sysmtx) == 0);
+    for(int i = 0; i < nfs; i++)
+        fs_kick(fsinfo[i]);
+    VERIFY(pthread_mutex_unlock(&sysmtx) == 0);
+
     VERIFY(pthread_mutex_lock(&mtx) == 0);
 
     struct timeval now;
@@ -376,22 +502,15 @@ int zfsfuse_listener_stop()
 static void fuse_unmount_all() {
     VERIFY(pthread_mutex_lock(&sysmtx) == 0);
 
-    for(int i = nfds-1; i >= 1; i--) {
-	if(fds[i].fd == -1)
-	    continue;
+    for(int i = nfs-1; i >= 0; i--) {
+	fuse_fs_info_t *fs = fsinfo[i];
 
-#ifdef DEBUG
-	fprintf(stderr, "Filesystem %i (%s) is being unmounted\n", i, mountpoints[i]);
-#endif
-	/* unmount before shuting down... */
-	fuse_session_remove_chan(fsinfo[i].ch);
-	fuse_session_destroy(fsinfo[i].se);
-	fsinfo[i].se = NULL;
-	fuse_unmount(mountpoints[i],fsinfo[i].ch);
-	close(fds[i].fd);
-	fds[i].fd = -1;
-	kmem_free(mountpoints[i],fsinfo[i].mntlen+1);
+	if(!fs->unmounted)
+	    destroy_fs(fs, B_TRUE);
 
+	/* workers which missed the 10s deadline still reference fs */
+	if(fs->workers == 0)
+	    free_fs(fs);
     }
 
     VERIFY(pthread_mutex_unlock(&sysmtx) == 0);
@@ -35,12 +35,21 @@
 typedef struct file_info {
 	vnode_t *vp;
 	int flags;
+	struct zfs_dircursor *dircursor; /* directories only */
 } file_info_t;
 
 extern kmem_cache_t *file_info_cache;
 
 extern boolean_t exit_fuse_listener;
 
+#define FUSE_THREADS_PER_FS_DEFAULT 8
+#define FUSE_THREADS_PER_FS_MAX 256
+#define FUSE_THREADS_MAX_DEFAULT 64
+#define FUSE_THREADS_MAX_MAX 4096
+
+extern int fuse_threads_per_fs;
+extern int fuse_threads_max;
+
 extern int zfsfuse_listener_init();
 extern int zfsfuse_listener_start();
 extern int zfsfuse_listener_stop();
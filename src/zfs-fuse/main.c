@@ -77,6 +77,9 @@ extern int optind, opterr, optopt;
 extern int zfs_vdev_cache_size; // in lib/libzpool/vdev_cache.c
 extern int zfs_prefetch_disable; // lib/libzpool/dmu_zfetch.c
 extern int arg_log_uberblocks, arg_min_uberblock_txg; // uberblock.c
+extern int zio_arena_hugepages; // lib/libsolkerncompat/zio_arena.c
+extern int zfs_arc_compressed; // lib/libzpool/arc.c
+extern int zfs_arc_warm; // lib/libzpool/arc_warm.c
 size_t stack_size = 0;
 
 static struct option longopts[] = {
@@ -155,11 +158,36 @@ static struct option longopts[] = {
 	    NULL,
 	    's'
 	},
+	{ "fuse-threads",
+	    1,
+	    NULL,
+	    't'
+	},
+	{ "fuse-threads-max",
+	    1,
+	    NULL,
+	    'T'
+	},
 	{ "enable-xattr",
 	  0,
 	  &cf_enable_xattr,
 	  1
 	},
+	{ "hugepages",
+	  0,
+	  &zio_arena_hugepages,
+	  1
+	},
+	{ "compressed-arc",
+	  0,
+	  &zfs_arc_compressed,
+	  1
+	},
+	{ "warm-arc",
+	  0,
+	  &zfs_arc_warm,
+	  1
+	},
 	{ 0, 0, 0, 0 }
 };
 
@@ -199,7 +227,7 @@ void print_usage(int argc, char *argv[]) {
 		"			Logs uberblocks of any mounted filesystem to syslog\n"
 		"  -m MB, --max-arc-size MB\n"
 		"			Forces the maximum ARC size (in megabytes).\n"
-		"			Range: 16 to 16384.\n"
+		"			Range: 16 to 16384. Default: 1/4 of the memory.\n"
 		"  -o OPT..., --fuse-mount-options OPT,OPT,OPT...\n"
 		"			Sets FUSE mount options for all filesystems.\n"
 		"			Format: comma-separated string of characters.\n"
@@ -213,13 +241,32 @@ void print_usage(int argc, char *argv[]) {
 		"  --stack-size=size\n"
 		"			Limit the stack size of threads (in kb).\n"
 		"			default : no limit (8 Mb for linux)\n"
+		"  -t N, --fuse-threads N\n"
+		"			Number of threads serving FUSE requests for each\n"
+		"			mounted filesystem. Range: 1 to %d. Default : %d\n"
+		"  --fuse-threads-max N\n"
+		"			Number of threads serving FUSE requests for all the\n"
+		"			filesystems together. A filesystem mounted once they\n"
+		"			are all taken gets a single one.\n"
+		"			Range: 1 to %d. Default : %d\n"
   		"  -x, --enable-xattr\n"
   		"			Enable support for extended attributes. Not generally \n"
 		"			recommended because it currently has a significant \n"
 		"			performance penalty for many small IOPS\n"
+		"  --hugepages\n"
+		"			Back the ARC buffers with 2MB pages (hugetlbfs\n"
+		"			if reserved, else transparent hugepages).\n"
+		"  --compressed-arc\n"
+		"			Keep compressed blocks compressed in the ARC and\n"
+		"			decompress them when they are read.\n"
+		"  --warm-arc\n"
+		"			Save the list of the hottest ARC blocks of a pool\n"
+		"			when it is unloaded, and read them back in when it\n"
+		"			is loaded again.\n"
 		"  -h, --help\n"
 		"			Show this usage summary.\n"
-		, progname);
+		, progname, FUSE_THREADS_PER_FS_MAX, FUSE_THREADS_PER_FS_DEFAULT,
+		FUSE_THREADS_MAX_MAX, FUSE_THREADS_MAX_DEFAULT);
 }
 
 static void check_opt(const char *progname,char *opt) {
@@ -240,7 +287,7 @@ static void parse_args(int argc, char *argv[])
 
 	optind = 0;
 	optarg = NULL;
-	while ((retval = getopt_long(argc, argv, "-hp:a:e:m:nxo:u:v:s:", longopts, NULL)) != -1) {
+	while ((retval = getopt_long(argc, argv, "-hp:a:e:m:nxo:u:v:s:t:", longopts, NULL)) != -1) {
 		switch (retval) {
 			case 1: /* non-option argument passed (due to - in optstring) */
 			case 'h':
@@ -337,6 +384,24 @@ static void parse_args(int argc, char *argv[])
 				stack_size=strtoul(optarg,&detecterror,10)<<10;
 				syslog(LOG_WARNING,"stack size for threads %zd",stack_size);
 				break;
+			case 't':
+				check_opt(progname,"-t");
+				fuse_threads_per_fs = strtol(optarg,&detecterror,10);
+				if ((fuse_threads_per_fs == 0 && detecterror == optarg) || (fuse_threads_per_fs < 1) || (fuse_threads_per_fs > FUSE_THREADS_PER_FS_MAX)) {
+					fprintf(stderr, "%s: you need to specify a valid, in-range number of fuse threads\n\n", progname);
+					print_usage(argc, argv);
+					exit(64);
+				}
+				break;
+			case 'T':
+				check_opt(progname,"--fuse-threads-max");
+				fuse_threads_max = strtol(optarg,&detecterror,10);
+				if ((fuse_threads_max == 0 && detecterror == optarg) || (fuse_threads_max < 1) || (fuse_threads_max > FUSE_THREADS_MAX_MAX)) {
+					fprintf(stderr, "%s: you need to specify a valid, in-range number of fuse threads\n\n", progname);
+					print_usage(argc, argv);
+					exit(64);
+				}
+				break;
 			case 'x':
 				cf_enable_xattr = 1;
 				break;
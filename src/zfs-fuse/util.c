@@ -41,6 +41,9 @@
 
 #include "cmd_listener.h"
 #include "fuse_listener.h"
+#include "zfsfuse_inode.h"
+#include "zfsfuse_opstats.h"
+#include "zfsfuse_tunables.h"
 
 #include "fuse.h"
 #include "zfs_operations.h"
@@ -231,6 +234,8 @@ int do_init()
 
 	VERIFY(zfs_ioctl_init() == 0);
 
+	zfsfuse_tunables_init();
+
     VERIFY(ioctl_fd != -1); // initialization moved to do_init_fusesocket
 
     VERIFY(cmd_listener_init() == 0);
@@ -261,6 +266,7 @@ void do_exit()
 
 	zfsfuse_listener_exit();
     cmd_listener_fini();
+	zfsfuse_tunables_fini();
 
 	if(ioctl_fd != -1)
 		zfsfuse_socket_close(ioctl_fd);
@@ -332,6 +338,8 @@ int do_mount(char *spec, char *dir, int mflag, char *opt)
 		kmem_free(vfs, sizeof(vfs_t));
 		return ret;
 	}
+	zfsfuse_inodes_create(vfs);
+	zfsfuse_opstats_create(vfs, spec);
 	/* Actually, optptr is totally ignored by VFS_MOUNT.
 	 * So we are going to pass this with fuse_mount_options if possible */
     if (fuse_mount_options == NULL)
@@ -396,6 +404,7 @@ int do_mount(char *spec, char *dir, int mflag, char *opt)
 	}
 
 	fuse_session_add_chan(se, ch);
+	zfsfuse_inodes_set_chan(vfs, ch);
 
 	if(zfsfuse_newfs(dir, ch) != 0) {
 		fuse_session_destroy(se);
@@ -410,9 +419,16 @@ int do_umount(vfs_t *vfs, boolean_t force)
 {
 	VFS_SYNC(vfs, 0, kcred);
 
+	/* The pinned inodes would keep the filesystem busy */
+	zfsfuse_inodes_drain(vfs);
+
 	int ret = VFS_UNMOUNT(vfs, force ? MS_FORCE : 0, kcred);
-	if(ret != 0)
+	if(ret != 0) {
+		zfsfuse_inodes_reopen(vfs);
 		return ret;
+	}
+
+	zfsfuse_inodes_destroy(vfs);
 
 	ASSERT(force || vfs->vfs_count == 1);
 	VFS_RELE(vfs);
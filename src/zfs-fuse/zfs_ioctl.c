@@ -1073,7 +1073,7 @@ zfs_ioc_pool_create(zfs_cmd_t *zc)
 
 	if (props) {
 		nvlist_t *nvl = NULL;
-		uint64_t version = SPA_VERSION;
+		uint64_t version = SPA_VERSION_DEFAULT;
 
 		(void) nvlist_lookup_uint64(props,
 		    zpool_prop_to_name(ZPOOL_PROP_VERSION), &version);
@@ -1871,6 +1871,176 @@ top:
 	return (error);
 }
 
+/*
+ * Adds the stats and properties of the named dataset to a list batch.
+ * Returns the packed size of the new entry in *sizep.
+ */
+static int
+zfs_list_batch_one(const char *name, nvlist_t *batch, size_t *sizep)
+{
+	objset_t *os;
+	dmu_objset_stats_t stats;
+	nvlist_t *nv, *props;
+	int error;
+
+	if (error = dmu_objset_hold(name, FTAG, &os))
+		return (error);
+
+	dmu_objset_fast_stat(os, &stats);
+
+	if ((error = dsl_prop_get_all(os, &props)) == 0) {
+		dmu_objset_stats(os, props);
+		/* see zfs_ioc_objset_stats() */
+		if (!stats.dds_inconsistent &&
+		    dmu_objset_type(os) == DMU_OST_ZVOL)
+			VERIFY(zvol_get_stats(os, props) == 0);
+
+		VERIFY(nvlist_alloc(&nv, NV_UNIQUE_NAME, KM_SLEEP) == 0);
+		VERIFY(nvlist_add_uint8_array(nv, ZFS_LIST_BATCH_STATS,
+		    (uint8_t *)&stats, sizeof (stats)) == 0);
+		VERIFY(nvlist_add_nvlist(nv, ZFS_LIST_BATCH_PROPS,
+		    props) == 0);
+		VERIFY(nvlist_size(nv, sizep, NV_ENCODE_NATIVE) == 0);
+		VERIFY(nvlist_add_nvlist(batch, name, nv) == 0);
+		nvlist_free(nv);
+		nvlist_free(props);
+	}
+
+	dmu_objset_rele(os, FTAG);
+	return (error);
+}
+
+/*
+ * inputs:
+ * zc_name		name of filesystem
+ * zc_cookie		zap cursor
+ * zc_objset_type	ZFS_LIST_BATCH_CHILDREN or ZFS_LIST_BATCH_SNAPSHOTS
+ * zc_obj		maximum number of datasets to return (0 for default)
+ * zc_nvlist_dst_size	size of buffer for the batch nvlist
+ *
+ * outputs:
+ * zc_cookie		zap cursor past the last dataset returned
+ * zc_nvlist_dst	nvlist of { name -> { stats, props } }
+ * zc_nvlist_dst_size	size of the batch nvlist
+ *
+ * Returns as many datasets as fit in the buffer, but at least one.  A
+ * listing that is already exhausted returns ESRCH, like the _list_next
+ * ioctls.
+ */
+static int
+zfs_ioc_list_batch(zfs_cmd_t *zc)
+{
+	objset_t *os;
+	nvlist_t *batch;
+	char name[MAXNAMELEN];
+	char *p;
+	int len, count = 0;
+	boolean_t snapshots;
+	uint64_t cookie, next, max;
+	size_t size, total = 0;
+	int error;
+
+	if (zc->zc_objset_type != ZFS_LIST_BATCH_CHILDREN &&
+	    zc->zc_objset_type != ZFS_LIST_BATCH_SNAPSHOTS)
+		return (EINVAL);
+	snapshots = (zc->zc_objset_type == ZFS_LIST_BATCH_SNAPSHOTS);
+
+	max = zc->zc_obj;
+	if (max == 0 || max > ZFS_LIST_BATCH_MAX)
+		max = ZFS_LIST_BATCH_MAX;
+
+	if (snapshots && zc->zc_cookie == 0)
+		(void) dmu_objset_find(zc->zc_name, dmu_objset_prefetch,
+		    NULL, DS_FIND_SNAPSHOTS);
+
+	if (error = dmu_objset_hold(zc->zc_name, FTAG, &os))
+		return (error == ENOENT ? ESRCH : error);
+
+	(void) strlcpy(name, zc->zc_name, sizeof (name));
+	if (snapshots) {
+		/*
+		 * A dataset name of maximum length cannot have any
+		 * snapshots.
+		 */
+		if (strlcat(name, "@", sizeof (name)) >= MAXNAMELEN) {
+			dmu_objset_rele(os, FTAG);
+			return (ESRCH);
+		}
+	} else {
+		p = strrchr(name, '/');
+		if (p == NULL || p[1] != '\0')
+			(void) strlcat(name, "/", sizeof (name));
+	}
+	p = name + strlen(name);
+	len = sizeof (name) - (p - name);
+
+	if (!snapshots && zc->zc_cookie == 0) {
+		cookie = 0;
+		while (dmu_dir_list_next(os, len, p, NULL, &cookie) == 0)
+			(void) dmu_objset_prefetch(p, NULL);
+	}
+
+	VERIFY(nvlist_alloc(&batch, NV_UNIQUE_NAME, KM_SLEEP) == 0);
+
+	cookie = zc->zc_cookie;
+	while (count < max) {
+		next = cookie;
+		if (snapshots)
+			error = dmu_snapshot_list_next(os, len, p, NULL,
+			    &next, NULL);
+		else
+			error = dmu_dir_list_next(os, len, p, NULL, &next);
+		if (error != 0) {
+			if (error == ENOENT)
+				error = 0;
+			break;
+		}
+
+		/* internal datasets have no stats, see dataset_list_next */
+		if (!snapshots && dataset_name_hidden(name)) {
+			cookie = next;
+			continue;
+		}
+
+		error = zfs_list_batch_one(name, batch, &size);
+		if (error == ENOENT) {
+			/* We lost a race with destroy, get the next one. */
+			cookie = next;
+			error = 0;
+			continue;
+		}
+		if (error != 0)
+			break;
+
+		/*
+		 * Leave the entry for the next call if it would overflow the
+		 * caller's buffer; the first entry always goes out so that
+		 * put_nvlist() can tell the caller how much room it needs.
+		 * The pair header and name are not part of the entry's own
+		 * packed size, so allow for them here.
+		 */
+		total += size + strlen(name) + 64;
+		if (count > 0 && total > zc->zc_nvlist_dst_size) {
+			VERIFY(nvlist_remove(batch, name,
+			    DATA_TYPE_NVLIST) == 0);
+			break;
+		}
+
+		cookie = next;
+		count++;
+	}
+	dmu_objset_rele(os, FTAG);
+
+	if (error == 0 && count == 0)
+		error = ESRCH;
+	if (error == 0)
+		error = put_nvlist(zc, batch);
+	if (error == 0)
+		zc->zc_cookie = cookie;
+	nvlist_free(batch);
+	return (error);
+}
+
 static int
 zfs_prop_set_userquota(const char *dsname, nvpair_t *pair)
 {
@@ -3175,6 +3345,11 @@ zfs_check_settable(const char *dsname, nvpair_t *pair, cred_t *cr)
 			    SPA_VERSION_ZLE_COMPRESSION))
 				return (ENOTSUP);
 
+			if (intval == ZIO_COMPRESS_LZ4 &&
+			    zfs_earlier_version(dsname,
+			    SPA_VERSION_LZ4_COMPRESSION))
+				return (ENOTSUP);
+
 			/*
 			 * If this is a bootable dataset then
 			 * verify that the compression algorithm
@@ -4380,6 +4555,8 @@ static zfs_ioc_vec_t zfs_ioc_vec[] = {
 	{ zfs_ioc_objset_recvd_props, zfs_secpolicy_read, DATASET_NAME, B_FALSE,
 	    B_FALSE },
 	{ zfs_ioc_vdev_split, zfs_secpolicy_config, POOL_NAME, B_TRUE,
+	    B_TRUE },
+	{ zfs_ioc_list_batch, zfs_secpolicy_read, DATASET_NAME, B_FALSE,
 	    B_TRUE }
 };
 
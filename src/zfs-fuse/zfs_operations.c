@@ -41,9 +41,12 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <time.h>
+#include <linux/falloc.h>
 
 #include "util.h"
 #include "fuse_listener.h"
+#include "zfsfuse_inode.h"
+#include "zfsfuse_opstats.h"
 #include <syslog.h>
 
 #define ZFS_MAGIC 0x2f52f5
@@ -70,6 +73,15 @@ static void zfsfuse_getcred(fuse_req_t req, cred_t *cred)
 	cred->req = req;
 }
 
+static void zfsfuse_init(void *userdata, struct fuse_conn_info *conn)
+{
+#ifdef FUSE_CAP_SPLICE_READ
+	/* Let zfsfuse_write_buf() read big writes from a pipe, see there */
+	if(conn->capable & FUSE_CAP_SPLICE_READ)
+		conn->want |= FUSE_CAP_SPLICE_READ;
+#endif
+}
+
 static void zfsfuse_destroy(void *userdata)
 {
 	vfs_t *vfs = (vfs_t *) userdata;
@@ -90,7 +102,7 @@ static void zfsfuse_destroy(void *userdata)
 #endif
 }
 
-static void zfsfuse_statfs(fuse_req_t req, fuse_ino_t ino)
+static int zfsfuse_statfs(fuse_req_t req, fuse_ino_t ino)
 {
     print_debug("function %s\n",__FUNCTION__);
 	vfs_t *vfs = (vfs_t *) fuse_req_userdata(req);
@@ -98,10 +110,8 @@ static void zfsfuse_statfs(fuse_req_t req, fuse_ino_t ino)
 	struct statvfs64 zfs_stat;
 
 	int ret = VFS_STATVFS(vfs, &zfs_stat);
-	if(ret != 0) {
-		fuse_reply_err(req, ret);
-		return;
-	}
+	if(ret != 0)
+		return ret;
 
 	struct statvfs stat = { 0 };
 
@@ -122,6 +132,19 @@ static void zfsfuse_statfs(fuse_req_t req, fuse_ino_t ino)
 	stat.f_namemax = zfs_stat.f_namemax;
 
 	fuse_reply_statfs(req, &stat);
+
+	return 0;
+}
+
+static void zfsfuse_statfs_helper(fuse_req_t req, fuse_ino_t ino)
+{
+	zfsfuse_opstat_t os;
+
+	zfsfuse_opstat_start(req, &os);
+	int error = zfsfuse_statfs(req, ino);
+	if(error)
+		fuse_reply_err(req, error);
+	zfsfuse_opstat_end(&os, ZFSFUSE_OP_STATFS, error);
 }
 
 static int zfsfuse_stat(vnode_t *vp, struct stat *stbuf, cred_t *cred)
@@ -165,7 +188,7 @@ static int zfsfuse_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info
 
 	znode_t *znode;
 
-	int error = zfs_zget(zfsvfs, ino, &znode, B_TRUE);
+	int error = zfsfuse_zget(vfs, ino, &znode, B_TRUE);
 	if(error) {
 		ZFS_EXIT(zfsvfs);
 		/* If the inode we are trying to get was recently deleted
@@ -195,21 +218,15 @@ static int zfsfuse_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info
 static void zfsfuse_getattr_helper(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
 {
 	fuse_ino_t real_ino = ino == 1 ? 3 : ino;
+	zfsfuse_opstat_t os;
 
+	zfsfuse_opstat_start(req, &os);
 	int error = zfsfuse_getattr(req, real_ino, fi);
 	if(error)
 		fuse_reply_err(req, error);
+	zfsfuse_opstat_end(&os, ZFSFUSE_OP_GETATTR, error);
 }
 
-static int int_zfs_enter(zfsvfs_t *zfsvfs) {
-    ZFS_ENTER(zfsvfs);
-    return 0;
-}
-
-// This macro allows to call ZFS_ENTER from a void function without warning
-#define ZFS_VOID_ENTER(a) \
-    if (int_zfs_enter(zfsvfs) != 0) return;
-
 /* This macro makes the lookup for the xattr directory, necessary for listxattr
  * getxattr and setxattr */
 #define MY_LOOKUP_XATTR() \
@@ -217,15 +234,14 @@ static int int_zfs_enter(zfsvfs_t *zfsvfs) {
     zfsvfs_t *zfsvfs = vfs->vfs_data;				\
     if (ino == 1) ino = 3;					\
 								\
-    ZFS_VOID_ENTER(zfsvfs);					\
+    ZFS_ENTER(zfsvfs);						\
 								\
     znode_t *znode;						\
 								\
-    int error = zfs_zget(zfsvfs, ino, &znode, B_FALSE);		\
+    int error = zfsfuse_zget(vfs, ino, &znode, B_FALSE);		\
     if(error) {							\
 	ZFS_EXIT(zfsvfs);					\
-	fuse_reply_err(req, error == EEXIST ? ENOENT : error);	\
-	return;							\
+	return error == EEXIST ? ENOENT : error;		\
     }								\
 								\
     ASSERT(znode != NULL);					\
@@ -244,13 +260,10 @@ static int int_zfs_enter(zfsvfs_t *zfsvfs) {
 	goto out;						\
     }
 
-static void zfsfuse_listxattr(fuse_req_t req, fuse_ino_t ino, size_t size)
+static int zfsfuse_listxattr(fuse_req_t req, fuse_ino_t ino, size_t size)
 {
 	if (!cf_enable_xattr)
-	{
-		fuse_reply_err(req, ENOSYS);
-		return;
-	}
+		return ENOSYS;
 	union {
 		char buf[DIRENT64_RECLEN(MAXNAMELEN)];
 		struct dirent64 dirent;
@@ -275,6 +288,7 @@ static void zfsfuse_listxattr(fuse_req_t req, fuse_ino_t ino, size_t size)
 	uio.uio_iov = &iovec;
 	uio.uio_iovcnt = 1;
 	uio.uio_segflg = UIO_SYSSPACE;
+	uio.uio_extflg = UIO_COPY_DEFAULT;
 	uio.uio_fmode = 0;
 	uio.uio_llimit = RLIM64_INFINITY;
 
@@ -323,17 +337,24 @@ out:
 	VN_RELE(vp);
     VN_RELE(dvp);
     ZFS_EXIT(zfsvfs);
-    if (error)
-	fuse_reply_err(req,error);
+    return error;
+}
+
+static void zfsfuse_listxattr_helper(fuse_req_t req, fuse_ino_t ino, size_t size)
+{
+	zfsfuse_opstat_t os;
+
+	zfsfuse_opstat_start(req, &os);
+	int error = zfsfuse_listxattr(req, ino, size);
+	if(error)
+		fuse_reply_err(req, error);
+	zfsfuse_opstat_end(&os, ZFSFUSE_OP_LISTXATTR, error);
 }
 
-static void zfsfuse_setxattr(fuse_req_t req, fuse_ino_t ino, const char *name, const char *value, size_t size, int flags)
+static int zfsfuse_setxattr(fuse_req_t req, fuse_ino_t ino, const char *name, const char *value, size_t size, int flags)
 {
 	if (!cf_enable_xattr)
-	{
-		fuse_reply_err(req, ENOSYS);
-		return;
-	}
+		return ENOSYS;
     MY_LOOKUP_XATTR();
     // Now the idea is to create a file inside the xattr directory with the
     // wanted attribute.
@@ -359,6 +380,7 @@ static void zfsfuse_setxattr(fuse_req_t req, fuse_ino_t ino, const char *name, c
     uio.uio_iov = &iovec;
     uio.uio_iovcnt = 1;
     uio.uio_segflg = UIO_SYSSPACE;
+    uio.uio_extflg = UIO_COPY_DEFAULT;
     uio.uio_fmode = 0;
     uio.uio_llimit = RLIM64_INFINITY;
 
@@ -376,18 +398,25 @@ out:
 	VN_RELE(vp);
     VN_RELE(dvp);
     ZFS_EXIT(zfsvfs);
-	// The fuse_reply_err at the end seems to be an mandatory even if there is no error
-    fuse_reply_err(req,error);
+    return error;
+}
+
+static void zfsfuse_setxattr_helper(fuse_req_t req, fuse_ino_t ino, const char *name, const char *value, size_t size, int flags)
+{
+	zfsfuse_opstat_t os;
+
+	zfsfuse_opstat_start(req, &os);
+	int error = zfsfuse_setxattr(req, ino, name, value, size, flags);
+	/* the reply is mandatory even if there is no error */
+	fuse_reply_err(req, error);
+	zfsfuse_opstat_end(&os, ZFSFUSE_OP_SETXATTR, error);
 }
 
-static void zfsfuse_getxattr(fuse_req_t req, fuse_ino_t ino, const char *name,
+static int zfsfuse_getxattr(fuse_req_t req, fuse_ino_t ino, const char *name,
 	size_t size)
 {
 	if (!cf_enable_xattr)
-	{
-		fuse_reply_err(req, ENOSYS);
-		return;
-	}
+		return ENOSYS;
     MY_LOOKUP_XATTR();
     vnode_t *new_vp = NULL;
     error = VOP_LOOKUP(vp, (char *) name, &new_vp, NULL, 0, NULL, &cred, NULL, NULL, NULL);  
@@ -408,12 +437,14 @@ static void zfsfuse_getxattr(fuse_req_t req, fuse_ino_t ino, const char *name,
 	fuse_reply_xattr(req,vattr.va_size);
 	goto out;
     } else if (size < vattr.va_size) {
-	fuse_reply_xattr(req, ERANGE);
+	error = ERANGE;
 	goto out;
     }
     char *buf = malloc(vattr.va_size);
-    if (!buf)
+    if (!buf) {
+	error = ENOMEM;
 	goto out;
+    }
 
     error = VOP_OPEN(&vp, FREAD, &cred, NULL);
     if (error) {
@@ -426,6 +457,7 @@ static void zfsfuse_getxattr(fuse_req_t req, fuse_ino_t ino, const char *name,
     uio.uio_iov = &iovec;
     uio.uio_iovcnt = 1;
     uio.uio_segflg = UIO_SYSSPACE;
+    uio.uio_extflg = UIO_COPY_DEFAULT;
     uio.uio_fmode = 0;
     uio.uio_llimit = RLIM64_INFINITY;
 
@@ -448,17 +480,25 @@ out:
 	VN_RELE(vp);
     VN_RELE(dvp);
     ZFS_EXIT(zfsvfs);
-    if (error)
-	fuse_reply_err(req,error);
+    return error;
+}
+
+static void zfsfuse_getxattr_helper(fuse_req_t req, fuse_ino_t ino, const char *name,
+	size_t size)
+{
+	zfsfuse_opstat_t os;
+
+	zfsfuse_opstat_start(req, &os);
+	int error = zfsfuse_getxattr(req, ino, name, size);
+	if(error)
+		fuse_reply_err(req, error);
+	zfsfuse_opstat_end(&os, ZFSFUSE_OP_GETXATTR, error);
 }
 
-static void zfsfuse_removexattr(fuse_req_t req, fuse_ino_t ino, const char *name)
+static int zfsfuse_removexattr(fuse_req_t req, fuse_ino_t ino, const char *name)
 {
 	if (!cf_enable_xattr)
-	{
-		fuse_reply_err(req, ENOSYS);
-		return;
-	}
+		return ENOSYS;
     MY_LOOKUP_XATTR();
     error = VOP_REMOVE(vp, (char *) name, &cred, NULL, 0);
 
@@ -469,7 +509,28 @@ out:
     ZFS_EXIT(zfsvfs);
 	if (error == ENOENT)
 		error = ENOATTR;
-    fuse_reply_err(req,error);
+    return error;
+}
+
+static void zfsfuse_removexattr_helper(fuse_req_t req, fuse_ino_t ino, const char *name)
+{
+	zfsfuse_opstat_t os;
+
+	zfsfuse_opstat_start(req, &os);
+	int error = zfsfuse_removexattr(req, ino, name);
+	fuse_reply_err(req, error);
+	zfsfuse_opstat_end(&os, ZFSFUSE_OP_REMOVEXATTR, error);
+}
+
+/*
+ * Reply with an entry the kernel takes a lookup count on.  If the reply
+ * does not get through, the kernel will never forget the inode, so undo
+ * the zfsfuse_inode_remember() done for it.
+ */
+static void zfsfuse_reply_entry(fuse_req_t req, vfs_t *vfs, const struct fuse_entry_param *e)
+{
+	if(fuse_reply_entry(req, e) != 0 && e->ino != 0)
+		zfsfuse_inode_forget(vfs, e->ino == 1 ? 3 : e->ino, 1);
 }
 
 static int zfsfuse_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
@@ -485,7 +546,7 @@ static int zfsfuse_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
 
 	znode_t *znode;
 
-	int error = zfs_zget(zfsvfs, parent, &znode, B_TRUE);
+	int error = zfsfuse_zget(vfs, parent, &znode, B_TRUE);
 	if(error) {
 		ZFS_EXIT(zfsvfs);
 		/* If the inode we are trying to get was recently deleted
@@ -528,6 +589,8 @@ static int zfsfuse_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
 	e.generation = VTOZ(vp)->z_phys->zp_gen;
 
 	error = zfsfuse_stat(vp, &e.attr, &cred);
+	if(!error)
+		zfsfuse_inode_remember(vfs, vp);
 
 out:
 	if(vp != NULL)
@@ -536,7 +599,7 @@ out:
 	ZFS_EXIT(zfsvfs);
 
 	if(!error)
-		fuse_reply_entry(req, &e);
+		zfsfuse_reply_entry(req, vfs, &e);
 
 	return error;
 }
@@ -544,10 +607,13 @@ out:
 static void zfsfuse_lookup_helper(fuse_req_t req, fuse_ino_t parent, const char *name)
 {
 	fuse_ino_t real_parent = parent == 1 ? 3 : parent;
+	zfsfuse_opstat_t os;
 
+	zfsfuse_opstat_start(req, &os);
 	int error = zfsfuse_lookup(req, real_parent, name);
 	if(error)
 		fuse_reply_err(req, error);
+	zfsfuse_opstat_end(&os, ZFSFUSE_OP_LOOKUP, error);
 }
 
 static int zfsfuse_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
@@ -560,7 +626,7 @@ static int zfsfuse_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info
 
 	znode_t *znode;
 
-	int error = zfs_zget(zfsvfs, ino, &znode, B_TRUE);
+	int error = zfsfuse_zget(vfs, ino, &znode, B_TRUE);
 	if(error) {
 		ZFS_EXIT(zfsvfs);
 		/* If the inode we are trying to get was recently deleted
@@ -604,6 +670,8 @@ static int zfsfuse_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info
 
 		info->vp = vp;
 		info->flags = FREAD;
+		info->dircursor = kmem_alloc(sizeof(zfs_dircursor_t), KM_SLEEP);
+		zfs_dircursor_init(info->dircursor);
 
 		fi->fh = (uint64_t) (uintptr_t) info;
 	}
@@ -622,10 +690,13 @@ out:
 static void zfsfuse_opendir_helper(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
 {
 	fuse_ino_t real_ino = ino == 1 ? 3 : ino;
+	zfsfuse_opstat_t os;
 
+	zfsfuse_opstat_start(req, &os);
 	int error = zfsfuse_opendir(req, real_ino, fi);
 	if(error)
 		fuse_reply_err(req, error);
+	zfsfuse_opstat_end(&os, ZFSFUSE_OP_OPENDIR, error);
 }
 
 static int zfsfuse_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
@@ -649,6 +720,11 @@ static int zfsfuse_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info
         syslog(LOG_WARNING, "zfsfuse_release: stale inode (%s)?", strerror(error));
 	else
 	{
+		/* The cursor holds zap buffers of the directory */
+		if(info->dircursor != NULL) {
+			zfs_dircursor_fini(info->dircursor);
+			kmem_free(info->dircursor, sizeof(zfs_dircursor_t));
+		}
 		VN_RELE(info->vp);
 
 		kmem_cache_free(file_info_cache, info);
@@ -662,96 +738,77 @@ static int zfsfuse_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info
 static void zfsfuse_release_helper(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
 {
 	fuse_ino_t real_ino = ino == 1 ? 3 : ino;
+	zfsfuse_opstat_t os;
 
+	zfsfuse_opstat_start(req, &os);
 	int error = zfsfuse_release(req, real_ino, fi);
 	/* Release events always reply_err */
 	fuse_reply_err(req, error);
+	zfsfuse_opstat_end(&os, ZFSFUSE_OP_RELEASE, error);
+}
+
+typedef struct zfsfuse_dirbuf {
+	fuse_req_t req;
+	char *buf;
+	size_t size;
+	size_t off;
+} zfsfuse_dirbuf_t;
+
+/* zfs_filldir_t callback: packs one entry into the reply buffer */
+static int zfsfuse_filldir(void *arg, const char *name, uint64_t objnum, uint8_t type, uint64_t nextoff)
+{
+	zfsfuse_dirbuf_t *db = arg;
+
+	size_t dsize = fuse_add_direntry(db->req, NULL, 0, name, NULL, 0);
+	if(dsize > db->size - db->off)
+		return 1;
+
+	struct stat fstat = { 0 };
+	fstat.st_ino = objnum == 3 ? 1 : objnum;
+	/* fuse_add_direntry() only looks at the file type bits */
+	fstat.st_mode = (mode_t) type << 12;
+
+	fuse_add_direntry(db->req, db->buf + db->off, dsize, name, &fstat, nextoff);
+	db->off += dsize;
+
+	return 0;
 }
 
 static int zfsfuse_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi)
 {
-	vnode_t *vp = ((file_info_t *)(uintptr_t) fi->fh)->vp;
+	file_info_t *info = (file_info_t *)(uintptr_t) fi->fh;
+
+	vnode_t *vp = info->vp;
 	ASSERT(vp != NULL);
 	ASSERT(VTOZ(vp) != NULL);
 	ASSERT(VTOZ(vp)->z_id == ino);
+	ASSERT(info->dircursor != NULL);
 
 	if(vp->v_type != VDIR)
 		return ENOTDIR;
 
     print_debug("function %s\n",__FUNCTION__);
-	vfs_t *vfs = (vfs_t *) fuse_req_userdata(req);
-	zfsvfs_t *zfsvfs = vfs->vfs_data;
 
-	char *outbuf = kmem_alloc(size, KM_NOSLEEP);
-	if(outbuf == NULL)
+	zfsfuse_dirbuf_t db;
+	db.req = req;
+	db.size = size;
+	db.off = 0;
+	db.buf = kmem_alloc(size, KM_NOSLEEP);
+	if(db.buf == NULL)
 		return ENOMEM;
 
-	ZFS_ENTER(zfsvfs);
-
 	cred_t cred;
 	zfsfuse_getcred(req, &cred);
 
-	union {
-		char buf[DIRENT64_RECLEN(MAXNAMELEN)];
-		struct dirent64 dirent;
-	} entry;
-
-	struct stat fstat = { 0 };
-
-	iovec_t iovec;
-	uio_t uio;
-	uio.uio_iov = &iovec;
-	uio.uio_iovcnt = 1;
-	uio.uio_segflg = UIO_SYSSPACE;
-	uio.uio_fmode = 0;
-	uio.uio_llimit = RLIM64_INFINITY;
-
 	int eofp = 0;
 
-	int outbuf_off = 0;
-	int outbuf_resid = size;
-
-	off_t next = off;
-
-	int error;
-
-	for(;;) {
-		iovec.iov_base = entry.buf;
-		iovec.iov_len = sizeof(entry.buf);
-		uio.uio_resid = iovec.iov_len;
-		uio.uio_loffset = next;
-
-		error = VOP_READDIR(vp, &uio, &cred, &eofp, NULL, 0);
-		if(error)
-			goto out;
-
-		/* No more directory entries */
-		if(iovec.iov_base == entry.buf)
-			break;
-
-		fstat.st_ino = entry.dirent.d_ino;
-		fstat.st_mode = 0;
-
-		int dsize = fuse_add_direntry(req, NULL, 0, entry.dirent.d_name, NULL, 0);
-		if(dsize > outbuf_resid)
-			break;
-
-		outbuf_resid -= dsize;
-		fuse_add_direntry(req, outbuf + outbuf_off, 
-		    dsize, entry.dirent.d_name, &fstat,
-		    entry.dirent.d_off);
-
-		outbuf_off += dsize;
-		next = entry.dirent.d_off;
-	}
-
-out:
-	ZFS_EXIT(zfsvfs);
+	/* Fill the whole buffer in one pass over the directory */
+	int error = zfs_readdir_batch(vp, info->dircursor, off, zfsfuse_filldir, &db, &cred, &eofp);
 
 	if(!error)
-		fuse_reply_buf(req, outbuf, outbuf_off);
+		fuse_reply_buf(req, db.buf, db.off);
 
-	kmem_free(outbuf, size);
+	kmem_free(db.buf, size);
 
 	return error;
 }
@@ -759,10 +816,13 @@ out:
 static void zfsfuse_readdir_helper(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi)
 {
 	fuse_ino_t real_ino = ino == 1 ? 3 : ino;
+	zfsfuse_opstat_t os;
 
+	zfsfuse_opstat_start(req, &os);
 	int error = zfsfuse_readdir(req, real_ino, size, off, fi);
 	if(error)
 		fuse_reply_err(req, error);
+	zfsfuse_opstat_end(&os, ZFSFUSE_OP_READDIR, error);
 }
 
 static int zfsfuse_opencreate(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi, int fflags, mode_t createmode, const char *name)
@@ -814,7 +874,7 @@ static int zfsfuse_opencreate(fuse_req_t req, fuse_ino_t ino, struct fuse_file_i
 
 	znode_t *znode;
 
-	int error = zfs_zget(zfsvfs, ino, &znode, B_FALSE);
+	int error = zfsfuse_zget(vfs, ino, &znode, B_FALSE);
 	if(error) {
 		ZFS_EXIT(zfsvfs);
 		/* If the inode we are trying to get was recently deleted
@@ -917,11 +977,14 @@ static int zfsfuse_opencreate(fuse_req_t req, fuse_ino_t ino, struct fuse_file_i
 
 	info->vp = vp;
 	info->flags = flags;
+	info->dircursor = NULL;
 
 	fi->fh = (uint64_t) (uintptr_t) info;
-	/* by setting these as int directly, we save one CMP operation per file open. */
-	/* but, honestly, we mostly get readability of the code */
-	fi->keep_cache = page_cache;
+	/*
+	 * Only let the kernel keep its page cache if the data did not change
+	 * behind its back since it last got it, see zfsfuse_inode.c
+	 */
+	fi->keep_cache = page_cache && zfsfuse_inode_keep_cache(vfs, VTOZ(vp));
 	fi->direct_io = block_cache ? 0 : 1;
 
 	if(flags & FCREAT) {
@@ -931,6 +994,7 @@ static int zfsfuse_opencreate(fuse_req_t req, fuse_ino_t ino, struct fuse_file_i
 		if(e.ino == 3)
 			e.ino = 1;
 		e.generation = VTOZ(vp)->z_phys->zp_gen;
+		zfsfuse_inode_remember(vfs, vp);
 	}
 
 out:
@@ -944,8 +1008,8 @@ out:
 	if(!error) {
 		if(!(flags & FCREAT))
 			fuse_reply_open(req, fi);
-		else
-			fuse_reply_create(req, &e, fi);
+		else if(fuse_reply_create(req, &e, fi) != 0)
+			zfsfuse_inode_forget(vfs, e.ino == 1 ? 3 : e.ino, 1);
 	}
 	return error;
 }
@@ -953,19 +1017,25 @@ out:
 static void zfsfuse_open_helper(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
 {
 	fuse_ino_t real_ino = ino == 1 ? 3 : ino;
+	zfsfuse_opstat_t os;
 
+	zfsfuse_opstat_start(req, &os);
 	int error = zfsfuse_opencreate(req, real_ino, fi, fi->flags, 0, NULL);
 	if(error)
 		fuse_reply_err(req, error);
+	zfsfuse_opstat_end(&os, ZFSFUSE_OP_OPEN, error);
 }
 
 static void zfsfuse_create_helper(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, struct fuse_file_info *fi)
 {
 	fuse_ino_t real_parent = parent == 1 ? 3 : parent;
+	zfsfuse_opstat_t os;
 
+	zfsfuse_opstat_start(req, &os);
 	int error = zfsfuse_opencreate(req, real_parent, fi, fi->flags | O_CREAT, mode, name);
 	if(error)
 		fuse_reply_err(req, error);
+	zfsfuse_opstat_end(&os, ZFSFUSE_OP_CREATE, error);
 }
 
 static int zfsfuse_readlink(fuse_req_t req, fuse_ino_t ino)
@@ -978,7 +1048,7 @@ static int zfsfuse_readlink(fuse_req_t req, fuse_ino_t ino)
 
 	znode_t *znode;
 
-	int error = zfs_zget(zfsvfs, ino, &znode, B_FALSE);
+	int error = zfsfuse_zget(vfs, ino, &znode, B_FALSE);
 	if(error) {
 		ZFS_EXIT(zfsvfs);
 		/* If the inode we are trying to get was recently deleted
@@ -997,6 +1067,7 @@ static int zfsfuse_readlink(fuse_req_t req, fuse_ino_t ino)
 	uio.uio_iov = &iovec;
 	uio.uio_iovcnt = 1;
 	uio.uio_segflg = UIO_SYSSPACE;
+	uio.uio_extflg = UIO_COPY_DEFAULT;
 	uio.uio_fmode = 0;
 	uio.uio_llimit = RLIM64_INFINITY;
 	iovec.iov_base = buffer;
@@ -1024,10 +1095,13 @@ static int zfsfuse_readlink(fuse_req_t req, fuse_ino_t ino)
 static void zfsfuse_readlink_helper(fuse_req_t req, fuse_ino_t ino)
 {
 	fuse_ino_t real_ino = ino == 1 ? 3 : ino;
+	zfsfuse_opstat_t os;
 
+	zfsfuse_opstat_start(req, &os);
 	int error = zfsfuse_readlink(req, real_ino);
 	if(error)
 		fuse_reply_err(req, error);
+	zfsfuse_opstat_end(&os, ZFSFUSE_OP_READLINK, error);
 }
 
 static int zfsfuse_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi)
@@ -1043,6 +1117,33 @@ static int zfsfuse_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
 	vfs_t *vfs = (vfs_t *) fuse_req_userdata(req);
 	zfsvfs_t *zfsvfs = vfs->vfs_data;
 
+	cred_t cred;
+	zfsfuse_getcred(req, &cred);
+
+	/*
+	 * Reply straight from the dbufs: this saves the bounce buffer and
+	 * the copy into it.  FRSYNC reads still go through VOP_READ, which
+	 * knows how to commit the intent log first.
+	 */
+	if(!(info->flags & FRSYNC) && size <= DMU_MAX_ACCESS) {
+		zfs_readhold_t zr;
+
+		ZFS_ENTER(zfsvfs);
+
+		int error = zfs_read_hold(vp, off, size, &cred, &zr);
+		if(!error) {
+			if(zr.zr_len == 0)
+				fuse_reply_buf(req, NULL, 0);
+			else
+				fuse_reply_iov(req, zr.zr_iov, zr.zr_iovcnt);
+			zfs_read_rele(vp, &zr);
+		}
+
+		ZFS_EXIT(zfsvfs);
+
+		return error;
+	}
+
 	char *outbuf = kmem_alloc(size, KM_NOSLEEP);
 	if(outbuf == NULL)
 		return ENOMEM;
@@ -1054,6 +1155,7 @@ static int zfsfuse_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
 	uio.uio_iov = &iovec;
 	uio.uio_iovcnt = 1;
 	uio.uio_segflg = UIO_SYSSPACE;
+	uio.uio_extflg = UIO_COPY_DEFAULT;
 	uio.uio_fmode = 0;
 	uio.uio_llimit = RLIM64_INFINITY;
 
@@ -1062,9 +1164,6 @@ static int zfsfuse_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
 	uio.uio_resid = iovec.iov_len;
 	uio.uio_loffset = off;
 
-	cred_t cred;
-	zfsfuse_getcred(req, &cred);
-
 	int error = VOP_READ(vp, &uio, info->flags, &cred, NULL);
 
 	ZFS_EXIT(zfsvfs);
@@ -1080,10 +1179,13 @@ static int zfsfuse_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
 static void zfsfuse_read_helper(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi)
 {
 	fuse_ino_t real_ino = ino == 1 ? 3 : ino;
+	zfsfuse_opstat_t os;
 
+	zfsfuse_opstat_start(req, &os);
 	int error = zfsfuse_read(req, real_ino, size, off, fi);
 	if(error)
 		fuse_reply_err(req, error);
+	zfsfuse_opstat_end(&os, ZFSFUSE_OP_READ, error);
 }
 
 static int zfsfuse_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode)
@@ -1099,7 +1201,7 @@ static int zfsfuse_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mo
 
 	znode_t *znode;
 
-	int error = zfs_zget(zfsvfs, parent, &znode, B_FALSE);
+	int error = zfsfuse_zget(vfs, parent, &znode, B_FALSE);
 	if(error) {
 		ZFS_EXIT(zfsvfs);
 		/* If the inode we are trying to get was recently deleted
@@ -1139,6 +1241,8 @@ static int zfsfuse_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mo
 	e.generation = VTOZ(vp)->z_phys->zp_gen;
 
 	error = zfsfuse_stat(vp, &e.attr, &cred);
+	if(!error)
+		zfsfuse_inode_remember(vfs, vp);
 
 out:
 	if(vp != NULL)
@@ -1147,7 +1251,7 @@ out:
 	ZFS_EXIT(zfsvfs);
 
 	if(!error)
-		fuse_reply_entry(req, &e);
+		zfsfuse_reply_entry(req, vfs, &e);
 
 	return error;
 }
@@ -1155,10 +1259,13 @@ out:
 static void zfsfuse_mkdir_helper(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode)
 {
 	fuse_ino_t real_parent = parent == 1 ? 3 : parent;
+	zfsfuse_opstat_t os;
 
+	zfsfuse_opstat_start(req, &os);
 	int error = zfsfuse_mkdir(req, real_parent, name, mode);
 	if(error)
 		fuse_reply_err(req, error);
+	zfsfuse_opstat_end(&os, ZFSFUSE_OP_MKDIR, error);
 }
 
 static int zfsfuse_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name)
@@ -1174,7 +1281,7 @@ static int zfsfuse_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name)
 
 	znode_t *znode;
 
-	int error = zfs_zget(zfsvfs, parent, &znode, B_FALSE);
+	int error = zfsfuse_zget(vfs, parent, &znode, B_FALSE);
 	if(error) {
 		ZFS_EXIT(zfsvfs);
 		/* If the inode we are trying to get was recently deleted
@@ -1206,10 +1313,13 @@ static int zfsfuse_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name)
 static void zfsfuse_rmdir_helper(fuse_req_t req, fuse_ino_t parent, const char *name)
 {
 	fuse_ino_t real_parent = parent == 1 ? 3 : parent;
+	zfsfuse_opstat_t os;
 
+	zfsfuse_opstat_start(req, &os);
 	int error = zfsfuse_rmdir(req, real_parent, name);
 	/* rmdir events always reply_err */
 	fuse_reply_err(req, error);
+	zfsfuse_opstat_end(&os, ZFSFUSE_OP_RMDIR, error);
 }
 
 static int zfsfuse_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr, int to_set, struct fuse_file_info *fi)
@@ -1231,7 +1341,7 @@ static int zfsfuse_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr, in
 	if(fi == NULL) {
 		znode_t *znode;
 
-		error = zfs_zget(zfsvfs, ino, &znode, B_TRUE);
+		error = zfsfuse_zget(vfs, ino, &znode, B_TRUE);
 		if(error) {
 			ZFS_EXIT(zfsvfs);
 			/* If the inode we are trying to get was recently deleted
@@ -1326,8 +1436,11 @@ static int zfsfuse_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr, in
 out: ;
 	struct stat stat_reply;
 
-	if(!error)
+	if(!error) {
+		/* The kernel truncated its own pages, if needed */
+		zfsfuse_inode_cached(vfs, VTOZ(vp));
 		error = zfsfuse_stat(vp, &stat_reply, &cred);
+	}
 
 	/* Do not release if vp was an opened inode */
 	if(release)
@@ -1344,10 +1457,13 @@ out: ;
 static void zfsfuse_setattr_helper(fuse_req_t req, fuse_ino_t ino, struct stat *attr, int to_set, struct fuse_file_info *fi)
 {
 	fuse_ino_t real_ino = ino == 1 ? 3 : ino;
+	zfsfuse_opstat_t os;
 
+	zfsfuse_opstat_start(req, &os);
 	int error = zfsfuse_setattr(req, real_ino, attr, to_set, fi);
 	if(error)
 		fuse_reply_err(req, error);
+	zfsfuse_opstat_end(&os, ZFSFUSE_OP_SETATTR, error);
 }
 
 static int zfsfuse_unlink(fuse_req_t req, fuse_ino_t parent, const char *name)
@@ -1363,7 +1479,7 @@ static int zfsfuse_unlink(fuse_req_t req, fuse_ino_t parent, const char *name)
 
 	znode_t *znode;
 
-	int error = zfs_zget(zfsvfs, parent, &znode, B_FALSE);
+	int error = zfsfuse_zget(vfs, parent, &znode, B_FALSE);
 	if(error) {
 		ZFS_EXIT(zfsvfs);
 		/* If the inode we are trying to get was recently deleted
@@ -1389,10 +1505,13 @@ static int zfsfuse_unlink(fuse_req_t req, fuse_ino_t parent, const char *name)
 static void zfsfuse_unlink_helper(fuse_req_t req, fuse_ino_t parent, const char *name)
 {
 	fuse_ino_t real_parent = parent == 1 ? 3 : parent;
+	zfsfuse_opstat_t os;
 
+	zfsfuse_opstat_start(req, &os);
 	int error = zfsfuse_unlink(req, real_parent, name);
 	/* unlink events always reply_err */
 	fuse_reply_err(req, error);
+	zfsfuse_opstat_end(&os, ZFSFUSE_OP_UNLINK, error);
 }
 
 static int zfsfuse_write(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size, off_t off, struct fuse_file_info *fi)
@@ -1415,6 +1534,7 @@ static int zfsfuse_write(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t
 	uio.uio_iov = &iovec;
 	uio.uio_iovcnt = 1;
 	uio.uio_segflg = UIO_SYSSPACE;
+	uio.uio_extflg = UIO_COPY_DEFAULT;
 	uio.uio_fmode = 0;
 	uio.uio_llimit = RLIM64_INFINITY;
 
@@ -1428,6 +1548,10 @@ static int zfsfuse_write(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t
 
 	int error = VOP_WRITE(vp, &uio, info->flags, &cred, NULL);
 
+	/* The data came through the kernel page cache */
+	if(!error)
+		zfsfuse_inode_cached(vfs, VTOZ(vp));
+
 	ZFS_EXIT(zfsvfs);
 
 	if(!error) {
@@ -1442,12 +1566,204 @@ static int zfsfuse_write(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t
 static void zfsfuse_write_helper(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size, off_t off, struct fuse_file_info *fi)
 {
 	fuse_ino_t real_ino = ino == 1 ? 3 : ino;
+	zfsfuse_opstat_t os;
 
+	zfsfuse_opstat_start(req, &os);
 	int error = zfsfuse_write(req, real_ino, buf, size, off, fi);
 	if(error)
 		fuse_reply_err(req, error);
+	zfsfuse_opstat_end(&os, ZFSFUSE_OP_WRITE, error);
+}
+
+#if FUSE_VERSION >= 29
+/*
+ * When the request was spliced from /dev/fuse, the payload is still in a
+ * pipe.  Hand the pipe to VOP_WRITE in a UIO_FDREAD uio, so that the data
+ * of block aligned writes is read straight into loaned arc buffers which
+ * zfs_write() then assigns to the dbufs without copying them again.
+ */
+static int zfsfuse_write_buf(fuse_req_t req, fuse_ino_t ino, struct fuse_bufvec *bufv, off_t off, struct fuse_file_info *fi)
+{
+	struct fuse_buf *fbuf = &bufv->buf[bufv->idx];
+	size_t size = fuse_buf_size(bufv);
+
+	if(bufv->count - bufv->idx == 1 && !(fbuf->flags & FUSE_BUF_IS_FD))
+		return zfsfuse_write(req, ino, (char *) fbuf->mem + bufv->off, size, off, fi);
+
+	if(bufv->count - bufv->idx != 1 || (fbuf->flags & FUSE_BUF_FD_SEEK) || bufv->off != 0) {
+		/* Not a plain pipe, let libfuse flatten it */
+		struct fuse_bufvec mem = FUSE_BUFVEC_INIT(size);
+		mem.buf[0].mem = kmem_alloc(size, KM_NOSLEEP);
+		if(mem.buf[0].mem == NULL)
+			return ENOMEM;
+
+		ssize_t res = fuse_buf_copy(&mem, bufv, 0);
+		int error = res < 0 ? -res : res != size ? EIO :
+		    zfsfuse_write(req, ino, mem.buf[0].mem, size, off, fi);
+
+		kmem_free(mem.buf[0].mem, size);
+		return error;
+	}
+
+	file_info_t *info = (file_info_t *)(uintptr_t) fi->fh;
+
+	vnode_t *vp = info->vp;
+	ASSERT(vp != NULL);
+	ASSERT(VTOZ(vp) != NULL);
+	ASSERT(VTOZ(vp)->z_id == ino);
+
+	print_debug("function %s\n",__FUNCTION__);
+	vfs_t *vfs = (vfs_t *) fuse_req_userdata(req);
+	zfsvfs_t *zfsvfs = vfs->vfs_data;
+
+	ZFS_ENTER(zfsvfs);
+
+	iovec_t iovec;
+	uiofd_t uiofd;
+	uio_t *uio = &uiofd.uiofd_uio;
+	uio->uio_iov = &iovec;
+	uio->uio_iovcnt = 1;
+	uio->uio_segflg = UIO_SYSSPACE;
+	uio->uio_extflg = UIO_FDREAD;
+	uio->uio_fmode = 0;
+	uio->uio_llimit = RLIM64_INFINITY;
+	uiofd.uiofd_fd = fbuf->fd;
+
+	iovec.iov_base = NULL;
+	iovec.iov_len = size;
+	uio->uio_resid = iovec.iov_len;
+	uio->uio_loffset = off;
+
+	cred_t cred;
+	zfsfuse_getcred(req, &cred);
+
+	int error = VOP_WRITE(vp, uio, info->flags, &cred, NULL);
+
+	if(!error)
+		zfsfuse_inode_cached(vfs, VTOZ(vp));
+
+	ZFS_EXIT(zfsvfs);
+
+	if(!error) {
+		/*
+		 * zfs_write() stops short on ENOSPC or EDQUOT once it made some
+		 * progress, and the pipe may come back short.  Only mark the
+		 * pipe drained if it was: otherwise libfuse throws away what is
+		 * left in it rather than reusing it for the next request.
+		 */
+		if(uio->uio_resid == 0)
+			bufv->idx = bufv->count;
+		fuse_reply_write(req, size - uio->uio_resid);
+	}
+
+	return error;
 }
 
+static void zfsfuse_write_buf_helper(fuse_req_t req, fuse_ino_t ino, struct fuse_bufvec *bufv, off_t off, struct fuse_file_info *fi)
+{
+	fuse_ino_t real_ino = ino == 1 ? 3 : ino;
+	zfsfuse_opstat_t os;
+
+	zfsfuse_opstat_start(req, &os);
+	int error = zfsfuse_write_buf(req, real_ino, bufv, off, fi);
+	if(error)
+		fuse_reply_err(req, error);
+	zfsfuse_opstat_end(&os, ZFSFUSE_OP_WRITE, error);
+}
+#endif
+
+#if FUSE_VERSION >= 29
+#ifndef FALLOC_FL_PUNCH_HOLE
+#define FALLOC_FL_PUNCH_HOLE 0x02
+#endif
+#ifndef FALLOC_FL_ZERO_RANGE
+#define FALLOC_FL_ZERO_RANGE 0x10
+#endif
+
+/*
+ * ZFS can't reserve blocks for a file ahead of the writes (they are copy
+ * on write anyway), so preallocation only checks that the pool has the
+ * room right now and extends the file size.  Punching holes and zeroing
+ * ranges free the blocks, which is a metadata operation however large the
+ * range is.
+ */
+static int zfsfuse_fallocate(fuse_req_t req, fuse_ino_t ino, int mode, off_t offset, off_t length, struct fuse_file_info *fi)
+{
+	file_info_t *info = (file_info_t *)(uintptr_t) fi->fh;
+
+	vnode_t *vp = info->vp;
+	ASSERT(vp != NULL);
+	ASSERT(VTOZ(vp) != NULL);
+	ASSERT(VTOZ(vp)->z_id == ino);
+
+	if(mode & ~(FALLOC_FL_KEEP_SIZE | FALLOC_FL_PUNCH_HOLE | FALLOC_FL_ZERO_RANGE))
+		return EOPNOTSUPP;
+	/* Same rules as the kernel */
+	if((mode & FALLOC_FL_PUNCH_HOLE) && (mode & FALLOC_FL_ZERO_RANGE))
+		return EOPNOTSUPP;
+	if((mode & FALLOC_FL_PUNCH_HOLE) && !(mode & FALLOC_FL_KEEP_SIZE))
+		return EOPNOTSUPP;
+	if(offset < 0 || length <= 0)
+		return EINVAL;
+	if((info->flags & FWRITE) == 0)
+		return EBADF;
+	if(vp->v_type != VREG)
+		return ENODEV;
+
+	print_debug("function %s\n",__FUNCTION__);
+	vfs_t *vfs = (vfs_t *) fuse_req_userdata(req);
+	zfsvfs_t *zfsvfs = vfs->vfs_data;
+
+	ZFS_ENTER(zfsvfs);
+	ZFS_VERIFY_ZP(VTOZ(vp));
+
+	/*
+	 * zfs_fallocate() only looks at the file size under the range lock,
+	 * so a write racing with us is never cut back or extended over.
+	 */
+	boolean_t punch = (mode & (FALLOC_FL_PUNCH_HOLE | FALLOC_FL_ZERO_RANGE)) != 0;
+	boolean_t keep = (mode & FALLOC_FL_KEEP_SIZE) != 0;
+	int error = 0;
+
+	if(!punch) {
+		/* Only a hint for the space check, the size may move */
+		uint64_t size = VTOZ(vp)->z_phys->zp_size;
+		uint64_t end = offset + length;
+		uint64_t refdbytes, availbytes, usedobjs, availobjs;
+
+		dmu_objset_space(zfsvfs->z_os, &refdbytes, &availbytes, &usedobjs, &availobjs);
+		if(end > size && end - size > availbytes)
+			error = ENOSPC;
+	}
+
+	if(!error && (punch || !keep))
+		error = zfs_fallocate(VTOZ(vp), offset, length, info->flags, punch, keep);
+
+	/* The kernel drops its pages in the range itself */
+	if(!error)
+		zfsfuse_inode_cached(vfs, VTOZ(vp));
+
+	ZFS_EXIT(zfsvfs);
+
+	if(!error)
+		fuse_reply_err(req, 0);
+
+	return error;
+}
+
+static void zfsfuse_fallocate_helper(fuse_req_t req, fuse_ino_t ino, int mode, off_t offset, off_t length, struct fuse_file_info *fi)
+{
+	fuse_ino_t real_ino = ino == 1 ? 3 : ino;
+	zfsfuse_opstat_t os;
+
+	zfsfuse_opstat_start(req, &os);
+	int error = zfsfuse_fallocate(req, real_ino, mode, offset, length, fi);
+	if(error)
+		fuse_reply_err(req, error);
+	zfsfuse_opstat_end(&os, ZFSFUSE_OP_FALLOCATE, error);
+}
+#endif
+
 static int zfsfuse_mknod(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, dev_t rdev)
 {
 	if(strlen(name) >= MAXNAMELEN)
@@ -1461,7 +1777,7 @@ static int zfsfuse_mknod(fuse_req_t req, fuse_ino_t parent, const char *name, mo
 
 	znode_t *znode;
 
-	int error = zfs_zget(zfsvfs, parent, &znode, B_FALSE);
+	int error = zfsfuse_zget(vfs, parent, &znode, B_FALSE);
 	if(error) {
 		ZFS_EXIT(zfsvfs);
 		/* If the inode we are trying to get was recently deleted
@@ -1510,6 +1826,8 @@ static int zfsfuse_mknod(fuse_req_t req, fuse_ino_t parent, const char *name, mo
 	e.generation = VTOZ(vp)->z_phys->zp_gen;
 
 	error = zfsfuse_stat(vp, &e.attr, &cred);
+	if(!error)
+		zfsfuse_inode_remember(vfs, vp);
 
 out:
 	if(vp != NULL)
@@ -1517,7 +1835,7 @@ out:
 	ZFS_EXIT(zfsvfs);
 
 	if(!error)
-		fuse_reply_entry(req, &e);
+		zfsfuse_reply_entry(req, vfs, &e);
 
 	return error;
 }
@@ -1525,10 +1843,13 @@ out:
 static void zfsfuse_mknod_helper(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, dev_t rdev)
 {
 	fuse_ino_t real_parent = parent == 1 ? 3 : parent;
+	zfsfuse_opstat_t os;
 
+	zfsfuse_opstat_start(req, &os);
 	int error = zfsfuse_mknod(req, real_parent, name, mode, rdev);
 	if(error)
 		fuse_reply_err(req, error);
+	zfsfuse_opstat_end(&os, ZFSFUSE_OP_MKNOD, error);
 }
 
 static int zfsfuse_symlink(fuse_req_t req, const char *link, fuse_ino_t parent, const char *name)
@@ -1544,7 +1865,7 @@ static int zfsfuse_symlink(fuse_req_t req, const char *link, fuse_ino_t parent,
 
 	znode_t *znode;
 
-	int error = zfs_zget(zfsvfs, parent, &znode, B_FALSE);
+	int error = zfsfuse_zget(vfs, parent, &znode, B_FALSE);
 	if(error) {
 		ZFS_EXIT(zfsvfs);
 		/* If the inode we are trying to get was recently deleted
@@ -1589,6 +1910,8 @@ static int zfsfuse_symlink(fuse_req_t req, const char *link, fuse_ino_t parent,
 	e.generation = VTOZ(vp)->z_phys->zp_gen;
 
 	error = zfsfuse_stat(vp, &e.attr, &cred);
+	if(!error)
+		zfsfuse_inode_remember(vfs, vp);
 
 out:
 	if(vp != NULL)
@@ -1598,7 +1921,7 @@ out:
 	ZFS_EXIT(zfsvfs);
 
 	if(!error)
-		fuse_reply_entry(req, &e);
+		zfsfuse_reply_entry(req, vfs, &e);
 
 	return error;
 }
@@ -1606,10 +1929,13 @@ out:
 static void zfsfuse_symlink_helper(fuse_req_t req, const char *link, fuse_ino_t parent, const char *name)
 {
 	fuse_ino_t real_parent = parent == 1 ? 3 : parent;
+	zfsfuse_opstat_t os;
 
+	zfsfuse_opstat_start(req, &os);
 	int error = zfsfuse_symlink(req, link, real_parent, name);
 	if(error)
 		fuse_reply_err(req, error);
+	zfsfuse_opstat_end(&os, ZFSFUSE_OP_SYMLINK, error);
 }
 
 static int zfsfuse_rename(fuse_req_t req, fuse_ino_t parent, const char *name, fuse_ino_t newparent, const char *newname)
@@ -1627,7 +1953,7 @@ static int zfsfuse_rename(fuse_req_t req, fuse_ino_t parent, const char *name, f
 
 	znode_t *p_znode, *np_znode;
 
-	int error = zfs_zget(zfsvfs, parent, &p_znode, B_FALSE);
+	int error = zfsfuse_zget(vfs, parent, &p_znode, B_FALSE);
 	if(error) {
 		ZFS_EXIT(zfsvfs);
 		/* If the inode we are trying to get was recently deleted
@@ -1637,7 +1963,7 @@ static int zfsfuse_rename(fuse_req_t req, fuse_ino_t parent, const char *name, f
 
 	ASSERT(p_znode != NULL);
 
-	error = zfs_zget(zfsvfs, newparent, &np_znode, B_FALSE);
+	error = zfsfuse_zget(vfs, newparent, &np_znode, B_FALSE);
 	if(error) {
 		VN_RELE(ZTOV(p_znode));
 		ZFS_EXIT(zfsvfs);
@@ -1670,11 +1996,14 @@ static void zfsfuse_rename_helper(fuse_req_t req, fuse_ino_t parent, const char
 {
 	fuse_ino_t real_parent = parent == 1 ? 3 : parent;
 	fuse_ino_t real_newparent = newparent == 1 ? 3 : newparent;
+	zfsfuse_opstat_t os;
 
+	zfsfuse_opstat_start(req, &os);
 	int error = zfsfuse_rename(req, real_parent, name, real_newparent, newname);
 
 	/* rename events always reply_err */
 	fuse_reply_err(req, error);
+	zfsfuse_opstat_end(&os, ZFSFUSE_OP_RENAME, error);
 }
 
 static int zfsfuse_fsync(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *fi)
@@ -1705,11 +2034,14 @@ static int zfsfuse_fsync(fuse_req_t req, fuse_ino_t ino, int datasync, struct fu
 static void zfsfuse_fsync_helper(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *fi)
 {
 	fuse_ino_t real_ino = ino == 1 ? 3 : ino;
+	zfsfuse_opstat_t os;
 
+	zfsfuse_opstat_start(req, &os);
 	int error = zfsfuse_fsync(req, real_ino, datasync, fi);
 
 	/* fsync events always reply_err */
 	fuse_reply_err(req, error);
+	zfsfuse_opstat_end(&os, ZFSFUSE_OP_FSYNC, error);
 }
 
 static int zfsfuse_link(fuse_req_t req, fuse_ino_t ino, fuse_ino_t newparent, const char *newname)
@@ -1725,7 +2057,7 @@ static int zfsfuse_link(fuse_req_t req, fuse_ino_t ino, fuse_ino_t newparent, co
 
 	znode_t *td_znode, *s_znode;
 
-	int error = zfs_zget(zfsvfs, ino, &s_znode, B_FALSE);
+	int error = zfsfuse_zget(vfs, ino, &s_znode, B_FALSE);
 	if(error) {
 		ZFS_EXIT(zfsvfs);
 		/* If the inode we are trying to get was recently deleted
@@ -1735,7 +2067,7 @@ static int zfsfuse_link(fuse_req_t req, fuse_ino_t ino, fuse_ino_t newparent, co
 
 	ASSERT(s_znode != NULL);
 
-	error = zfs_zget(zfsvfs, newparent, &td_znode, B_FALSE);
+	error = zfsfuse_zget(vfs, newparent, &td_znode, B_FALSE);
 	if(error) {
 		VN_RELE(ZTOV(s_znode));
 		ZFS_EXIT(zfsvfs);
@@ -1777,6 +2109,8 @@ static int zfsfuse_link(fuse_req_t req, fuse_ino_t ino, fuse_ino_t newparent, co
 	e.generation = VTOZ(vp)->z_phys->zp_gen;
 
 	error = zfsfuse_stat(vp, &e.attr, &cred);
+	if(!error)
+		zfsfuse_inode_remember(vfs, vp);
 
 out:
 	if(vp != NULL)
@@ -1787,7 +2121,7 @@ out:
 	ZFS_EXIT(zfsvfs);
 
 	if(!error)
-		fuse_reply_entry(req, &e);
+		zfsfuse_reply_entry(req, vfs, &e);
 
 	return error;
 }
@@ -1796,12 +2130,41 @@ static void zfsfuse_link_helper(fuse_req_t req, fuse_ino_t ino, fuse_ino_t newpa
 {
 	fuse_ino_t real_ino = ino == 1 ? 3 : ino;
 	fuse_ino_t real_newparent = newparent == 1 ? 3 : newparent;
+	zfsfuse_opstat_t os;
 
+	zfsfuse_opstat_start(req, &os);
 	int error = zfsfuse_link(req, real_ino, real_newparent, newname);
 	if(error)
 		fuse_reply_err(req, error);
+	zfsfuse_opstat_end(&os, ZFSFUSE_OP_LINK, error);
 }
 
+static void zfsfuse_forget(fuse_req_t req, fuse_ino_t ino, unsigned long nlookup)
+{
+	vfs_t *vfs = (vfs_t *) fuse_req_userdata(req);
+	fuse_ino_t real_ino = ino == 1 ? 3 : ino;
+
+	/* No ZFS_ENTER: forget must be answered, and zfs_inactive() copes */
+	zfsfuse_inode_forget(vfs, real_ino, nlookup);
+
+	fuse_reply_none(req);
+}
+
+#if FUSE_VERSION >= 29
+static void zfsfuse_forget_multi(fuse_req_t req, size_t count, struct fuse_forget_data *forgets)
+{
+	vfs_t *vfs = (vfs_t *) fuse_req_userdata(req);
+
+	for(size_t i = 0; i < count; i++) {
+		fuse_ino_t real_ino = forgets[i].ino == 1 ? 3 : forgets[i].ino;
+
+		zfsfuse_inode_forget(vfs, real_ino, forgets[i].nlookup);
+	}
+
+	fuse_reply_none(req);
+}
+#endif
+
 static int zfsfuse_access(fuse_req_t req, fuse_ino_t ino, int mask)
 {
     print_debug("function %s\n",__FUNCTION__);
@@ -1812,7 +2175,7 @@ static int zfsfuse_access(fuse_req_t req, fuse_ino_t ino, int mask)
 
 	znode_t *znode;
 
-	int error = zfs_zget(zfsvfs, ino, &znode, B_TRUE);
+	int error = zfsfuse_zget(vfs, ino, &znode, B_TRUE);
 	if(error) {
 		ZFS_EXIT(zfsvfs);
 		/* If the inode we are trying to get was recently deleted
@@ -1847,11 +2210,14 @@ static int zfsfuse_access(fuse_req_t req, fuse_ino_t ino, int mask)
 static void zfsfuse_access_helper(fuse_req_t req, fuse_ino_t ino, int mask)
 {
 	fuse_ino_t real_ino = ino == 1 ? 3 : ino;
+	zfsfuse_opstat_t os;
 
+	zfsfuse_opstat_start(req, &os);
 	int error = zfsfuse_access(req, real_ino, mask);
 
 	/* access events always reply_err */
 	fuse_reply_err(req, error);
+	zfsfuse_opstat_end(&os, ZFSFUSE_OP_ACCESS, error);
 }
 
 struct fuse_lowlevel_ops zfs_operations =
@@ -1859,11 +2225,18 @@ struct fuse_lowlevel_ops zfs_operations =
 	.open       = zfsfuse_open_helper,
 	.read       = zfsfuse_read_helper,
 	.write      = zfsfuse_write_helper,
+#if FUSE_VERSION >= 29
+	.write_buf  = zfsfuse_write_buf_helper,
+#endif
 	.release    = zfsfuse_release_helper,
 	.opendir    = zfsfuse_opendir_helper,
 	.readdir    = zfsfuse_readdir_helper,
 	.releasedir = zfsfuse_release_helper,
 	.lookup     = zfsfuse_lookup_helper,
+	.forget     = zfsfuse_forget,
+#if FUSE_VERSION >= 29
+	.forget_multi = zfsfuse_forget_multi,
+#endif
 	.getattr    = zfsfuse_getattr_helper,
 	.readlink   = zfsfuse_readlink_helper,
 	.mkdir      = zfsfuse_mkdir_helper,
@@ -1877,11 +2250,15 @@ struct fuse_lowlevel_ops zfs_operations =
 	.setattr    = zfsfuse_setattr_helper,
 	.fsync      = zfsfuse_fsync_helper,
 	.fsyncdir   = zfsfuse_fsync_helper,
+#if FUSE_VERSION >= 29
+	.fallocate  = zfsfuse_fallocate_helper,
+#endif
 	.access     = zfsfuse_access_helper,
-	.statfs     = zfsfuse_statfs,
+	.statfs     = zfsfuse_statfs_helper,
+	.init       = zfsfuse_init,
 	.destroy    = zfsfuse_destroy,
-	.listxattr  = zfsfuse_listxattr,
-	.setxattr   = zfsfuse_setxattr,
-	.getxattr   = zfsfuse_getxattr,
-	.removexattr= zfsfuse_removexattr,
+	.listxattr  = zfsfuse_listxattr_helper,
+	.setxattr   = zfsfuse_setxattr_helper,
+	.getxattr   = zfsfuse_getxattr_helper,
+	.removexattr= zfsfuse_removexattr_helper,
 };
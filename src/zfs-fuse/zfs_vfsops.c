@@ -62,6 +62,8 @@
 #include <sys/spa_boot.h>
 
 #include "util.h"
+#include "zfsfuse_inode.h"
+#include "zfsfuse_opstats.h"
 
 int zfsfstype;
 vfsops_t *zfs_vfsops = NULL;
@@ -2040,6 +2042,10 @@ zfs_resume_fs(zfsvfs_t *zfsvfs, const char *osname)
 	rw_exit(&zfsvfs->z_teardown_inactive_lock);
 	rrw_exit(&zfsvfs->z_teardown_lock, FTAG);
 
+	/* ZFSFUSE: drop the kernel's pages of the files that changed */
+	if (err == 0)
+		zfsfuse_inodes_revalidate(zfsvfs->z_vfs);
+
 	if (err) {
 		/*
 		 * Since we couldn't reopen zfsvfs::z_os, force
@@ -2063,6 +2069,9 @@ zfs_freevfs(vfs_t *vfsp)
 	if (zfsvfs->z_issnap)
 		VFS_RELE(zfsvfs->z_parent->z_vfs);
 
+	/* ZFSFUSE: the workers of the mount are gone by now */
+	zfsfuse_opstats_destroy(vfsp);
+
 	zfsvfs_free(zfsvfs);
 
 	atomic_add_32(&zfs_active_fs_count, -1);
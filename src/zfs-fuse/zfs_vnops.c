@@ -559,6 +559,110 @@ out:
 	return (error);
 }
 
+/*
+ * ZFSFUSE: zero-copy variant of zfs_read().  Instead of copying the data
+ * into a caller supplied buffer, hold the dbufs covering
+ * [off, off + len) and return an iovec pointing straight into them, so
+ * the reply can be written to the fuse device from the ARC buffers.
+ *
+ * The caller must be inside ZFS_ENTER() and must call zfs_read_rele()
+ * once it is done with zr->zr_iov, whatever zr->zr_len is.
+ *
+ *	RETURN:	0 if success
+ *		error code if failure (nothing is held)
+ */
+int
+zfs_read_hold(vnode_t *vp, offset_t off, size_t len, cred_t *cr,
+    zfs_readhold_t *zr)
+{
+	znode_t		*zp = VTOZ(vp);
+	zfsvfs_t	*zfsvfs = zp->z_zfsvfs;
+	uint64_t	n, resid;
+	int		error, i;
+
+	bzero(zr, sizeof (zfs_readhold_t));
+
+	ZFS_ENTER(zfsvfs);
+	ZFS_VERIFY_ZP(zp);
+
+	if (zp->z_phys->zp_flags & ZFS_AV_QUARANTINED) {
+		ZFS_EXIT(zfsvfs);
+		return (EACCES);
+	}
+
+	if (off < (offset_t)0) {
+		ZFS_EXIT(zfsvfs);
+		return (EINVAL);
+	}
+
+	if (MANDMODE((mode_t)zp->z_phys->zp_mode)) {
+		if (error = chklock(vp, FREAD, off, len, 0, NULL)) {
+			ZFS_EXIT(zfsvfs);
+			return (error);
+		}
+	}
+
+	/*
+	 * The range lock keeps writers (and dmu_assign_arcbuf() in
+	 * particular) away from the held buffers until zfs_read_rele().
+	 */
+	zr->zr_rl = zfs_range_lock(zp, off, len, RL_READER);
+
+	if (len == 0 || off >= zp->z_phys->zp_size) {
+		ZFS_EXIT(zfsvfs);
+		return (0);
+	}
+
+	n = MIN(len, zp->z_phys->zp_size - off);
+	error = dmu_buf_hold_array_by_bonus(zp->z_dbuf, off, n, TRUE, zr,
+	    &zr->zr_numbufs, &zr->zr_dbp);
+	if (error) {
+		zfs_range_unlock(zr->zr_rl);
+		zr->zr_rl = NULL;
+		ZFS_EXIT(zfsvfs);
+		/* convert checksum errors into IO errors */
+		return (error == ECKSUM ? EIO : error);
+	}
+
+	zr->zr_iov = kmem_alloc(sizeof (iovec_t) * zr->zr_numbufs, KM_SLEEP);
+	for (i = 0, resid = n; i < zr->zr_numbufs; i++) {
+		dmu_buf_t *db = zr->zr_dbp[i];
+		uint64_t bufoff = off + (n - resid) - db->db_offset;
+		uint64_t tocpy = MIN(db->db_size - bufoff, resid);
+
+		ASSERT(resid > 0);
+		zr->zr_iov[i].iov_base = (char *)db->db_data + bufoff;
+		zr->zr_iov[i].iov_len = tocpy;
+		resid -= tocpy;
+	}
+	ASSERT(resid == 0);
+	zr->zr_iovcnt = zr->zr_numbufs;
+	zr->zr_len = n;
+
+	ZFS_EXIT(zfsvfs);
+	return (0);
+}
+
+/*
+ * Drop everything zfs_read_hold() took.
+ */
+void
+zfs_read_rele(vnode_t *vp, zfs_readhold_t *zr)
+{
+	znode_t		*zp = VTOZ(vp);
+	zfsvfs_t	*zfsvfs = zp->z_zfsvfs;
+
+	if (zr->zr_iov != NULL)
+		kmem_free(zr->zr_iov, sizeof (iovec_t) * zr->zr_numbufs);
+	if (zr->zr_dbp != NULL)
+		dmu_buf_rele_array(zr->zr_dbp, zr->zr_numbufs, zr);
+	if (zr->zr_rl != NULL) {
+		zfs_range_unlock(zr->zr_rl);
+		ZFS_ACCESSTIME_STAMP(zfsvfs, zp);
+	}
+	bzero(zr, sizeof (zfs_readhold_t));
+}
+
 /*
  * Write the bytes to a file.
  *
@@ -708,22 +812,22 @@ again:
 			break;
 		}
 
-#if 0
-/* zfs-fuse : well there is a serious problem here.
-Using uiocopy right here sends the result to a socket which asked for an ioctl but
-never asked for anything about arc.
-There is clearly a difference here with opensolaris.
-All I can hope is that we can simply disable this code without risk */
 		/*
 		 * If dmu_assign_arcbuf() is expected to execute with minimum
 		 * overhead loan an arc buffer and copy user data to it before
 		 * we enter a txg.  This avoids holding a txg forever while we
 		 * pagefault on a hanging NFS server mapping.
+		 *
+		 * ZFSFUSE: only for UIO_SYSSPACE, uiocopy() of a user space
+		 * uio goes through the ioctl socket.  For a UIO_FDREAD uio
+		 * (a write spliced from /dev/fuse) the data is read straight
+		 * into the loaned buffer, which is the only copy it gets.
 		 */
 		if (abuf == NULL && n >= max_blksz &&
 		    woff >= zp->z_phys->zp_size &&
 		    P2PHASE(woff, max_blksz) == 0 &&
-		    zp->z_blksz == max_blksz && cur_fd >= 0) {
+		    zp->z_blksz == max_blksz &&
+		    uio->uio_segflg == UIO_SYSSPACE) {
 			size_t cbytes;
 
 			abuf = dmu_request_arcbuf(zp->z_dbuf, max_blksz);
@@ -736,7 +840,6 @@ All I can hope is that we can simply disable this code without risk */
 			}
 			ASSERT(cbytes == max_blksz);
 		}
-#endif
 
 		/*
 		 * Start a transaction.
@@ -2211,6 +2314,154 @@ update:
 	return (error);
 }
 
+void
+zfs_dircursor_init(zfs_dircursor_t *zd)
+{
+	mutex_init(&zd->zd_lock, NULL, MUTEX_DEFAULT, NULL);
+	zd->zd_active = B_FALSE;
+	zd->zd_offset = 0;
+}
+
+void
+zfs_dircursor_fini(zfs_dircursor_t *zd)
+{
+	if (zd->zd_active)
+		zap_cursor_fini(&zd->zd_zc);
+	zd->zd_active = B_FALSE;
+	mutex_destroy(&zd->zd_lock);
+}
+
+/*
+ * ZFSFUSE: readdir for the FUSE layer.
+ *
+ * Same walk as zfs_readdir(), but entries are handed to a callback
+ * together with their type, and the zap cursor lives in the caller's
+ * zfs_dircursor_t. When the next request continues where the last one
+ * stopped, the cursor (and the zap and leaf buffers it holds) is reused
+ * as is; otherwise (seekdir, rewinddir) it is rebuilt from the offset.
+ *
+ * Offsets are the ones zfs_readdir() uses: 0 is ".", 1 is "..", 2 is
+ * ".zfs" (or the start of the zap) and anything else is a serialized zap
+ * cursor.
+ */
+int
+zfs_readdir_batch(vnode_t *vp, zfs_dircursor_t *zd, uint64_t offset,
+    zfs_filldir_t *filldir, void *arg, cred_t *cr, int *eofp)
+{
+	znode_t		*zp = VTOZ(vp);
+	zfsvfs_t	*zfsvfs = zp->z_zfsvfs;
+	objset_t	*os;
+	zap_cursor_t	*zc = &zd->zd_zc;
+	zap_attribute_t	zap;
+	uint64_t	objnum, next;
+	uint8_t		type;
+	uint8_t		prefetch;
+	int		error = 0;
+
+	ZFS_ENTER(zfsvfs);
+	ZFS_VERIFY_ZP(zp);
+
+	/*
+	 * Quit if directory has been removed (posix)
+	 */
+	if ((*eofp = zp->z_unlinked) != 0) {
+		ZFS_EXIT(zfsvfs);
+		return (0);
+	}
+
+	os = zfsvfs->z_os;
+	prefetch = zp->z_zn_prefetch;
+
+	mutex_enter(&zd->zd_lock);
+
+	if (!zd->zd_active || zd->zd_offset != offset || offset <= 2) {
+		if (zd->zd_active)
+			zap_cursor_fini(zc);
+		if (offset <= 3)
+			zap_cursor_init(zc, os, zp->z_id);
+		else
+			zap_cursor_init_serialized(zc, os, zp->z_id, offset);
+		zd->zd_active = B_TRUE;
+	}
+
+	for (;;) {
+		/*
+		 * Special case `.', `..', and `.zfs'.
+		 */
+		if (offset == 0) {
+			(void) strcpy(zap.za_name, ".");
+			objnum = zp->z_id;
+			type = IFTODT(S_IFDIR);
+		} else if (offset == 1) {
+			(void) strcpy(zap.za_name, "..");
+			objnum = zp->z_phys->zp_parent;
+			type = IFTODT(S_IFDIR);
+		} else if (offset == 2 && zfs_show_ctldir(zp)) {
+			(void) strcpy(zap.za_name, ZFS_CTLDIR_NAME);
+			objnum = ZFSCTL_INO_ROOT;
+			type = IFTODT(S_IFDIR);
+		} else {
+			if (error = zap_cursor_retrieve(zc, &zap)) {
+				*eofp = (error == ENOENT);
+				break;
+			}
+
+			if (zap.za_integer_length != 8 ||
+			    zap.za_num_integers != 1) {
+				cmn_err(CE_WARN, "zap_readdir: bad directory "
+				    "entry, obj = %lld, offset = %lld\n",
+				    (u_longlong_t)zp->z_id,
+				    (u_longlong_t)offset);
+				error = ENXIO;
+				break;
+			}
+
+			objnum = ZFS_DIRENT_OBJ(zap.za_first_integer);
+			type = ZFS_DIRENT_TYPE(zap.za_first_integer);
+		}
+
+		/*
+		 * Work out the offset of the next entry without moving the
+		 * cursor past this one, so that it can be handed out again
+		 * if it does not fit.
+		 */
+		if (offset > 2 || (offset == 2 && !zfs_show_ctldir(zp))) {
+			zap_cursor_advance(zc);
+			next = zap_cursor_serialize(zc);
+		} else {
+			next = offset + 1;
+		}
+
+		if (filldir(arg, zap.za_name, objnum, type, next)) {
+			if (offset > 2 || (offset == 2 && !zfs_show_ctldir(zp))) {
+				/* Step back onto the entry we could not return */
+				zap_cursor_fini(zc);
+				zap_cursor_init_serialized(zc, os, zp->z_id,
+				    offset);
+			}
+			break;
+		}
+
+		/* Prefetch znode */
+		if (prefetch)
+			dmu_prefetch(os, objnum, 0, 0);
+
+		offset = next;
+	}
+	zp->z_zn_prefetch = B_FALSE; /* a lookup will re-enable pre-fetching */
+
+	zd->zd_offset = offset;
+	mutex_exit(&zd->zd_lock);
+
+	if (error == ENOENT)
+		error = 0;
+
+	ZFS_ACCESSTIME_STAMP(zfsvfs, zp);
+
+	ZFS_EXIT(zfsvfs);
+	return (error);
+}
+
 ulong_t zfs_fsync_sync_cnt = 4;
 
 static int
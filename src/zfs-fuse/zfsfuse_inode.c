@@ -0,0 +1,468 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+/*
+ * Copyright 2006 Ricardo Correia.
+ * Use is subject to license terms.
+ */
+
+#include <sys/debug.h>
+#include <sys/kmem.h>
+#include <sys/atomic.h>
+#include <sys/vnode.h>
+#include <sys/zfs_znode.h>
+
+#include "zfsfuse_inode.h"
+
+/*
+ * The kernel sends a forget() for every inode it got through a lookup,
+ * create, mkdir, etc. once it drops it from its inode cache.  Until then
+ * the same inode numbers come back in getattr(), open(), setattr() and in
+ * the parent of lookup(), and each of them used to cost a zfs_zget(): a
+ * dnode_hold() under the ZFS_OBJ_MUTEX of the object, and a VN_RELE().
+ *
+ * Here we keep a vnode hold for each inode the kernel has a lookup count
+ * on, so that zfsfuse_zget() is a hash lookup plus a VN_HOLD().  The table
+ * is bounded by fuse_inodes_max: inodes looked up while it is full are
+ * simply not pinned and take the zfs_zget() path.
+ *
+ * Everything but forget() runs under ZFS_ENTER, which do_umount() waits
+ * out before it destroys the table.  forget() has to be answered even
+ * on a filesystem that is going away, so it looks the table up under
+ * fuse_inodes_lock, which zfsfuse_inodes_destroy() takes as a writer to
+ * clear vfs->fuse_inodes.
+ */
+
+#define FUSE_INODE_HASH_SIZE	4096	/* buckets, power of 2 */
+#define FUSE_INODE_LOCKS	64	/* bucket locks, power of 2 */
+
+/*
+ * What the file data looked like when the kernel last got it.  If this
+ * still matches at open() time, the kernel may keep its page cache.
+ */
+typedef struct fuse_datasig {
+	uint64_t	ds_mtime[2];
+	uint64_t	ds_ctime[2];
+	uint64_t	ds_gen;
+	uint64_t	ds_wseq;
+} fuse_datasig_t;
+
+typedef struct fuse_inode {
+	struct fuse_inode *fi_next;
+	uint64_t	fi_ino;
+	vnode_t		*fi_vp;
+	uint64_t	fi_nlookup;	/* kernel lookup count */
+	fuse_datasig_t	fi_cached;	/* data in the kernel page cache */
+} fuse_inode_t;
+
+typedef struct fuse_inodes {
+	kmutex_t	it_lock[FUSE_INODE_LOCKS];
+	fuse_inode_t	*it_hash[FUSE_INODE_HASH_SIZE];
+	uint32_t	it_count;
+	boolean_t	it_closing;	/* draining, pin nothing new */
+	struct fuse_chan *it_chan;	/* for invalidation notices */
+} fuse_inodes_t;
+
+#define FUSE_INODE_HASH(ino)	((ino) & (FUSE_INODE_HASH_SIZE - 1))
+#define FUSE_INODE_LOCK(it, ino) \
+	(&(it)->it_lock[(ino) & (FUSE_INODE_LOCKS - 1)])
+
+int fuse_inodes_max = FUSE_INODES_MAX_DEFAULT;
+
+static kmem_cache_t *fuse_inode_cache = NULL;
+
+static krwlock_t fuse_inodes_lock;
+
+void zfsfuse_inode_init()
+{
+	rw_init(&fuse_inodes_lock, NULL, RW_DEFAULT, NULL);
+
+	fuse_inode_cache = kmem_cache_create("fuse_inode_t", sizeof(fuse_inode_t), 0, NULL, NULL, NULL, NULL, NULL, 0);
+	VERIFY(fuse_inode_cache != NULL);
+}
+
+void zfsfuse_inode_fini()
+{
+	if(fuse_inode_cache != NULL)
+		kmem_cache_destroy(fuse_inode_cache);
+
+	rw_destroy(&fuse_inodes_lock);
+}
+
+void zfsfuse_inodes_create(vfs_t *vfs)
+{
+	fuse_inodes_t *it = kmem_zalloc(sizeof(fuse_inodes_t), KM_SLEEP);
+
+	for(int i = 0; i < FUSE_INODE_LOCKS; i++)
+		mutex_init(&it->it_lock[i], NULL, MUTEX_DEFAULT, NULL);
+
+	vfs->fuse_inodes = it;
+}
+
+/*
+ * Drop all the vnode holds, so that the filesystem can be unmounted.
+ * Lookups that race with this are not pinned: zfsfuse_inode_remember()
+ * checks it_closing under the bucket lock, which we take after setting
+ * it, so whatever it inserted before is still found here.
+ */
+void zfsfuse_inodes_drain(vfs_t *vfs)
+{
+	fuse_inodes_t *it = vfs->fuse_inodes;
+
+	if(it == NULL)
+		return;
+
+	it->it_closing = B_TRUE;
+	membar_producer();
+
+	for(int i = 0; i < FUSE_INODE_HASH_SIZE; i++) {
+		kmutex_t *lock = FUSE_INODE_LOCK(it, i);
+
+		mutex_enter(lock);
+		fuse_inode_t *fi = it->it_hash[i];
+		it->it_hash[i] = NULL;
+		mutex_exit(lock);
+
+		while(fi != NULL) {
+			fuse_inode_t *next = fi->fi_next;
+
+			VN_RELE(fi->fi_vp);
+			kmem_cache_free(fuse_inode_cache, fi);
+			atomic_dec_32(&it->it_count);
+			fi = next;
+		}
+	}
+}
+
+/*
+ * The unmount failed after zfsfuse_inodes_drain(): pin inodes again.
+ */
+void zfsfuse_inodes_reopen(vfs_t *vfs)
+{
+	fuse_inodes_t *it = vfs->fuse_inodes;
+
+	if(it != NULL)
+		it->it_closing = B_FALSE;
+}
+
+void zfsfuse_inodes_destroy(vfs_t *vfs)
+{
+	fuse_inodes_t *it;
+
+	/* Wait for the forgets still looking at the table */
+	rw_enter(&fuse_inodes_lock, RW_WRITER);
+	it = vfs->fuse_inodes;
+	vfs->fuse_inodes = NULL;
+	rw_exit(&fuse_inodes_lock);
+
+	if(it == NULL)
+		return;
+
+	/* Nothing can reach the table any more, drain it for good */
+	for(int i = 0; i < FUSE_INODE_HASH_SIZE; i++) {
+		fuse_inode_t *fi = it->it_hash[i];
+
+		while(fi != NULL) {
+			fuse_inode_t *next = fi->fi_next;
+
+			VN_RELE(fi->fi_vp);
+			kmem_cache_free(fuse_inode_cache, fi);
+			atomic_dec_32(&it->it_count);
+			fi = next;
+		}
+	}
+	ASSERT(it->it_count == 0);
+
+	for(int i = 0; i < FUSE_INODE_LOCKS; i++)
+		mutex_destroy(&it->it_lock[i]);
+
+	kmem_free(it, sizeof(fuse_inodes_t));
+}
+
+void zfsfuse_inodes_set_chan(vfs_t *vfs, struct fuse_chan *ch)
+{
+	fuse_inodes_t *it = vfs->fuse_inodes;
+
+	if(it != NULL)
+		it->it_chan = ch;
+}
+
+static void zfsfuse_datasig(znode_t *zp, fuse_datasig_t *ds)
+{
+	mutex_enter(&zp->z_lock);
+	ds->ds_mtime[0] = zp->z_phys->zp_mtime[0];
+	ds->ds_mtime[1] = zp->z_phys->zp_mtime[1];
+	ds->ds_ctime[0] = zp->z_phys->zp_ctime[0];
+	ds->ds_ctime[1] = zp->z_phys->zp_ctime[1];
+	ds->ds_gen = zp->z_phys->zp_gen;
+	ds->ds_wseq = zp->z_wseq;
+	mutex_exit(&zp->z_lock);
+}
+
+/* Must be called with the bucket lock of ino held */
+static fuse_inode_t *zfsfuse_inode_find(fuse_inodes_t *it, uint64_t ino)
+{
+	fuse_inode_t *fi;
+
+	for(fi = it->it_hash[FUSE_INODE_HASH(ino)]; fi != NULL; fi = fi->fi_next)
+		if(fi->fi_ino == ino)
+			break;
+
+	return fi;
+}
+
+/*
+ * Same as zfs_zget(), for inodes the kernel knows about.
+ */
+int zfsfuse_zget(vfs_t *vfs, uint64_t ino, znode_t **zpp, boolean_t zget_unlinked)
+{
+	fuse_inodes_t *it = vfs->fuse_inodes;
+
+	if(it != NULL) {
+		kmutex_t *lock = FUSE_INODE_LOCK(it, ino);
+		fuse_inode_t *fi;
+
+		mutex_enter(lock);
+		if((fi = zfsfuse_inode_find(it, ino)) != NULL) {
+			znode_t *zp = VTOZ(fi->fi_vp);
+
+			/* After a rollback the znode may have lost its dbuf */
+			if(zp->z_dbuf != NULL && (!zp->z_unlinked || zget_unlinked)) {
+				VN_HOLD(fi->fi_vp);
+				mutex_exit(lock);
+				*zpp = zp;
+				return 0;
+			}
+		}
+		mutex_exit(lock);
+	}
+
+	return zfs_zget(vfs->vfs_data, ino, zpp, zget_unlinked);
+}
+
+/*
+ * The kernel's lookup count on vp is about to go up by one, that is
+ * vp is being returned in a fuse_reply_entry() or fuse_reply_create().
+ * If the reply fails, the caller undoes this with zfsfuse_inode_forget().
+ */
+void zfsfuse_inode_remember(vfs_t *vfs, vnode_t *vp)
+{
+	fuse_inodes_t *it = vfs->fuse_inodes;
+	uint64_t ino = VTOZ(vp)->z_id;
+	kmutex_t *lock;
+	fuse_inode_t *fi;
+
+	if(it == NULL)
+		return;
+
+	lock = FUSE_INODE_LOCK(it, ino);
+
+	mutex_enter(lock);
+	if((fi = zfsfuse_inode_find(it, ino)) != NULL) {
+		vnode_t *stale = NULL;
+
+		/* A rollback or remount gave the object a new vnode */
+		if(fi->fi_vp != vp) {
+			VN_HOLD(vp);
+			stale = fi->fi_vp;
+			fi->fi_vp = vp;
+		}
+		fi->fi_nlookup++;
+		mutex_exit(lock);
+
+		if(stale != NULL)
+			VN_RELE(stale);
+		return;
+	}
+
+	/* Unmounting: zfsfuse_inodes_drain() may be past this bucket */
+	if(it->it_closing) {
+		mutex_exit(lock);
+		return;
+	}
+
+	if(atomic_inc_32_nv(&it->it_count) > (uint32_t) fuse_inodes_max ||
+	   (fi = kmem_cache_alloc(fuse_inode_cache, KM_NOSLEEP)) == NULL) {
+		atomic_dec_32(&it->it_count);
+		mutex_exit(lock);
+		return;
+	}
+
+	VN_HOLD(vp);
+	fi->fi_ino = ino;
+	fi->fi_vp = vp;
+	fi->fi_nlookup = 1;
+	/* The kernel has no pages of a new inode, any state will do */
+	zfsfuse_datasig(VTOZ(vp), &fi->fi_cached);
+	fi->fi_next = it->it_hash[FUSE_INODE_HASH(ino)];
+	it->it_hash[FUSE_INODE_HASH(ino)] = fi;
+	mutex_exit(lock);
+}
+
+/*
+ * The kernel dropped nlookup references to ino.  Inodes that were not
+ * pinned because the table was full are ignored.
+ */
+void zfsfuse_inode_forget(vfs_t *vfs, uint64_t ino, uint64_t nlookup)
+{
+	fuse_inodes_t *it;
+	kmutex_t *lock;
+	fuse_inode_t *fi, **fip;
+
+	rw_enter(&fuse_inodes_lock, RW_READER);
+	if((it = vfs->fuse_inodes) == NULL) {
+		rw_exit(&fuse_inodes_lock);
+		return;
+	}
+
+	lock = FUSE_INODE_LOCK(it, ino);
+
+	mutex_enter(lock);
+	for(fip = &it->it_hash[FUSE_INODE_HASH(ino)]; (fi = *fip) != NULL; fip = &fi->fi_next) {
+		if(fi->fi_ino != ino)
+			continue;
+
+		/*
+		 * The count may be short if the inode was looked up while
+		 * the table was full, and pinned only later on.
+		 */
+		if(fi->fi_nlookup > nlookup) {
+			fi->fi_nlookup -= nlookup;
+			fi = NULL;
+		} else {
+			*fip = fi->fi_next;
+		}
+		break;
+	}
+	mutex_exit(lock);
+
+	if(fi != NULL) {
+		/* Outside the bucket lock, this may free an unlinked file */
+		VN_RELE(fi->fi_vp);
+		kmem_cache_free(fuse_inode_cache, fi);
+		atomic_dec_32(&it->it_count);
+	}
+	rw_exit(&fuse_inodes_lock);
+}
+
+/*
+ * Called on open: returns B_TRUE if the data did not change since the
+ * kernel last got it, so that it can keep its page cache (keep_cache),
+ * and records that from now on the kernel has the current data.  Inodes
+ * that are not pinned have no history and always return B_FALSE.
+ */
+boolean_t zfsfuse_inode_keep_cache(vfs_t *vfs, znode_t *zp)
+{
+	fuse_inodes_t *it = vfs->fuse_inodes;
+	boolean_t keep = B_FALSE;
+	fuse_datasig_t ds;
+	fuse_inode_t *fi;
+
+	if(it == NULL)
+		return B_FALSE;
+
+	zfsfuse_datasig(zp, &ds);
+
+	mutex_enter(FUSE_INODE_LOCK(it, zp->z_id));
+	if((fi = zfsfuse_inode_find(it, zp->z_id)) != NULL) {
+		keep = bcmp(&fi->fi_cached, &ds, sizeof(ds)) == 0;
+		fi->fi_cached = ds;
+	}
+	mutex_exit(FUSE_INODE_LOCK(it, zp->z_id));
+
+	return keep;
+}
+
+/*
+ * The change to zp was made through the kernel (write, truncate, etc.),
+ * which already updated its page cache accordingly.
+ */
+void zfsfuse_inode_cached(vfs_t *vfs, znode_t *zp)
+{
+	fuse_inodes_t *it = vfs->fuse_inodes;
+	fuse_datasig_t ds;
+	fuse_inode_t *fi;
+
+	if(it == NULL)
+		return;
+
+	zfsfuse_datasig(zp, &ds);
+
+	mutex_enter(FUSE_INODE_LOCK(it, zp->z_id));
+	if((fi = zfsfuse_inode_find(it, zp->z_id)) != NULL)
+		fi->fi_cached = ds;
+	mutex_exit(FUSE_INODE_LOCK(it, zp->z_id));
+}
+
+/*
+ * The data changed underneath the kernel (rollback, receive).  Tell it to
+ * drop the pages of the inodes whose data really is different, open files
+ * included; the others keep their cache.
+ */
+void zfsfuse_inodes_revalidate(vfs_t *vfs)
+{
+	fuse_inodes_t *it = vfs->fuse_inodes;
+
+	if(it == NULL || it->it_chan == NULL)
+		return;
+
+	for(int i = 0; i < FUSE_INODE_HASH_SIZE; i++) {
+		kmutex_t *lock = FUSE_INODE_LOCK(it, i);
+		uint64_t stale[16];
+		int nstale;
+		fuse_inode_t *fi;
+
+again:
+		nstale = 0;
+		mutex_enter(lock);
+		for(fi = it->it_hash[i]; fi != NULL; fi = fi->fi_next) {
+			fuse_datasig_t ds;
+
+			if(VTOZ(fi->fi_vp)->z_dbuf == NULL)
+				continue;
+
+			zfsfuse_datasig(VTOZ(fi->fi_vp), &ds);
+			if(bcmp(&fi->fi_cached, &ds, sizeof(ds)) == 0)
+				continue;
+
+			if(nstale == sizeof(stale) / sizeof(stale[0]))
+				break;
+
+			fi->fi_cached = ds;
+			stale[nstale++] = fi->fi_ino;
+		}
+		mutex_exit(lock);
+
+		/*
+		 * Not under the bucket lock: the kernel may need to wait for
+		 * a read that needs it to finish before it can drop a page.
+		 */
+		for(int j = 0; j < nstale; j++) {
+#if FUSE_VERSION >= 28
+			fuse_lowlevel_notify_inval_inode(it->it_chan,
+			    stale[j] == 3 ? 1 : stale[j], 0, 0);
+#endif
+		}
+
+		/* The ones we did now match, so this makes progress */
+		if(fi != NULL)
+			goto again;
+	}
+}
@@ -0,0 +1,62 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+/*
+ * Copyright 2006 Ricardo Correia.
+ * Use is subject to license terms.
+ */
+
+#ifndef ZFSFUSE_INODE_H
+#define ZFSFUSE_INODE_H
+
+#include <sys/types.h>
+#include <sys/vfs.h>
+#include <sys/zfs_znode.h>
+
+#include "fuse.h"
+
+/*
+ * Per-mount table of the inodes the kernel holds a lookup count on.  Each
+ * entry keeps a vnode hold until the kernel forgets the inode, so that
+ * zfsfuse_zget() can find it without going through the DMU.
+ */
+
+#define FUSE_INODES_MAX_DEFAULT 32768
+
+extern int fuse_inodes_max;
+
+extern void zfsfuse_inode_init();
+extern void zfsfuse_inode_fini();
+
+extern void zfsfuse_inodes_create(vfs_t *vfs);
+extern void zfsfuse_inodes_drain(vfs_t *vfs);
+extern void zfsfuse_inodes_reopen(vfs_t *vfs);
+extern void zfsfuse_inodes_destroy(vfs_t *vfs);
+
+extern int zfsfuse_zget(vfs_t *vfs, uint64_t ino, znode_t **zpp, boolean_t zget_unlinked);
+extern void zfsfuse_inode_remember(vfs_t *vfs, vnode_t *vp);
+extern void zfsfuse_inode_forget(vfs_t *vfs, uint64_t ino, uint64_t nlookup);
+
+extern void zfsfuse_inodes_set_chan(vfs_t *vfs, struct fuse_chan *ch);
+extern boolean_t zfsfuse_inode_keep_cache(vfs_t *vfs, znode_t *zp);
+extern void zfsfuse_inode_cached(vfs_t *vfs, znode_t *zp);
+extern void zfsfuse_inodes_revalidate(vfs_t *vfs);
+
+#endif
@@ -0,0 +1,267 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+/*
+ * Copyright 2006 Ricardo Correia.
+ * Use is subject to license terms.
+ */
+
+#include <sys/debug.h>
+#include <sys/kmem.h>
+#include <sys/kstat.h>
+#include <sys/atomic.h>
+#include <sys/bitmap.h>
+#include <pthread.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "kmem_asprintf.h"
+#include "zfsfuse_opstats.h"
+
+/*
+ * Every thread serving a mount records into a block of its own, so that
+ * the fast path is a few increments on thread private cache lines.  The
+ * blocks are only summed up when the kstats are read.  Blocks are kept
+ * until the mount goes away: worker threads come and go with their mount
+ * anyway (see fuse_listener.c).
+ *
+ * zfsfuse_opstat_end() runs after the reply, outside of ZFS_ENTER, so the
+ * opstats live as long as the vfs rather than the mount: they are freed
+ * by zfs_freevfs().  The vfs is released by do_umount(), which runs from
+ * the destroy callback of the fuse session once the last worker of the
+ * mount has exited, so no worker can still be recording into them.
+ */
+
+typedef struct opstat_ops {
+	uint64_t	oo_count;
+	uint64_t	oo_errors;
+	uint64_t	oo_time;	/* ns */
+	uint64_t	oo_hist[ZFSFUSE_OPSTAT_BUCKETS];
+} opstat_ops_t;
+
+typedef struct opstat_thread {
+	struct opstat_thread *ot_next;
+	pthread_t	ot_thread;
+	opstat_ops_t	ot_ops[ZFSFUSE_OP_COUNT];
+} opstat_thread_t;
+
+/* named values of one operation, in the order of opstat_ops_t */
+#define OPSTAT_NAMED (3 + ZFSFUSE_OPSTAT_BUCKETS)
+
+typedef struct opstats {
+	uint64_t	st_id;		/* tells mounts apart in opstat_tls */
+	kmutex_t	st_lock;	/* protects st_threads, serializes updates */
+	opstat_thread_t	*st_threads;
+	kstat_t		*st_ksp[ZFSFUSE_OP_COUNT];
+	kstat_named_t	st_named[ZFSFUSE_OP_COUNT][OPSTAT_NAMED];
+} opstats_t;
+
+static const char *opstat_names[ZFSFUSE_OP_COUNT] = {
+	[ZFSFUSE_OP_LOOKUP]	= "lookup",
+	[ZFSFUSE_OP_GETATTR]	= "getattr",
+	[ZFSFUSE_OP_SETATTR]	= "setattr",
+	[ZFSFUSE_OP_ACCESS]	= "access",
+	[ZFSFUSE_OP_READLINK]	= "readlink",
+	[ZFSFUSE_OP_OPEN]	= "open",
+	[ZFSFUSE_OP_CREATE]	= "create",
+	[ZFSFUSE_OP_READ]	= "read",
+	[ZFSFUSE_OP_WRITE]	= "write",
+	[ZFSFUSE_OP_FSYNC]	= "fsync",
+	[ZFSFUSE_OP_RELEASE]	= "release",
+	[ZFSFUSE_OP_OPENDIR]	= "opendir",
+	[ZFSFUSE_OP_READDIR]	= "readdir",
+	[ZFSFUSE_OP_MKDIR]	= "mkdir",
+	[ZFSFUSE_OP_RMDIR]	= "rmdir",
+	[ZFSFUSE_OP_MKNOD]	= "mknod",
+	[ZFSFUSE_OP_SYMLINK]	= "symlink",
+	[ZFSFUSE_OP_LINK]	= "link",
+	[ZFSFUSE_OP_UNLINK]	= "unlink",
+	[ZFSFUSE_OP_RENAME]	= "rename",
+	[ZFSFUSE_OP_FALLOCATE]	= "fallocate",
+	[ZFSFUSE_OP_STATFS]	= "statfs",
+	[ZFSFUSE_OP_SETXATTR]	= "setxattr",
+	[ZFSFUSE_OP_GETXATTR]	= "getxattr",
+	[ZFSFUSE_OP_LISTXATTR]	= "listxattr",
+	[ZFSFUSE_OP_REMOVEXATTR] = "removexattr",
+};
+
+static uint64_t opstats_next_id = 0;
+
+static __thread struct {
+	uint64_t	id;
+	opstat_thread_t	*thread;
+} opstat_tls;
+
+static int opstats_update(kstat_t *ksp, int rw)
+{
+	opstats_t *st = ksp->ks_private;
+	kstat_named_t *named = ksp->ks_data;
+	zfsfuse_op_t op = (named - st->st_named[0]) / OPSTAT_NAMED;
+	opstat_ops_t sum = { 0 };
+
+	if(rw == KSTAT_WRITE)
+		return EACCES;
+
+	for(opstat_thread_t *ot = st->st_threads; ot != NULL; ot = ot->ot_next) {
+		opstat_ops_t *oo = &ot->ot_ops[op];
+
+		sum.oo_count += oo->oo_count;
+		sum.oo_errors += oo->oo_errors;
+		sum.oo_time += oo->oo_time;
+		for(int b = 0; b < ZFSFUSE_OPSTAT_BUCKETS; b++)
+			sum.oo_hist[b] += oo->oo_hist[b];
+	}
+
+	named[0].value.ui64 = sum.oo_count;
+	named[1].value.ui64 = sum.oo_errors;
+	named[2].value.ui64 = sum.oo_time;
+	for(int b = 0; b < ZFSFUSE_OPSTAT_BUCKETS; b++)
+		named[3 + b].value.ui64 = sum.oo_hist[b];
+
+	return 0;
+}
+
+static void opstats_named_init(kstat_named_t *kn, const char *name)
+{
+	(void) strlcpy(kn->name, name, KSTAT_STRLEN);
+	kn->data_type = KSTAT_DATA_UINT64;
+	kn->value.ui64 = 0;
+}
+
+void zfsfuse_opstats_create(vfs_t *vfs, const char *dataset)
+{
+	opstats_t *st = kmem_zalloc(sizeof(opstats_t), KM_SLEEP);
+
+	st->st_id = atomic_inc_64_nv(&opstats_next_id);
+	mutex_init(&st->st_lock, NULL, MUTEX_DEFAULT, NULL);
+
+	for(int op = 0; op < ZFSFUSE_OP_COUNT; op++) {
+		kstat_named_t *named = st->st_named[op];
+		char buf[KSTAT_STRLEN];
+
+		opstats_named_init(&named[0], "count");
+		opstats_named_init(&named[1], "errors");
+		opstats_named_init(&named[2], "time_ns");
+		for(int b = 0; b < ZFSFUSE_OPSTAT_BUCKETS - 1; b++) {
+			snprintf(buf, sizeof(buf), "lt_%lluus", 1ULL << b);
+			opstats_named_init(&named[3 + b], buf);
+		}
+		snprintf(buf, sizeof(buf), "ge_%lluus", 1ULL << (ZFSFUSE_OPSTAT_BUCKETS - 2));
+		opstats_named_init(&named[2 + ZFSFUSE_OPSTAT_BUCKETS], buf);
+
+		char *name = kmem_asprintf("%s/ops/%s", dataset, opstat_names[op]);
+		kstat_t *ksp = kstat_create("zfs-fuse", 0, name, "misc",
+		    KSTAT_TYPE_NAMED, OPSTAT_NAMED, KSTAT_FLAG_VIRTUAL);
+		strfree(name);
+
+		if(ksp != NULL) {
+			ksp->ks_data = named;
+			ksp->ks_update = opstats_update;
+			ksp->ks_private = st;
+			ksp->ks_lock = &st->st_lock;
+			kstat_install(ksp);
+		}
+		st->st_ksp[op] = ksp;
+	}
+
+	vfs->fuse_opstats = st;
+}
+
+/*
+ * Called by zfs_freevfs() with the vfs itself, see the top of this file.
+ */
+void zfsfuse_opstats_destroy(vfs_t *vfs)
+{
+	opstats_t *st = vfs->fuse_opstats;
+
+	if(st == NULL)
+		return;
+	vfs->fuse_opstats = NULL;
+
+	for(int op = 0; op < ZFSFUSE_OP_COUNT; op++)
+		if(st->st_ksp[op] != NULL)
+			kstat_delete(st->st_ksp[op]);
+
+	while(st->st_threads != NULL) {
+		opstat_thread_t *ot = st->st_threads;
+		st->st_threads = ot->ot_next;
+		kmem_free(ot, sizeof(opstat_thread_t));
+	}
+
+	mutex_destroy(&st->st_lock);
+	kmem_free(st, sizeof(opstats_t));
+}
+
+/*
+ * Find or make the block of the calling thread, the slow path.
+ */
+static opstat_thread_t *opstats_thread(opstats_t *st)
+{
+	pthread_t self = pthread_self();
+	opstat_thread_t *ot;
+
+	mutex_enter(&st->st_lock);
+	for(ot = st->st_threads; ot != NULL; ot = ot->ot_next)
+		if(pthread_equal(ot->ot_thread, self))
+			break;
+
+	if(ot == NULL) {
+		ot = kmem_zalloc(sizeof(opstat_thread_t), KM_SLEEP);
+		ot->ot_thread = self;
+		ot->ot_next = st->st_threads;
+		st->st_threads = ot;
+	}
+	mutex_exit(&st->st_lock);
+
+	opstat_tls.id = st->st_id;
+	opstat_tls.thread = ot;
+
+	return ot;
+}
+
+void zfsfuse_opstat_end(zfsfuse_opstat_t *os, zfsfuse_op_t op, int error)
+{
+	hrtime_t delta = gethrtime() - os->os_start;
+	opstat_thread_t *ot;
+	int b;
+
+	opstats_t *st = os->os_vfs->fuse_opstats;
+	if(st == NULL)
+		return;
+
+	if(opstat_tls.id == st->st_id)
+		ot = opstat_tls.thread;
+	else
+		ot = opstats_thread(st);
+
+	opstat_ops_t *oo = &ot->ot_ops[op];
+	uint64_t us = delta / 1000;
+
+	b = us == 0 ? 0 : highbit(us);
+	if(b >= ZFSFUSE_OPSTAT_BUCKETS)
+		b = ZFSFUSE_OPSTAT_BUCKETS - 1;
+
+	oo->oo_count++;
+	if(error)
+		oo->oo_errors++;
+	oo->oo_time += delta;
+	oo->oo_hist[b]++;
+}
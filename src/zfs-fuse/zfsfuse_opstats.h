@@ -0,0 +1,94 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+/*
+ * Copyright 2006 Ricardo Correia.
+ * Use is subject to license terms.
+ */
+
+#ifndef ZFSFUSE_OPSTATS_H
+#define ZFSFUSE_OPSTATS_H
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/vfs.h>
+
+#include "fuse.h"
+
+/*
+ * Per-mount count, error count, total time and log2 latency histogram of
+ * each fuse operation, published as kstats under
+ * zfs-fuse/<dataset>/ops/<operation>.
+ */
+
+typedef enum zfsfuse_op {
+	ZFSFUSE_OP_LOOKUP,
+	ZFSFUSE_OP_GETATTR,
+	ZFSFUSE_OP_SETATTR,
+	ZFSFUSE_OP_ACCESS,
+	ZFSFUSE_OP_READLINK,
+	ZFSFUSE_OP_OPEN,
+	ZFSFUSE_OP_CREATE,
+	ZFSFUSE_OP_READ,
+	ZFSFUSE_OP_WRITE,
+	ZFSFUSE_OP_FSYNC,
+	ZFSFUSE_OP_RELEASE,
+	ZFSFUSE_OP_OPENDIR,
+	ZFSFUSE_OP_READDIR,
+	ZFSFUSE_OP_MKDIR,
+	ZFSFUSE_OP_RMDIR,
+	ZFSFUSE_OP_MKNOD,
+	ZFSFUSE_OP_SYMLINK,
+	ZFSFUSE_OP_LINK,
+	ZFSFUSE_OP_UNLINK,
+	ZFSFUSE_OP_RENAME,
+	ZFSFUSE_OP_FALLOCATE,
+	ZFSFUSE_OP_STATFS,
+	ZFSFUSE_OP_SETXATTR,
+	ZFSFUSE_OP_GETXATTR,
+	ZFSFUSE_OP_LISTXATTR,
+	ZFSFUSE_OP_REMOVEXATTR,
+	ZFSFUSE_OP_COUNT
+} zfsfuse_op_t;
+
+/* bucket 0 is < 1us, bucket n is [2^(n-1), 2^n) us, the last is open */
+#define ZFSFUSE_OPSTAT_BUCKETS 32
+
+typedef struct zfsfuse_opstat {
+	vfs_t *os_vfs;
+	hrtime_t os_start;
+} zfsfuse_opstat_t;
+
+extern void zfsfuse_opstats_create(vfs_t *vfs, const char *dataset);
+extern void zfsfuse_opstats_destroy(vfs_t *vfs);
+
+/*
+ * Called at the start of a request, and once it was replied to (the
+ * request can't be used anymore by then, hence the vfs is kept in os).
+ */
+static inline void zfsfuse_opstat_start(fuse_req_t req, zfsfuse_opstat_t *os)
+{
+	os->os_vfs = (vfs_t *) fuse_req_userdata(req);
+	os->os_start = gethrtime();
+}
+
+extern void zfsfuse_opstat_end(zfsfuse_opstat_t *os, zfsfuse_op_t op, int error);
+
+#endif
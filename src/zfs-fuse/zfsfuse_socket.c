@@ -36,6 +36,7 @@
 #include <sys/file.h>
 #include <sys/avl.h>
 #include <sys/uio.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <pthread.h>
 
@@ -45,6 +46,11 @@
 
 __thread int cur_fd = -1;
 
+/* Shared memory region attached to the connection in cur_fd, if any */
+static __thread char *cur_shm = NULL;
+static __thread uint64_t cur_shm_base;
+static __thread uint64_t cur_shm_size;
+
 avl_tree_t fd_avl;
 pthread_mutex_t fd_avl_mtx = PTHREAD_MUTEX_INITIALIZER;
 
@@ -127,7 +133,6 @@ void zfsfuse_socket_close(int fd)
 
 /*
  * This function is repeated in lib/libzfs/libzfs_zfsfuse.c
- * and in zfs-fuse/fuse_listener.c
  */
 int zfsfuse_socket_read_loop(int fd, void *buf, int bytes)
 {
@@ -168,6 +173,21 @@ int zfsfuse_socket_ioctl_write(int fd, int ret)
 	return 0;
 }
 
+/*
+ * Translates a client address range that lies inside the attached shared
+ * memory region.  Returns NULL if it has to be copied over the socket.
+ */
+static void *zfsfuse_shm_ptr(const void *ptr, uint64_t size)
+{
+	uint64_t addr = (uint64_t)(uintptr_t) ptr;
+
+	if(cur_shm == NULL || addr < cur_shm_base || size > cur_shm_size ||
+	    addr - cur_shm_base > cur_shm_size - size)
+		return NULL;
+
+	return cur_shm + (addr - cur_shm_base);
+}
+
 int xcopyin(const void *src, void *dest, size_t size)
 {
 #ifdef DEBUG
@@ -180,6 +200,12 @@ int xcopyin(const void *src, void *dest, size_t size)
 	/* This should catch stray xcopyin()s in the code.. */
 	VERIFY(cur_fd >= 0);
 
+	void *shm = zfsfuse_shm_ptr(src, size);
+	if(shm != NULL) {
+		memcpy(dest, shm, size);
+		return 0;
+	}
+
 	cmd.cmd_type = COPYIN_REQ;
 	cmd.cmd_u.copy_req.ptr = (uint64_t)(uintptr_t) src;
 	cmd.cmd_u.copy_req.size = size;
@@ -210,6 +236,25 @@ int copyinstr(const char *from, char *to, size_t max, size_t *len)
 	/* This should catch stray copyinstr()s in the code.. */
 	VERIFY(cur_fd >= 0);
 
+	char *shm = zfsfuse_shm_ptr(from, 1);
+	if(shm != NULL) {
+		size_t avail = cur_shm_size - ((uint64_t)(uintptr_t) from - cur_shm_base);
+		size_t length = strnlen(shm, MIN(max, avail));
+		int ret = 0;
+
+		if(length == avail && avail < max)
+			return EFAULT;
+		if(length >= max) {
+			length = max - 1;
+			ret = ENAMETOOLONG;
+		}
+		memcpy(to, shm, length);
+		to[length] = '\0';
+		if(len != NULL)
+			*len = length + 1;
+		return ret;
+	}
+
 	cmd.cmd_type = COPYINSTR_REQ;
 	cmd.cmd_u.copy_req.ptr = (uint64_t)(uintptr_t) from;
 	cmd.cmd_u.copy_req.size = max;
@@ -248,6 +293,12 @@ int xcopyout(const void *src, void *dest, size_t size)
 	/* This should catch stray xcopyout()s in the code.. */
 	VERIFY(cur_fd >= 0);
 
+	void *shm = zfsfuse_shm_ptr(dest, size);
+	if(shm != NULL) {
+		memcpy(shm, src, size);
+		return 0;
+	}
+
 	cmd.cmd_type = COPYOUT_REQ;
 	cmd.cmd_u.copy_req.ptr = (uint64_t)(uintptr_t) dest;
 	cmd.cmd_u.copy_req.size = size;
@@ -264,10 +315,8 @@ int xcopyout(const void *src, void *dest, size_t size)
 /*
  * Request a file descriptor from the "user" process.
  * The file descriptor is passed through the UNIX socket.
- *
- * This function is declared in libsolkerncompat/include/sys/file.h
  */
-file_t *getf(int fd)
+static int zfsfuse_socket_getfd(int fd)
 {
 #ifdef DEBUG
 	/* Clear valgrind's uninitialized byte(s) warning */
@@ -283,7 +332,7 @@ file_t *getf(int fd)
 	cmd.cmd_u.getf_req_fd = fd;
 
 	if(write(cur_fd, &cmd, sizeof(zfsfuse_cmd_t)) != sizeof(zfsfuse_cmd_t))
-		return NULL;
+		return -1;
 
 retry: ;
 	/* man cmsg(3) */
@@ -309,19 +358,29 @@ retry: ;
 
 	int r = recvmsg(cur_fd, &msg, 0);
 	if(r == 0)
-		return NULL;
+		return -1;
 
 	if(r == -1) {
 		if(errno == EINTR)
 			goto retry;
-		return NULL;
+		return -1;
 	}
 
 	if(cmsg->cmsg_len != CMSG_LEN(sizeof(int)) || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
-		return NULL;
+		return -1;
 
 	fdptr = (int *) CMSG_DATA(cmsg);
-	int new_fd = *fdptr;
+	return *fdptr;
+}
+
+/*
+ * This function is declared in libsolkerncompat/include/sys/file.h
+ */
+file_t *getf(int fd)
+{
+	int new_fd = zfsfuse_socket_getfd(fd);
+	if(new_fd == -1)
+		return NULL;
 
 	file_t *ret = kmem_alloc(sizeof(file_t), KM_SLEEP);
 
@@ -368,3 +427,61 @@ void releasef(int fd)
 
 	kmem_free(node, sizeof(file_t));
 }
+
+/*
+ * Handles ZFSFUSE_IOC_SHM_ATTACH for the connection in cur_fd.
+ */
+int zfsfuse_socket_shm_attach(uint64_t arg)
+{
+#ifdef F_SEAL_SHRINK
+	zfsfuse_shm_req_t req;
+	struct stat st;
+	void *shm;
+	int fd;
+
+	if(xcopyin((void *)(uintptr_t) arg, &req, sizeof(req)) != 0)
+		return EFAULT;
+
+	if(req.zsr_size == 0 || req.zsr_size > ZFSFUSE_SHM_MAX)
+		return EINVAL;
+
+	if((fd = zfsfuse_socket_getfd(req.zsr_fd)) == -1)
+		return EBADF;
+
+	/*
+	 * The client could shrink an unsealed memfd under us and turn our
+	 * memcpy()s into SIGBUS, so insist on F_SEAL_SHRINK.
+	 */
+	int seals = fcntl(fd, F_GET_SEALS);
+	if(fstat(fd, &st) != 0 || st.st_size < req.zsr_size ||
+	    seals == -1 || !(seals & F_SEAL_SHRINK)) {
+		close(fd);
+		return EINVAL;
+	}
+
+	shm = mmap(NULL, req.zsr_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(shm == MAP_FAILED)
+		return ENOMEM;
+
+	zfsfuse_socket_shm_detach();
+	cur_shm = shm;
+	cur_shm_base = req.zsr_base;
+	cur_shm_size = req.zsr_size;
+
+	return 0;
+#else
+	return EINVAL;
+#endif
+}
+
+void zfsfuse_socket_shm_detach()
+{
+	if(cur_shm == NULL)
+		return;
+
+	munmap(cur_shm, cur_shm_size);
+	cur_shm = NULL;
+	cur_shm_base = 0;
+	cur_shm_size = 0;
+}
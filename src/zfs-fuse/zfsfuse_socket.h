@@ -38,4 +38,7 @@ extern void zfsfuse_socket_close(int fd);
 extern int zfsfuse_socket_read_loop(int fd, void *buf, int bytes);
 extern int zfsfuse_socket_ioctl_write(int fd, int ret);
 
+extern int zfsfuse_socket_shm_attach(uint64_t arg);
+extern void zfsfuse_socket_shm_detach();
+
 #endif
@@ -0,0 +1,328 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+/*
+ * Copyright 2006 Ricardo Correia.
+ * Use is subject to license terms.
+ */
+
+
+#include <sys/debug.h>
+#include <sys/kmem.h>
+#include <sys/kstat.h>
+#include <sys/mutex.h>
+#include <sys/spa.h>
+#include <sys/arc.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "format.h"
+#include "fuse_listener.h"
+#include "zfs_fletcher.h"
+#include "zfsfuse_tunables.h"
+
+extern int zfs_prefetch_disable;		/* dmu_zfetch.c */
+extern uint32_t zfetch_max_streams;
+extern uint32_t zfetch_min_sec_reap;
+extern uint32_t zfetch_block_cap;
+extern uint64_t zfetch_array_rd_sz;
+extern int zfs_vdev_cache_size;			/* vdev_cache.c */
+extern int zfs_vdev_max_pending;		/* vdev_queue.c */
+extern int zfs_vdev_min_pending;
+extern int zfs_vdev_time_shift;
+extern int zfs_vdev_ramp_rate;
+extern int zfs_vdev_aggregation_limit;
+extern int zfs_vdev_read_gap_limit;
+extern int zfs_vdev_write_gap_limit;
+extern int zfs_txg_timeout;			/* txg.c */
+extern int zfs_txg_synctime_ms;			/* dsl_pool.c */
+extern uint64_t zfs_write_limit_override;
+extern int zfs_scrub_limit;			/* vdev.c */
+extern boolean_t zfs_nocacheflush;		/* zil.c */
+extern uint64_t zfs_arc_max;			/* arc.c */
+extern uint64_t zfs_arc_min;
+extern uint64_t zfs_arc_meta_limit;
+extern int zfs_arc_grow_retry;
+extern int zfs_arc_shrink_shift;
+extern int zfs_arc_compressed;
+extern boolean_t l2arc_rebuild_enabled;
+extern int zfs_arc_warm;			/* arc_warm.c */
+extern uint64_t zfs_arc_warm_max;
+extern uint64_t zfs_arc_warm_rate;
+extern int zfs_sha256_batch;			/* zio.c */
+extern int zfs_compress_early_abort;		/* zio_compress.c */
+
+#define	MB	(1ULL << 20)
+#define	GB	(1ULL << 30)
+
+static zfsfuse_tunable_t zfsfuse_tunables[] = {
+	/* ARC */
+	{ "zfs_arc_max", ZFSFUSE_TUNABLE_UINT64, &zfs_arc_max,
+	    16 * MB, UINT64_MAX, arc_tuning_update },
+	{ "zfs_arc_min", ZFSFUSE_TUNABLE_UINT64, &zfs_arc_min,
+	    16 * MB, UINT64_MAX, arc_tuning_update },
+	{ "zfs_arc_meta_limit", ZFSFUSE_TUNABLE_UINT64, &zfs_arc_meta_limit,
+	    4 * MB, UINT64_MAX, arc_tuning_update },
+	{ "zfs_arc_grow_retry", ZFSFUSE_TUNABLE_INT, &zfs_arc_grow_retry,
+	    1, 3600, arc_tuning_update },
+	{ "zfs_arc_shrink_shift", ZFSFUSE_TUNABLE_INT, &zfs_arc_shrink_shift,
+	    1, 31, arc_tuning_update },
+	{ "zfs_arc_compressed", ZFSFUSE_TUNABLE_INT, &zfs_arc_compressed,
+	    0, 1, NULL },
+	{ "l2arc_rebuild_enabled", ZFSFUSE_TUNABLE_INT, &l2arc_rebuild_enabled,
+	    0, 1, NULL },
+	{ "zfs_arc_warm", ZFSFUSE_TUNABLE_INT, &zfs_arc_warm,
+	    0, 1, NULL },
+	{ "zfs_arc_warm_max", ZFSFUSE_TUNABLE_UINT64, &zfs_arc_warm_max,
+	    0, 1ULL << 24, NULL },
+	{ "zfs_arc_warm_rate", ZFSFUSE_TUNABLE_UINT64, &zfs_arc_warm_rate,
+	    1, 1000000, NULL },
+
+	/* prefetch */
+	{ "zfs_prefetch_disable", ZFSFUSE_TUNABLE_INT, &zfs_prefetch_disable,
+	    0, 1, NULL },
+	{ "zfetch_max_streams", ZFSFUSE_TUNABLE_UINT32, &zfetch_max_streams,
+	    1, 64, NULL },
+	{ "zfetch_min_sec_reap", ZFSFUSE_TUNABLE_UINT32, &zfetch_min_sec_reap,
+	    0, 3600, NULL },
+	{ "zfetch_block_cap", ZFSFUSE_TUNABLE_UINT32, &zfetch_block_cap,
+	    1, 4096, NULL },
+	{ "zfetch_array_rd_sz", ZFSFUSE_TUNABLE_UINT64, &zfetch_array_rd_sz,
+	    0, 1 * GB, NULL },
+
+	/* vdev cache and queue */
+	{ "zfs_vdev_cache_size", ZFSFUSE_TUNABLE_INT, &zfs_vdev_cache_size,
+	    0, 1 * GB, NULL },
+	{ "zfs_vdev_max_pending", ZFSFUSE_TUNABLE_INT, &zfs_vdev_max_pending,
+	    1, 1000, NULL },
+	{ "zfs_vdev_min_pending", ZFSFUSE_TUNABLE_INT, &zfs_vdev_min_pending,
+	    1, 1000, NULL },
+	{ "zfs_vdev_time_shift", ZFSFUSE_TUNABLE_INT, &zfs_vdev_time_shift,
+	    0, 30, NULL },
+	{ "zfs_vdev_ramp_rate", ZFSFUSE_TUNABLE_INT, &zfs_vdev_ramp_rate,
+	    1, 1000, NULL },
+	{ "zfs_vdev_aggregation_limit", ZFSFUSE_TUNABLE_INT,
+	    &zfs_vdev_aggregation_limit, 0, SPA_MAXBLOCKSIZE, NULL },
+	{ "zfs_vdev_read_gap_limit", ZFSFUSE_TUNABLE_INT,
+	    &zfs_vdev_read_gap_limit, 0, SPA_MAXBLOCKSIZE, NULL },
+	{ "zfs_vdev_write_gap_limit", ZFSFUSE_TUNABLE_INT,
+	    &zfs_vdev_write_gap_limit, 0, SPA_MAXBLOCKSIZE, NULL },
+
+	/* transaction groups */
+	{ "zfs_txg_timeout", ZFSFUSE_TUNABLE_INT, &zfs_txg_timeout,
+	    1, 600, NULL },
+	{ "zfs_txg_synctime_ms", ZFSFUSE_TUNABLE_INT, &zfs_txg_synctime_ms,
+	    100, 600000, NULL },
+	{ "zfs_write_limit_override", ZFSFUSE_TUNABLE_UINT64,
+	    &zfs_write_limit_override, 0, UINT64_MAX, NULL },
+	{ "zfs_scrub_limit", ZFSFUSE_TUNABLE_INT, &zfs_scrub_limit,
+	    1, 1000, NULL },
+	{ "zfs_nocacheflush", ZFSFUSE_TUNABLE_INT, &zfs_nocacheflush,
+	    0, 1, NULL },
+
+	/* fuse workers, for the filesystems mounted afterwards */
+	{ "fuse_threads_per_fs", ZFSFUSE_TUNABLE_INT, &fuse_threads_per_fs,
+	    1, FUSE_THREADS_PER_FS_MAX, NULL },
+	{ "fuse_threads_max", ZFSFUSE_TUNABLE_INT, &fuse_threads_max,
+	    1, FUSE_THREADS_MAX_MAX, NULL },
+
+	/* checksums */
+	{ "zfs_fletcher_4_impl", ZFSFUSE_TUNABLE_INT, &zfs_fletcher_4_impl,
+	    FLETCHER_4_IMPL_FASTEST, FLETCHER_4_IMPL_MAX,
+	    fletcher_4_impl_update },
+	{ "zfs_sha256_batch", ZFSFUSE_TUNABLE_INT, &zfs_sha256_batch,
+	    1, ZIO_CHECKSUM_BATCH_MAX, NULL },
+
+	/* compression */
+	{ "zfs_compress_early_abort", ZFSFUSE_TUNABLE_INT,
+	    &zfs_compress_early_abort, 0, 1, NULL },
+};
+
+#define	NTUNABLES	(sizeof(zfsfuse_tunables) / sizeof(zfsfuse_tunable_t))
+
+static kmutex_t tunables_lock;
+static kstat_t *tunables_ksp;
+static kstat_named_t tunables_named[NTUNABLES];
+
+static uint64_t tunable_value(zfsfuse_tunable_t *zt)
+{
+	switch(zt->zt_type) {
+	case ZFSFUSE_TUNABLE_INT:
+		return *(int *)zt->zt_addr;
+	case ZFSFUSE_TUNABLE_UINT32:
+		return *(uint32_t *)zt->zt_addr;
+	default:
+		return *(uint64_t *)zt->zt_addr;
+	}
+}
+
+static void tunable_store(zfsfuse_tunable_t *zt, uint64_t value)
+{
+	switch(zt->zt_type) {
+	case ZFSFUSE_TUNABLE_INT:
+		*(int *)zt->zt_addr = value;
+		break;
+	case ZFSFUSE_TUNABLE_UINT32:
+		*(uint32_t *)zt->zt_addr = value;
+		break;
+	default:
+		*(uint64_t *)zt->zt_addr = value;
+	}
+}
+
+static zfsfuse_tunable_t *tunable_lookup(const char *name)
+{
+	for(int i = 0; i < NTUNABLES; i++)
+		if(strcmp(zfsfuse_tunables[i].zt_name, name) == 0)
+			return &zfsfuse_tunables[i];
+
+	return NULL;
+}
+
+/* called with tunables_lock held */
+static int tunable_set_locked(zfsfuse_tunable_t *zt, uint64_t value)
+{
+	uint64_t old = tunable_value(zt);
+	int error;
+
+	if(value < zt->zt_min || value > zt->zt_max)
+		return EINVAL;
+
+	tunable_store(zt, value);
+	if(zt->zt_update != NULL && (error = zt->zt_update()) != 0) {
+		tunable_store(zt, old);
+		return error;
+	}
+
+	if(value != old)
+		cmn_err(CE_NOTE, "tunable %s changed from " FU64 " to " FU64,
+		    zt->zt_name, old, value);
+
+	return 0;
+}
+
+int zfsfuse_tunable_get(const char *name, uint64_t *value)
+{
+	zfsfuse_tunable_t *zt = tunable_lookup(name);
+
+	if(zt == NULL)
+		return ENOENT;
+
+	mutex_enter(&tunables_lock);
+	*value = tunable_value(zt);
+	mutex_exit(&tunables_lock);
+
+	return 0;
+}
+
+int zfsfuse_tunable_set(const char *name, uint64_t value)
+{
+	zfsfuse_tunable_t *zt = tunable_lookup(name);
+	int error;
+
+	if(zt == NULL)
+		return ENOENT;
+
+	mutex_enter(&tunables_lock);
+	error = tunable_set_locked(zt, value);
+	mutex_exit(&tunables_lock);
+
+	return error;
+}
+
+char *zfsfuse_tunables_list(const char *name)
+{
+	size_t size = NTUNABLES * 96, len = 0;
+	char *buf = kmem_alloc(size, KM_SLEEP), *ret;
+
+	buf[0] = '\0';
+
+	mutex_enter(&tunables_lock);
+	for(int i = 0; i < NTUNABLES; i++) {
+		zfsfuse_tunable_t *zt = &zfsfuse_tunables[i];
+
+		if(name[0] != '\0' && strcmp(zt->zt_name, name) != 0)
+			continue;
+
+		len += snprintf(buf + len, size - len, "%s " FU64 " " FU64 " " FU64 "\n",
+		    zt->zt_name, tunable_value(zt), zt->zt_min, zt->zt_max);
+		ASSERT(len < size);
+	}
+	mutex_exit(&tunables_lock);
+
+	ret = kmem_alloc(len + 1, KM_SLEEP);
+	(void) memcpy(ret, buf, len + 1);
+	kmem_free(buf, size);
+
+	return ret;
+}
+
+/*
+ * Reads refresh the values from the variables.  A write stores the new
+ * value in its kstat_named_t before calling us, so the tunable to change
+ * is the one that differs from its variable.
+ */
+static int tunables_update(kstat_t *ksp, int rw)
+{
+	for(int i = 0; i < NTUNABLES; i++) {
+		zfsfuse_tunable_t *zt = &zfsfuse_tunables[i];
+		uint64_t value = tunable_value(zt);
+
+		if(rw == KSTAT_READ) {
+			tunables_named[i].value.ui64 = value;
+		} else if(tunables_named[i].value.ui64 != value) {
+			int error = tunable_set_locked(zt, tunables_named[i].value.ui64);
+			if(error != 0)
+				return error;
+		}
+	}
+
+	return 0;
+}
+
+void zfsfuse_tunables_init(void)
+{
+	mutex_init(&tunables_lock, NULL, MUTEX_DEFAULT, NULL);
+
+	for(int i = 0; i < NTUNABLES; i++) {
+		(void) strlcpy(tunables_named[i].name, zfsfuse_tunables[i].zt_name, KSTAT_STRLEN);
+		tunables_named[i].data_type = KSTAT_DATA_UINT64;
+	}
+
+	tunables_ksp = kstat_create("zfs-fuse", 0, "tunables", "misc",
+	    KSTAT_TYPE_NAMED, NTUNABLES, KSTAT_FLAG_VIRTUAL | KSTAT_FLAG_WRITABLE);
+	if(tunables_ksp != NULL) {
+		tunables_ksp->ks_data = tunables_named;
+		tunables_ksp->ks_update = tunables_update;
+		tunables_ksp->ks_lock = &tunables_lock;
+		kstat_install(tunables_ksp);
+	}
+}
+
+void zfsfuse_tunables_fini(void)
+{
+	if(tunables_ksp != NULL) {
+		kstat_delete(tunables_ksp);
+		tunables_ksp = NULL;
+	}
+
+	mutex_destroy(&tunables_lock);
+}
@@ -0,0 +1,67 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+/*
+ * Copyright 2006 Ricardo Correia.
+ * Use is subject to license terms.
+ */
+
+
+#ifndef ZFSFUSE_TUNABLES_H
+#define ZFSFUSE_TUNABLES_H
+
+#include <sys/types.h>
+
+/*
+ * Tunables that can be changed while the daemon runs, through the
+ * zfs-fuse/tunables kstat (echo 64 > /zfs-kstat/zfs-fuse/tunables/...) or
+ * the TUNABLE_REQ command of the control socket (ztune).  Every tunable
+ * has bounds; values outside of them are refused with EINVAL.
+ */
+
+typedef enum zfsfuse_tunable_type {
+	ZFSFUSE_TUNABLE_INT,
+	ZFSFUSE_TUNABLE_UINT32,
+	ZFSFUSE_TUNABLE_UINT64
+} zfsfuse_tunable_type_t;
+
+typedef struct zfsfuse_tunable {
+	const char	*zt_name;
+	zfsfuse_tunable_type_t zt_type;
+	void		*zt_addr;
+	uint64_t	zt_min;
+	uint64_t	zt_max;
+	/* applies the new value, or returns an error to have it undone */
+	int		(*zt_update)(void);
+} zfsfuse_tunable_t;
+
+extern void zfsfuse_tunables_init(void);
+extern void zfsfuse_tunables_fini(void);
+
+extern int zfsfuse_tunable_get(const char *name, uint64_t *value);
+extern int zfsfuse_tunable_set(const char *name, uint64_t value);
+
+/*
+ * Describes the tunable called name, or all of them if name is "", one
+ * "name value min max" line each.  Free the result with strfree().
+ */
+extern char *zfsfuse_tunables_list(const char *name);
+
+#endif